@@ -0,0 +1,343 @@
+/*  Heap allocation check for the steady state paths
+*   malloc, calloc, realloc, the aligned variants and free are replaced
+*   here by counting wrappers around glibc's own, so every allocation made
+*   anywhere in the process (stdio included) is seen. Each path is warmed
+*   up, then run many times with counting on, and must not allocate or
+*   free anything: codec and CSV scratch comes from reusable arenas, file
+*   I/O goes through plain descriptors, and MIDI tasks and ports are
+*   recycled. The exit status is 1 if any path touched the heap.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "event_loop.h"
+#include "fcb.h"
+#include "midi.h"
+#include "task.h"
+#include "timing.h"
+#include "ui_ncurses.h"
+
+#define WARMUP_CALLS 3
+#define CHECK_CALLS 200
+#define MIDI_CALLS 20     // Each send waits for at least one 10 ms tick
+#define CHECK_THREADS 4
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+static bool counting;
+static size_t allocations;
+static size_t frees;
+
+static void count(size_t *counter) {
+    if (__atomic_load_n(&counting, __ATOMIC_RELAXED)) __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size) {
+    count(&allocations);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count_, size_t size) {
+    count(&allocations);
+    return __libc_calloc(count_, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    count(&allocations);
+    return __libc_realloc(ptr, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    count(&allocations);
+    return __libc_memalign(alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    count(&allocations);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    count(&allocations);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : 12;  // ENOMEM
+}
+
+void free(void *ptr) {
+    if (ptr) count(&frees);
+    __libc_free(ptr);
+}
+
+// midi.c is linked for send and receive; the UI it can call is not used
+void ui_message(const char *format, ...) { (void)format; }
+bool ui_run_task(Task *task) { (void)task; return false; }
+bool ui_task_busy() { return false; }
+void ui_confirm(const char *prompt, UiConfirmCallback on_confirm, void *user_data) {
+    (void)prompt;
+    (void)on_confirm;
+    (void)user_data;
+}
+void select_midi_device(char devices[MAX_DEVICES][128], int device_count, UiSelectCallback on_select,
+                        void *user_data) {
+    (void)devices;
+    (void)device_count;
+    (void)on_select;
+    (void)user_data;
+}
+
+static char scratch_dir[256];
+static char dump_path[512];
+static char csv_path[512];
+static char ndjson_path[512];
+static char out_syx[512];
+static char wire_path[512];
+static uint8_t dump[SYSEX_SIZE];
+static FCB1010 decoded;
+static EventLoop *loop;
+static bool path_ok;  // Set false by a path that failed outright
+
+static void run_parse_sysex() {
+    FCB1010 fcb;
+    uint8_t data[SYSEX_SIZE];
+    memcpy(data, dump, SYSEX_SIZE);
+    if (!parse_sysex(&fcb, data, SYSEX_SIZE)) path_ok = false;
+}
+
+static void run_get_raw_sysex() {
+    uint8_t data[SYSEX_SIZE];
+    if (!get_raw_sysex(&decoded, data)) path_ok = false;
+}
+
+static void run_write_csv() {
+    if (!write_csv(&decoded, csv_path)) path_ok = false;
+}
+
+static void run_load_csv() {
+    FCB1010 fcb;
+    if (!load_csv(&fcb, csv_path)) path_ok = false;
+}
+
+static void run_sysex_files() {
+    uint8_t data[SYSEX_SIZE];
+    if (fcb_read_sysex_file(dump_path, data, NULL) != FCB_OK ||
+        fcb_write_sysex_file(out_syx, data, NULL) != FCB_OK) {
+        path_ok = false;
+    }
+}
+
+static void run_load_ndjson() {
+    FCB1010 fcb;
+    if (fcb_read_ndjson_file(ndjson_path, &fcb, NULL) != FCB_OK) path_ok = false;
+}
+
+static void run_recover() {
+    FCB1010 fcb;
+    if (fcb_recover_sysex(dump, SYSEX_SIZE, NULL, &fcb, NULL, NULL, NULL) != FCB_OK) path_ok = false;
+}
+
+static void task_over(EventLoop *loop_, int timer_id, void *user_data) {
+    (void)timer_id;
+    if (((Task *)user_data)->state != TASK_RUNNING) event_loop_stop(loop_);
+}
+
+static bool finish_task(Task *task) {
+    if (!task) return false;
+
+    int timer = event_loop_add_timer(loop, NSEC_PER_MSEC, true, task_over, task);
+    event_loop_run(loop);
+    event_loop_remove_timer(loop, timer);
+
+    bool done = task->state == TASK_DONE;
+    task_destroy(task);
+    return done;
+}
+
+// The dump out through a port and back in, the way the menu entries do it
+static void run_send_receive() {
+    char error[256];
+    if (!finish_task(send_sysex_dump(loop, wire_path, dump_path, 0, error, sizeof(error))) ||
+        !finish_task(receive_sysex_dump(loop, wire_path, out_syx, error, sizeof(error)))) {
+        path_ok = false;
+    }
+}
+
+typedef struct {
+    const char *name;
+    void (*run)();
+    int calls;
+} Check;
+
+static const Check checks[] = {
+    { "parse_sysex", run_parse_sysex, CHECK_CALLS },
+    { "get_raw_sysex", run_get_raw_sysex, CHECK_CALLS },
+    { "write_csv", run_write_csv, CHECK_CALLS },
+    { "load_csv", run_load_csv, CHECK_CALLS },
+    { "sysex_files", run_sysex_files, CHECK_CALLS },
+    { "load_ndjson", run_load_ndjson, CHECK_CALLS },
+    { "recover_sysex", run_recover, CHECK_CALLS },
+    { "send_receive", run_send_receive, MIDI_CALLS },
+};
+
+#define NUM_CHECKS (int)(sizeof(checks) / sizeof(checks[0]))
+
+static void set_counting(bool on) {
+    __atomic_store_n(&counting, on, __ATOMIC_SEQ_CST);
+}
+
+static bool report(const char *name, int calls) {
+    bool clean = allocations == 0 && frees == 0 && path_ok;
+    printf("%-24s %6d calls %6zu allocations %6zu frees   %s\n", name, calls, allocations, frees,
+           !path_ok ? "FAILED" : clean ? "ok" : "ALLOCATES");
+    return clean;
+}
+
+static bool run_check(const Check *check) {
+    path_ok = true;
+    for (int i = 0; i < WARMUP_CALLS; i++) check->run();
+
+    allocations = frees = 0;
+    set_counting(true);
+    for (int i = 0; i < check->calls; i++) check->run();
+    set_counting(false);
+    return report(check->name, check->calls);
+}
+
+// load_csv on several threads at once: each has its own arena, so after
+// their first call none of them goes back to malloc
+static pthread_barrier_t barrier;
+
+static void *load_csv_thread(void *arg) {
+    (void)arg;
+    for (int i = 0; i < WARMUP_CALLS; i++) run_load_csv();
+
+    pthread_barrier_wait(&barrier);  // Warm, the main thread starts counting
+    pthread_barrier_wait(&barrier);
+    for (int i = 0; i < CHECK_CALLS; i++) run_load_csv();
+    pthread_barrier_wait(&barrier);  // Done, counting stops before the exit frees the arena
+    pthread_barrier_wait(&barrier);
+    return NULL;
+}
+
+static bool run_threads() {
+    pthread_t threads[CHECK_THREADS];
+    int started = 0;
+
+    path_ok = true;
+    pthread_barrier_init(&barrier, NULL, CHECK_THREADS + 1);
+    for (; started < CHECK_THREADS; started++) {
+        if (pthread_create(&threads[started], NULL, load_csv_thread, NULL) != 0) break;
+    }
+    if (started < CHECK_THREADS) {
+        fprintf(stderr, "Failed to start threads\n");
+        exit(1);
+    }
+
+    pthread_barrier_wait(&barrier);
+    allocations = frees = 0;
+    set_counting(true);
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    set_counting(false);
+    pthread_barrier_wait(&barrier);
+
+    for (int i = 0; i < CHECK_THREADS; i++) pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&barrier);
+
+    char name[32];
+    snprintf(name, sizeof(name), "load_csv/%d_threads", CHECK_THREADS);
+    return report(name, CHECK_THREADS * CHECK_CALLS);
+}
+
+// Counting has to see what libc allocates inside stdio, or a clean run
+// would prove nothing
+static bool counter_works() {
+    allocations = 0;
+    set_counting(true);
+    FILE *file = fopen("/dev/null", "r");
+    set_counting(false);
+    if (file) fclose(file);
+    return allocations > 0;
+}
+
+static bool prepare(const char *source) {
+    snprintf(dump_path, sizeof(dump_path), "%s/dump.syx", scratch_dir);
+    snprintf(csv_path, sizeof(csv_path), "%s/dump.csv", scratch_dir);
+    snprintf(ndjson_path, sizeof(ndjson_path), "%s/dump.ndjson", scratch_dir);
+    snprintf(out_syx, sizeof(out_syx), "%s/out.syx", scratch_dir);
+    snprintf(wire_path, sizeof(wire_path), "%s/wire", scratch_dir);
+
+    FCBError error;
+    if (source && fcb_read_sysex_file(source, dump, &error) == FCB_OK &&
+        fcb_decode_sysex(dump, SYSEX_SIZE, &decoded, &error) == FCB_OK) {
+        printf("Dump: %s\n", source);
+    } else {
+        if (source) fprintf(stderr, "%s: %s, using a default dump\n", source, error.message);
+        init_fcb1010(&decoded);
+        fcb_encode_sysex(&decoded, dump, SYSEX_SIZE, NULL);
+    }
+
+    static char ndjson[128 * 1024];
+    size_t length;
+    if (fcb_write_sysex_file(dump_path, dump, &error) != FCB_OK ||
+        fcb_write_csv_file(csv_path, &decoded, &error) != FCB_OK ||
+        fcb_format_ndjson(&decoded, NULL, ndjson, sizeof(ndjson), &length, &error) != FCB_OK) {
+        fprintf(stderr, "%s\n", error.message);
+        return false;
+    }
+
+    FILE *file = fopen(ndjson_path, "wb");
+    bool ok = file && fwrite(ndjson, 1, length, file) == length;
+    if (file && fclose(file) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Failed to write %s\n", ndjson_path);
+    return ok;
+}
+
+static void remove_scratch() {
+    const char *names[] = { dump_path, csv_path, ndjson_path, out_syx, wire_path };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) unlink(names[i]);
+    rmdir(scratch_dir);
+}
+
+int main(int argc, char *argv[]) {
+    const char *source = "dumps/v-amp.syx";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            source = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: fcballocs [--dump <file.syx>]\n");
+            return 1;
+        }
+    }
+
+    if (!counter_works()) {
+        fprintf(stderr, "malloc is not being counted; the check cannot run\n");
+        return 1;
+    }
+
+    snprintf(scratch_dir, sizeof(scratch_dir), "%s/fcballocs.XXXXXX", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+    if (!mkdtemp(scratch_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    loop = event_loop_create();
+    bool clean = loop && prepare(source);
+    if (clean) {
+        for (int c = 0; c < NUM_CHECKS; c++) {
+            if (!run_check(&checks[c])) clean = false;
+        }
+        if (!run_threads()) clean = false;
+    }
+
+    event_loop_destroy(loop);
+    remove_scratch();
+    return clean ? 0 : 1;
+}
@@ -0,0 +1,552 @@
+/*  Microbenchmarks for the codec, CSV and file conversion paths
+*   Builds without ncurses or ALSA. Every benchmark runs over two input
+*   sets: the dumps in the corpus directory, and synthetic dumps made from
+*   randomized presets. Each one is warmed up, then timed in several
+*   repetitions of a fixed wall time. The fastest repetition is reported:
+*   noise only ever adds time, so it is the most repeatable figure.
+*
+*   The fuzz corpus (bench/corpus, one directory per fuzz target) is timed
+*   too: it is small, reaches every parser path the fuzzer found, and so
+*   catches a slowdown in the error paths the dumps never take.
+*
+*   --save writes the results as a baseline, --baseline compares against
+*   one and exits non-zero if anything got slower than the threshold.
+*/
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fcb.h"
+#include "fuzz.h"
+#include "timing.h"
+
+#define BENCH_MAX_INPUTS 64
+#define BENCH_MAX_RESULTS 32
+#define BENCH_MAX_FUZZ_INPUTS 512
+#define BENCH_SYNTHETIC_DUMPS 16
+#define BENCH_REPETITIONS 7
+#define BENCH_WARMUP_NS (50 * NSEC_PER_MSEC)
+#define BENCH_REPETITION_NS (40 * NSEC_PER_MSEC)
+#define BENCH_DEFAULT_THRESHOLD 15.0
+#define BENCH_BATCH (4 * FCB_BATCH_LANES)
+#define BENCH_NDJSON_SIZE (128 * 1024)
+
+typedef struct {
+    uint8_t sysex[SYSEX_SIZE];
+    FCB1010 fcb;
+    char syx_path[512];
+    char csv_path[512];
+    char ndjson_path[512];
+    size_t csv_size;
+} BenchInput;
+
+typedef struct {
+    const char *name;
+    BenchInput *inputs;
+    int count;
+} InputSet;
+
+typedef struct {
+    const char *name;
+    void (*run)(const BenchInput *input);
+    bool csv_bytes;  // Throughput counts CSV bytes rather than dump bytes
+    int dumps;       // Dumps handled per call
+} Benchmark;
+
+// What one fuzz target keeps in its corpus directory
+typedef struct {
+    const FuzzTarget *target;
+    uint8_t *data[BENCH_MAX_FUZZ_INPUTS];
+    size_t size[BENCH_MAX_FUZZ_INPUTS];
+    int count;
+    size_t bytes;
+} FuzzCorpus;
+
+typedef struct {
+    const Benchmark *bench;
+    const InputSet *set;
+} BenchRun;
+
+typedef struct {
+    char name[64];
+    double ns_per_op;
+} Result;
+
+static char scratch_dir[256];
+static char out_csv[512];
+static char out_syx[512];
+static char ndjson_text[BENCH_NDJSON_SIZE];
+static volatile uint8_t sink;  // Keeps results observable so nothing is optimized away
+
+static void bench_parse_sysex(const BenchInput *input) {
+    FCB1010 fcb;
+    uint8_t data[SYSEX_SIZE];
+
+    memcpy(data, input->sysex, SYSEX_SIZE);
+    parse_sysex(&fcb, data, SYSEX_SIZE);
+    sink = fcb.preset[NUM_PRESETS - 1].note_value;
+}
+
+static void bench_get_raw_sysex(const BenchInput *input) {
+    uint8_t data[SYSEX_SIZE];
+
+    get_raw_sysex(&input->fcb, data);
+    sink = data[SYSEX_SIZE / 2];
+}
+
+static void bench_write_csv(const BenchInput *input) {
+    sink = write_csv(&input->fcb, out_csv);
+}
+
+static void bench_load_csv(const BenchInput *input) {
+    FCB1010 fcb;
+
+    init_fcb1010(&fcb);
+    load_csv(&fcb, input->csv_path);
+    sink = fcb.preset[NUM_PRESETS - 1].note_value;
+}
+
+// Into memory, to time the formatter rather than the file system
+static void bench_format_ndjson(const BenchInput *input) {
+    size_t length;
+
+    fcb_format_ndjson(&input->fcb, NULL, ndjson_text, sizeof(ndjson_text), &length, NULL);
+    sink = (uint8_t)length;
+}
+
+static void bench_load_ndjson(const BenchInput *input) {
+    FCB1010 fcb;
+
+    init_fcb1010(&fcb);
+    fcb_read_ndjson_file(input->ndjson_path, &fcb, NULL);
+    sink = fcb.preset[NUM_PRESETS - 1].note_value;
+}
+
+// Dump file to CSV file, the way "Create CSV from dump.syx" does it
+static void bench_syx_to_csv(const BenchInput *input) {
+    uint8_t data[SYSEX_SIZE];
+    FCB1010 fcb;
+
+    FILE *file = fopen(input->syx_path, "rb");
+    if (!file) return;
+    size_t size = fread(data, 1, SYSEX_SIZE, file);
+    fclose(file);
+
+    init_fcb1010(&fcb);
+    if (size == SYSEX_SIZE && parse_sysex(&fcb, data, size)) {
+        sink = write_csv(&fcb, out_csv);
+    }
+}
+
+// CSV file to dump file, the way "Create Sysex from CSV" does it
+static void bench_csv_to_syx(const BenchInput *input) {
+    uint8_t data[SYSEX_SIZE];
+    FCB1010 fcb;
+
+    init_fcb1010(&fcb);
+    if (!load_csv(&fcb, input->csv_path) || !get_raw_sysex(&fcb, data)) return;
+
+    FILE *file = fopen(out_syx, "wb");
+    if (!file) return;
+    sink = fwrite(data, 1, SYSEX_SIZE, file) == SYSEX_SIZE;
+    fclose(file);
+}
+
+// BENCH_BATCH copies of the dump through the vector decoder on one thread
+static void bench_decode_batch(const BenchInput *input) {
+    static FCBBatch batch;
+    static bool ready;
+    const uint8_t *dumps[BENCH_BATCH];
+
+    if (!ready) ready = fcb_batch_create(&batch, BENCH_BATCH, NULL, NULL) == FCB_OK;
+    if (!ready) return;
+
+    for (int i = 0; i < BENCH_BATCH; i++) dumps[i] = input->sysex;
+    sink = (uint8_t)fcb_decode_batch(dumps, NULL, BENCH_BATCH, &batch, 1);
+}
+
+static const Benchmark benchmarks[] = {
+    { "parse_sysex", bench_parse_sysex, false, 1 },
+    { "decode_batch", bench_decode_batch, false, BENCH_BATCH },
+    { "get_raw_sysex", bench_get_raw_sysex, false, 1 },
+    { "write_csv", bench_write_csv, true, 1 },
+    { "load_csv", bench_load_csv, true, 1 },
+    { "syx_to_csv", bench_syx_to_csv, false, 1 },
+    { "csv_to_syx", bench_csv_to_syx, true, 1 },
+    { "format_ndjson", bench_format_ndjson, false, 1 },
+    { "load_ndjson", bench_load_ndjson, false, 1 },
+};
+
+#define NUM_BENCHMARKS (int)(sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+// Write the dump, its CSV and its NDJSON to the scratch directory so the file
+// benchmarks have something to read
+static bool prepare_input(BenchInput *input, const char *set, int index) {
+    snprintf(input->syx_path, sizeof(input->syx_path), "%s/%s%d.syx", scratch_dir, set, index);
+    snprintf(input->csv_path, sizeof(input->csv_path), "%s/%s%d.csv", scratch_dir, set, index);
+    snprintf(input->ndjson_path, sizeof(input->ndjson_path), "%s/%s%d.ndjson", scratch_dir, set, index);
+
+    init_fcb1010(&input->fcb);
+    if (!parse_sysex(&input->fcb, input->sysex, SYSEX_SIZE)) return false;
+
+    FILE *file = fopen(input->syx_path, "wb");
+    if (!file) return false;
+    bool ok = fwrite(input->sysex, 1, SYSEX_SIZE, file) == SYSEX_SIZE;
+    fclose(file);
+
+    struct stat st;
+    if (!ok || !write_csv(&input->fcb, input->csv_path) || stat(input->csv_path, &st) != 0) return false;
+
+    input->csv_size = st.st_size;
+
+    size_t length;
+    if (fcb_format_ndjson(&input->fcb, NULL, ndjson_text, sizeof(ndjson_text), &length, NULL) != FCB_OK) return false;
+    file = fopen(input->ndjson_path, "wb");
+    if (!file) return false;
+    ok = fwrite(ndjson_text, 1, length, file) == length;
+    return fclose(file) == 0 && ok;
+}
+
+static int load_corpus(const char *dir, BenchInput *inputs) {
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+
+    int count = 0;
+    struct dirent *entry;
+
+    while ((entry = readdir(d)) && count < BENCH_MAX_INPUTS) {
+        size_t len = strlen(entry->d_name);
+        if (len < 4 || strcmp(entry->d_name + len - 4, ".syx") != 0) continue;
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+
+        FILE *file = fopen(path, "rb");
+        if (!file) continue;
+        size_t size = fread(inputs[count].sysex, 1, SYSEX_SIZE, file);
+        fclose(file);
+
+        if (size == SYSEX_SIZE && prepare_input(&inputs[count], "corpus", count)) {
+            count++;
+        } else {
+            fprintf(stderr, "Skipping %s: not a valid dump\n", path);
+        }
+    }
+
+    closedir(d);
+    return count;
+}
+
+// Random but valid settings, encoded into dumps the same way the tool does
+static int make_synthetic(BenchInput *inputs, unsigned seed) {
+    for (int n = 0; n < BENCH_SYNTHETIC_DUMPS; n++) {
+        FCB1010 fcb;
+        init_fcb1010(&fcb);
+
+        for (int p = 0; p < NUM_PRESETS; p++) {
+            for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+                int max = fcb_preset_fields[f].is_flag ? 2 : 128;
+                fcb_set_preset_field(&fcb.preset[p], f, rand_r(&seed) % max);
+            }
+        }
+
+        fcb.pc1_midi_channel = rand_r(&seed) % 16;
+        fcb.pc2_midi_channel = rand_r(&seed) % 16;
+        fcb.pc3_midi_channel = rand_r(&seed) % 16;
+        fcb.pc4_midi_channel = rand_r(&seed) % 16;
+        fcb.pc5_midi_channel = rand_r(&seed) % 16;
+        fcb.cc1_midi_channel = rand_r(&seed) % 16;
+        fcb.cc2_midi_channel = rand_r(&seed) % 16;
+        fcb.expA_midi_channel = rand_r(&seed) % 16;
+        fcb.expB_midi_channel = rand_r(&seed) % 16;
+        fcb.note_midi_channel = rand_r(&seed) % 16;
+        fcb.direct_select = rand_r(&seed) % 2;
+        fcb.running_status = rand_r(&seed) % 2;
+        fcb.merge = rand_r(&seed) % 2;
+        fcb.switch1 = rand_r(&seed) % 2;
+        fcb.switch2 = rand_r(&seed) % 2;
+        fcb.expA_calibration_min = rand_r(&seed) % 64;
+        fcb.expA_calibration_max = 64 + rand_r(&seed) % 64;
+        fcb.expB_calibration_min = rand_r(&seed) % 64;
+        fcb.expB_calibration_max = 64 + rand_r(&seed) % 64;
+
+        if (!get_raw_sysex(&fcb, inputs[n].sysex) || !prepare_input(&inputs[n], "synthetic", n)) {
+            return n;
+        }
+    }
+
+    return BENCH_SYNTHETIC_DUMPS;
+}
+
+// Read target's corpus from dir/<target name>; returns false if it has none
+static bool load_fuzz_corpus(const char *dir, const FuzzTarget *target, FuzzCorpus *corpus) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, target->name);
+
+    corpus->target = target;
+    corpus->count = 0;
+    corpus->bytes = 0;
+
+    DIR *d = opendir(path);
+    if (!d) return false;
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) && corpus->count < BENCH_MAX_FUZZ_INPUTS) {
+        if (entry->d_name[0] == '.') continue;
+
+        char file_path[1280];
+        struct stat st;
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, entry->d_name);
+        if (stat(file_path, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size > target->max_size) continue;
+
+        FILE *file = fopen(file_path, "rb");
+        if (!file) continue;
+        uint8_t *data = malloc(st.st_size ? st.st_size : 1);
+        size_t size = data ? fread(data, 1, st.st_size, file) : 0;
+        fclose(file);
+
+        if (data && size == (size_t)st.st_size) {
+            corpus->data[corpus->count] = data;
+            corpus->size[corpus->count] = size;
+            corpus->bytes += size;
+            corpus->count++;
+        } else {
+            free(data);
+        }
+    }
+
+    closedir(d);
+    return corpus->count > 0;
+}
+
+static void free_fuzz_corpus(FuzzCorpus *corpus) {
+    for (int i = 0; i < corpus->count; i++) free(corpus->data[i]);
+    corpus->count = 0;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Run over the whole set until duration_ns has passed; returns ns per op
+// (per dump for batch benchmarks)
+static double run_for(const void *what, uint64_t duration_ns) {
+    const BenchRun *run = what;
+    uint64_t start_ns = timing_now_ns();
+    uint64_t elapsed_ns;
+    uint64_t ops = 0;
+
+    do {
+        for (int i = 0; i < run->set->count; i++) run->bench->run(&run->set->inputs[i]);
+        ops += run->set->count * run->bench->dumps;
+        elapsed_ns = timing_now_ns() - start_ns;
+    } while (elapsed_ns < duration_ns);
+
+    return (double)elapsed_ns / ops;
+}
+
+// The same over a fuzz corpus, per input
+static double run_corpus_for(const void *what, uint64_t duration_ns) {
+    const FuzzCorpus *corpus = what;
+    uint64_t start_ns = timing_now_ns();
+    uint64_t elapsed_ns;
+    uint64_t ops = 0;
+
+    do {
+        for (int i = 0; i < corpus->count; i++) corpus->target->parse(corpus->data[i], corpus->size[i]);
+        ops += corpus->count;
+        elapsed_ns = timing_now_ns() - start_ns;
+    } while (elapsed_ns < duration_ns);
+
+    return (double)elapsed_ns / ops;
+}
+
+static double measure(double (*run)(const void *what, uint64_t duration_ns), const void *what) {
+    double samples[BENCH_REPETITIONS];
+
+    run(what, BENCH_WARMUP_NS);
+    for (int r = 0; r < BENCH_REPETITIONS; r++) {
+        samples[r] = run(what, BENCH_REPETITION_NS);
+    }
+
+    qsort(samples, BENCH_REPETITIONS, sizeof(double), compare_double);
+    return samples[0];
+}
+
+static double average_bytes(const Benchmark *bench, const InputSet *set) {
+    double total = 0;
+
+    for (int i = 0; i < set->count; i++) {
+        total += bench->csv_bytes ? set->inputs[i].csv_size : SYSEX_SIZE;
+    }
+    return total / set->count;
+}
+
+static bool save_baseline(const char *filename, const Result *results, int count) {
+    FILE *file = fopen(filename, "w");
+    if (!file) return false;
+
+    for (int i = 0; i < count; i++) {
+        fprintf(file, "%s %.1f\n", results[i].name, results[i].ns_per_op);
+    }
+    return fclose(file) == 0;
+}
+
+// Compare against a saved baseline; returns the number of regressions,
+// or -1 if the baseline cannot be read
+static int compare_baseline(const char *filename, const Result *results, int count, double threshold) {
+    FILE *file = fopen(filename, "r");
+    if (!file) return -1;
+
+    int regressions = 0;
+    char name[64];
+    double baseline;
+
+    printf("\nAgainst %s (threshold %.0f%%):\n", filename, threshold);
+    while (fscanf(file, "%63s %lf", name, &baseline) == 2) {
+        for (int i = 0; i < count; i++) {
+            if (strcmp(results[i].name, name) != 0) continue;
+
+            double change = (results[i].ns_per_op / baseline - 1) * 100;
+            bool regressed = change > threshold;
+            printf("  %-24s %12.1f -> %12.1f ns/op  %+6.1f%%%s\n", name, baseline,
+                   results[i].ns_per_op, change, regressed ? "  REGRESSION" : "");
+            if (regressed) regressions++;
+        }
+    }
+
+    fclose(file);
+    return regressions;
+}
+
+static void remove_scratch(const InputSet *sets, int set_count) {
+    for (int s = 0; s < set_count; s++) {
+        for (int i = 0; i < sets[s].count; i++) {
+            unlink(sets[s].inputs[i].syx_path);
+            unlink(sets[s].inputs[i].csv_path);
+            unlink(sets[s].inputs[i].ndjson_path);
+        }
+    }
+    unlink(out_csv);
+    unlink(out_syx);
+    rmdir(scratch_dir);
+}
+
+static void print_usage() {
+    fprintf(stderr, "Usage: fcbbench [--corpus <dir>] [--fuzz-corpus <dir>] [--filter <name>] [--save <baseline>]\n");
+    fprintf(stderr, "                [--baseline <baseline>] [--threshold <percent>] [--seed <n>]\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *corpus = "dumps";
+    const char *fuzz_corpus = "bench/corpus";
+    const char *filter = NULL;
+    const char *save = NULL;
+    const char *baseline = NULL;
+    double threshold = BENCH_DEFAULT_THRESHOLD;
+    unsigned seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) {
+            corpus = argv[++i];
+        } else if (strcmp(argv[i], "--fuzz-corpus") == 0 && i + 1 < argc) {
+            fuzz_corpus = argv[++i];
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+            save = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], NULL, 10);
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    snprintf(scratch_dir, sizeof(scratch_dir), "%s/fcbbench.XXXXXX", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+    if (!mkdtemp(scratch_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(out_csv, sizeof(out_csv), "%s/out.csv", scratch_dir);
+    snprintf(out_syx, sizeof(out_syx), "%s/out.syx", scratch_dir);
+
+    static BenchInput corpus_inputs[BENCH_MAX_INPUTS];
+    static BenchInput synthetic_inputs[BENCH_SYNTHETIC_DUMPS];
+    InputSet sets[2] = {
+        { "corpus", corpus_inputs, load_corpus(corpus, corpus_inputs) },
+        { "synthetic", synthetic_inputs, make_synthetic(synthetic_inputs, seed) },
+    };
+
+    if (sets[0].count == 0) fprintf(stderr, "No dumps found in %s, running synthetic inputs only\n", corpus);
+
+    Result results[BENCH_MAX_RESULTS];
+    int result_count = 0;
+
+    printf("%-24s %12s %10s   (%d corpus, %d synthetic dumps)\n", "benchmark", "ns/op", "MB/s",
+           sets[0].count, sets[1].count);
+
+    for (int b = 0; b < NUM_BENCHMARKS; b++) {
+        for (int s = 0; s < 2; s++) {
+            if (sets[s].count == 0) continue;
+
+            Result *r = &results[result_count];
+            snprintf(r->name, sizeof(r->name), "%s/%s", benchmarks[b].name, sets[s].name);
+            if (filter && !strstr(r->name, filter)) continue;
+
+            BenchRun run = { &benchmarks[b], &sets[s] };
+            r->ns_per_op = measure(run_for, &run);
+            double mb_per_s = average_bytes(&benchmarks[b], &sets[s]) / r->ns_per_op * 1e3;
+            printf("%-24s %12.1f %10.2f\n", r->name, r->ns_per_op, mb_per_s);
+            result_count++;
+        }
+    }
+
+    // Per input of each fuzz corpus, in the corpus's own mix of sizes
+    for (int t = 0; t < fuzz_target_count; t++) {
+        static FuzzCorpus fuzz;
+        Result *r = &results[result_count];
+        snprintf(r->name, sizeof(r->name), "fuzz_%s/corpus", fuzz_targets[t].name);
+        if (filter && !strstr(r->name, filter)) continue;
+        if (!load_fuzz_corpus(fuzz_corpus, &fuzz_targets[t], &fuzz)) continue;
+
+        r->ns_per_op = measure(run_corpus_for, &fuzz);
+        double mb_per_s = (double)fuzz.bytes / fuzz.count / r->ns_per_op * 1e3;
+        printf("%-24s %12.1f %10.2f   (%d inputs)\n", r->name, r->ns_per_op, mb_per_s, fuzz.count);
+        result_count++;
+        free_fuzz_corpus(&fuzz);
+    }
+
+    remove_scratch(sets, 2);
+
+    if (save) {
+        if (!save_baseline(save, results, result_count)) {
+            fprintf(stderr, "Failed to write baseline %s\n", save);
+            return 1;
+        }
+        printf("Baseline saved to %s\n", save);
+    }
+
+    if (baseline) {
+        int regressions = compare_baseline(baseline, results, result_count, threshold);
+        if (regressions < 0) {
+            fprintf(stderr, "Failed to read baseline %s\n", baseline);
+            return 1;
+        }
+        if (regressions > 0) {
+            printf("%d benchmark%s slower than the baseline allows\n", regressions, regressions == 1 ? "" : "s");
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,492 @@
+/*  Coverage-guided fuzzer for the fuzz targets
+*   The library is built with gcc's -fsanitize-coverage=trace-pc, which
+*   calls __sanitizer_cov_trace_pc() at every basic block; the blocks one
+*   input reaches are hashed into a bitmap. Inputs are mutated from the
+*   corpus, and one that reaches a block no earlier input did is added to
+*   it. ASan and UBSan turn memory errors into crashes, and a crash (or a
+*   failed check in a target) leaves the input behind as crash-<target>-
+*   <hash> for replaying. After a run the corpus is minimized: smallest
+*   inputs first, only those that add coverage are kept. What remains is
+*   small, reaches every block found, and is what make bench times.
+*
+*   Built with -DFUZZ_LIBFUZZER instead, this file is just the libFuzzer
+*   entry point for clang users, with the target taken from FUZZ_TARGET.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fcb.h"
+#include "fuzz.h"
+#include "timing.h"
+
+#ifdef FUZZ_LIBFUZZER
+
+static const FuzzTarget *target;
+
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+    (void)argc;
+    (void)argv;
+    const char *name = getenv("FUZZ_TARGET");
+    target = fuzz_find_target(name ? name : "sysex");
+    if (!target) {
+        fprintf(stderr, "Unknown FUZZ_TARGET %s\n", name);
+        exit(1);
+    }
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size <= target->max_size) target->run(data, size);
+    return 0;
+}
+
+#else
+
+#define COVERAGE_BITS (1 << 16)
+#define MAX_CORPUS 4096
+#define MAX_STACKED 4  // Mutations applied to one input
+#define REPORT_NS (2 * NSEC_PER_SEC)
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+} Input;
+
+static uint8_t coverage[COVERAGE_BITS / 8];  // Blocks reached by the current input
+static uint8_t seen[COVERAGE_BITS / 8];      // Blocks reached by any input so far
+static bool tracing;
+
+static const FuzzTarget *target;
+static Input corpus[MAX_CORPUS];
+static int corpus_count;
+static const uint8_t *current;  // The input being run, for the crash handler
+static size_t current_size;
+
+void __attribute__((no_sanitize_coverage)) __sanitizer_cov_trace_pc() {
+    if (!tracing) return;
+    uint64_t pc = (uintptr_t)__builtin_return_address(0);
+    uint32_t bit = (pc * 0x9e3779b97f4a7c15ull) >> (64 - 16);
+    coverage[bit / 8] |= 1 << (bit % 8);
+}
+
+// Set when the sanitizers are linked in; lets the crash input be saved
+// before they exit
+extern void __sanitizer_set_death_callback(void (*callback)()) __attribute__((weak));
+
+static uint64_t hash(const uint8_t *data, size_t size) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++) h = (h ^ data[i]) * 0x100000001b3ull;
+    return h;
+}
+
+static void hex_name(char *out, const char *prefix, uint64_t value) {
+    static const char digits[] = "0123456789abcdef";
+    size_t n = strlen(prefix);
+
+    memcpy(out, prefix, n);
+    for (int i = 0; i < 16; i++) out[n + i] = digits[(value >> (60 - 4 * i)) & 15];
+    out[n + 16] = '\0';
+}
+
+// Runs from a signal handler or the sanitizer's death callback, so only
+// plain system calls
+static void save_crash() {
+    static bool saved;
+    if (!current || saved) return;
+    saved = true;
+
+    char prefix[64];
+    char name[96];
+    size_t n = strlen(target->name);
+    if (n > 40) n = 40;
+    memcpy(prefix, "crash-", 6);
+    memcpy(prefix + 6, target->name, n);
+    prefix[6 + n] = '-';
+    prefix[7 + n] = '\0';
+    hex_name(name, prefix, hash(current, current_size));
+
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+    ssize_t written = write(fd, current, current_size);
+    (void)written;
+    close(fd);
+
+    const char message[] = "\nCrashing input saved as ";
+    written = write(STDERR_FILENO, message, sizeof(message) - 1);
+    written = write(STDERR_FILENO, name, strlen(name));
+    written = write(STDERR_FILENO, "\n", 1);
+}
+
+static void crash_signal(int signal) {
+    save_crash();
+    raise(signal);  // The handler was installed with SA_RESETHAND
+}
+
+static void catch_crashes() {
+    if (__sanitizer_set_death_callback) __sanitizer_set_death_callback(save_crash);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = crash_signal;
+    action.sa_flags = SA_RESETHAND;
+    const int signals[] = { SIGABRT, SIGSEGV, SIGBUS, SIGFPE, SIGILL };
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) sigaction(signals[i], &action, NULL);
+}
+
+// Run one input in a buffer of exactly its size, so a read past the end
+// is caught. Returns how many blocks it reached that no input had before.
+static int run_input(const uint8_t *data, size_t size) {
+    uint8_t *copy = malloc(size ? size : 1);
+    if (!copy) return 0;
+    memcpy(copy, data, size);
+
+    memset(coverage, 0, sizeof(coverage));
+    current = copy;
+    current_size = size;
+    tracing = true;
+    target->run(copy, size);
+    tracing = false;
+    current = NULL;
+    free(copy);
+
+    int added = 0;
+    for (size_t i = 0; i < sizeof(coverage); i++) {
+        uint8_t fresh = coverage[i] & ~seen[i];
+        if (fresh) {
+            added += __builtin_popcount(fresh);
+            seen[i] |= fresh;
+        }
+    }
+    return added;
+}
+
+static int count_bits(const uint8_t *map) {
+    int count = 0;
+    for (size_t i = 0; i < COVERAGE_BITS / 8; i++) count += __builtin_popcount(map[i]);
+    return count;
+}
+
+static bool add_to_corpus(const uint8_t *data, size_t size) {
+    if (corpus_count == MAX_CORPUS) return false;
+
+    uint8_t *copy = malloc(size ? size : 1);
+    if (!copy) return false;
+    memcpy(copy, data, size);
+    corpus[corpus_count].data = copy;
+    corpus[corpus_count].size = size;
+    corpus_count++;
+    return true;
+}
+
+static bool write_input(const char *dir, const uint8_t *data, size_t size) {
+    char name[32];
+    char path[1024];
+    hex_name(name, "", hash(data, size));
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE *file = fopen(path, "wb");
+    if (!file) return false;
+    bool ok = fwrite(data, 1, size, file) == size;
+    return fclose(file) == 0 && ok;
+}
+
+static bool read_input(const char *path, uint8_t **data, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return false;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    rewind(file);
+    *data = malloc(length > 0 ? length : 1);
+    *size = length > 0 ? length : 0;
+    bool ok = *data && length >= 0 && fread(*data, 1, *size, file) == *size;
+    fclose(file);
+    if (!ok) free(*data);
+    return ok;
+}
+
+// Every file in dir into the corpus, smallest first
+static int compare_inputs(const void *a, const void *b) {
+    const Input *x = a;
+    const Input *y = b;
+    if (x->size != y->size) return x->size < y->size ? -1 : 1;
+    return memcmp(x->data, y->data, x->size);
+}
+
+static void load_corpus(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) && corpus_count < MAX_CORPUS) {
+        if (entry->d_name[0] == '.') continue;
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        Input input;
+        if (!read_input(path, &input.data, &input.size)) continue;
+        if (input.size <= target->max_size) corpus[corpus_count++] = input;
+        else free(input.data);
+    }
+    closedir(d);
+    qsort(corpus, corpus_count, sizeof(Input), compare_inputs);
+}
+
+static const char *const dictionary[] = {
+    "\xF0", "\xF7", "\x20\x32\x01\x0C\x0F", "\xF8", "\x7F", "\x80", ",", ",,", "\n", "\r\n", "0", "1",
+    "15", "16", "127", "128", "-1", "4294967296", "#", "*", "global", "true", "false", "null", "{", "}", "[",
+    "]", "\"", ":", "\\u0000", "\"type\"", "\"globals\"", "\"preset\"", "\"bank\"", "\"dump\"", " ",
+};
+
+#define DICTIONARY_SIZE (int)(sizeof(dictionary) / sizeof(dictionary[0]))
+
+// A token worth splicing in: a field name, or one of the above
+static const char *random_token(unsigned *rng) {
+    int pick = rand_r(rng) % (DICTIONARY_SIZE + NUM_PRESET_FIELDS + NUM_GLOBAL_FIELDS);
+    if (pick < DICTIONARY_SIZE) return dictionary[pick];
+    pick -= DICTIONARY_SIZE;
+    return pick < NUM_PRESET_FIELDS ? fcb_preset_fields[pick].name : fcb_global_fields[pick - NUM_PRESET_FIELDS].name;
+}
+
+static size_t insert_bytes(uint8_t *data, size_t size, size_t capacity, size_t at, const uint8_t *bytes,
+                           size_t count) {
+    if (count > capacity - size) count = capacity - size;
+    memmove(data + at + count, data + at, size - at);
+    memcpy(data + at, bytes, count);
+    return size + count;
+}
+
+static size_t mutate(uint8_t *data, size_t size, size_t capacity, unsigned *rng) {
+    size_t at = size ? rand_r(rng) % size : 0;
+
+    switch (rand_r(rng) % 9) {
+        case 0:  // Flip a bit
+            if (size) data[at] ^= 1 << (rand_r(rng) % 8);
+            break;
+        case 1:  // Any byte
+            if (size) data[at] = rand_r(rng);
+            break;
+        case 2:  // A digit, so numbers change but stay numbers
+            if (size) data[at] = '0' + rand_r(rng) % 10;
+            break;
+        case 3: {  // Drop a run
+            size_t count = size ? 1 + rand_r(rng) % (size - at < 64 ? size - at : 64) : 0;
+            memmove(data + at, data + at + count, size - at - count);
+            size -= count;
+            break;
+        }
+        case 4: {  // Repeat a run
+            size_t count = size ? 1 + rand_r(rng) % (size - at < 64 ? size - at : 64) : 0;
+            uint8_t run[64];
+            memcpy(run, data + at, count);
+            size = insert_bytes(data, size, capacity, at, run, count);
+            break;
+        }
+        case 5:
+        case 6: {  // A token
+            const char *token = random_token(rng);
+            size_t length = strlen(token) ? strlen(token) : 1;
+            if (rand_r(rng) % 2 && at + length <= size) {
+                memcpy(data + at, token, length);
+            } else {
+                size = insert_bytes(data, size, capacity, at, (const uint8_t *)token, length);
+            }
+            break;
+        }
+        case 7: {  // A piece of another input
+            const Input *other = &corpus[rand_r(rng) % corpus_count];
+            if (other->size == 0) break;
+            size_t from = rand_r(rng) % other->size;
+            size_t count = 1 + rand_r(rng) % (other->size - from < 256 ? other->size - from : 256);
+            size = insert_bytes(data, size, capacity, at, other->data + from, count);
+            break;
+        }
+        case 8:  // Cut the end off
+            size = at;
+            break;
+    }
+    return size;
+}
+
+// Keep the smallest inputs that between them reach every block the
+// corpus reaches; the others are deleted from dir
+static int minimize(const char *dir) {
+    memset(seen, 0, sizeof(seen));
+    int kept = 0;
+
+    for (int i = 0; i < corpus_count; i++) {
+        if (run_input(corpus[i].data, corpus[i].size) > 0) {
+            write_input(dir, corpus[i].data, corpus[i].size);  // Under its hash, whatever it was called
+            corpus[kept++] = corpus[i];
+        } else {
+            free(corpus[i].data);
+        }
+    }
+
+    // Then everything else in dir goes
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    while (d && (entry = readdir(d))) {
+        if (entry->d_name[0] == '.') continue;
+
+        bool keep = false;
+        for (int i = 0; i < kept && !keep; i++) {
+            char name[32];
+            hex_name(name, "", hash(corpus[i].data, corpus[i].size));
+            keep = strcmp(name, entry->d_name) == 0;
+        }
+        if (!keep) {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            unlink(path);
+        }
+    }
+    if (d) closedir(d);
+
+    corpus_count = kept;
+    return kept;
+}
+
+// Stops after runs inputs, or at the end of seconds if that is not 0
+static int fuzz(const char *dir, long runs, long seconds, unsigned seed) {
+    unsigned rng = seed;
+    if (dir) {
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Failed to create %s: %s\n", dir, strerror(errno));
+            return 1;
+        }
+        load_corpus(dir);
+    }
+
+    // Replay what is there, then seed with valid inputs if it was empty
+    int loaded = corpus_count;
+    for (int i = 0; i < loaded; i++) run_input(corpus[i].data, corpus[i].size);
+
+    uint8_t *buffer = malloc(target->max_size);
+    if (!buffer) return 1;
+    for (int i = 0; corpus_count == 0 && i < 4; i++) {
+        size_t size = target->seed(buffer, target->max_size, &rng);
+        if (run_input(buffer, size) > 0 && add_to_corpus(buffer, size) && dir) write_input(dir, buffer, size);
+    }
+    if (corpus_count == 0) add_to_corpus(buffer, 0);
+
+    printf("%s: %d inputs, %d blocks\n", target->name, corpus_count, count_bits(seen));
+
+    uint64_t start_ns = timing_now_ns();
+    uint64_t report_ns = start_ns + REPORT_NS;
+    uint64_t end_ns = seconds ? start_ns + seconds * NSEC_PER_SEC : 0;
+    int found = 0;
+    long run;
+    for (run = 0; run < runs && (!end_ns || timing_now_ns() < end_ns); run++) {
+        const Input *parent = &corpus[rand_r(&rng) % corpus_count];
+        size_t size = parent->size;
+        memcpy(buffer, parent->data, size);
+
+        int stacked = 1 + rand_r(&rng) % MAX_STACKED;
+        for (int m = 0; m < stacked; m++) size = mutate(buffer, size, target->max_size, &rng);
+
+        if (run_input(buffer, size) > 0 && add_to_corpus(buffer, size)) {
+            found++;
+            if (dir) write_input(dir, buffer, size);
+        }
+
+        uint64_t now = timing_now_ns();
+        if (now >= report_ns) {
+            printf("  %ld runs, %d inputs, %d blocks, %.0f runs/s\n", run + 1, corpus_count, count_bits(seen),
+                   (run + 1) / ((now - start_ns) / 1e9));
+            fflush(stdout);
+            report_ns = now + REPORT_NS;
+        }
+    }
+
+    printf("%s: %ld runs, %d new inputs, %d blocks", target->name, run, found, count_bits(seen));
+    if (dir) {
+        qsort(corpus, corpus_count, sizeof(Input), compare_inputs);
+        printf(", corpus minimized to %d", minimize(dir));
+    }
+    printf("\n");
+
+    free(buffer);
+    for (int i = 0; i < corpus_count; i++) free(corpus[i].data);
+    return 0;
+}
+
+static void print_usage() {
+    fprintf(stderr, "Usage: fcbfuzz <target> [--corpus <dir>] [--runs <count>] [--time <seconds>] [--seed <n>]\n");
+    fprintf(stderr, "       fcbfuzz <target> --replay <file>...\n");
+    fprintf(stderr, "       fcbfuzz roundtrip [--runs <count>] [--seed <n>]\n");
+    fprintf(stderr, "Targets:");
+    for (int t = 0; t < fuzz_target_count; t++) fprintf(stderr, " %s", fuzz_targets[t].name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = NULL;
+    long runs = 0;
+    long seconds = 0;
+    unsigned seed = 1;
+    int replay = 0;
+
+    if (argc < 2) {
+        print_usage();
+        return 1;
+    }
+    for (int i = 2; i < argc && !replay; i++) {
+        if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+            seconds = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay = i + 1;
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    // A time limit alone runs until it is up
+    if (runs <= 0) runs = seconds ? LONG_MAX : 100000;
+
+    if (strcmp(argv[1], "roundtrip") == 0) {
+        int failures = fuzz_roundtrip(seed, runs);
+        printf("roundtrip: %ld random dumps, %d failed checks\n", runs, failures);
+        return failures ? 1 : 0;
+    }
+
+    target = fuzz_find_target(argv[1]);
+    if (!target) {
+        print_usage();
+        return 1;
+    }
+    catch_crashes();
+
+    if (replay) {
+        for (int i = replay; i < argc; i++) {
+            Input input;
+            if (!read_input(argv[i], &input.data, &input.size)) {
+                fprintf(stderr, "Failed to read %s\n", argv[i]);
+                return 1;
+            }
+            run_input(input.data, input.size);
+            printf("%s: ok\n", argv[i]);
+            free(input.data);
+        }
+        return 0;
+    }
+
+    return fuzz(dir, runs, seconds, seed);
+}
+
+#endif
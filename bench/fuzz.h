@@ -0,0 +1,28 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// An entry point that takes untrusted bytes. run feeds them to the parser
+// and, when they parse, checks what came out against the other codec
+// paths; a failed check aborts. parse is the entry point alone, which the
+// benchmarks time over the corpus. seed writes a valid input.
+typedef struct {
+    const char *name;
+    void (*run)(const uint8_t *data, size_t size);
+    void (*parse)(const uint8_t *data, size_t size);
+    size_t (*seed)(uint8_t *out, size_t size, unsigned *rng);
+    size_t max_size;
+} FuzzTarget;
+
+extern const FuzzTarget fuzz_targets[];
+extern const int fuzz_target_count;
+
+const FuzzTarget *fuzz_find_target(const char *name);
+
+// Randomized FCB1010s through every encode and decode path; returns the
+// number of failed checks, with details on stderr
+int fuzz_roundtrip(unsigned seed, long runs);
+
+#endif
@@ -0,0 +1,473 @@
+/*  Fuzz targets and the round-trip property test
+*   Each target feeds arbitrary bytes to one parser of untrusted input: the
+*   SysEx decoder, the CSV and NDJSON parsers, the damaged capture scanner
+*   and the variant override parser. Whatever parses is then held to the
+*   other codec paths: the lazy, batch and vector decoders must agree
+*   with the full one, and what is encoded or formatted again must parse back the
+*   same. fuzz_roundtrip() does the same from the other side, starting
+*   from random settings rather than random bytes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fcb.h"
+#include "fuzz.h"
+
+#define NDJSON_SIZE (128 * 1024)
+
+#define CHECK(condition) ((condition) ? (void)0 : check_failed(#condition, __LINE__))
+
+static void check_failed(const char *condition, int line) {
+    fprintf(stderr, "fuzz_targets.c:%d: check failed: %s\n", line, condition);
+    abort();
+}
+
+static bool global_in_range(int field, uint8_t value) {
+    const FCBGlobalField *g = &fcb_global_fields[field];
+    return value <= (g->is_flag ? 1 : g->in_csv ? 15 : 127);
+}
+
+static bool preset_in_range(int field, uint8_t value) {
+    return value <= (fcb_preset_fields[field].is_flag ? 1 : 127);
+}
+
+// The first field where a and b differ, as "preset 12 cc1_value" or
+// "global merge", or NULL when they match. csv_only skips the global
+// settings a CSV does not carry.
+static const char *first_difference(const FCB1010 *a, const FCB1010 *b, bool csv_only) {
+    static char where[64];
+
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+            if (fcb_get_preset_field(&a->preset[p], f) != fcb_get_preset_field(&b->preset[p], f)) {
+                snprintf(where, sizeof(where), "preset %d %s", p, fcb_preset_fields[f].name);
+                return where;
+            }
+        }
+    }
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        if (csv_only && !fcb_global_fields[f].in_csv) continue;
+        if (fcb_get_global_field(a, f) != fcb_get_global_field(b, f)) {
+            snprintf(where, sizeof(where), "global %s", fcb_global_fields[f].name);
+            return where;
+        }
+    }
+    return NULL;
+}
+
+static bool same(const FCB1010 *a, const FCB1010 *b) {
+    return first_difference(a, b, false) == NULL;
+}
+
+static bool same_preset(const FCB1010Preset *a, const FCB1010Preset *b) {
+    for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+        if (fcb_get_preset_field(a, f) != fcb_get_preset_field(b, f)) return false;
+    }
+    return true;
+}
+
+static void random_fcb(FCB1010 *fcb, unsigned *rng) {
+    init_fcb1010(fcb);
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+            fcb_set_preset_field(&fcb->preset[p], f, rand_r(rng) % (fcb_preset_fields[f].is_flag ? 2 : 128));
+        }
+    }
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        const FCBGlobalField *g = &fcb_global_fields[f];
+        fcb_set_global_field(fcb, f, rand_r(rng) % (g->is_flag ? 2 : g->in_csv ? 16 : 128));
+    }
+}
+
+// Settings that came out of any parser must be in range, encode, and
+// decode back to themselves
+static void check_canonical(const FCB1010 *fcb) {
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+            CHECK(preset_in_range(f, fcb_get_preset_field(&fcb->preset[p], f)));
+        }
+    }
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) CHECK(global_in_range(f, fcb_get_global_field(fcb, f)));
+
+    uint8_t dump[SYSEX_SIZE];
+    FCB1010 again;
+    CHECK(fcb_encode_sysex(fcb, dump, SYSEX_SIZE, NULL) == FCB_OK);
+    CHECK(fcb_decode_sysex(dump, SYSEX_SIZE, &again, NULL) == FCB_OK);
+    CHECK(same(fcb, &again));
+}
+
+// Dump 0 of a decoded batch against fcb, every preset and global lane;
+// returns the first field that differs, or NULL
+static const char *batch_difference(const FCBBatch *batch, const FCB1010 *fcb) {
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+            if (batch->preset[f][p * batch->stride] != fcb_get_preset_field(&fcb->preset[p], f)) {
+                return fcb_preset_fields[f].name;
+            }
+        }
+    }
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        if (batch->global[f][0] != fcb_get_global_field(fcb, f)) return fcb_global_fields[f].name;
+    }
+    return NULL;
+}
+
+static void parse_sysex_target(const uint8_t *data, size_t size) {
+    FCB1010 fcb;
+    fcb_decode_sysex(data, size, &fcb, NULL);
+}
+
+static void run_sysex(const uint8_t *data, size_t size) {
+    FCB1010 fcb;
+    FCBError error;
+    FCBStatus status = fcb_decode_sysex(data, size, &fcb, &error);
+    CHECK((status == FCB_OK) == (fcb_check_sysex(data, size, NULL) == FCB_OK));
+
+    // The lazy, batch and vector decoders agree with the full one
+    for (int p = 0; p < NUM_PRESETS; p += 33) {
+        FCB1010Preset preset;
+        FCBStatus preset_status = fcb_decode_preset(data, size, p, &preset, NULL);
+        CHECK((preset_status == FCB_OK) == (status == FCB_OK));
+        if (status == FCB_OK) CHECK(same_preset(&preset, &fcb.preset[p]));
+    }
+
+    FCB1010 globals;
+    init_fcb1010(&globals);
+    CHECK((fcb_decode_globals(data, size, &globals, NULL) == FCB_OK) == (status == FCB_OK));
+
+    const uint8_t *dumps[1] = { data };
+    FCB1010 batch;
+    FCBStatus batch_status;
+    fcb_decode_batch_structs(dumps, &size, 1, &batch, &batch_status, 1);
+    CHECK((batch_status == FCB_OK) == (status == FCB_OK));
+
+    FCBBatch columns;
+    CHECK(fcb_batch_create(&columns, 1, NULL, NULL) == FCB_OK);
+    CHECK(fcb_decode_batch(dumps, &size, 1, &columns, 1) == (status == FCB_OK ? 1u : 0u));
+    CHECK((columns.status[0] == FCB_OK) == (status == FCB_OK));
+    bool columns_same = status != FCB_OK || batch_difference(&columns, &fcb) == NULL;
+    fcb_batch_free(&columns);
+    CHECK(columns_same);
+
+    if (status != FCB_OK) return;
+
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        CHECK(fcb_get_global_field(&globals, f) == fcb_get_global_field(&fcb, f));
+    }
+    CHECK(same(&batch, &fcb));
+
+    // The decoder takes channels and calibration as they come; the
+    // encoder refuses channels past 15 and calibration past 127
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        if (!global_in_range(f, fcb_get_global_field(&fcb, f))) {
+            uint8_t dump[SYSEX_SIZE];
+            CHECK(fcb_encode_sysex(&fcb, dump, SYSEX_SIZE, NULL) == FCB_ERR_VALUE);
+            return;
+        }
+    }
+    check_canonical(&fcb);
+
+    // Overlaying what was decoded only cleans up stray high bits, and
+    // doing it again changes nothing
+    uint8_t copy[SYSEX_SIZE];
+    size_t changed;
+    FCB1010 again;
+    memcpy(copy, data, SYSEX_SIZE);
+    CHECK(fcb_overlay_sysex(&fcb, copy, SYSEX_SIZE, &changed, NULL, NULL) == FCB_OK);
+    CHECK(fcb_decode_sysex(copy, SYSEX_SIZE, &again, NULL) == FCB_OK && same(&fcb, &again));
+    CHECK(fcb_overlay_sysex(&fcb, copy, SYSEX_SIZE, &changed, NULL, NULL) == FCB_OK && changed == 0);
+}
+
+static size_t seed_sysex(uint8_t *out, size_t size, unsigned *rng) {
+    FCB1010 fcb;
+    random_fcb(&fcb, rng);
+    return size >= SYSEX_SIZE && fcb_encode_sysex(&fcb, out, size, NULL) == FCB_OK ? SYSEX_SIZE : 0;
+}
+
+static void parse_csv_target(const uint8_t *data, size_t size) {
+    FCB1010 fcb;
+    fcb_parse_csv((const char *)data, size, &fcb, NULL);
+}
+
+static void run_csv(const uint8_t *data, size_t size) {
+    FCB1010 fcb;
+    if (fcb_parse_csv((const char *)data, size, &fcb, NULL) != FCB_OK) return;
+    check_canonical(&fcb);
+
+    static char text[FCB_CSV_MAX_SIZE];
+    size_t length;
+    FCB1010 again;
+    CHECK(fcb_format_csv(&fcb, text, sizeof(text), &length, NULL) == FCB_OK);
+    CHECK(fcb_parse_csv(text, length, &again, NULL) == FCB_OK);
+    CHECK(same(&fcb, &again));
+}
+
+static size_t seed_csv(uint8_t *out, size_t size, unsigned *rng) {
+    FCB1010 fcb;
+    size_t length;
+    random_fcb(&fcb, rng);
+    return fcb_format_csv(&fcb, (char *)out, size, &length, NULL) == FCB_OK ? length : 0;
+}
+
+static void parse_ndjson_target(const uint8_t *data, size_t size) {
+    FCB1010 fcb;
+    fcb_parse_ndjson((const char *)data, size, &fcb, NULL);
+}
+
+static void run_ndjson(const uint8_t *data, size_t size) {
+    FCB1010 fcb;
+    if (fcb_parse_ndjson((const char *)data, size, &fcb, NULL) != FCB_OK) return;
+    check_canonical(&fcb);
+
+    static char text[NDJSON_SIZE];
+    size_t length;
+    FCB1010 again;
+    CHECK(fcb_format_ndjson(&fcb, NULL, text, sizeof(text), &length, NULL) == FCB_OK);
+    CHECK(fcb_parse_ndjson(text, length, &again, NULL) == FCB_OK);
+    CHECK(same(&fcb, &again));
+}
+
+static size_t seed_ndjson(uint8_t *out, size_t size, unsigned *rng) {
+    FCB1010 fcb;
+    size_t length;
+    random_fcb(&fcb, rng);
+    return fcb_format_ndjson(&fcb, "seed", (char *)out, size, &length, NULL) == FCB_OK ? length : 0;
+}
+
+static void parse_recover_target(const uint8_t *data, size_t size) {
+    uint8_t repaired[SYSEX_SIZE];
+    FCB1010 fcb;
+    fcb_recover_sysex(data, size, repaired, &fcb, NULL, NULL, NULL);
+}
+
+static void run_recover(const uint8_t *data, size_t size) {
+    uint8_t repaired[SYSEX_SIZE];
+    FCB1010 fcb;
+    FCBRecovery report;
+    if (fcb_recover_sysex(data, size, repaired, &fcb, &report, NULL, NULL) != FCB_OK) return;
+
+    for (int p = 0; p < NUM_PRESETS; p++) CHECK(report.confidence[p] <= 100);
+    CHECK(report.globals_confidence <= 100);
+
+    // The repaired dump is a dump, and it holds what was reported
+    FCB1010 decoded;
+    CHECK(fcb_decode_sysex(repaired, SYSEX_SIZE, &decoded, NULL) == FCB_OK);
+    CHECK(same(&decoded, &fcb));
+    if (report.exact) CHECK(size == SYSEX_SIZE && memcmp(data, repaired, SYSEX_SIZE) == 0);
+}
+
+// A dump with a few bytes dropped, doubled and inserted, as a flaky
+// MIDI interface delivers it
+static size_t seed_recover(uint8_t *out, size_t size, unsigned *rng) {
+    uint8_t dump[SYSEX_SIZE];
+    if (seed_sysex(dump, sizeof(dump), rng) == 0) return 0;
+
+    size_t length = 0;
+    for (size_t i = 0; i < SYSEX_SIZE && length + 2 <= size; i++) {
+        int r = rand_r(rng) % 400;
+        if (r == 0) continue;
+        if (r == 1) out[length++] = 0xF8;
+        if (r == 2) out[length++] = dump[i];
+        out[length++] = dump[i];
+    }
+    return length;
+}
+
+static void parse_variants_target(const uint8_t *data, size_t size) {
+    FCBVariantSet set;
+    if (fcb_parse_variants((const char *)data, size, &set, NULL) == FCB_OK) fcb_variants_free(&set);
+}
+
+static void run_variants(const uint8_t *data, size_t size) {
+    FCBVariantSet set;
+    if (fcb_parse_variants((const char *)data, size, &set, NULL) != FCB_OK) return;
+
+    // Every override reads back from the patched dump
+    FCB1010 base;
+    uint8_t dump[SYSEX_SIZE];
+    init_fcb1010(&base);
+    fcb_encode_sysex(&base, dump, SYSEX_SIZE, NULL);
+    for (size_t v = 0; v < set.count; v++) {
+        const FCBVariant *variant = &set.variants[v];
+        CHECK(variant->first + variant->count <= set.override_count);
+
+        uint8_t patched[SYSEX_SIZE];
+        memcpy(patched, dump, SYSEX_SIZE);
+        fcb_apply_overrides(set.overrides + variant->first, variant->count, patched, NULL);
+
+        FCB1010 fcb;
+        CHECK(fcb_decode_sysex(patched, SYSEX_SIZE, &fcb, NULL) == FCB_OK);
+        for (size_t o = variant->first; o < variant->first + variant->count; o++) {
+            const FCBOverride *override = &set.overrides[o];
+            bool overridden = false;  // A later line for the same field wins
+            for (size_t l = o + 1; l < variant->first + variant->count; l++) {
+                if (set.overrides[l].preset == override->preset && set.overrides[l].field == override->field) {
+                    overridden = true;
+                }
+            }
+            if (overridden) continue;
+
+            uint8_t value = override->preset == FCB_OVERRIDE_GLOBAL
+                                ? fcb_get_global_field(&fcb, override->field)
+                                : fcb_get_preset_field(&fcb.preset[override->preset], override->field);
+            CHECK(value == override->value);
+        }
+    }
+    fcb_variants_free(&set);
+}
+
+static size_t seed_variants(uint8_t *out, size_t size, unsigned *rng) {
+    size_t length = 0;
+    for (int v = 0; v < 4; v++) {
+        for (int line = 0; line < 3; line++) {
+            int field = rand_r(rng) % NUM_PRESET_FIELDS;
+            int n = snprintf((char *)out + length, size - length, "v%d %d-%d %s %d\n", v, rand_r(rng) % 10 + 1,
+                             rand_r(rng) % 10 + 1, fcb_preset_fields[field].name,
+                             rand_r(rng) % (fcb_preset_fields[field].is_flag ? 2 : 128));
+            if (n < 0 || (size_t)n >= size - length) return length;
+            length += n;
+        }
+    }
+    int n = snprintf((char *)out + length, size - length, "stock\nv9 global %s 3\n", fcb_global_fields[0].name);
+    return n > 0 && (size_t)n < size - length ? length + n : length;
+}
+
+const FuzzTarget fuzz_targets[] = {
+    { "sysex", run_sysex, parse_sysex_target, seed_sysex, 2 * SYSEX_SIZE },
+    { "csv", run_csv, parse_csv_target, seed_csv, FCB_CSV_MAX_SIZE },
+    { "ndjson", run_ndjson, parse_ndjson_target, seed_ndjson, 64 * 1024 },
+    { "recover", run_recover, parse_recover_target, seed_recover, 2 * SYSEX_SIZE },
+    { "variants", run_variants, parse_variants_target, seed_variants, 4096 },
+};
+
+const int fuzz_target_count = sizeof(fuzz_targets) / sizeof(fuzz_targets[0]);
+
+const FuzzTarget *fuzz_find_target(const char *name) {
+    for (int t = 0; t < fuzz_target_count; t++) {
+        if (strcmp(fuzz_targets[t].name, name) == 0) return &fuzz_targets[t];
+    }
+    return NULL;
+}
+
+static int failures;
+
+static void expect(bool condition, const char *what, unsigned seed, long run, const char *where) {
+    if (condition) return;
+    failures++;
+    fprintf(stderr, "roundtrip seed %u run %ld: %s%s%s\n", seed, run, what, where ? " at " : "", where ? where : "");
+}
+
+static void roundtrip_one(unsigned seed, long run, unsigned *rng) {
+    static char text[NDJSON_SIZE];
+    size_t length;
+    FCB1010 fcb, other, out;
+    uint8_t dump[SYSEX_SIZE], legacy[SYSEX_SIZE], patched[SYSEX_SIZE];
+
+    random_fcb(&fcb, rng);
+    random_fcb(&other, rng);
+
+    expect(fcb_encode_sysex(&fcb, dump, SYSEX_SIZE, NULL) == FCB_OK, "encode failed", seed, run, NULL);
+    expect(fcb_decode_sysex(dump, SYSEX_SIZE, &out, NULL) == FCB_OK, "decode failed", seed, run, NULL);
+    expect(same(&fcb, &out), "encode then decode differs", seed, run, first_difference(&fcb, &out, false));
+
+    expect(get_raw_sysex(&fcb, legacy) && memcmp(legacy, dump, SYSEX_SIZE) == 0, "get_raw_sysex differs", seed,
+           run, NULL);
+    expect(parse_sysex(&out, legacy, SYSEX_SIZE) && same(&fcb, &out), "parse_sysex differs", seed, run, NULL);
+
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        FCB1010Preset preset;
+        expect(fcb_decode_preset(dump, SYSEX_SIZE, p, &preset, NULL) == FCB_OK && same_preset(&preset, &fcb.preset[p]),
+               "fcb_decode_preset differs", seed, run, NULL);
+    }
+    init_fcb1010(&out);
+    fcb_decode_globals(dump, SYSEX_SIZE, &out, NULL);
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        expect(fcb_get_global_field(&out, f) == fcb_get_global_field(&fcb, f), "fcb_decode_globals differs", seed,
+               run, fcb_global_fields[f].name);
+    }
+
+    // The vector decoder, both as structs and as columns
+    const uint8_t *dumps[1] = { dump };
+    FCBStatus status;
+    fcb_decode_batch_structs(dumps, NULL, 1, &out, &status, 1);
+    expect(status == FCB_OK && same(&fcb, &out), "fcb_decode_batch_structs differs", seed, run,
+           first_difference(&fcb, &out, false));
+
+    FCBBatch batch;
+    if (fcb_batch_create(&batch, 1, NULL, NULL) == FCB_OK) {
+        fcb_decode_batch(dumps, NULL, 1, &batch, 1);
+        expect(batch_difference(&batch, &fcb) == NULL, "fcb_decode_batch differs", seed, run,
+               batch_difference(&batch, &fcb));
+
+        // A value byte with its high bit set still passes fcb_check_sysex;
+        // every decoder drops the bit
+        int p = rand_r(rng) % NUM_PRESETS;
+        int f = rand_r(rng) % NUM_PRESET_FIELDS;
+        uint8_t bit;
+        memcpy(patched, dump, SYSEX_SIZE);
+        if (!fcb_preset_fields[f].is_flag) patched[fcb_field_wire_offset(p, f, &bit)] |= 0x80;
+        patched[7] |= 0x80;
+        dumps[0] = patched;
+        fcb_decode_batch(dumps, NULL, 1, &batch, 1);
+        expect(fcb_decode_sysex(patched, SYSEX_SIZE, &out, NULL) == FCB_OK && same(&fcb, &out),
+               "high bit on a value byte differs", seed, run, first_difference(&fcb, &out, false));
+        expect(batch_difference(&batch, &fcb) == NULL, "fcb_decode_batch differs with a high bit set", seed, run,
+               batch_difference(&batch, &fcb));
+        fcb_batch_free(&batch);
+    }
+
+    // CSV keeps the presets and channels; the rest comes back as defaults
+    expect(fcb_format_csv(&fcb, text, sizeof(text), &length, NULL) == FCB_OK &&
+               fcb_parse_csv(text, length, &out, NULL) == FCB_OK,
+           "CSV round trip failed", seed, run, NULL);
+    expect(first_difference(&fcb, &out, true) == NULL, "CSV round trip differs", seed, run,
+           first_difference(&fcb, &out, true));
+
+    expect(fcb_format_ndjson(&fcb, NULL, text, sizeof(text), &length, NULL) == FCB_OK &&
+               fcb_parse_ndjson(text, length, &out, NULL) == FCB_OK,
+           "NDJSON round trip failed", seed, run, NULL);
+    expect(same(&fcb, &out), "NDJSON round trip differs", seed, run, first_difference(&fcb, &out, false));
+
+    // Overlay onto another dump: what a CSV carries comes from fcb, the
+    // rest stays as it was
+    fcb_encode_sysex(&other, patched, SYSEX_SIZE, NULL);
+    expect(fcb_overlay_sysex(&fcb, patched, SYSEX_SIZE, NULL, NULL, NULL) == FCB_OK &&
+               fcb_decode_sysex(patched, SYSEX_SIZE, &out, NULL) == FCB_OK,
+           "overlay failed", seed, run, NULL);
+    expect(first_difference(&fcb, &out, true) == NULL, "overlay differs", seed, run,
+           first_difference(&fcb, &out, true));
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        if (fcb_global_fields[f].in_csv) continue;
+        expect(fcb_get_global_field(&out, f) == fcb_get_global_field(&other, f), "overlay changed a global", seed,
+               run, fcb_global_fields[f].name);
+    }
+
+    // Single field patches, as variants and the batch set command use them
+    int p = rand_r(rng) % NUM_PRESETS;
+    int f = rand_r(rng) % NUM_PRESET_FIELDS;
+    uint8_t value = rand_r(rng) % (fcb_preset_fields[f].is_flag ? 2 : 128);
+    int g = rand_r(rng) % NUM_GLOBAL_FIELDS;
+    uint8_t global = rand_r(rng) % (fcb_global_fields[g].is_flag ? 2 : fcb_global_fields[g].in_csv ? 16 : 128);
+    memcpy(patched, dump, SYSEX_SIZE);
+    fcb_encode_preset_field(patched, p, f, value, NULL);
+    fcb_encode_global_field(patched, g, global, NULL);
+    fcb_set_preset_field(&fcb.preset[p], f, value);
+    fcb_set_global_field(&fcb, g, global);
+    expect(fcb_decode_sysex(patched, SYSEX_SIZE, &out, NULL) == FCB_OK && same(&fcb, &out), "field patch differs",
+           seed, run, first_difference(&fcb, &out, false));
+
+    // A clean capture goes through the scanner untouched
+    FCBRecovery report;
+    expect(fcb_recover_sysex(patched, SYSEX_SIZE, NULL, &out, &report, NULL, NULL) == FCB_OK && report.exact &&
+               same(&fcb, &out),
+           "recovering a clean dump differs", seed, run, NULL);
+}
+
+int fuzz_roundtrip(unsigned seed, long runs) {
+    unsigned rng = seed;
+
+    failures = 0;
+    for (long run = 0; run < runs && failures < 20; run++) roundtrip_one(seed, run, &rng);
+    return failures;
+}
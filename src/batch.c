@@ -0,0 +1,652 @@
+/*  Scripted command mode
+*   fcbtool --batch reads one command per line from stdin and answers each
+*   with one JSON object per line on stdout, so scripts and test rigs can
+*   drive the tool without ncurses. The FCB1010 being edited, the dump it
+*   was loaded from and every MIDI port a command opened stay in place
+*   between commands, so a long session pays for startup, device
+*   enumeration and parsing once. Replies are flushed as they are written;
+*   a caller can wait for each one before sending the next command.
+*
+*   Edits are patched onto the loaded dump the way csv_to_sysex() does, so
+*   saving or sending a dump that was loaded and barely touched changes
+*   only the bytes that were edited.
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "fcb.h"
+#include "midi.h"
+#include "timing.h"
+
+typedef struct {
+    char name[128];
+    int flags;
+    MidiPort *port;
+    uint8_t pending[BUFFER_SIZE];  // Read past the end of the last dump
+    size_t pending_start;
+    size_t pending_length;
+    bool broken;  // A read failed; the port is dropped after the command
+} OpenPort;
+
+typedef struct {
+    FCB1010 fcb;
+    uint8_t dump[SYSEX_SIZE];
+    bool have_dump;  // dump is the base edits are patched onto
+    OpenPort *ports[BATCH_MAX_PORTS];
+    int port_count;
+    FCBJsonWriter reply;
+    char *reply_buffer;
+    FCBArena *scratch;  // Memory for one command, reset after it
+    bool failed;     // Some command failed; sets the exit status
+} BatchState;
+
+typedef struct {
+    const char *name;
+    FCBStatus (*run)(BatchState *s, char *args, FCBError *error);
+} Command;
+
+static void print_usage() {
+    fprintf(stderr, "Usage: fcbtool --batch < commands\n");
+    fprintf(stderr, "  One command per line; each gets one JSON reply line on stdout\n");
+}
+
+// Next space separated word of *cursor, or NULL when there is none
+static char *next_word(char **cursor) {
+    char *word = *cursor + strspn(*cursor, " \t");
+    if (*word == '\0') return NULL;
+
+    char *end = word + strcspn(word, " \t");
+    *cursor = *end ? end + 1 : end;
+    *end = '\0';
+    return word;
+}
+
+// The rest of the line, for paths that may hold spaces
+static char *rest_of_line(char **cursor) {
+    char *rest = *cursor + strspn(*cursor, " \t");
+    *cursor += strlen(*cursor);
+    return *rest ? rest : NULL;
+}
+
+static bool parse_number(const char *text, unsigned max, uint8_t *value) {
+    if (text[0] < '0' || text[0] > '9') return false;
+
+    char *end;
+    unsigned long number = strtoul(text, &end, 10);
+    if (*end != '\0' || number > max) return false;
+    *value = (uint8_t)number;
+    return true;
+}
+
+static void preset_label(int preset, char *out, size_t size) {
+    snprintf(out, size, "%d-%d", preset / 10 + 1, preset % 10 + 1);
+}
+
+static void put_value(FCBJsonWriter *w, bool is_flag, uint8_t value) {
+    if (is_flag) {
+        fcb_json_bool(w, value != 0);
+    } else {
+        fcb_json_uint(w, value);
+    }
+}
+
+// A .syx also fills in dump and sets *is_dump; CSV and NDJSON only fcb
+static FCBStatus read_any(const char *path, FCB1010 *fcb, uint8_t *dump, bool *is_dump, FCBError *error) {
+    *is_dump = false;
+    if (fcb_has_suffix(path, ".csv")) return fcb_read_csv_file(path, fcb, NULL, error);
+    if (fcb_has_suffix(path, ".ndjson")) return fcb_read_ndjson_file(path, fcb, error);
+
+    FCBStatus status = fcb_read_sysex_file(path, dump, error);
+    if (status == FCB_OK) status = fcb_decode_sysex(dump, SYSEX_SIZE, fcb, error);
+    *is_dump = status == FCB_OK;
+    return status;
+}
+
+// Bring the dump up to date with the edits: patched onto the loaded one,
+// or encoded from scratch when nothing was loaded from a dump. Globals
+// the CSV does not carry are written one by one, since the overlay keeps
+// the pedal's copies of them.
+static FCBStatus build_dump(BatchState *s, FCBError *error) {
+    FCBStatus status;
+    if (s->have_dump) {
+        status = fcb_overlay_sysex(&s->fcb, s->dump, SYSEX_SIZE, NULL, NULL, error);
+    } else {
+        status = fcb_encode_sysex(&s->fcb, s->dump, SYSEX_SIZE, error);
+    }
+    if (status != FCB_OK) return status;
+
+    s->have_dump = true;
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        if (!fcb_global_fields[f].in_csv) fcb_encode_global_field(s->dump, f, fcb_get_global_field(&s->fcb, f), NULL);
+    }
+    return FCB_OK;
+}
+
+static FCBStatus save_ndjson(BatchState *s, const char *path, FCBError *error) {
+    size_t length;
+    fcb_format_ndjson(&s->fcb, NULL, NULL, 0, &length, NULL);
+
+    char *text = fcb_arena_alloc(s->scratch, length + 1);
+    if (!text) return fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory");
+
+    FCBStatus status = fcb_format_ndjson(&s->fcb, NULL, text, length + 1, &length, error);
+    if (status == FCB_OK) status = fcb_write_file(path, text, length, error);
+    return status;
+}
+
+static OpenPort *find_port(BatchState *s, const char *name, int flags, FCBError *error) {
+    for (int i = 0; i < s->port_count; i++) {
+        if (s->ports[i]->flags == flags && strcmp(s->ports[i]->name, name) == 0) return s->ports[i];
+    }
+
+    if (s->port_count == BATCH_MAX_PORTS) {
+        fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "%d ports are open already; close one first", BATCH_MAX_PORTS);
+        return NULL;
+    }
+
+    OpenPort *p = calloc(1, sizeof(OpenPort));
+    if (!p) {
+        fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory");
+        return NULL;
+    }
+
+    char message[256];
+    p->port = midi_port_open(name, flags, message, sizeof(message));
+    if (!p->port) {
+        free(p);
+        fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "%s", message);
+        return NULL;
+    }
+
+    snprintf(p->name, sizeof(p->name), "%s", name);
+    p->flags = flags;
+    s->ports[s->port_count++] = p;
+    return p;
+}
+
+// Close a port and forget it. One that failed is dropped this way so the
+// next command opens it afresh.
+static void drop_port(BatchState *s, OpenPort *p) {
+    for (int i = 0; i < s->port_count; i++) {
+        if (s->ports[i] != p) continue;
+
+        midi_port_close(p->port);
+        free(p);
+        s->ports[i] = s->ports[--s->port_count];
+        return;
+    }
+}
+
+// Collect bytes from the F0 to the next F7 into message. Anything read
+// past the F7 stays in the port for the next receive.
+static FCBStatus receive_message(OpenPort *p, uint8_t *message, size_t capacity, size_t *size, int timeout_ms,
+                                 FCBError *error) {
+    uint64_t deadline = timing_now_ns() + (uint64_t)timeout_ms * NSEC_PER_MSEC;
+    bool in_sysex = false;
+
+    *size = 0;
+    for (;;) {
+        while (p->pending_start < p->pending_length) {
+            uint8_t byte = p->pending[p->pending_start++];
+            if (byte == 0xF0) {
+                in_sysex = true;
+                *size = 0;
+            }
+            if (!in_sysex) continue;
+
+            if (*size == capacity) {
+                return fcb_set_error(error, FCB_ERR_SIZE, 0, 0, 0, "SysEx message longer than %zu bytes", capacity);
+            }
+            message[(*size)++] = byte;
+            if (byte == 0xF7) return FCB_OK;
+        }
+        p->pending_start = p->pending_length = 0;
+
+        uint64_t now = timing_now_ns();
+        if (now >= deadline) {
+            return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "No SysEx dump from %s within %d ms", p->name, timeout_ms);
+        }
+
+        struct pollfd pfds[MIDI_PORT_MAX_POLL_FDS];
+        int nfds = midi_port_poll_descriptors(p->port, pfds, MIDI_PORT_MAX_POLL_FDS);
+        int wait_ms = (int)((deadline - now + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC);
+        if (poll(pfds, nfds, wait_ms) < 0 && errno != EINTR) {
+            return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to wait for %s", p->name);
+        }
+
+        ssize_t len = midi_port_read(p->port, p->pending, sizeof(p->pending));
+        if (len < 0) {
+            p->broken = true;
+            return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Error reading MIDI input from %s", p->name);
+        }
+        p->pending_length = len;
+    }
+}
+
+// load <file.syx|file.csv|file.ndjson>
+static FCBStatus cmd_load(BatchState *s, char *args, FCBError *error) {
+    const char *path = rest_of_line(&args);
+    if (!path) return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "Usage: load <file.syx|file.csv|file.ndjson>");
+
+    FCB1010 fcb;
+    uint8_t dump[SYSEX_SIZE];
+    bool is_dump;
+    FCBStatus status = read_any(path, &fcb, dump, &is_dump, error);
+    if (status != FCB_OK) return status;
+
+    if (is_dump) {
+        memcpy(s->dump, dump, SYSEX_SIZE);
+        s->have_dump = true;
+    } else if (fcb_has_suffix(path, ".csv")) {
+        // The CSV leaves the other globals as they were
+        for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+            if (!fcb_global_fields[f].in_csv) fcb_set_global_field(&fcb, f, fcb_get_global_field(&s->fcb, f));
+        }
+    }
+    s->fcb = fcb;
+
+    fcb_json_key(&s->reply, "file");
+    fcb_json_string(&s->reply, path);
+    fcb_json_key(&s->reply, "dump");
+    fcb_json_bool(&s->reply, is_dump);
+    return FCB_OK;
+}
+
+// save <file.syx|file.csv|file.ndjson>
+static FCBStatus cmd_save(BatchState *s, char *args, FCBError *error) {
+    const char *path = rest_of_line(&args);
+    if (!path) return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "Usage: save <file.syx|file.csv|file.ndjson>");
+
+    FCBStatus status;
+    if (fcb_has_suffix(path, ".csv")) {
+        status = fcb_write_csv_file(path, &s->fcb, error);
+    } else if (fcb_has_suffix(path, ".ndjson")) {
+        status = save_ndjson(s, path, error);
+    } else {
+        status = build_dump(s, error);
+        if (status == FCB_OK) status = fcb_write_sysex_file(path, s->dump, error);
+    }
+    if (status != FCB_OK) return status;
+
+    fcb_json_key(&s->reply, "file");
+    fcb_json_string(&s->reply, path);
+    return FCB_OK;
+}
+
+// reset: back to the defaults of a new CSV, with no dump underneath
+static FCBStatus cmd_reset(BatchState *s, char *args, FCBError *error) {
+    (void)args;
+    (void)error;
+
+    init_fcb1010(&s->fcb);
+    s->have_dump = false;
+    return FCB_OK;
+}
+
+// get <bank>-<preset>|global [field]
+static FCBStatus cmd_get(BatchState *s, char *args, FCBError *error) {
+    const char *target = next_word(&args);
+    const char *name = next_word(&args);
+    if (!target || next_word(&args)) {
+        return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "Usage: get <bank>-<preset>|global [field]");
+    }
+
+    FCBJsonWriter *w = &s->reply;
+    bool global = strcmp(target, "global") == 0;
+    int preset = global ? -1 : fcb_parse_preset(target);
+    if (!global && preset < 0) return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "No preset %s", target);
+
+    int count = global ? NUM_GLOBAL_FIELDS : NUM_PRESET_FIELDS;
+    int field = -1;
+    if (name) {
+        field = global ? fcb_find_global_field(name) : fcb_find_preset_field(name);
+        if (field < 0) return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "Unknown field %s", name);
+    }
+
+    fcb_json_key(w, "target");
+    fcb_json_string(w, target);
+    fcb_json_key(w, "values");
+    fcb_json_begin_object(w);
+    for (int f = 0; f < count; f++) {
+        if (field >= 0 && f != field) continue;
+
+        if (global) {
+            fcb_json_key(w, fcb_global_fields[f].name);
+            put_value(w, fcb_global_fields[f].is_flag, fcb_get_global_field(&s->fcb, f));
+        } else {
+            fcb_json_key(w, fcb_preset_fields[f].name);
+            put_value(w, fcb_preset_fields[f].is_flag, fcb_get_preset_field(&s->fcb.preset[preset], f));
+        }
+    }
+    fcb_json_end_object(w);
+    return FCB_OK;
+}
+
+// set <bank>-<preset>|global <field> <value>. Values are checked here,
+// against the same limits the encoder has, so a bad one never gets in.
+static FCBStatus cmd_set(BatchState *s, char *args, FCBError *error) {
+    const char *target = next_word(&args);
+    const char *name = next_word(&args);
+    const char *text = next_word(&args);
+    if (!text || next_word(&args)) {
+        return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "Usage: set <bank>-<preset>|global <field> <value>");
+    }
+
+    bool global = strcmp(target, "global") == 0;
+    int preset = global ? -1 : fcb_parse_preset(target);
+    if (!global && preset < 0) return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "No preset %s", target);
+
+    int field = global ? fcb_find_global_field(name) : fcb_find_preset_field(name);
+    if (field < 0) return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "Unknown field %s", name);
+
+    bool is_flag = global ? fcb_global_fields[field].is_flag : fcb_preset_fields[field].is_flag;
+    unsigned max = is_flag ? 1 : global && fcb_global_fields[field].in_csv ? 15 : 127;
+    uint8_t value;
+    if (is_flag && (strcmp(text, "true") == 0 || strcmp(text, "false") == 0)) {
+        value = text[0] == 't';
+    } else if (!parse_number(text, max, &value)) {
+        return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "%s must be %s, not %s", name,
+                             is_flag ? "true or false" : max == 15 ? "0-15" : "0-127", text);
+    }
+
+    uint8_t old;
+    if (global) {
+        old = fcb_get_global_field(&s->fcb, field);
+        fcb_set_global_field(&s->fcb, field, value);
+    } else {
+        old = fcb_get_preset_field(&s->fcb.preset[preset], field);
+        fcb_set_preset_field(&s->fcb.preset[preset], field, value);
+    }
+
+    fcb_json_key(&s->reply, "target");
+    fcb_json_string(&s->reply, target);
+    fcb_json_key(&s->reply, "field");
+    fcb_json_string(&s->reply, name);
+    fcb_json_key(&s->reply, "old");
+    put_value(&s->reply, is_flag, old);
+    fcb_json_key(&s->reply, "new");
+    put_value(&s->reply, is_flag, value);
+    return FCB_OK;
+}
+
+static void put_change(FCBJsonWriter *w, const char *target, const char *field, bool is_flag, uint8_t old_value,
+                       uint8_t new_value) {
+    fcb_json_begin_object(w);
+    fcb_json_key(w, "target");
+    fcb_json_string(w, target);
+    fcb_json_key(w, "field");
+    fcb_json_string(w, field);
+    fcb_json_key(w, "old");
+    put_value(w, is_flag, old_value);
+    fcb_json_key(w, "new");
+    put_value(w, is_flag, new_value);
+    fcb_json_end_object(w);
+}
+
+// diff <file>: what would change if the file were loaded
+static FCBStatus cmd_diff(BatchState *s, char *args, FCBError *error) {
+    const char *path = rest_of_line(&args);
+    if (!path) return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "Usage: diff <file>");
+
+    FCB1010 other;
+    uint8_t dump[SYSEX_SIZE];
+    bool is_dump;
+    FCBStatus status = read_any(path, &other, dump, &is_dump, error);
+    if (status != FCB_OK) return status;
+
+    FCBJsonWriter *w = &s->reply;
+    unsigned count = 0;
+    fcb_json_key(w, "changes");
+    fcb_json_begin_array(w);
+
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+            uint8_t old_value = fcb_get_preset_field(&s->fcb.preset[p], f);
+            uint8_t new_value = fcb_get_preset_field(&other.preset[p], f);
+            if (old_value == new_value) continue;
+
+            char label[8];
+            preset_label(p, label, sizeof(label));
+            put_change(w, label, fcb_preset_fields[f].name, fcb_preset_fields[f].is_flag, old_value, new_value);
+            count++;
+        }
+    }
+
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        // A CSV does not say what the other globals are
+        if (!is_dump && fcb_has_suffix(path, ".csv") && !fcb_global_fields[f].in_csv) continue;
+
+        uint8_t old_value = fcb_get_global_field(&s->fcb, f);
+        uint8_t new_value = fcb_get_global_field(&other, f);
+        if (old_value == new_value) continue;
+
+        put_change(w, "global", fcb_global_fields[f].name, fcb_global_fields[f].is_flag, old_value, new_value);
+        count++;
+    }
+
+    fcb_json_end_array(w);
+    fcb_json_key(w, "count");
+    fcb_json_uint(w, count);
+    return FCB_OK;
+}
+
+// validate [file]: the current state, or a file, without loading it
+static FCBStatus cmd_validate(BatchState *s, char *args, FCBError *error) {
+    const char *path = rest_of_line(&args);
+    uint8_t dump[SYSEX_SIZE];
+
+    if (!path) return fcb_encode_sysex(&s->fcb, dump, SYSEX_SIZE, error);
+
+    FCB1010 fcb;
+    bool is_dump;
+    FCBStatus status = read_any(path, &fcb, dump, &is_dump, error);
+    if (status == FCB_OK && !is_dump) status = fcb_encode_sysex(&fcb, dump, SYSEX_SIZE, error);
+    return status;
+}
+
+// devices: the ALSA MIDI devices, in the form send and receive take
+static FCBStatus cmd_devices(BatchState *s, char *args, FCBError *error) {
+    (void)args;
+    (void)error;
+
+    char devices[MAX_DEVICES][128];
+    int count;
+    list_midi_devices(devices, &count);
+
+    fcb_json_key(&s->reply, "devices");
+    fcb_json_begin_array(&s->reply);
+    for (int i = 0; i < count; i++) fcb_json_string(&s->reply, devices[i]);
+    fcb_json_end_array(&s->reply);
+    return FCB_OK;
+}
+
+// send <port>: the current state as a dump
+static FCBStatus cmd_send(BatchState *s, char *args, FCBError *error) {
+    const char *name = rest_of_line(&args);
+    if (!name) return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "Usage: send <port>");
+
+    FCBStatus status = build_dump(s, error);
+    if (status != FCB_OK) return status;
+
+    OpenPort *p = find_port(s, name, MIDI_PORT_OUTPUT, error);
+    if (!p) return error->status;
+
+    if (!midi_port_write(p->port, s->dump, SYSEX_SIZE)) {
+        drop_port(s, p);
+        return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Error writing to %s", name);
+    }
+
+    fcb_json_key(&s->reply, "port");
+    fcb_json_string(&s->reply, name);
+    fcb_json_key(&s->reply, "bytes");
+    fcb_json_uint(&s->reply, SYSEX_SIZE);
+    return FCB_OK;
+}
+
+// receive <port> [timeout_ms]: wait for a dump and make it the state
+static FCBStatus cmd_receive(BatchState *s, char *args, FCBError *error) {
+    const char *name = next_word(&args);
+    const char *timeout = next_word(&args);
+    char *end = NULL;
+    long timeout_ms = timeout ? strtol(timeout, &end, 10) : BATCH_RECEIVE_TIMEOUT_MS;
+    if (!name || (timeout && (*end != '\0' || timeout_ms < 0 || timeout_ms > 86400000)) || next_word(&args)) {
+        return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "Usage: receive <port> [timeout_ms]");
+    }
+
+    OpenPort *p = find_port(s, name, MIDI_PORT_INPUT | MIDI_PORT_NONBLOCK, error);
+    if (!p) return error->status;
+
+    uint8_t message[SYSEX_SIZE * 2];
+    size_t size;
+    FCBStatus status = receive_message(p, message, sizeof(message), &size, (int)timeout_ms, error);
+    if (status != FCB_OK) {
+        if (p->broken) drop_port(s, p);
+        return status;
+    }
+
+    FCB1010 fcb;
+    status = fcb_decode_sysex(message, size, &fcb, error);
+    if (status != FCB_OK) return status;
+
+    memcpy(s->dump, message, SYSEX_SIZE);
+    s->have_dump = true;
+    s->fcb = fcb;
+
+    fcb_json_key(&s->reply, "port");
+    fcb_json_string(&s->reply, name);
+    fcb_json_key(&s->reply, "bytes");
+    fcb_json_uint(&s->reply, size);
+    return FCB_OK;
+}
+
+// close [port]: one port, in both directions, or all of them
+static FCBStatus cmd_close(BatchState *s, char *args, FCBError *error) {
+    const char *name = rest_of_line(&args);
+    unsigned closed = 0;
+
+    for (int i = s->port_count - 1; i >= 0; i--) {
+        if (name && strcmp(s->ports[i]->name, name) != 0) continue;
+        drop_port(s, s->ports[i]);
+        closed++;
+    }
+    if (name && closed == 0) return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "%s is not open", name);
+
+    fcb_json_key(&s->reply, "closed");
+    fcb_json_uint(&s->reply, closed);
+    return FCB_OK;
+}
+
+static const Command commands[] = {
+    { "load", cmd_load },
+    { "save", cmd_save },
+    { "reset", cmd_reset },
+    { "get", cmd_get },
+    { "set", cmd_set },
+    { "diff", cmd_diff },
+    { "validate", cmd_validate },
+    { "devices", cmd_devices },
+    { "send", cmd_send },
+    { "receive", cmd_receive },
+    { "close", cmd_close },
+    { "quit", NULL }
+};
+
+static void write_error(BatchState *s, const char *command, const FCBError *error) {
+    FCBJsonWriter *w = &s->reply;
+
+    fcb_json_writer_init(w, s->reply_buffer, BATCH_REPLY_SIZE);
+    fcb_json_begin_object(w);
+    fcb_json_key(w, "ok");
+    fcb_json_bool(w, false);
+    fcb_json_key(w, "command");
+    fcb_json_string(w, command);
+    fcb_json_key(w, "error");
+    fcb_json_string(w, error->message);
+    if (error->line > 0) {
+        fcb_json_key(w, "line");
+        fcb_json_uint(w, error->line);
+    }
+    if (error->column > 0) {
+        fcb_json_key(w, "column");
+        fcb_json_uint(w, error->column);
+    }
+    fcb_json_end_object(w);
+}
+
+// Run one input line; false once the session should end
+static bool run_line(BatchState *s, char *line) {
+    line[strcspn(line, "\r\n")] = '\0';
+    char *cursor = line;
+    const char *name = next_word(&cursor);
+    if (!name || name[0] == '#') return true;
+
+    const Command *command = NULL;
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strcmp(commands[i].name, name) == 0) command = &commands[i];
+    }
+
+    FCBJsonWriter *w = &s->reply;
+    fcb_json_writer_init(w, s->reply_buffer, BATCH_REPLY_SIZE);
+    fcb_json_begin_object(w);
+    fcb_json_key(w, "ok");
+    fcb_json_bool(w, true);
+    fcb_json_key(w, "command");
+    fcb_json_string(w, name);
+
+    FCBError error = { .status = FCB_OK };
+    FCBStatus status;
+    if (!command) {
+        status = fcb_set_error(&error, FCB_ERR_VALUE, 0, 0, 0, "Unknown command %s", name);
+    } else {
+        status = command->run ? command->run(s, cursor, &error) : FCB_OK;
+    }
+    fcb_json_end_object(w);
+    fcb_arena_reset(s->scratch);
+
+    if (status == FCB_OK && w->length + 1 > BATCH_REPLY_SIZE) {
+        status = fcb_set_error(&error, FCB_ERR_SIZE, 0, 0, 0, "Reply is larger than %d bytes", BATCH_REPLY_SIZE);
+    }
+    if (status != FCB_OK) {
+        write_error(s, name, &error);
+        s->failed = true;
+    }
+
+    fcb_json_end_line(w);
+    fwrite(s->reply_buffer, 1, w->length, stdout);
+    fflush(stdout);
+    return !command || command->run;
+}
+
+int batch_main(int argc, char *argv[]) {
+    (void)argv;
+
+    if (argc > 2) {
+        print_usage();
+        return 1;
+    }
+
+    static BatchState state;
+    init_fcb1010(&state.fcb);
+    state.reply_buffer = malloc(BATCH_REPLY_SIZE);
+    if (!state.reply_buffer || fcb_arena_create(&state.scratch, BATCH_SCRATCH_SIZE, NULL) != FCB_OK) {
+        fprintf(stderr, "Out of memory\n");
+        free(state.reply_buffer);
+        return 1;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, stdin) >= 0) {
+        if (!run_line(&state, line)) break;
+    }
+
+    while (state.port_count > 0) drop_port(&state, state.ports[0]);
+    free(line);
+    free(state.reply_buffer);
+    fcb_arena_free(state.scratch);
+    return state.failed ? 1 : 0;
+}
@@ -0,0 +1,18 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// MIDI ports a session can hold open at once
+#define BATCH_MAX_PORTS 8
+
+// How long receive waits for a dump unless told otherwise
+#define BATCH_RECEIVE_TIMEOUT_MS 30000
+
+// One reply line; a diff of every field of two dumps fits
+#define BATCH_REPLY_SIZE (512 * 1024)
+
+// Starting size of the per-command arena; an NDJSON dump fits
+#define BATCH_SCRATCH_SIZE (64 * 1024)
+
+int batch_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,547 @@
+/*  FCB1010 emulator
+*   fcbtool --emulate stands in for the pedal, so sending and receiving
+*   dumps can be tried and timed on a machine with none attached. The
+*   endpoint is a pty linked at a path of choice, an ALSA virtual port, or
+*   stdin/stdout. What arrives goes into a bounded buffer that the pedal
+*   drains at wire speed; bytes that find it full are dropped, so a host
+*   sending faster than the wire shows up as a rejected dump, just as it
+*   would on the real unit. A complete dump is stored, a dump request is
+*   answered with it, and pressing a preset sends its program and control
+*   changes. Replies leave at wire speed as well.
+*/
+
+#define _GNU_SOURCE  // posix_openpt(), ptsname(), cfmakeraw()
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#include "emulator.h"
+#include "event_loop.h"
+#include "fcb.h"
+#include "midi.h"
+#include "playback.h"
+#include "timing.h"
+
+#define EMULATOR_TICK_NS NSEC_PER_MSEC
+#define OUTPUT_SIZE (SYSEX_SIZE + 64 * PLAYBACK_MAX_MESSAGE)
+#define SYSEX_TIMEOUT_NS (500 * NSEC_PER_MSEC)  // A SysEx message that stalls this long is given up
+#define GAP 0x100  // Bytes were dropped right after this one
+
+// The real pedal only sends its dump from the front panel. Here the dump
+// header closed straight away asks for it.
+static const uint8_t dump_request[] = { 0xF0, 0x00, 0x20, 0x32, 0x01, 0x0C, 0x0F, 0xF7 };
+
+// Bytes waiting for the wire, oldest first
+typedef struct {
+    uint16_t *data;
+    size_t capacity;
+    size_t start;
+    size_t count;
+    size_t peak;
+    uint64_t clock_ns;  // When the wire finished the last byte taken
+} Wire;
+
+typedef struct {
+    EventLoop *loop;
+    MidiPort *input;
+    MidiPort *output;  // The same port as input unless the endpoint is "-"
+    FILE *report;
+    const char *link;
+    const char *save_filename;
+    uint32_t rate;
+    Wire in;
+    Wire out;
+    bool closing;  // Input ended; stop once both wires are empty
+
+    uint8_t message[SYSEX_SIZE];
+    size_t message_size;
+    bool in_sysex;
+    bool damaged;
+    uint64_t message_start_ns;
+    uint64_t last_byte_ns;
+
+    uint8_t dump[SYSEX_SIZE];
+    FCB1010 fcb;
+
+    char command[256];
+    size_t command_length;
+
+    uint64_t bytes_in;
+    uint64_t dropped;
+    uint64_t bytes_out;
+    unsigned dumps;
+    unsigned rejected;
+    unsigned requests;
+    unsigned presses;
+} Emulator;
+
+static bool wire_init(Wire *w, size_t capacity) {
+    w->data = malloc(capacity * sizeof(uint16_t));
+    w->capacity = capacity;
+    return w->data != NULL;
+}
+
+static uint16_t *wire_at(Wire *w, size_t i) {
+    return &w->data[(w->start + i) % w->capacity];
+}
+
+static bool wire_push(Wire *w, uint8_t byte) {
+    if (w->count == w->capacity) {
+        if (w->count > 0) *wire_at(w, w->count - 1) |= GAP;
+        return false;
+    }
+
+    *wire_at(w, w->count++) = byte;
+    if (w->count > w->peak) w->peak = w->count;
+    return true;
+}
+
+// How many waiting bytes the wire has carried by now. Idle time is not
+// banked, so a burst after a pause still goes at wire speed.
+static size_t wire_due(Wire *w, uint32_t rate, uint64_t now) {
+    if (w->count == 0) {
+        w->clock_ns = now;
+        return 0;
+    }
+    if (rate == 0) return w->count;
+
+    size_t due = (now - w->clock_ns) * rate / NSEC_PER_SEC;
+    if (due > w->count) due = w->count;
+    w->clock_ns += due * NSEC_PER_SEC / rate;
+    return due;
+}
+
+static uint16_t wire_take(Wire *w) {
+    uint16_t entry = w->data[w->start];
+    w->start = (w->start + 1) % w->capacity;
+    w->count--;
+    return entry;
+}
+
+static void print_bytes(FILE *out, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) fprintf(out, " %02X", data[i]);
+    fprintf(out, "\n");
+}
+
+static void drain_output(Emulator *e, uint64_t now) {
+    size_t due = wire_due(&e->out, e->rate, now);
+    uint8_t bytes[BUFFER_SIZE];
+
+    while (due > 0) {
+        size_t n = due < sizeof(bytes) ? due : sizeof(bytes);
+        for (size_t i = 0; i < n; i++) bytes[i] = *wire_at(&e->out, i) & 0xFF;
+
+        ssize_t written = midi_port_write_some(e->output, bytes, n);
+        if (written < 0) {
+            fprintf(stderr, "Error writing MIDI output\n");
+            event_loop_stop(e->loop);
+            return;
+        }
+        // Whatever the host is not reading yet waits here, behind the wire
+        for (ssize_t i = 0; i < written; i++) wire_take(&e->out);
+        e->bytes_out += written;
+        due -= written;
+        if ((size_t)written < n) {
+            e->out.clock_ns = now;
+            return;
+        }
+    }
+}
+
+// All of a message goes out or none of it
+static bool send_message(Emulator *e, const uint8_t *data, size_t size) {
+    drain_output(e, timing_now_ns());
+    if (e->out.capacity - e->out.count < size) return false;
+
+    for (size_t i = 0; i < size; i++) wire_push(&e->out, data[i]);
+    return true;
+}
+
+static void send_dump(Emulator *e, const char *why) {
+    if (send_message(e, e->dump, SYSEX_SIZE)) {
+        fprintf(e->report, "Sending the dump (%s)\n", why);
+    } else {
+        fprintf(e->report, "Output busy; dump not sent\n");
+    }
+}
+
+static void store_dump(Emulator *e, uint64_t now) {
+    FCB1010 fcb;
+    FCBError error;
+    if (fcb_decode_sysex(e->message, SYSEX_SIZE, &fcb, &error) != FCB_OK) {
+        e->rejected++;
+        fprintf(e->report, "Dump rejected: %s\n", error.message);
+        return;
+    }
+
+    memcpy(e->dump, e->message, SYSEX_SIZE);
+    e->fcb = fcb;
+    e->dumps++;
+
+    double seconds = (now - e->message_start_ns) / 1e9;
+    fprintf(e->report, "Dump stored: %d bytes in %.3f s", SYSEX_SIZE, seconds);
+    if (seconds > 0) fprintf(e->report, " (%.0f bytes/s)", SYSEX_SIZE / seconds);
+    fprintf(e->report, "\n");
+
+    if (e->save_filename && fcb_write_sysex_file(e->save_filename, e->dump, &error) != FCB_OK) {
+        fprintf(stderr, "%s\n", error.message);
+    }
+}
+
+static void end_message(Emulator *e, uint64_t now) {
+    size_t size = e->message_size;
+
+    if (e->damaged) {
+        e->rejected++;
+        fprintf(e->report, "Message rejected: input overrun, %zu bytes arrived%s\n", size,
+                size <= SYSEX_SIZE ? "" : " (too many for a dump)");
+    } else if (size == sizeof(dump_request) && memcmp(e->message, dump_request, size) == 0) {
+        e->requests++;
+        send_dump(e, "requested");
+    } else if (size == SYSEX_SIZE) {
+        store_dump(e, now);
+    } else {
+        e->rejected++;
+        fprintf(e->report, "Ignored a SysEx message of %zu bytes\n", size);
+    }
+}
+
+// A message that never got its F7, most often because it was dropped
+static void abandon_message(Emulator *e, const char *why) {
+    e->in_sysex = false;
+    e->rejected++;
+    fprintf(e->report, "Message rejected: %s after %zu bytes%s\n", why, e->message_size,
+            e->damaged ? ", input overrun" : "");
+}
+
+// The pedal's side of the input buffer: one byte as it comes off the wire
+static void pedal_byte(Emulator *e, uint16_t entry, uint64_t now) {
+    uint8_t byte = entry & 0xFF;
+
+    if (byte >= 0xF8) return;  // Real time messages can come between any bytes
+    e->last_byte_ns = now;
+    if (byte == 0xF0) {
+        if (e->in_sysex) abandon_message(e, "no F7");
+        e->in_sysex = true;
+        e->damaged = false;
+        e->message_size = 0;
+        e->message_start_ns = now;
+    } else if (!e->in_sysex) {
+        return;  // Channel messages are not for the pedal
+    } else if (byte & 0x80 && byte != 0xF7) {
+        abandon_message(e, "cut short by a status byte");
+        return;
+    }
+
+    if (e->message_size < sizeof(e->message)) e->message[e->message_size] = byte;
+    e->message_size++;
+    if (entry & GAP) e->damaged = true;
+
+    if (byte == 0xF7) {
+        e->in_sysex = false;
+        end_message(e, now);
+    }
+}
+
+static void drain_input(Emulator *e, uint64_t now) {
+    for (size_t due = wire_due(&e->in, e->rate, now); due > 0; due--) {
+        pedal_byte(e, wire_take(&e->in), now);
+    }
+}
+
+static void tick(EventLoop *loop, int timer_id, void *user_data) {
+    (void)timer_id;
+
+    Emulator *e = user_data;
+    uint64_t now = timing_now_ns();
+    drain_input(e, now);
+    drain_output(e, now);
+
+    if (e->in_sysex && e->in.count == 0 && now - e->last_byte_ns > SYSEX_TIMEOUT_NS) {
+        abandon_message(e, "timed out");
+    }
+    if (e->closing && e->in.count == 0 && e->out.count == 0) {
+        if (e->in_sysex) abandon_message(e, "input ended");
+        event_loop_stop(loop);
+    }
+}
+
+static void input_readable(EventLoop *loop, int fd, short revents, void *user_data) {
+    (void)revents;
+
+    Emulator *e = user_data;
+    uint8_t buffer[BUFFER_SIZE];
+    ssize_t len;
+
+    for (;;) {
+        // Make room for what the wire has carried away since the last read
+        drain_input(e, timing_now_ns());
+
+        len = midi_port_read(e->input, buffer, sizeof(buffer));
+        if (len <= 0) break;
+
+        e->bytes_in += len;
+        for (ssize_t i = 0; i < len; i++) {
+            // With no rate limit the pedal keeps up with anything
+            if (e->rate == 0 && e->in.count == e->in.capacity) drain_input(e, timing_now_ns());
+            if (!wire_push(&e->in, buffer[i])) e->dropped++;
+        }
+    }
+
+    if (len < 0) {
+        event_loop_remove_fd(loop, fd);
+        e->closing = true;
+    }
+}
+
+static void print_status(Emulator *e) {
+    fprintf(e->report, "In: %llu bytes, %llu dropped, buffer peak %zu of %zu. ", (unsigned long long)e->bytes_in,
+            (unsigned long long)e->dropped, e->in.peak, e->in.capacity);
+    fprintf(e->report, "Dumps: %u stored, %u rejected, %u requests. Out: %u presses, %llu bytes\n", e->dumps,
+            e->rejected, e->requests, e->presses, (unsigned long long)e->bytes_out);
+}
+
+static void press(Emulator *e, int preset) {
+    uint8_t bytes[PLAYBACK_MAX_MESSAGE];
+    size_t size = playback_resolve_preset(&e->fcb, preset, bytes);
+
+    if (!send_message(e, bytes, size)) {
+        fprintf(e->report, "Output busy; preset %d-%d not sent\n", preset / 10 + 1, preset % 10 + 1);
+        return;
+    }
+
+    e->presses++;
+    fprintf(e->report, "Preset %d-%d:", preset / 10 + 1, preset % 10 + 1);
+    print_bytes(e->report, bytes, size);
+}
+
+// press <bank>-<preset> | dump | status | quit
+static void run_command(Emulator *e, char *line) {
+    char *word = strtok(line, " \t\r");
+    char *arg = strtok(NULL, " \t\r");
+    int bank, preset;
+    char extra;
+
+    if (!word) return;
+
+    if (strcmp(word, "press") == 0 && arg && sscanf(arg, "%d-%d%c", &bank, &preset, &extra) == 2 &&
+        bank >= 1 && bank <= 10 && preset >= 1 && preset <= 10) {
+        press(e, (bank - 1) * 10 + preset - 1);
+    } else if (strcmp(word, "dump") == 0 && !arg) {
+        send_dump(e, "front panel");
+    } else if (strcmp(word, "status") == 0 && !arg) {
+        print_status(e);
+    } else if (strcmp(word, "quit") == 0 && !arg) {
+        event_loop_stop(e->loop);
+    } else {
+        fprintf(e->report, "Commands: press <bank>-<preset>, dump, status, quit\n");
+    }
+}
+
+static void stdin_readable(EventLoop *loop, int fd, short revents, void *user_data) {
+    (void)revents;
+
+    Emulator *e = user_data;
+    char buffer[BUFFER_SIZE];
+    ssize_t len = read(fd, buffer, sizeof(buffer));
+    if (len < 0 && errno == EINTR) return;
+    if (len <= 0) {
+        event_loop_remove_fd(loop, fd);  // Keep emulating until a signal
+        return;
+    }
+
+    for (ssize_t i = 0; i < len; i++) {
+        if (buffer[i] != '\n') {
+            if (e->command_length + 1 < sizeof(e->command)) e->command[e->command_length++] = buffer[i];
+            continue;
+        }
+        e->command[e->command_length] = '\0';
+        e->command_length = 0;
+        run_command(e, e->command);
+    }
+}
+
+static void signal_readable(EventLoop *loop, int fd, short revents, void *user_data) {
+    (void)revents;
+    (void)user_data;
+
+    struct signalfd_siginfo info;
+    if (read(fd, &info, sizeof(info)) == sizeof(info)) event_loop_stop(loop);
+}
+
+// A raw pty whose slave end is linked at path for hosts to open like a
+// device. One slave descriptor stays open here, or the master would fail
+// each time the last host closes it. Returns the master or -1.
+static int open_pty(const char *link, int *slave, char *error, size_t error_size) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    const char *name = master >= 0 && grantpt(master) == 0 && unlockpt(master) == 0 ? ptsname(master) : NULL;
+    *slave = name ? open(name, O_RDWR | O_NOCTTY | O_CLOEXEC) : -1;
+
+    struct termios termios;
+    if (*slave < 0 || tcgetattr(*slave, &termios) != 0) {
+        snprintf(error, error_size, "Failed to create a pty: %s", strerror(errno));
+        if (master >= 0) close(master);
+        if (*slave >= 0) close(*slave);
+        return -1;
+    }
+    cfmakeraw(&termios);
+    tcsetattr(*slave, TCSANOW, &termios);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+
+    // Only a link left by an earlier run is replaced
+    struct stat st;
+    if (lstat(link, &st) == 0 && S_ISLNK(st.st_mode)) unlink(link);
+    if (symlink(name, link) != 0) {
+        snprintf(error, error_size, "Failed to link %s to %s: %s", link, name, strerror(errno));
+        close(master);
+        close(*slave);
+        return -1;
+    }
+
+    return master;
+}
+
+static bool open_endpoint(Emulator *e, const char *name, int *slave, char *error, size_t error_size) {
+    *slave = -1;
+
+    if (strcmp(name, "-") == 0) {
+        e->input = midi_port_open(name, MIDI_PORT_INPUT, error, error_size);
+        e->output = e->input ? midi_port_open(name, MIDI_PORT_OUTPUT, error, error_size) : NULL;
+    } else if (strcmp(name, "virtual") == 0) {
+        e->input = e->output =
+            midi_port_open(name, MIDI_PORT_INPUT | MIDI_PORT_OUTPUT | MIDI_PORT_NONBLOCK, error, error_size);
+    } else {
+        int master = open_pty(name, slave, error, error_size);
+        if (master < 0) return false;
+
+        e->input = e->output = midi_port_adopt_fd(master, error, error_size);
+        if (!e->input) {
+            // Nothing else cleans up after a failed start
+            close(master);
+            close(*slave);
+            *slave = -1;
+            unlink(name);
+            return false;
+        }
+        e->link = name;
+    }
+
+    if (e->input && e->output) return true;
+    midi_port_close(e->input);
+    return false;
+}
+
+static void print_usage() {
+    fprintf(stderr, "Usage: fcbtool --emulate <link|virtual|-> [--dump <file.syx>] [--save <file.syx>]\n");
+    fprintf(stderr, "                [--rate <bytes/s>|wire|max] [--buffer <bytes>]\n");
+}
+
+int emulator_main(int argc, char *argv[]) {
+    static Emulator e;
+    const char *endpoint = NULL;
+    const char *dump_filename = NULL;
+    long buffer = EMULATOR_BUFFER;
+
+    e.rate = MIDI_WIRE_RATE;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dump_filename = argv[++i];
+        } else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+            e.save_filename = argv[++i];
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            if (!midi_parse_rate(argv[++i], &e.rate)) {
+                fprintf(stderr, "Invalid rate: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--buffer") == 0 && i + 1 < argc) {
+            buffer = strtol(argv[++i], NULL, 10);
+        } else if (!endpoint) {
+            endpoint = argv[i];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (!endpoint || buffer < 1 || buffer > EMULATOR_MAX_BUFFER) {
+        print_usage();
+        return 1;
+    }
+
+    // Without a dump the pedal starts out factory fresh
+    FCBError fcb_error;
+    if (dump_filename) {
+        if (fcb_read_sysex_file(dump_filename, e.dump, &fcb_error) != FCB_OK ||
+            fcb_decode_sysex(e.dump, SYSEX_SIZE, &e.fcb, &fcb_error) != FCB_OK) {
+            fprintf(stderr, "%s: %s\n", dump_filename, fcb_error.message);
+            return 1;
+        }
+    } else {
+        init_fcb1010(&e.fcb);
+        fcb_encode_sysex(&e.fcb, e.dump, SYSEX_SIZE, NULL);
+    }
+
+    e.report = strcmp(endpoint, "-") == 0 ? stderr : stdout;
+    setvbuf(e.report, NULL, _IOLBF, 0);  // Events show up as they happen, even through a pipe
+    e.loop = event_loop_create();
+    if (!e.loop || !wire_init(&e.in, buffer) || !wire_init(&e.out, OUTPUT_SIZE)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    char error[256];
+    int slave;
+    if (!open_endpoint(&e, endpoint, &slave, error, sizeof(error))) {
+        fprintf(stderr, "%s\n", error);
+        event_loop_destroy(e.loop);
+        return 1;
+    }
+
+    // SIGINT/SIGTERM arrive through the event loop for a clean shutdown
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    struct pollfd pfds[MIDI_PORT_MAX_POLL_FDS];
+    int nfds = midi_port_poll_descriptors(e.input, pfds, MIDI_PORT_MAX_POLL_FDS);
+    bool ok = signal_fd >= 0 && event_loop_add_fd(e.loop, signal_fd, POLLIN, signal_readable, &e) &&
+              event_loop_add_timer(e.loop, EMULATOR_TICK_NS, true, tick, &e) != 0;
+    for (int i = 0; ok && i < nfds; i++) {
+        ok = event_loop_add_fd(e.loop, pfds[i].fd, POLLIN, input_readable, &e);
+    }
+    if (ok && strcmp(endpoint, "-") != 0) ok = event_loop_add_fd(e.loop, STDIN_FILENO, POLLIN, stdin_readable, &e);
+
+    if (ok) {
+        fprintf(e.report, "Emulating an FCB1010 on %s with a %ld byte buffer, ", endpoint, buffer);
+        if (e.rate > 0) {
+            fprintf(e.report, "%u bytes/s each way\n", e.rate);
+        } else {
+            fprintf(e.report, "no rate limit\n");
+        }
+        event_loop_run(e.loop);
+        print_status(&e);
+    } else {
+        fprintf(stderr, "Failed to set up the event loop\n");
+    }
+
+    midi_port_close(e.input);
+    if (e.output != e.input) midi_port_close(e.output);
+    if (slave >= 0) close(slave);
+    if (e.link) unlink(e.link);
+    if (signal_fd >= 0) close(signal_fd);
+    event_loop_destroy(e.loop);
+    free(e.in.data);
+    free(e.out.data);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,11 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+// Input the emulated pedal holds before it starts dropping bytes; a host
+// that sends faster than the wire fills it within a fraction of a dump
+#define EMULATOR_BUFFER 256
+#define EMULATOR_MAX_BUFFER 65536
+
+int emulator_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,257 @@
+/*  Single threaded event loop
+*   Multiplexes file descriptors (stdin, MIDI ports), monotonic timers
+*   and inotify watches through one ppoll() call so nothing the UI does
+*   ever blocks on I/O. Callbacks may add or remove entries, including
+*   their own, while the loop is dispatching.
+*/
+
+#define _GNU_SOURCE  // ppoll()
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+#include "event_loop.h"
+#include "timing.h"
+
+typedef struct {
+    int fd;  // -1 when the slot is free
+    short events;
+    EventFdCallback callback;
+    void *user_data;
+} FdEntry;
+
+typedef struct {
+    int id;  // 0 when the slot is free
+    uint64_t deadline_ns;
+    uint64_t interval_ns;
+    bool repeat;
+    EventTimerCallback callback;
+    void *user_data;
+} TimerEntry;
+
+typedef struct {
+    int wd;  // -1 when the slot is free
+    EventWatchCallback callback;
+    void *user_data;
+} WatchEntry;
+
+struct EventLoop {
+    FdEntry fds[EVENT_LOOP_MAX_FDS];
+    TimerEntry timers[EVENT_LOOP_MAX_TIMERS];
+    WatchEntry watches[EVENT_LOOP_MAX_WATCHES];
+    int next_timer_id;
+    int inotify_fd;
+    bool running;
+};
+
+EventLoop *event_loop_create() {
+    EventLoop *loop = calloc(1, sizeof(EventLoop));
+    if (!loop) return NULL;
+
+    for (int i = 0; i < EVENT_LOOP_MAX_FDS; i++) loop->fds[i].fd = -1;
+    for (int i = 0; i < EVENT_LOOP_MAX_WATCHES; i++) loop->watches[i].wd = -1;
+    loop->next_timer_id = 1;
+    loop->inotify_fd = -1;
+
+    return loop;
+}
+
+void event_loop_destroy(EventLoop *loop) {
+    if (!loop) return;
+    if (loop->inotify_fd >= 0) close(loop->inotify_fd);
+    free(loop);
+}
+
+bool event_loop_add_fd(EventLoop *loop, int fd, short events, EventFdCallback callback, void *user_data) {
+    for (int i = 0; i < EVENT_LOOP_MAX_FDS; i++) {
+        if (loop->fds[i].fd < 0) {
+            loop->fds[i].fd = fd;
+            loop->fds[i].events = events;
+            loop->fds[i].callback = callback;
+            loop->fds[i].user_data = user_data;
+            return true;
+        }
+    }
+    return false;
+}
+
+void event_loop_remove_fd(EventLoop *loop, int fd) {
+    for (int i = 0; i < EVENT_LOOP_MAX_FDS; i++) {
+        if (loop->fds[i].fd == fd) loop->fds[i].fd = -1;
+    }
+}
+
+int event_loop_add_timer(EventLoop *loop, uint64_t interval_ns, bool repeat,
+                         EventTimerCallback callback, void *user_data) {
+    for (int i = 0; i < EVENT_LOOP_MAX_TIMERS; i++) {
+        TimerEntry *t = &loop->timers[i];
+        if (t->id == 0) {
+            t->id = loop->next_timer_id++;
+            if (loop->next_timer_id == INT_MAX) loop->next_timer_id = 1;
+            t->deadline_ns = timing_now_ns() + interval_ns;
+            t->interval_ns = interval_ns;
+            t->repeat = repeat;
+            t->callback = callback;
+            t->user_data = user_data;
+            return t->id;
+        }
+    }
+    return 0;
+}
+
+void event_loop_remove_timer(EventLoop *loop, int timer_id) {
+    if (timer_id == 0) return;
+    for (int i = 0; i < EVENT_LOOP_MAX_TIMERS; i++) {
+        if (loop->timers[i].id == timer_id) loop->timers[i].id = 0;
+    }
+}
+
+static void dispatch_inotify(EventLoop *loop, int fd, short revents, void *user_data) {
+    (void)revents;
+    (void)user_data;
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char *ptr = buffer; ptr < buffer + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+
+            for (int i = 0; i < EVENT_LOOP_MAX_WATCHES; i++) {
+                WatchEntry *w = &loop->watches[i];
+                if (w->wd == event->wd) {
+                    w->callback(loop, event->len ? event->name : "", event->mask, w->user_data);
+                    break;
+                }
+            }
+
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+// Watch a file or directory; returns an id > 0, or -1 on failure
+int event_loop_add_watch(EventLoop *loop, const char *path, uint32_t mask,
+                         EventWatchCallback callback, void *user_data) {
+    if (loop->inotify_fd < 0) {
+        loop->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (loop->inotify_fd < 0) return -1;
+
+        if (!event_loop_add_fd(loop, loop->inotify_fd, POLLIN, dispatch_inotify, NULL)) {
+            close(loop->inotify_fd);
+            loop->inotify_fd = -1;
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < EVENT_LOOP_MAX_WATCHES; i++) {
+        WatchEntry *w = &loop->watches[i];
+        if (w->wd < 0) {
+            int wd = inotify_add_watch(loop->inotify_fd, path, mask);
+            if (wd < 0) return -1;
+
+            w->wd = wd;
+            w->callback = callback;
+            w->user_data = user_data;
+            return wd;
+        }
+    }
+
+    return -1;
+}
+
+void event_loop_remove_watch(EventLoop *loop, int watch_id) {
+    for (int i = 0; i < EVENT_LOOP_MAX_WATCHES; i++) {
+        if (loop->watches[i].wd == watch_id && watch_id >= 0) {
+            inotify_rm_watch(loop->inotify_fd, watch_id);
+            loop->watches[i].wd = -1;
+        }
+    }
+}
+
+static void run_timers(EventLoop *loop) {
+    uint64_t now_ns = timing_now_ns();
+
+    for (int i = 0; i < EVENT_LOOP_MAX_TIMERS; i++) {
+        TimerEntry *t = &loop->timers[i];
+        if (t->id == 0 || t->deadline_ns > now_ns) continue;
+
+        int id = t->id;
+        if (t->repeat) {
+            // Skip ticks that were missed rather than firing a burst
+            do {
+                t->deadline_ns += t->interval_ns;
+            } while (t->deadline_ns <= now_ns && t->interval_ns > 0);
+        } else {
+            t->id = 0;
+        }
+
+        t->callback(loop, id, t->user_data);
+    }
+}
+
+static bool next_timeout(EventLoop *loop, struct timespec *timeout) {
+    uint64_t earliest = UINT64_MAX;
+
+    for (int i = 0; i < EVENT_LOOP_MAX_TIMERS; i++) {
+        if (loop->timers[i].id != 0 && loop->timers[i].deadline_ns < earliest) {
+            earliest = loop->timers[i].deadline_ns;
+        }
+    }
+
+    if (earliest == UINT64_MAX) return false;
+
+    uint64_t now_ns = timing_now_ns();
+    uint64_t wait_ns = earliest > now_ns ? earliest - now_ns : 0;
+    timeout->tv_sec = wait_ns / NSEC_PER_SEC;
+    timeout->tv_nsec = wait_ns % NSEC_PER_SEC;
+    return true;
+}
+
+void event_loop_run(EventLoop *loop) {
+    struct pollfd pfds[EVENT_LOOP_MAX_FDS];
+    int slots[EVENT_LOOP_MAX_FDS];
+
+    loop->running = true;
+
+    while (loop->running) {
+        int count = 0;
+        for (int i = 0; i < EVENT_LOOP_MAX_FDS; i++) {
+            if (loop->fds[i].fd >= 0) {
+                pfds[count].fd = loop->fds[i].fd;
+                pfds[count].events = loop->fds[i].events;
+                pfds[count].revents = 0;
+                slots[count] = i;
+                count++;
+            }
+        }
+
+        struct timespec timeout;
+        bool has_timeout = next_timeout(loop, &timeout);
+
+        int ready = ppoll(pfds, count, has_timeout ? &timeout : NULL, NULL);
+        if (ready < 0 && errno != EINTR) break;
+
+        for (int i = 0; i < count && ready > 0; i++) {
+            if (pfds[i].revents == 0) continue;
+
+            // The callback of an earlier entry may have removed this one
+            FdEntry *entry = &loop->fds[slots[i]];
+            if (entry->fd != pfds[i].fd) continue;
+
+            entry->callback(loop, pfds[i].fd, pfds[i].revents, entry->user_data);
+            if (!loop->running) break;
+        }
+
+        run_timers(loop);
+    }
+}
+
+void event_loop_stop(EventLoop *loop) {
+    loop->running = false;
+}
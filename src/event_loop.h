@@ -0,0 +1,34 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EVENT_LOOP_MAX_FDS 32
+#define EVENT_LOOP_MAX_TIMERS 16
+#define EVENT_LOOP_MAX_WATCHES 16
+
+typedef struct EventLoop EventLoop;
+
+typedef void (*EventFdCallback)(EventLoop *loop, int fd, short revents, void *user_data);
+typedef void (*EventTimerCallback)(EventLoop *loop, int timer_id, void *user_data);
+typedef void (*EventWatchCallback)(EventLoop *loop, const char *name, uint32_t mask, void *user_data);
+
+EventLoop *event_loop_create();
+void event_loop_destroy(EventLoop *loop);
+
+bool event_loop_add_fd(EventLoop *loop, int fd, short events, EventFdCallback callback, void *user_data);
+void event_loop_remove_fd(EventLoop *loop, int fd);
+
+int event_loop_add_timer(EventLoop *loop, uint64_t interval_ns, bool repeat,
+                         EventTimerCallback callback, void *user_data);
+void event_loop_remove_timer(EventLoop *loop, int timer_id);
+
+int event_loop_add_watch(EventLoop *loop, const char *path, uint32_t mask,
+                         EventWatchCallback callback, void *user_data);
+void event_loop_remove_watch(EventLoop *loop, int watch_id);
+
+void event_loop_run(EventLoop *loop);
+void event_loop_stop(EventLoop *loop);
+
+#endif
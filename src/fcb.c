@@ -7,12 +7,132 @@
 *   There is no affiliation with Behringer. This is all reverse engineered
 */
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "fcb.h"
+#include "stats.h"
+
+#define FIELD(name, is_flag, slot, invert) { #name, is_flag, offsetof(FCB1010Preset, name), slot, invert }
+
+// Every preset field with its wire position, in CSV column order
+const FCBPresetField fcb_preset_fields[NUM_PRESET_FIELDS] = {
+    FIELD(pc1_enabled, true, 0, true),
+    FIELD(pc1_program, false, 0, false),
+    FIELD(pc2_enabled, true, 1, true),
+    FIELD(pc2_program, false, 1, false),
+    FIELD(pc3_enabled, true, 2, true),
+    FIELD(pc3_program, false, 2, false),
+    FIELD(pc4_enabled, true, 3, true),
+    FIELD(pc4_program, false, 3, false),
+    FIELD(pc5_enabled, true, 4, true),
+    FIELD(pc5_program, false, 4, false),
+    FIELD(cc1_enabled, true, 5, true),
+    FIELD(cc1_controller, false, 5, false),
+    FIELD(cc1_value, false, 6, false),
+    FIELD(cc2_enabled, true, 7, true),
+    FIELD(cc2_controller, false, 7, false),
+    FIELD(cc2_value, false, 8, false),
+    FIELD(switch1_enabled, true, 6, false),
+    FIELD(switch2_enabled, true, 8, false),
+    FIELD(expA_enabled, true, 9, true),
+    FIELD(expA_controller, false, 9, false),
+    FIELD(expA_min, false, 10, false),
+    FIELD(expA_max, false, 11, false),
+    FIELD(expB_enabled, true, 12, true),
+    FIELD(expB_controller, false, 12, false),
+    FIELD(expB_min, false, 13, false),
+    FIELD(expB_max, false, 14, false),
+    FIELD(note_enabled, true, 15, true),
+    FIELD(note_value, false, 15, false),
+};
+
+#undef FIELD
+
+// The MIDI channels are the only globals in the CSV, and the only ones
+// with a mirror copy
+#define GLOBAL(name, is_flag, wire_offset, wire_mask, mirror) \
+    { #name, offsetof(FCB1010, name), is_flag, wire_offset, wire_mask, mirror, mirror != 0 }
+
+const FCBGlobalField fcb_global_fields[NUM_GLOBAL_FIELDS] = {
+    GLOBAL(pc1_midi_channel, false, 2311, 0, 2331),
+    GLOBAL(pc2_midi_channel, false, 2312, 0, 2332),
+    GLOBAL(pc3_midi_channel, false, 2313, 0, 2333),
+    GLOBAL(pc4_midi_channel, false, 2314, 0, 2335),
+    GLOBAL(pc5_midi_channel, false, 2315, 0, 2336),
+    GLOBAL(cc1_midi_channel, false, 2316, 0, 2337),
+    GLOBAL(cc2_midi_channel, false, 2317, 0, 2338),
+    GLOBAL(expA_midi_channel, false, 2319, 0, 2339),
+    GLOBAL(expB_midi_channel, false, 2320, 0, 2340),
+    GLOBAL(note_midi_channel, false, 2321, 0, 2341),
+    GLOBAL(direct_select, true, 2330, 2, 0),
+    GLOBAL(running_status, true, 2330, 4, 0),
+    GLOBAL(merge, true, 2330, 16, 0),
+    GLOBAL(switch1, true, 2334, 4, 0),
+    GLOBAL(switch2, true, 2329, 64, 0),
+    GLOBAL(expA_calibration_min, false, 2343, 0, 0),
+    GLOBAL(expA_calibration_max, false, 2344, 0, 0),
+    GLOBAL(expB_calibration_min, false, 2345, 0, 0),
+    GLOBAL(expB_calibration_max, false, 2346, 0, 0),
+};
+
+#undef GLOBAL
+
+static const char csv_header_groups[] =
+    "Global,,Program Change 1,,Program Change 2,,Program Change 3,,Program Change 4,,Program Change 5,,"
+    "Continuous Controller 1,,,Continuous Controller 2,,,Switch 1,Switch 2,Expression Pedal A,,,,"
+    "Expression Pedal B,,,,Note,";
+
+static const char csv_header_columns[] =
+    "Bank,Preset,Enabled,Program,Enabled,Program,Enabled,Program,Enabled,Program,Enabled,Program,"
+    "Enabled,Controller,Value,Enabled,Controller,Value,Enabled,Enabled,Enabled,Controller,Minimum,Maximum,"
+    "Enabled,Controller,Minimum,Maximum,Enabled,Value";
+
+#define CSV_COLUMNS 30
+#define CSV_MAX_LINE 1024
+#define CSV_MAX_FILE_SIZE (1024 * 1024)
+
+static const char *status_strings[] = {
+    [FCB_OK] = "OK",
+    [FCB_ERR_SIZE] = "wrong size",
+    [FCB_ERR_HEADER] = "not an FCB1010 dump",
+    [FCB_ERR_VALUE] = "value out of range",
+    [FCB_ERR_CSV_HEADER] = "bad CSV header",
+    [FCB_ERR_CSV_ROW] = "bad CSV row",
+    [FCB_ERR_IO] = "I/O error",
+    [FCB_ERR_NOMEM] = "out of memory",
+    [FCB_ERR_JSON] = "bad NDJSON",
+};
+
+const char *fcb_status_string(FCBStatus status) {
+    if ((size_t)status >= sizeof(status_strings) / sizeof(status_strings[0])) return "unknown error";
+    return status_strings[status];
+}
+
+FCBStatus fcb_set_error(FCBError *error, FCBStatus status, int line, int column, size_t offset,
+                           const char *format, ...) {
+    if (!error) return status;
+
+    error->status = status;
+    error->line = line;
+    error->column = column;
+    error->offset = offset;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error->message, sizeof(error->message), format, args);
+    va_end(args);
+
+    return status;
+}
 
 void init_fcb1010(FCB1010 *fcb) {
     memset(fcb, 0, sizeof(FCB1010));
@@ -25,6 +145,120 @@ void init_fcb1010(FCB1010 *fcb) {
         fcb->preset[i].expB_max = 127;
         fcb->preset[i].note_value = 60;
     }
+    fcb->expA_calibration_max = 127;
+    fcb->expB_calibration_max = 127;
+}
+
+// Look up a preset field by name; returns its index or -1
+int fcb_find_preset_field(const char *name) {
+    for (int i = 0; i < NUM_PRESET_FIELDS; i++) {
+        if (strcmp(fcb_preset_fields[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+// Look up a global field by name; returns its index or -1
+int fcb_find_global_field(const char *name) {
+    for (int i = 0; i < NUM_GLOBAL_FIELDS; i++) {
+        if (strcmp(fcb_global_fields[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+// "3-7" is bank 3, preset 7; returns 0-99 or -1
+int fcb_parse_preset(const char *text) {
+    unsigned bank;
+    unsigned preset;
+    int consumed = 0;
+
+    if (sscanf(text, "%u-%u%n", &bank, &preset, &consumed) != 2 || text[consumed] != '\0') return -1;
+    if (bank < 1 || bank > 10 || preset < 1 || preset > 10) return -1;
+    return (bank - 1) * 10 + preset - 1;
+}
+
+bool fcb_has_suffix(const char *path, const char *suffix) {
+    size_t len = strlen(path);
+    size_t suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(path + len - suffix_len, suffix) == 0;
+}
+
+uint8_t fcb_get_preset_field(const FCB1010Preset *preset, int field) {
+    const FCBPresetField *f = &fcb_preset_fields[field];
+    const uint8_t *base = (const uint8_t *)preset;
+
+    if (f->is_flag) return *(const bool *)(base + f->offset) ? 1 : 0;
+    return base[f->offset];
+}
+
+void fcb_set_preset_field(FCB1010Preset *preset, int field, uint8_t value) {
+    const FCBPresetField *f = &fcb_preset_fields[field];
+    uint8_t *base = (uint8_t *)preset;
+
+    if (f->is_flag) {
+        *(bool *)(base + f->offset) = value != 0;
+    } else {
+        base[f->offset] = value & 0x7F;
+    }
+}
+
+uint8_t fcb_get_global_field(const FCB1010 *fcb, int field) {
+    const uint8_t *base = (const uint8_t *)fcb + fcb_global_fields[field].offset;
+    if (fcb_global_fields[field].is_flag) return *(const bool *)base ? 1 : 0;
+    return *base;
+}
+
+void fcb_set_global_field(FCB1010 *fcb, int field, uint8_t value) {
+    uint8_t *base = (uint8_t *)fcb + fcb_global_fields[field].offset;
+    if (fcb_global_fields[field].is_flag) {
+        *(bool *)base = value != 0;
+    } else {
+        *base = value;
+    }
+}
+
+// Byte offset of a preset field in a raw dump. For flags, *bit gets the
+// bit number within that byte. Mirrors the walk parse_sysex() does.
+size_t fcb_field_wire_offset(int preset, int field, uint8_t *bit) {
+    const FCBPresetField *f = &fcb_preset_fields[field];
+    size_t index = (size_t)preset * 16 + f->slot;
+
+    if (f->is_flag) {
+        if (bit) *bit = index % 7;
+        return 14 + (index / 7) * 8;
+    }
+
+    if (bit) *bit = 0;
+    return 7 + index + index / 7;
+}
+
+// Write one field straight into a raw dump, touching only its own byte
+// (or flag bit), and widen the dirty range to cover it
+void fcb_encode_preset_field(uint8_t *data, int preset, int field, uint8_t value, FCBDirtyRange *dirty) {
+    const FCBPresetField *f = &fcb_preset_fields[field];
+    uint8_t bit;
+    size_t offset = fcb_field_wire_offset(preset, field, &bit);
+    uint8_t old = data[offset];
+
+    if (f->is_flag) {
+        bool set = (value != 0) != f->invert;
+        if (set) {
+            data[offset] |= 1 << bit;
+        } else {
+            data[offset] &= ~(1 << bit);
+        }
+    } else {
+        data[offset] = value & 0x7F;
+    }
+
+    if (dirty && data[offset] != old) {
+        if (dirty->start == dirty->end) {
+            dirty->start = offset;
+            dirty->end = offset + 1;
+        } else {
+            if (offset < dirty->start) dirty->start = offset;
+            if (offset + 1 > dirty->end) dirty->end = offset + 1;
+        }
+    }
 }
 
 // Function to get the enable state of a preset's parameters
@@ -55,7 +289,7 @@ void set_param_enable_states(uint8_t *data, size_t *offset, size_t *flag, bool v
 
 // Function to get preset parameter values 
 size_t get_params(const uint8_t *data, size_t offset, uint8_t *result) {
-    *result = data[offset];
+    *result = data[offset] & 0x7F;  // As fcb_set_preset_field() stores it
     offset++;
 
     if ((offset - 6) % 8 == 0) {
@@ -79,13 +313,9 @@ size_t set_params(uint8_t *data, size_t offset, uint8_t value) {
 }
 
 
-bool parse_sysex(FCB1010 *fcb, uint8_t *data, size_t size) {
-    if (size != SYSEX_SIZE || data[0] != 0xF0 || data[size - 1] != 0xF7 ||
-        data[1] != 0 || data[2] != 32 || data[3] != 50 || data[4] != 1 ||
-        data[5] != 12 || data[6] != 15) {
-        return false;
-    }
+static const uint8_t sysex_header[] = { 0xF0, 0, 32, 50, 1, 12, 15 };
 
+static void decode_sysex(const uint8_t *data, FCB1010 *fcb) {
     size_t offset = 14;  // Start offset after the header
     size_t flag = 0;
 
@@ -180,11 +410,66 @@ bool parse_sysex(FCB1010 *fcb, uint8_t *data, size_t size) {
     fcb->expA_calibration_max = data[2344];
     fcb->expB_calibration_min = data[2345];
     fcb->expB_calibration_max = data[2346];
+}
 
-    return true;
+FCBStatus fcb_check_sysex(const uint8_t *data, size_t size, FCBError *error) {
+    if (size != SYSEX_SIZE) {
+        return fcb_set_error(error, FCB_ERR_SIZE, 0, 0, 0, "Expected %d bytes, got %zu", SYSEX_SIZE, size);
+    }
+
+    for (size_t i = 0; i < sizeof(sysex_header); i++) {
+        if (data[i] != sysex_header[i]) {
+            return fcb_set_error(error, FCB_ERR_HEADER, 0, 0, i, "Byte %zu is %u, expected %u",
+                             i, data[i], sysex_header[i]);
+        }
+    }
+    if (data[size - 1] != 0xF7) {
+        return fcb_set_error(error, FCB_ERR_HEADER, 0, 0, size - 1, "Dump does not end with F7");
+    }
+    return FCB_OK;
 }
 
-bool get_raw_sysex(const FCB1010 *fcb, uint8_t *data) {
+// One preset straight from its wire positions, for readers that only
+// need a few presets of a dump
+FCBStatus fcb_decode_preset(const uint8_t *data, size_t size, int preset, FCB1010Preset *out, FCBError *error) {
+    FCBStatus status = fcb_check_sysex(data, size, error);
+    if (status != FCB_OK) return status;
+
+    for (int field = 0; field < NUM_PRESET_FIELDS; field++) {
+        const FCBPresetField *f = &fcb_preset_fields[field];
+        uint8_t bit;
+        uint8_t byte = data[fcb_field_wire_offset(preset, field, &bit)];
+
+        fcb_set_preset_field(out, field, f->is_flag ? ((byte >> bit) & 1) != f->invert : byte);
+    }
+    return FCB_OK;
+}
+
+// The global settings only; the presets of fcb are left as they are
+FCBStatus fcb_decode_globals(const uint8_t *data, size_t size, FCB1010 *fcb, FCBError *error) {
+    FCBStatus status = fcb_check_sysex(data, size, error);
+    if (status != FCB_OK) return status;
+
+    for (int field = 0; field < NUM_GLOBAL_FIELDS; field++) {
+        const FCBGlobalField *g = &fcb_global_fields[field];
+        uint8_t byte = data[g->wire_offset];
+
+        fcb_set_global_field(fcb, field, g->is_flag ? (byte & g->wire_mask) != 0 : byte);
+    }
+    return FCB_OK;
+}
+
+FCBStatus fcb_decode_sysex(const uint8_t *data, size_t size, FCB1010 *fcb, FCBError *error) {
+    FCBStatus status = fcb_check_sysex(data, size, error);
+    if (status != FCB_OK) return status;
+
+    STATS_BEGIN(start);
+    decode_sysex(data, fcb);
+    STATS_END(STATS_PARSE_SYSEX, start);
+    return FCB_OK;
+}
+
+static void encode_sysex(const FCB1010 *fcb, uint8_t *data) {
     memset(data, 0, SYSEX_SIZE);
 
     data[0] = 0xF0;  // SysEx start byte
@@ -198,6 +483,7 @@ bool get_raw_sysex(const FCB1010 *fcb, uint8_t *data) {
     for (size_t i = 1835; i < 2311; ++i) {
         data[i] = 127;
     }
+    data[1838] = 0x70;  // The low bits are the last preset's flags, set below
     size_t offset = 14;
     size_t flag = 0;
 
@@ -242,7 +528,6 @@ bool get_raw_sysex(const FCB1010 *fcb, uint8_t *data) {
         offset = set_params(data, offset, fcb->preset[preset].note_value);
     }
 
-    data[1838] = 120;
     data[2311] = fcb->pc1_midi_channel;
     data[2312] = fcb->pc2_midi_channel;
     data[2313] = fcb->pc3_midi_channel;
@@ -276,37 +561,187 @@ bool get_raw_sysex(const FCB1010 *fcb, uint8_t *data) {
     if (fcb->direct_select) data[2330] |= 2;
     if (fcb->running_status) data[2330] |= 4;
     if (fcb->merge) data[2330] |= 16;
-    if (fcb->switch1) data[2334] |= 2;
+    if (fcb->switch1) data[2334] |= 4;
     if (fcb->switch2) data[2329] |= 64;
-    data[2343] = 0; //fcb->expA_calibration_min;
-    data[2344] = 127; //fcb->expA_calibration_max;
-    data[2345] = 0; //fcb->expB_calibration_min;
-    data[2346] = 127; //fcb->expB_calibration_max;
+    data[2343] = fcb->expA_calibration_min;
+    data[2344] = fcb->expA_calibration_max;
+    data[2345] = fcb->expB_calibration_min;
+    data[2346] = fcb->expB_calibration_max;
 
     data[2350] = 10;
     data[2351] = 247;
+}
 
-    return true;
+// Everything that ends up on the wire must fit in 7 bits, channels in 4
+static FCBStatus check_values(const FCB1010 *fcb, FCBError *error) {
+    for (int preset = 0; preset < NUM_PRESETS; preset++) {
+        for (int field = 0; field < NUM_PRESET_FIELDS; field++) {
+            if (fcb_preset_fields[field].is_flag) continue;
+
+            uint8_t value = fcb_get_preset_field(&fcb->preset[preset], field);
+            if (value > 127) {
+                return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "Bank %d preset %d: %s is %u, must be 0-127",
+                                 preset / 10 + 1, preset % 10 + 1, fcb_preset_fields[field].name, value);
+            }
+        }
+    }
+
+    const uint8_t channels[] = {
+        fcb->pc1_midi_channel, fcb->pc2_midi_channel, fcb->pc3_midi_channel, fcb->pc4_midi_channel,
+        fcb->pc5_midi_channel, fcb->cc1_midi_channel, fcb->cc2_midi_channel, fcb->expA_midi_channel,
+        fcb->expB_midi_channel, fcb->note_midi_channel
+    };
+    for (size_t i = 0; i < sizeof(channels); i++) {
+        if (channels[i] > 15) {
+            return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "MIDI channel %u out of range 0-15", channels[i]);
+        }
+    }
+
+    const uint8_t calibration[] = {
+        fcb->expA_calibration_min, fcb->expA_calibration_max, fcb->expB_calibration_min, fcb->expB_calibration_max
+    };
+    for (size_t i = 0; i < sizeof(calibration); i++) {
+        if (calibration[i] > 127) {
+            return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "Pedal calibration %u out of range 0-127",
+                                 calibration[i]);
+        }
+    }
+
+    return FCB_OK;
 }
 
-bool write_csv(const FCB1010 *fcb, const char *filename) {
-    FILE *file = fopen(filename, "w");
-    if (!file) return false;
+FCBStatus fcb_encode_sysex(const FCB1010 *fcb, uint8_t *data, size_t size, FCBError *error) {
+    if (size < SYSEX_SIZE) {
+        return fcb_set_error(error, FCB_ERR_SIZE, 0, 0, 0, "Output needs %d bytes, got %zu", SYSEX_SIZE, size);
+    }
+
+    FCBStatus status = check_values(fcb, error);
+    if (status != FCB_OK) return status;
+
+    STATS_BEGIN(start);
+    encode_sysex(fcb, data);
+    STATS_END(STATS_GET_RAW_SYSEX, start);
+    return FCB_OK;
+}
+
+static void mark_dirty(FCBDirtyRange *dirty, size_t offset) {
+    if (dirty->start == dirty->end) {
+        dirty->start = offset;
+        dirty->end = offset + 1;
+    } else {
+        if (offset < dirty->start) dirty->start = offset;
+        if (offset + 1 > dirty->end) dirty->end = offset + 1;
+    }
+}
+
+// Set a byte, or one bit of it, counting and marking real changes
+static void overlay_byte(uint8_t *data, size_t offset, uint8_t mask, uint8_t value, size_t *changed,
+                         FCBDirtyRange *dirty) {
+    uint8_t old = data[offset];
+    uint8_t updated = mask ? (value ? old | mask : old & ~mask) : value;
+    if (updated == old) return;
+
+    data[offset] = updated;
+    (*changed)++;
+    mark_dirty(dirty, offset);
+}
+
+// Compares field by field against what the decoder would read, so a dump
+// that already matches costs one pass of reads and no writes. Channels
+// keep their mirror bytes in step. Global flags and pedal calibration are
+// not in the CSV, so they stay as the pedal sent them instead of taking
+// the init_fcb1010() defaults a CSV import leaves in fcb.
+FCBStatus fcb_overlay_sysex(const FCB1010 *fcb, uint8_t *data, size_t size, size_t *changed, FCBDirtyRange *dirty,
+                            FCBError *error) {
+    FCBStatus status = fcb_check_sysex(data, size, error);
+    if (status == FCB_OK) status = check_values(fcb, error);
+    if (status != FCB_OK) return status;
+
+    size_t count = 0;
+    FCBDirtyRange range = {0, 0};
+
+    for (int preset = 0; preset < NUM_PRESETS; preset++) {
+        const FCB1010Preset *p = &fcb->preset[preset];
+        for (int field = 0; field < NUM_PRESET_FIELDS; field++) {
+            const FCBPresetField *f = &fcb_preset_fields[field];
+            uint8_t bit;
+            size_t offset = fcb_field_wire_offset(preset, field, &bit);
+            uint8_t value = fcb_get_preset_field(p, field);
+
+            if (f->is_flag) {
+                overlay_byte(data, offset, 1 << bit, (value != 0) != f->invert, &count, &range);
+            } else {
+                overlay_byte(data, offset, 0, value, &count, &range);
+            }
+        }
+    }
+
+    for (int field = 0; field < NUM_GLOBAL_FIELDS; field++) {
+        const FCBGlobalField *g = &fcb_global_fields[field];
+        if (!g->in_csv) continue;
+
+        uint8_t value = fcb_get_global_field(fcb, field);
+        overlay_byte(data, g->wire_offset, 0, value, &count, &range);
+        overlay_byte(data, g->mirror, 0, value, &count, &range);
+    }
+
+    if (changed) *changed = count;
+    if (dirty) *dirty = range;
+    return FCB_OK;
+}
+
+// Write one global straight into a raw dump: its byte or flag bit, and a
+// channel's mirror too
+void fcb_encode_global_field(uint8_t *data, int field, uint8_t value, FCBDirtyRange *dirty) {
+    const FCBGlobalField *g = &fcb_global_fields[field];
+    FCBDirtyRange unused = {0, 0};
+    size_t changed = 0;
+
+    if (!dirty) dirty = &unused;
+    if (g->is_flag) {
+        overlay_byte(data, g->wire_offset, g->wire_mask, value != 0, &changed, dirty);
+    } else {
+        overlay_byte(data, g->wire_offset, 0, value & 0x7F, &changed, dirty);
+        if (g->mirror) overlay_byte(data, g->mirror, 0, value & 0x7F, &changed, dirty);
+    }
+}
+
+typedef struct {
+    char *out;
+    size_t size;
+    size_t length;  // Keeps counting past size so the caller learns what is needed
+} CsvWriter;
+
+__attribute__((format(printf, 2, 3)))
+static void csv_printf(CsvWriter *w, const char *format, ...) {
+    size_t room = w->length < w->size ? w->size - w->length : 0;
+
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(room ? w->out + w->length : NULL, room, format, args);
+    va_end(args);
+
+    if (n > 0) w->length += n;
+}
+
+// Format as CSV into out (NUL terminated). *length gets the text length,
+// or the size needed when out is too small.
+FCBStatus fcb_format_csv(const FCB1010 *fcb, char *out, size_t size, size_t *length, FCBError *error) {
+    STATS_BEGIN(start);
+    CsvWriter w = { .out = out, .size = size, .length = 0 };
 
     // Write the CSV headers (matching the Python version)
-    fprintf(file, "Global,,Program Change 1,,Program Change 2,,Program Change 3,,Program Change 4,,Program Change 5,,Continuous Controller 1,,,Continuous Controller 2,,,Switch 1,Switch 2,Expression Pedal A,,,,Expression Pedal B,,,,Note,\n");
-    
+    csv_printf(&w, "%s\n", csv_header_groups);
+
     // Write the global MIDI channel settings (matching the Python version)
-    fprintf(file, "MIDI Channel,,%d,,%d,,%d,,%d,,%d,,%d,,,%d,,,N/A,N/A,%d,,,,%d,,,,%d,\n",
-            fcb->pc1_midi_channel, fcb->pc2_midi_channel, fcb->pc3_midi_channel,
-            fcb->pc4_midi_channel, fcb->pc5_midi_channel, fcb->cc1_midi_channel,
-            fcb->cc2_midi_channel, fcb->expA_midi_channel, fcb->expB_midi_channel,
-            fcb->note_midi_channel);
+    csv_printf(&w, "MIDI Channel,,%d,,%d,,%d,,%d,,%d,,%d,,,%d,,,N/A,N/A,%d,,,,%d,,,,%d,\n",
+               fcb->pc1_midi_channel, fcb->pc2_midi_channel, fcb->pc3_midi_channel,
+               fcb->pc4_midi_channel, fcb->pc5_midi_channel, fcb->cc1_midi_channel,
+               fcb->cc2_midi_channel, fcb->expA_midi_channel, fcb->expB_midi_channel,
+               fcb->note_midi_channel);
 
     // Write the detailed headers for each preset (matching the Python version)
-    fprintf(file, "Bank,Preset,Enabled,Program,Enabled,Program,Enabled,Program,Enabled,Program,Enabled,Program,"
-                  "Enabled,Controller,Value,Enabled,Controller,Value,Enabled,Enabled,Enabled,Controller,Minimum,Maximum,"
-                  "Enabled,Controller,Minimum,Maximum,Enabled,Value\n");
+    csv_printf(&w, "%s\n", csv_header_columns);
 
     // Write each preset (matching the Python version)
     for (int bank = 1; bank <= 10; ++bank) {
@@ -314,25 +749,30 @@ bool write_csv(const FCB1010 *fcb, const char *filename) {
             int preset = (bank - 1) * 10 + (offset - 1);
 
             const FCB1010Preset *p = &fcb->preset[preset];
-            fprintf(file, "%d,%d,%d,%hhu,%d,%hhu,%d,%hhu,%d,%hhu,%d,%hhu,%d,%hhu,%hhu,%d,%hhu,%hhu,%d,%d,%d,%hhu,%hhu,%hhu,"
-                          "%d,%hhu,%hhu,%hhu,%d,%hhu\n",
-                    bank, offset,
-                    p->pc1_enabled, p->pc1_program,
-                    p->pc2_enabled, p->pc2_program,
-                    p->pc3_enabled, p->pc3_program,
-                    p->pc4_enabled, p->pc4_program,
-                    p->pc5_enabled, p->pc5_program,
-                    p->cc1_enabled, p->cc1_controller, p->cc1_value,
-                    p->cc2_enabled, p->cc2_controller, p->cc2_value,
-                    p->switch1_enabled, p->switch2_enabled,
-                    p->expA_enabled, p->expA_controller, p->expA_min, p->expA_max,
-                    p->expB_enabled, p->expB_controller, p->expB_min, p->expB_max,
-                    p->note_enabled, p->note_value);
+            csv_printf(&w, "%d,%d,%d,%hhu,%d,%hhu,%d,%hhu,%d,%hhu,%d,%hhu,%d,%hhu,%hhu,%d,%hhu,%hhu,%d,%d,%d,%hhu,%hhu,%hhu,"
+                           "%d,%hhu,%hhu,%hhu,%d,%hhu\n",
+                       bank, offset,
+                       p->pc1_enabled, p->pc1_program,
+                       p->pc2_enabled, p->pc2_program,
+                       p->pc3_enabled, p->pc3_program,
+                       p->pc4_enabled, p->pc4_program,
+                       p->pc5_enabled, p->pc5_program,
+                       p->cc1_enabled, p->cc1_controller, p->cc1_value,
+                       p->cc2_enabled, p->cc2_controller, p->cc2_value,
+                       p->switch1_enabled, p->switch2_enabled,
+                       p->expA_enabled, p->expA_controller, p->expA_min, p->expA_max,
+                       p->expB_enabled, p->expB_controller, p->expB_min, p->expB_max,
+                       p->note_enabled, p->note_value);
         }
     }
 
-    fclose(file);
-    return true;
+    if (length) *length = w.length;
+    STATS_END(STATS_WRITE_CSV, start);
+
+    if (w.length >= size) {
+        return fcb_set_error(error, FCB_ERR_SIZE, 0, 0, 0, "CSV needs %zu bytes, buffer holds %zu", w.length + 1, size);
+    }
+    return FCB_OK;
 }
 
 bool parse_csv_line(char *line, char *parsed_data[], int expected_columns) {
@@ -353,114 +793,278 @@ bool parse_csv_line(char *line, char *parsed_data[], int expected_columns) {
         line_ptr++;
     }
 
-    if (start != line_ptr) {
-        parsed_data[i++] = start;
-    } else if (*line_ptr == '\0') {
-        parsed_data[i++] = NULL;
-    }
+    // Every column is taken and there is still a comma: too many columns
+    if (i == expected_columns) return false;
 
+    parsed_data[i++] = start != line_ptr ? start : NULL;
     return (i == expected_columns);
 }
 
-bool load_csv(FCB1010 *fcb, const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        printf("Failed to read file %s\n", filename);
-        return false;
-    }
-
-    char line[1024];
-    char *lines[NUM_PRESETS + 3];
-    int line_count = 0;
-
-    while (fgets(line, sizeof(line), file) && line_count < NUM_PRESETS + 3) {
-        lines[line_count] = strdup(line);
-        line_count++;
-    }
-
-    fclose(file);
-
-    if (line_count < 3) {
-        printf("CSV has insufficient lines. Should be at least 3\n");
-        return false;
-    }
-
-    if (strcmp(lines[0], "Global,,Program Change 1,,Program Change 2,,Program Change 3,,Program Change 4,,Program Change 5,,Continuous Controller 1,,,Continuous Controller 2,,,Switch 1,Switch 2,Expression Pedal A,,,,Expression Pedal B,,,,Note,\n") != 0) {
-        printf("First line of CSV should contain headers:\n");
-        printf("Global,,Program Change 1,,Program Change 2,,Program Change 3,,Program Change 4,,Program Change 5,,Continuous Controller 1,,,Continuous Controller 2,,,Switch 1,Switch 2,Expression Pedal A,,,,Expression Pedal B,,,,Note,\n");
-        return false;
-    }
-
-    if (strcmp(lines[2], "Bank,Preset,Enabled,Program,Enabled,Program,Enabled,Program,Enabled,Program,Enabled,Program,Enabled,Controller,Value,Enabled,Controller,Value,Enabled,Enabled,Enabled,Controller,Minimum,Maximum,Enabled,Controller,Minimum,Maximum,Enabled,Value\n") != 0) {
-        printf("Third line of CSV should contain headers:\n");
-        printf("Bank,Preset,Enabled,Program,Enabled,Program,Enabled,Program,Enabled,Program,Enabled,Program,Enabled,Controller,Value,Enabled,Controller,Value,Enabled,Enabled,Enabled,Controller,Minimum,Maximum,Enabled,Controller,Minimum,Maximum,Enabled,Value\n");
-        return false;
-    }
-
-    char *midi_channels[30];
-    if (!parse_csv_line(lines[1], midi_channels, 30)) {
-        printf("Insufficient MIDI Channel parameters.\n");
-        return false;
-    }
-
-    fcb->pc1_midi_channel = atoi(midi_channels[2]);
-    fcb->pc2_midi_channel = atoi(midi_channels[4]);
-    fcb->pc3_midi_channel = atoi(midi_channels[6]);
-    fcb->pc4_midi_channel = atoi(midi_channels[8]);
-    fcb->pc5_midi_channel = atoi(midi_channels[10]);
-    fcb->cc1_midi_channel = atoi(midi_channels[12]);
-    fcb->cc2_midi_channel = atoi(midi_channels[15]);
-    fcb->expA_midi_channel = atoi(midi_channels[20]);
-    fcb->expB_midi_channel = atoi(midi_channels[24]);
-    fcb->note_midi_channel = atoi(midi_channels[28]);
-
-    for (int i = 3; i < line_count; i++) {
-        char *data[30];
-        if (!parse_csv_line(lines[i], data, 30)) continue;
-
-        int bank = atoi(data[0]);
-        if (bank < 1 || bank > 10) continue;
-
-        int preset_num = atoi(data[1]);
-        if (preset_num < 1 || preset_num > 10) continue;
-
-        int preset_index = (bank - 1) * 10 + (preset_num - 1);
-        FCB1010Preset *preset = &fcb->preset[preset_index];
-
-        preset->pc1_enabled = atoi(data[2]) == 1;
-        preset->pc1_program = atoi(data[3]);
-        preset->pc2_enabled = atoi(data[4]) == 1;
-        preset->pc2_program = atoi(data[5]);
-        preset->pc3_enabled = atoi(data[6]) == 1;
-        preset->pc3_program = atoi(data[7]);
-        preset->pc4_enabled = atoi(data[8]) == 1;
-        preset->pc4_program = atoi(data[9]);
-        preset->pc5_enabled = atoi(data[10]) == 1;
-        preset->pc5_program = atoi(data[11]);
-        preset->cc1_enabled = atoi(data[12]) == 1;
-        preset->cc1_controller = atoi(data[13]);
-        preset->cc1_value = atoi(data[14]);
-        preset->cc2_enabled = atoi(data[15]) == 1;
-        preset->cc2_controller = atoi(data[16]);
-        preset->cc2_value = atoi(data[17]);
-        preset->switch1_enabled = atoi(data[18]) == 1;
-        preset->switch2_enabled = atoi(data[19]) == 1;
-        preset->expA_enabled = atoi(data[20]) == 1;
-        preset->expA_controller = atoi(data[21]);
-        preset->expA_min = atoi(data[22]);
-        preset->expA_max = atoi(data[23]);
-        preset->expB_enabled = atoi(data[24]) == 1;
-        preset->expB_controller = atoi(data[25]);
-        preset->expB_min = atoi(data[26]);
-        preset->expB_max = atoi(data[27]);
-        preset->note_enabled = atoi(data[28]) == 1;
-        preset->note_value = atoi(data[29]);
-    }
-
-    for (int i = 0; i < line_count; i++) {
-        free(lines[i]);
-    }
+// Copy the next line of text into line without its line ending. Returns
+// false at the end of the text; *too_long is set if the line was cut.
+static bool next_line(const char **text, const char *end, char *line, size_t size, bool *too_long) {
+    if (*text >= end) return false;
+
+    const char *newline = memchr(*text, '\n', end - *text);
+    const char *line_end = newline ? newline : end;
+    size_t len = line_end - *text;
+
+    *too_long = len >= size;
+    if (*too_long) len = size - 1;
+    memcpy(line, *text, len);
+    if (len > 0 && line[len - 1] == '\r') len--;
+    line[len] = '\0';
 
+    *text = newline ? newline + 1 : end;
     return true;
 }
 
+// Strict integer field: digits only, within [min, max]
+static bool parse_number(const char *field, int min, int max, int *value) {
+    if (!field || *field == '\0') return false;
+
+    char *end;
+    long v = strtol(field, &end, 10);
+    if (*end != '\0' || v < min || v > max) return false;
+
+    *value = (int)v;
+    return true;
+}
+
+// CSV columns of the global MIDI channel line, in FCB1010 field order
+static const int csv_channel_columns[] = { 2, 4, 6, 8, 10, 12, 15, 20, 24, 28 };
+
+static FCBStatus parse_csv(const char *text, size_t length, FCB1010 *fcb, FCBError *error) {
+    const char *ptr = text;
+    const char *end = text + length;
+    char line[CSV_MAX_LINE];
+    char *fields[CSV_COLUMNS];
+    bool too_long;
+    int line_number = 0;
+
+    while (next_line(&ptr, end, line, sizeof(line), &too_long)) {
+        line_number++;
+        if (too_long) {
+            return fcb_set_error(error, FCB_ERR_CSV_ROW, line_number, 0, 0, "Line longer than %d characters", CSV_MAX_LINE - 1);
+        }
+
+        if (line_number == 1 || line_number == 3) {
+            const char *expected = line_number == 1 ? csv_header_groups : csv_header_columns;
+            if (strcmp(line, expected) != 0) {
+                return fcb_set_error(error, FCB_ERR_CSV_HEADER, line_number, 0, 0,
+                                 "Line %d of the CSV should contain the %s headers", line_number,
+                                 line_number == 1 ? "group" : "column");
+            }
+            continue;
+        }
+
+        if (line_number == 2) {
+            if (!parse_csv_line(line, fields, CSV_COLUMNS)) {
+                return fcb_set_error(error, FCB_ERR_CSV_HEADER, line_number, 0, 0, "Insufficient MIDI Channel parameters");
+            }
+
+            uint8_t *channels[] = {
+                &fcb->pc1_midi_channel, &fcb->pc2_midi_channel, &fcb->pc3_midi_channel, &fcb->pc4_midi_channel,
+                &fcb->pc5_midi_channel, &fcb->cc1_midi_channel, &fcb->cc2_midi_channel, &fcb->expA_midi_channel,
+                &fcb->expB_midi_channel, &fcb->note_midi_channel
+            };
+            for (size_t i = 0; i < sizeof(channels) / sizeof(channels[0]); i++) {
+                int column = csv_channel_columns[i];
+                int value;
+                if (!parse_number(fields[column], 0, 15, &value)) {
+                    return fcb_set_error(error, FCB_ERR_VALUE, line_number, column + 1, 0,
+                                     "MIDI channel must be 0-15");
+                }
+                *channels[i] = value;
+            }
+            continue;
+        }
+
+        if (line[0] == '\0') continue;  // Blank lines, typically at the end
+
+        if (!parse_csv_line(line, fields, CSV_COLUMNS)) {
+            return fcb_set_error(error, FCB_ERR_CSV_ROW, line_number, 0, 0, "Expected %d columns", CSV_COLUMNS);
+        }
+
+        int bank, preset_num;
+        if (!parse_number(fields[0], 1, 10, &bank) || !parse_number(fields[1], 1, 10, &preset_num)) {
+            return fcb_set_error(error, FCB_ERR_CSV_ROW, line_number, 1, 0, "Bank and preset must be 1-10");
+        }
+
+        FCB1010Preset *preset = &fcb->preset[(bank - 1) * 10 + (preset_num - 1)];
+
+        // Columns after bank and preset follow fcb_preset_fields
+        for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+            bool is_flag = fcb_preset_fields[f].is_flag;
+            int value;
+            if (!parse_number(fields[f + 2], 0, is_flag ? 1 : 127, &value)) {
+                return fcb_set_error(error, FCB_ERR_VALUE, line_number, f + 3, 0, "%s must be %s",
+                                 fcb_preset_fields[f].name, is_flag ? "0 or 1" : "0-127");
+            }
+            fcb_set_preset_field(preset, f, value);
+        }
+    }
+
+    if (line_number < 3) {
+        return fcb_set_error(error, FCB_ERR_CSV_HEADER, line_number, 0, 0, "CSV has insufficient lines. Should be at least 3");
+    }
+    return FCB_OK;
+}
+
+// Parse CSV text. fcb starts from init_fcb1010() defaults, so settings
+// the CSV does not carry (and presets it leaves out) get those. On error
+// fcb is left untouched.
+FCBStatus fcb_parse_csv(const char *text, size_t length, FCB1010 *fcb, FCBError *error) {
+    STATS_BEGIN(start);
+    FCB1010 parsed;
+
+    init_fcb1010(&parsed);
+    FCBStatus status = parse_csv(text, length, &parsed, error);
+    if (status == FCB_OK) *fcb = parsed;
+
+    STATS_END(STATS_LOAD_CSV, start);
+    return status;
+}
+
+// Plain descriptors rather than stdio, which would allocate a FILE on
+// every call. Both return the bytes moved, or -1 on error.
+static ssize_t read_all(int fd, void *data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, (uint8_t *)data + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+static ssize_t write_all(int fd, const void *data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, (const uint8_t *)data + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        done += n;
+    }
+    return done;
+}
+
+FCBStatus fcb_read_sysex_file(const char *path, uint8_t *data, FCBError *error) {
+    STATS_BEGIN(start);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to open %s", path);
+
+    ssize_t size = read_all(fd, data, SYSEX_SIZE);
+    close(fd);
+    if (size < 0) return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to read %s", path);
+    STATS_END(STATS_FILE_READ, start);
+    STATS_ADD(STATS_FILE_BYTES_READ, size);
+
+    if (size != SYSEX_SIZE) {
+        return fcb_set_error(error, FCB_ERR_SIZE, 0, 0, size, "%s: expected %d bytes, got %zd", path, SYSEX_SIZE, size);
+    }
+    return FCB_OK;
+}
+
+// Write to a unique temporary file next to path, then rename it over
+// path, so readers never see a half written file
+FCBStatus fcb_write_file(const char *path, const void *data, size_t size, FCBError *error) {
+    STATS_BEGIN(start);
+    char temp_path[1024];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path) >= (int)sizeof(temp_path)) {
+        return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Path too long: %s", path);
+    }
+
+    int fd = mkstemp(temp_path);
+    if (fd < 0) return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to create a file next to %s", path);
+
+    bool ok = fchmod(fd, 0644) == 0 && write_all(fd, data, size) == (ssize_t)size;
+    if (close(fd) != 0) ok = false;
+
+    if (!ok || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to write %s", path);
+    }
+
+    STATS_END(STATS_FILE_WRITE, start);
+    STATS_ADD(STATS_FILE_BYTES_WRITTEN, size);
+    return FCB_OK;
+}
+
+FCBStatus fcb_write_sysex_file(const char *path, const uint8_t *data, FCBError *error) {
+    return fcb_write_file(path, data, SYSEX_SIZE, error);
+}
+
+// The text goes in allocator memory, or in the thread's arena, which is
+// reset afterwards
+FCBStatus fcb_read_csv_file(const char *path, FCB1010 *fcb, const FCBAllocator *allocator, FCBError *error) {
+    STATS_BEGIN(start);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to read file %s", path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size > CSV_MAX_FILE_SIZE) {
+        close(fd);
+        return fcb_set_error(error, FCB_ERR_SIZE, 0, 0, 0, "%s is not an FCB1010 CSV (too large)", path);
+    }
+
+    size_t size = st.st_size;
+    FCBArena *scratch = allocator ? NULL : fcb_thread_arena();
+    char *text = NULL;
+    if (allocator) {
+        text = allocator->alloc(size + 1, allocator->user_data);
+    } else if (scratch) {
+        text = fcb_arena_alloc(scratch, size + 1);
+    }
+    if (!text) {
+        close(fd);
+        return fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory reading %s", path);
+    }
+
+    ssize_t read_size = read_all(fd, text, size);
+    close(fd);
+    STATS_END(STATS_FILE_READ, start);
+
+    FCBStatus status;
+    if (read_size < 0) {
+        status = fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to read file %s", path);
+    } else {
+        STATS_ADD(STATS_FILE_BYTES_READ, read_size);
+        status = fcb_parse_csv(text, read_size, fcb, error);
+    }
+
+    if (allocator) {
+        allocator->free(text, allocator->user_data);
+    } else {
+        fcb_arena_reset(scratch);
+    }
+    return status;
+}
+
+FCBStatus fcb_write_csv_file(const char *path, const FCB1010 *fcb, FCBError *error) {
+    char text[FCB_CSV_MAX_SIZE];
+    size_t length;
+
+    FCBStatus status = fcb_format_csv(fcb, text, sizeof(text), &length, error);
+    if (status != FCB_OK) return status;
+
+    return fcb_write_file(path, text, length, error);
+}
+
+bool parse_sysex(FCB1010 *fcb, uint8_t *data, size_t size) {
+    return fcb_decode_sysex(data, size, fcb, NULL) == FCB_OK;
+}
+
+bool get_raw_sysex(const FCB1010 *fcb, uint8_t *data) {
+    return fcb_encode_sysex(fcb, data, SYSEX_SIZE, NULL) == FCB_OK;
+}
+
+bool write_csv(const FCB1010 *fcb, const char *filename) {
+    return fcb_write_csv_file(filename, fcb, NULL) == FCB_OK;
+}
+
+bool load_csv(FCB1010 *fcb, const char *filename) {
+    return fcb_read_csv_file(filename, fcb, NULL, NULL) == FCB_OK;
+}
@@ -2,10 +2,13 @@
 #define FCB_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define SYSEX_SIZE 2352
 #define NUM_PRESETS 100
+#define NUM_PRESET_FIELDS 28
+#define NUM_GLOBAL_FIELDS 19
 
 typedef struct {
     bool pc1_enabled;
@@ -61,8 +64,438 @@ typedef struct {
     uint8_t expB_calibration_max;
 } FCB1010;
 
+// Where a preset field lives on the wire. Enable flags are bits in the
+// 8th byte of each 8-byte group (slot = bit position in the preset's run
+// of 16 flags); values are the other 7 bytes (slot = value number 0-15).
+typedef struct {
+    const char *name;
+    bool is_flag;
+    size_t offset;  // offsetof() in FCB1010Preset
+    uint8_t slot;
+    bool invert;    // Flag bit is set when the field is false
+} FCBPresetField;
+
+// A global setting of FCB1010, for code that walks all of them
+typedef struct {
+    const char *name;
+    size_t offset;         // offsetof() in FCB1010
+    bool is_flag;
+    uint16_t wire_offset;  // Byte of the dump the decoder reads it from
+    uint8_t wire_mask;     // The bit in that byte, for flags
+    uint16_t mirror;       // Second copy the encoder writes, or 0
+    bool in_csv;           // Carried by the CSV format
+} FCBGlobalField;
+
+// Byte range [start, end) of a SysEx buffer changed since the last commit
+typedef struct {
+    size_t start;
+    size_t end;
+} FCBDirtyRange;
+
+extern const FCBPresetField fcb_preset_fields[NUM_PRESET_FIELDS];
+extern const FCBGlobalField fcb_global_fields[NUM_GLOBAL_FIELDS];
+
+// Library API (libfcb). Everything here is reentrant: no shared state
+// beyond the atomic --stats counters, no output, no environment lookups.
+// Functions return FCB_OK or an error status and, if error is not NULL,
+// fill it in with the details.
+
+// Upper bound on the CSV text of one FCB1010
+#define FCB_CSV_MAX_SIZE 16384
+
+typedef enum {
+    FCB_OK = 0,
+    FCB_ERR_SIZE,         // Dump is not SYSEX_SIZE bytes, or a buffer is too small
+    FCB_ERR_HEADER,       // Not an FCB1010 SysEx dump
+    FCB_ERR_VALUE,        // A value does not fit its 7-bit (or 4-bit channel) field
+    FCB_ERR_CSV_HEADER,   // CSV header lines are missing or wrong
+    FCB_ERR_CSV_ROW,      // A CSV row has the wrong shape or an unknown preset
+    FCB_ERR_IO,           // A file could not be read or written
+    FCB_ERR_NOMEM,
+    FCB_ERR_JSON          // NDJSON is malformed or has an unknown key or record
+} FCBStatus;
+
+typedef struct {
+    FCBStatus status;
+    int line;        // 1-based CSV line, 0 when not applicable
+    int column;      // 1-based CSV column, 0 when not applicable
+    size_t offset;   // Byte offset in a dump, when relevant
+    char message[160];
+} FCBError;
+
+// Allocation hooks for functions that need heap memory. A NULL
+// allocator means malloc/free, or fcb_thread_arena() for scratch that
+// does not outlive the call.
+typedef struct {
+    void *(*alloc)(size_t size, void *user_data);
+    void (*free)(void *ptr, void *user_data);
+    void *user_data;
+} FCBAllocator;
+
+// Bump allocator for memory that lives as long as one work item
+// (fcb_arena.c): reset hands everything back at once and keeps the
+// memory, so steady state work allocates nothing
+typedef struct FCBArena FCBArena;
+
+FCBStatus fcb_arena_create(FCBArena **arena, size_t size, FCBError *error);
+void fcb_arena_free(FCBArena *arena);
+// 16 byte aligned; NULL only when the arena had to grow and could not
+void *fcb_arena_alloc(FCBArena *arena, size_t size);
+void fcb_arena_reset(FCBArena *arena);
+size_t fcb_arena_size(const FCBArena *arena);
+// Hooks for the functions that take an FCBAllocator; free does nothing
+FCBAllocator fcb_arena_allocator(FCBArena *arena);
+
+// The calling thread's arena, created on first use (NULL if that fails).
+// Library calls given a NULL allocator use it for their scratch and reset
+// it before returning, so nothing may be kept in it across those calls.
+FCBArena *fcb_thread_arena();
+
+const char *fcb_status_string(FCBStatus status);
+
+// Fill in *error (if any) and hand back status, so callers can
+// "return fcb_set_error(...)"
+FCBStatus fcb_set_error(FCBError *error, FCBStatus status, int line, int column, size_t offset,
+                        const char *format, ...) __attribute__((format(printf, 6, 7)));
+
+// Size, header and end byte only; fcb_decode_sysex() starts with this
+FCBStatus fcb_check_sysex(const uint8_t *data, size_t size, FCBError *error);
+FCBStatus fcb_decode_sysex(const uint8_t *data, size_t size, FCB1010 *fcb, FCBError *error);
+// Decode just one preset (0-99), or just the global settings, on demand
+FCBStatus fcb_decode_preset(const uint8_t *data, size_t size, int preset, FCB1010Preset *out, FCBError *error);
+FCBStatus fcb_decode_globals(const uint8_t *data, size_t size, FCB1010 *fcb, FCBError *error);
+FCBStatus fcb_encode_sysex(const FCB1010 *fcb, uint8_t *data, size_t size, FCBError *error);
+// Patch fcb onto an existing dump in place, rewriting only the bytes
+// whose decoded value differs. Only what a CSV carries is written (preset
+// fields and MIDI channels); everything else passes through. *changed (if
+// not NULL) gets the number of bytes rewritten and dirty (if not NULL)
+// their span; nothing is touched on error.
+FCBStatus fcb_overlay_sysex(const FCB1010 *fcb, uint8_t *data, size_t size, size_t *changed, FCBDirtyRange *dirty,
+                            FCBError *error);
+FCBStatus fcb_format_csv(const FCB1010 *fcb, char *out, size_t size, size_t *length, FCBError *error);
+FCBStatus fcb_parse_csv(const char *text, size_t length, FCB1010 *fcb, FCBError *error);
+
+FCBStatus fcb_read_sysex_file(const char *path, uint8_t *data, FCBError *error);
+FCBStatus fcb_write_sysex_file(const char *path, const uint8_t *data, FCBError *error);
+// Any bytes, through a temporary file renamed over path like the writers here
+FCBStatus fcb_write_file(const char *path, const void *data, size_t size, FCBError *error);
+FCBStatus fcb_read_csv_file(const char *path, FCB1010 *fcb, const FCBAllocator *allocator, FCBError *error);
+FCBStatus fcb_write_csv_file(const char *path, const FCB1010 *fcb, FCBError *error);
+
+// How far the presets salvaged by fcb_recover_sysex() can be trusted
+typedef struct {
+    uint8_t confidence[NUM_PRESETS];  // 0-100, chance every byte of the preset is right
+    uint8_t globals_confidence;       // Same for channels and global settings
+    bool exact;                       // The capture was clean and decoded as is
+    int stray_bytes;                  // Status, realtime and out-of-frame bytes removed
+    int inserted_bytes;               // Estimated data bytes skipped as insertions
+    int dropped_bytes;                // Estimated data bytes missing
+} FCBRecovery;
+
+// Realign a damaged capture of any length against the dump layout. repaired
+// (SYSEX_SIZE bytes) and report may be NULL. Fails only when the capture is
+// too far from SYSEX_SIZE to align; check the confidence map either way.
+FCBStatus fcb_recover_sysex(const uint8_t *data, size_t size, uint8_t *repaired, FCB1010 *fcb,
+                            FCBRecovery *report, const FCBAllocator *allocator, FCBError *error);
+
+// Column store of many dumps (fcbconv export and aggregate). The presets
+// table has a row per preset of every dump, dump-major: dump, bank and
+// preset keys, enabled_count, then one column per preset field. The dumps
+// table has a row per dump: its name, then one column per global setting.
+// All columns are one byte per row except dump and name.
+#define FCB_COLUMN_NAME_SIZE 32
+#define FCB_NUM_COLUMNS (4 + NUM_PRESET_FIELDS + 1 + NUM_GLOBAL_FIELDS)
+#define FCB_COLUMN_VALUES 128  // Every one byte column holds 0-127
+
+typedef enum {
+    FCB_TABLE_PRESETS,
+    FCB_TABLE_DUMPS
+} FCBTable;
+
+typedef struct {
+    char name[FCB_COLUMN_NAME_SIZE];
+    uint32_t width;   // Bytes per row, 1 or 4
+    uint32_t table;   // FCBTable
+    uint64_t offset;  // Start of the values in the file
+} FCBColumn;
+
+typedef struct FCBColumnWriter FCBColumnWriter;
+
+// Dumps are kept in memory until fcb_columns_write()
+FCBStatus fcb_columns_create(FCBColumnWriter **writer, const FCBAllocator *allocator, FCBError *error);
+FCBStatus fcb_columns_append(FCBColumnWriter *writer, const char *name, const FCB1010 *fcb, FCBError *error);
+FCBStatus fcb_columns_write(FCBColumnWriter *writer, const char *path, FCBError *error);
+void fcb_columns_free(FCBColumnWriter *writer);
+
+// A column file mapped read only; the columns are used in place
+typedef struct {
+    const uint8_t *base;
+    size_t size;
+    uint32_t dump_count;
+    uint32_t column_count;
+    const FCBColumn *column;
+    const char *names;
+    size_t names_size;
+} FCBColumns;
+
+FCBStatus fcb_columns_open(const char *path, FCBColumns *columns, FCBError *error);
+void fcb_columns_close(FCBColumns *columns);
+const FCBColumn *fcb_columns_find(const FCBColumns *columns, const char *name);
+size_t fcb_columns_rows(const FCBColumns *columns, const FCBColumn *column);
+const char *fcb_columns_dump_name(const FCBColumns *columns, uint32_t dump);
+
+// Scan kernels over one byte columns. mask (0 or 1 per row) may be NULL
+// to count every row; counts are added to, not reset.
+void fcb_columns_filter(const uint8_t *values, uint8_t value, uint8_t *mask, size_t rows);
+void fcb_columns_histogram(const uint8_t *values, const uint8_t *mask, size_t rows,
+                           uint64_t counts[FCB_COLUMN_VALUES]);
+void fcb_columns_group_count(const uint8_t *keys, const uint8_t *values, const uint8_t *mask, size_t rows,
+                             uint64_t counts[FCB_COLUMN_VALUES * FCB_COLUMN_VALUES]);
+
+// Batch decode of many dumps (fcb_batch.c). FCB_BATCH_LANES dumps are
+// decoded side by side: their bytes are transposed so one vector holds
+// the same byte of each, and every field is extracted for all lanes at
+// once. Blocks of lanes are shared out over threads.
+#define FCB_BATCH_LANES 16
+
+// Decoded dumps as a structure of arrays, dump index fastest:
+// preset[field][preset * stride + dump] and global[field][dump]
+typedef struct {
+    size_t count;
+    size_t stride;  // count rounded up to FCB_BATCH_LANES
+    uint8_t *preset[NUM_PRESET_FIELDS];
+    uint8_t *global[NUM_GLOBAL_FIELDS];
+    FCBStatus *status;  // Per dump; the values of a dump that failed are zero
+    void *block;
+    FCBAllocator allocator;
+} FCBBatch;
+
+FCBStatus fcb_batch_create(FCBBatch *batch, size_t count, const FCBAllocator *allocator, FCBError *error);
+void fcb_batch_free(FCBBatch *batch);
+
+// dumps[i] holds sizes[i] bytes, or SYSEX_SIZE when sizes is NULL. threads
+// <= 0 uses every CPU. Both return how many dumps decoded; the others get
+// an error status.
+size_t fcb_decode_batch(const uint8_t *const *dumps, const size_t *sizes, size_t count, FCBBatch *batch,
+                        int threads);
+size_t fcb_decode_batch_structs(const uint8_t *const *dumps, const size_t *sizes, size_t count, FCB1010 *out,
+                                FCBStatus *status, int threads);
+
+// NDJSON (fcb_json.c): a "globals" record and then a "preset" record per
+// preset, one object per line. The writer appends into a caller buffer
+// and keeps counting past its end, like fcb_format_csv(), so the caller
+// can flush and retry; nothing is allocated.
+typedef struct {
+    char *out;
+    size_t size;
+    size_t length;   // Keeps counting past size so the caller learns what is needed
+    bool first;      // Nothing written yet in the current object or array
+    bool after_key;
+} FCBJsonWriter;
+
+void fcb_json_writer_init(FCBJsonWriter *w, char *out, size_t size);
+void fcb_json_begin_object(FCBJsonWriter *w);
+void fcb_json_end_object(FCBJsonWriter *w);
+void fcb_json_begin_array(FCBJsonWriter *w);
+void fcb_json_end_array(FCBJsonWriter *w);
+void fcb_json_key(FCBJsonWriter *w, const char *key);
+void fcb_json_string(FCBJsonWriter *w, const char *value);
+void fcb_json_uint(FCBJsonWriter *w, unsigned value);
+void fcb_json_bool(FCBJsonWriter *w, bool value);
+void fcb_json_end_line(FCBJsonWriter *w);
+
+#define FCB_JSON_MAX_DEPTH 32
+#define FCB_JSON_STRING_MAX 4096
+
+typedef enum {
+    FCB_JSON_ERROR,
+    FCB_JSON_END,       // No more records
+    FCB_JSON_END_LINE,  // The record (top level value) and its line are done
+    FCB_JSON_BEGIN_OBJECT,
+    FCB_JSON_END_OBJECT,
+    FCB_JSON_BEGIN_ARRAY,
+    FCB_JSON_END_ARRAY,
+    FCB_JSON_KEY,       // string holds the key
+    FCB_JSON_STRING,    // string holds the value
+    FCB_JSON_NUMBER,    // number holds the value when integer is set
+    FCB_JSON_TRUE,
+    FCB_JSON_FALSE,
+    FCB_JSON_NULL
+} FCBJsonToken;
+
+// Pull parser over a buffer that must outlive it; a token at a time from
+// fcb_json_next(). Records may not span lines.
+typedef struct {
+    const char *pos;
+    const char *end;
+    const char *line_start;
+    int line;      // 1-based, of the current token
+    int column;    // 1-based, where the current token starts
+    int expect;
+    int depth;
+    uint32_t in_array;  // Bit per depth
+    char string[FCB_JSON_STRING_MAX];  // Unescaped and NUL terminated
+    size_t string_length;
+    long long number;
+    bool integer;  // number is exact: no fraction or exponent, 18 digits at most
+} FCBJsonReader;
+
+void fcb_json_reader_init(FCBJsonReader *r, const char *text, size_t length);
+FCBJsonToken fcb_json_next(FCBJsonReader *r, FCBError *error);
+
+FCBStatus fcb_format_ndjson(const FCB1010 *fcb, const char *dump, char *out, size_t size, size_t *length,
+                            FCBError *error);
+FCBStatus fcb_parse_ndjson(const char *text, size_t length, FCB1010 *fcb, FCBError *error);
+FCBStatus fcb_read_ndjson_file(const char *path, FCB1010 *fcb, FCBError *error);
+
+// A directory of dumps browsed without loading them (fcb_library.c).
+// Presets and globals are decoded on first use and kept in an LRU cache
+// of cache_entries entries (one per preset, or per dump's globals), and
+// only a handful of files stay mapped, so memory does not grow with the
+// number of dumps.
+typedef struct FCBLibrary FCBLibrary;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t files_mapped;
+    uint32_t cached;  // Entries in use
+} FCBLibraryStats;
+
+FCBStatus fcb_library_open(FCBLibrary **library, const char *directory, size_t cache_entries, FCBError *error);
+void fcb_library_close(FCBLibrary *library);
+size_t fcb_library_count(const FCBLibrary *library);
+const char *fcb_library_name(const FCBLibrary *library, size_t dump);
+bool fcb_library_path(const FCBLibrary *library, size_t dump, char *out, size_t size);
+FCBLibraryStats fcb_library_stats(const FCBLibrary *library);
+
+// NULL if the file is not a readable dump. The preset stays valid until
+// the next call that may evict it, so copy it to keep it.
+const FCB1010Preset *fcb_library_preset(FCBLibrary *library, size_t dump, int preset, FCBError *error);
+// Fills in only the global settings of fcb
+FCBStatus fcb_library_globals(FCBLibrary *library, size_t dump, FCB1010 *fcb, FCBError *error);
+
+// Many small files at once (fcb_files.c): each input is read whole,
+// handed to convert, and what convert leaves in out is written to the
+// matching output. The I/O runs through io_uring, or a thread pool where
+// the kernel lacks it. convert and finish run in the thread driving the
+// pipeline, in completion order unless ordered is set. With shards > 1
+// the files are split between that many pipelines on threads of their
+// own, and the callbacks must be thread safe.
+#define FCB_FILES_DEPTH 64
+
+typedef enum {
+    FCB_FILES_AUTO,     // io_uring if the kernel has it, else threads
+    FCB_FILES_URING,
+    FCB_FILES_THREADS   // open/pread/pwrite on a pool of threads
+} FCBFileBackend;
+
+typedef struct {
+    FCBFileBackend backend;
+    unsigned depth;      // Files in flight; 0 for FCB_FILES_DEPTH
+    int threads;         // Pool size; 0 for twice the CPU count
+    int shards;          // Pipelines side by side; 0 or 1 for one
+    size_t read_size;    // Longest input; longer ones fail with FCB_ERR_SIZE
+    size_t write_size;   // Room for each output
+    bool ordered;        // convert sees each shard's files in input order
+    // Turn input file into *length bytes of out; errors go in *error
+    void (*convert)(size_t file, const uint8_t *data, size_t size, uint8_t *out, size_t out_size, size_t *length,
+                    FCBError *error, void *user_data);
+    // A file is done: written, or failed as error says
+    void (*finish)(size_t file, const FCBError *error, void *user_data);
+    void *user_data;
+} FCBFileJob;
+
+// outputs may be NULL, or hold NULL for files with nothing to write
+FCBStatus fcb_process_files(const char *const *inputs, const char *const *outputs, size_t count,
+                            const FCBFileJob *job, FCBFileBackend *used, FCBError *error);
+
+// Variants of a base dump (fcb_variants.c). An override file has a line
+// "<variant> <bank>-<preset>|*|global <field> <value>" per changed field,
+// with each variant's lines together; a line of just "<variant>" makes one
+// with no changes, and # starts a comment. Field names and limits are
+// those of the CSV and NDJSON formats.
+#define FCB_VARIANT_NAME_SIZE 64
+#define FCB_VARIANT_MAX_LINE 256
+#define FCB_OVERRIDE_GLOBAL -1
+
+typedef struct {
+    int16_t preset;  // 0-99, or FCB_OVERRIDE_GLOBAL
+    uint8_t field;   // In fcb_preset_fields or fcb_global_fields
+    uint8_t value;
+} FCBOverride;
+
+typedef struct {
+    char name[FCB_VARIANT_NAME_SIZE];  // Also the output file name
+    int line;                          // Where it starts in the file
+    size_t first;                      // overrides[first] onwards
+    size_t count;
+} FCBVariant;
+
+typedef struct {
+    FCBVariant *variants;
+    size_t count;
+    FCBOverride *overrides;
+    size_t override_count;
+} FCBVariantSet;
+
+FCBStatus fcb_parse_variants(const char *text, size_t length, FCBVariantSet *set, FCBError *error);
+FCBStatus fcb_read_variants_file(const char *path, FCBVariantSet *set, FCBError *error);
+void fcb_variants_free(FCBVariantSet *set);
+// Rewrite only the bytes of the overridden fields, in order
+void fcb_apply_overrides(const FCBOverride *overrides, size_t count, uint8_t *data, FCBDirtyRange *dirty);
+
+#define FCB_VARIANT_SYX 1
+#define FCB_VARIANT_CSV 2
+
+// Write <out_dir>/<name>.syx and/or .csv for every variant, patched onto
+// a copy of base and checked by decoding it again. threads <= 0 uses
+// every CPU. *written gets the number of variants done; the error is the
+// first variant in the file that failed.
+FCBStatus fcb_generate_variants(const uint8_t *base, const FCBVariantSet *set, const char *out_dir, int formats,
+                                int threads, size_t *written, FCBError *error);
+
+// Near-duplicate dumps (fcb_cluster.c). A MinHash sketch of a dump's
+// presets and globals; the share of equal entries of two sketches
+// estimates how many presets they have in common.
+#define FCB_MINHASH_SIZE 64
+#define FCB_LSH_BANDS 16
+
+void fcb_minhash(const FCB1010 *fcb, uint32_t signature[FCB_MINHASH_SIZE]);
+double fcb_minhash_similarity(const uint32_t *a, const uint32_t *b);
+// signatures holds count sketches back to back. cluster[i] gets the
+// representative dump of i's group (i itself when it has no near
+// duplicate at threshold 0-1). Linear time: only dumps that share a band
+// of their sketch are ever compared.
+FCBStatus fcb_cluster_minhash(const uint32_t *signatures, size_t count, double threshold, uint32_t *cluster,
+                              FCBError *error);
+
 void init_fcb1010(FCB1010 *fcb);
 
+int fcb_find_preset_field(const char *name);
+
+int fcb_find_global_field(const char *name);
+
+int fcb_parse_preset(const char *text);
+
+// Whether path ends in suffix, such as ".syx"
+bool fcb_has_suffix(const char *path, const char *suffix);
+
+uint8_t fcb_get_preset_field(const FCB1010Preset *preset, int field);
+
+void fcb_set_preset_field(FCB1010Preset *preset, int field, uint8_t value);
+
+uint8_t fcb_get_global_field(const FCB1010 *fcb, int field);
+
+void fcb_set_global_field(FCB1010 *fcb, int field, uint8_t value);
+
+size_t fcb_field_wire_offset(int preset, int field, uint8_t *bit);
+
+void fcb_encode_preset_field(uint8_t *data, int preset, int field, uint8_t value, FCBDirtyRange *dirty);
+
+void fcb_encode_global_field(uint8_t *data, int field, uint8_t value, FCBDirtyRange *dirty);
+
 void get_param_enable_states(const uint8_t *data, size_t *offset, size_t *flag, bool invert, bool *result);
 
 void set_param_enable_states(uint8_t *data, size_t *offset, size_t *flag, bool value);
@@ -71,6 +504,7 @@ size_t get_params(const uint8_t *data, size_t offset, uint8_t *result);
 
 size_t set_params(uint8_t *data, size_t offset, uint8_t value);
 
+// Older interface, kept as thin wrappers over the library API above
 bool parse_sysex(FCB1010 *fcb, uint8_t *data, size_t size);
 
 bool get_raw_sysex(const FCB1010 *fcb, uint8_t *data);
@@ -0,0 +1,135 @@
+/*  Arenas for per-item scratch memory
+*   An arena hands out memory by bumping an offset through a chunk and
+*   takes all of it back at once with fcb_arena_reset(). When a chunk runs
+*   out another, larger one is chained on; the next reset folds them into
+*   a single chunk as large as they were together. After the first few
+*   items the arena therefore holds one chunk big enough for the largest
+*   item seen, and from then on it neither allocates nor frees.
+*
+*   Every thread also gets an arena of its own on first use, which the
+*   library borrows for file text and decoder scratch when it is given no
+*   allocator, so threads never meet in malloc for those.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "fcb.h"
+
+#define ARENA_ALIGN 16
+#define THREAD_ARENA_SIZE (64 * 1024)
+
+typedef struct Chunk Chunk;
+struct Chunk {
+    Chunk *previous;
+    size_t size;
+    _Alignas(ARENA_ALIGN) uint8_t data[];
+};
+
+struct FCBArena {
+    Chunk *chunk;     // Current chunk; older ones hang off previous
+    size_t used;      // Bytes handed out from the current chunk
+    size_t total;     // Size of all chunks together
+};
+
+static Chunk *new_chunk(size_t size, Chunk *previous) {
+    Chunk *chunk = malloc(sizeof(Chunk) + size);
+    if (!chunk) return NULL;
+    chunk->previous = previous;
+    chunk->size = size;
+    return chunk;
+}
+
+FCBStatus fcb_arena_create(FCBArena **out, size_t size, FCBError *error) {
+    *out = NULL;
+    FCBArena *arena = calloc(1, sizeof(FCBArena));
+    if (!arena || !(arena->chunk = new_chunk(size, NULL))) {
+        free(arena);
+        return fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory for a %zu byte arena", size);
+    }
+    arena->total = size;
+    *out = arena;
+    return FCB_OK;
+}
+
+static void free_chunks(Chunk *chunk) {
+    while (chunk) {
+        Chunk *previous = chunk->previous;
+        free(chunk);
+        chunk = previous;
+    }
+}
+
+void fcb_arena_free(FCBArena *arena) {
+    if (!arena) return;
+    free_chunks(arena->chunk);
+    free(arena);
+}
+
+void *fcb_arena_alloc(FCBArena *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (size > arena->chunk->size - arena->used) {
+        size_t grown = arena->chunk->size * 2;
+        if (grown < size) grown = size;
+
+        Chunk *chunk = new_chunk(grown, arena->chunk);
+        if (!chunk) return NULL;
+        arena->chunk = chunk;
+        arena->used = 0;
+        arena->total += grown;
+    }
+
+    void *ptr = arena->chunk->data + arena->used;
+    arena->used += size;
+    return ptr;
+}
+
+void fcb_arena_reset(FCBArena *arena) {
+    arena->used = 0;
+    if (!arena->chunk->previous) return;
+
+    // Outgrown: replace the chain with one chunk that holds it all. If
+    // that fails the chain stays, which still works.
+    Chunk *merged = new_chunk(arena->total, NULL);
+    if (!merged) return;
+    free_chunks(arena->chunk);
+    arena->chunk = merged;
+}
+
+size_t fcb_arena_size(const FCBArena *arena) {
+    return arena->total;
+}
+
+static void *arena_alloc(size_t size, void *user_data) {
+    return fcb_arena_alloc(user_data, size);
+}
+
+static void arena_free(void *ptr, void *user_data) {
+    (void)ptr;
+    (void)user_data;
+}
+
+FCBAllocator fcb_arena_allocator(FCBArena *arena) {
+    return (FCBAllocator){ .alloc = arena_alloc, .free = arena_free, .user_data = arena };
+}
+
+static pthread_key_t thread_key;
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
+
+static void free_thread_arena(void *arena) {
+    fcb_arena_free(arena);
+}
+
+static void create_thread_key() {
+    pthread_key_create(&thread_key, free_thread_arena);
+}
+
+FCBArena *fcb_thread_arena() {
+    pthread_once(&thread_once, create_thread_key);
+
+    FCBArena *arena = pthread_getspecific(thread_key);
+    if (!arena && fcb_arena_create(&arena, THREAD_ARENA_SIZE, NULL) == FCB_OK) {
+        pthread_setspecific(thread_key, arena);
+    }
+    return arena;
+}
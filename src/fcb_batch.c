@@ -0,0 +1,269 @@
+/*  Batch decoding of many dumps
+*   Archives get decoded as a whole, so instead of walking one dump field
+*   by field, fcb_decode_batch() works on FCB_BATCH_LANES dumps at a time.
+*   Each 16 byte stretch of the lanes is loaded as 16 vectors and
+*   transposed in registers, which leaves one vector per byte position
+*   holding that byte of every lane. A field is then a load, at most a
+*   shift and two bitwise operations, and one store into the structure of
+*   arrays. Blocks of lanes go to worker threads through a shared counter.
+*
+*   The vectors use GCC's generic vector extension, so this compiles to
+*   SSE2, NEON or plain integer code as the target allows.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fcb.h"
+
+#define MAX_THREADS 64
+
+// Dumps handed to one thread at a time by fcb_decode_batch_structs()
+#define STRUCTS_CHUNK 64
+
+typedef uint8_t Lanes __attribute__((vector_size(FCB_BATCH_LANES)));
+
+#if defined(__clang__)
+#define SHUFFLE(a, b, ...) __builtin_shufflevector(a, b, __VA_ARGS__)
+#else
+#define SHUFFLE(a, b, ...) __builtin_shuffle(a, b, (Lanes){__VA_ARGS__})
+#endif
+
+// Where a field's bytes come from. Flags are bit shift of the byte,
+// inverted when invert is 1; other values keep the bits in mask, as the
+// scalar decoder does (7 bits for presets, the whole byte for globals).
+typedef struct {
+    uint16_t position;
+    uint8_t shift;
+    uint8_t is_flag;
+    uint8_t invert;
+    uint8_t mask;
+} Extract;
+
+typedef struct {
+    const uint8_t *const *dumps;
+    const size_t *sizes;
+    size_t count;
+    FCBBatch *batch;
+    FCB1010 *structs;
+    FCBStatus *status;
+    Extract preset_extract[NUM_PRESETS * NUM_PRESET_FIELDS];
+    Extract global_extract[NUM_GLOBAL_FIELDS];
+    size_t units;       // Blocks of lanes, or chunks of structs
+    size_t next_unit;   // Taken with an atomic add
+    size_t decoded;
+} BatchJob;
+
+FCBStatus fcb_batch_create(FCBBatch *batch, size_t count, const FCBAllocator *allocator, FCBError *error) {
+    memset(batch, 0, sizeof(FCBBatch));
+    if (allocator) {
+        batch->allocator = *allocator;
+    }
+
+    batch->count = count;
+    batch->stride = (count + FCB_BATCH_LANES - 1) / FCB_BATCH_LANES * FCB_BATCH_LANES;
+    if (batch->stride == 0) batch->stride = FCB_BATCH_LANES;
+
+    size_t row_bytes = NUM_PRESET_FIELDS * NUM_PRESETS + NUM_GLOBAL_FIELDS + sizeof(FCBStatus);
+    if (count > SIZE_MAX / row_bytes - FCB_BATCH_LANES) {
+        return fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Batch of %zu dumps is too large", count);
+    }
+    size_t preset_bytes = NUM_PRESETS * batch->stride;
+    size_t size = row_bytes * batch->stride;
+
+    uint8_t *block = allocator ? allocator->alloc(size, allocator->user_data) : malloc(size);
+    if (!block) return fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory for %zu dumps", count);
+    batch->block = block;
+
+    // Status first keeps it aligned; the byte columns follow
+    batch->status = (FCBStatus *)block;
+    uint8_t *next = block + batch->stride * sizeof(FCBStatus);
+    for (int f = 0; f < NUM_PRESET_FIELDS; f++, next += preset_bytes) batch->preset[f] = next;
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++, next += batch->stride) batch->global[f] = next;
+    return FCB_OK;
+}
+
+void fcb_batch_free(FCBBatch *batch) {
+    if (batch->allocator.free) {
+        batch->allocator.free(batch->block, batch->allocator.user_data);
+    } else {
+        free(batch->block);
+    }
+    batch->block = NULL;
+}
+
+// 16x16 byte transpose: interleaving rows i and i+8, four times over,
+// leaves column j of the input in row j
+static void transpose(Lanes row[FCB_BATCH_LANES]) {
+#pragma GCC unroll 4
+    for (int round = 0; round < 4; round++) {
+        Lanes t[FCB_BATCH_LANES];
+#pragma GCC unroll 8
+        for (int i = 0; i < FCB_BATCH_LANES / 2; i++) {
+            t[2 * i] = SHUFFLE(row[i], row[i + 8], 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+            t[2 * i + 1] = SHUFFLE(row[i], row[i + 8], 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+        }
+        memcpy(row, t, sizeof(t));
+    }
+}
+
+static Lanes extract(const Lanes *bytes, const Extract *e) {
+    Lanes v = bytes[e->position];
+    if (e->is_flag) return ((v >> e->shift) & 1) ^ e->invert;
+    return v & e->mask;
+}
+
+static void decode_block(BatchJob *job, size_t block) {
+    static const uint8_t zero_dump[SYSEX_SIZE];
+    FCBBatch *batch = job->batch;
+    size_t first = block * FCB_BATCH_LANES;
+
+    // Lanes past the end or holding a bad dump read zeros and are
+    // cleared afterwards
+    const uint8_t *lane[FCB_BATCH_LANES];
+    bool blank[FCB_BATCH_LANES];
+    int good = 0;
+    for (int l = 0; l < FCB_BATCH_LANES; l++) {
+        size_t d = first + l;
+        lane[l] = zero_dump;
+        blank[l] = true;
+        if (d >= job->count) continue;
+
+        size_t size = job->sizes ? job->sizes[d] : SYSEX_SIZE;
+        batch->status[d] = fcb_check_sysex(job->dumps[d], size, NULL);
+        if (batch->status[d] != FCB_OK) continue;
+        lane[l] = job->dumps[d];
+        blank[l] = false;
+        good++;
+    }
+
+    Lanes bytes[SYSEX_SIZE];
+    for (size_t offset = 0; offset < SYSEX_SIZE; offset += FCB_BATCH_LANES) {
+        Lanes *rows = &bytes[offset];
+        for (int l = 0; l < FCB_BATCH_LANES; l++) memcpy(&rows[l], lane[l] + offset, FCB_BATCH_LANES);
+        transpose(rows);
+    }
+
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+            Lanes v = extract(bytes, &job->preset_extract[p * NUM_PRESET_FIELDS + f]);
+            memcpy(batch->preset[f] + p * batch->stride + first, &v, FCB_BATCH_LANES);
+        }
+    }
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        Lanes v = extract(bytes, &job->global_extract[f]);
+        memcpy(batch->global[f] + first, &v, FCB_BATCH_LANES);
+    }
+
+    for (int l = 0; good < FCB_BATCH_LANES && l < FCB_BATCH_LANES; l++) {
+        if (!blank[l]) continue;
+        for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+            for (int p = 0; p < NUM_PRESETS; p++) batch->preset[f][p * batch->stride + first + l] = 0;
+        }
+        for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) batch->global[f][first + l] = 0;
+    }
+
+    __atomic_fetch_add(&job->decoded, good, __ATOMIC_RELAXED);
+}
+
+static void decode_chunk(BatchJob *job, size_t chunk) {
+    size_t end = (chunk + 1) * STRUCTS_CHUNK;
+    if (end > job->count) end = job->count;
+
+    size_t good = 0;
+    for (size_t d = chunk * STRUCTS_CHUNK; d < end; d++) {
+        size_t size = job->sizes ? job->sizes[d] : SYSEX_SIZE;
+        FCBStatus status = fcb_decode_sysex(job->dumps[d], size, &job->structs[d], NULL);
+        if (job->status) job->status[d] = status;
+        if (status == FCB_OK) good++;
+    }
+
+    __atomic_fetch_add(&job->decoded, good, __ATOMIC_RELAXED);
+}
+
+static void *batch_worker(void *arg) {
+    BatchJob *job = arg;
+    size_t unit;
+
+    while ((unit = __atomic_fetch_add(&job->next_unit, 1, __ATOMIC_RELAXED)) < job->units) {
+        if (job->batch) {
+            decode_block(job, unit);
+        } else {
+            decode_chunk(job, unit);
+        }
+    }
+    return NULL;
+}
+
+// The calling thread works too; extra threads only when there is work
+// for them, and none at all if they cannot be started
+static void run_job(BatchJob *job, int threads) {
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if ((size_t)threads > job->units) threads = (int)job->units;
+
+    pthread_t thread[MAX_THREADS];
+    int started = 0;
+    while (started < threads - 1 && pthread_create(&thread[started], NULL, batch_worker, job) == 0) started++;
+
+    batch_worker(job);
+    for (int i = 0; i < started; i++) pthread_join(thread[i], NULL);
+}
+
+size_t fcb_decode_batch(const uint8_t *const *dumps, const size_t *sizes, size_t count, FCBBatch *batch,
+                        int threads) {
+    // The extraction table is too big for a worker-sized stack frame
+    BatchJob *job = calloc(1, sizeof(BatchJob));
+    if (!job) {
+        for (size_t d = 0; d < count && d < batch->count; d++) batch->status[d] = FCB_ERR_NOMEM;
+        return 0;
+    }
+    job->dumps = dumps;
+    job->sizes = sizes;
+    job->count = count < batch->count ? count : batch->count;
+    job->batch = batch;
+    job->units = (job->count + FCB_BATCH_LANES - 1) / FCB_BATCH_LANES;
+
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+            Extract *e = &job->preset_extract[p * NUM_PRESET_FIELDS + f];
+            uint8_t bit;
+            e->position = (uint16_t)fcb_field_wire_offset(p, f, &bit);
+            e->shift = bit;
+            e->is_flag = fcb_preset_fields[f].is_flag;
+            e->invert = fcb_preset_fields[f].invert;
+            e->mask = 0x7F;
+        }
+    }
+
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        const FCBGlobalField *g = &fcb_global_fields[f];
+        Extract *e = &job->global_extract[f];
+        e->position = g->wire_offset;
+        e->shift = g->is_flag ? (uint8_t)__builtin_ctz(g->wire_mask) : 0;
+        e->is_flag = g->is_flag;
+        e->invert = 0;
+        e->mask = 0xFF;
+    }
+
+    run_job(job, threads);
+    size_t decoded = job->decoded;
+    free(job);
+    return decoded;
+}
+
+size_t fcb_decode_batch_structs(const uint8_t *const *dumps, const size_t *sizes, size_t count, FCB1010 *out,
+                                FCBStatus *status, int threads) {
+    BatchJob job;
+    memset(&job, 0, sizeof(job));
+    job.dumps = dumps;
+    job.sizes = sizes;
+    job.count = count;
+    job.structs = out;
+    job.status = status;
+    job.units = (count + STRUCTS_CHUNK - 1) / STRUCTS_CHUNK;
+
+    run_job(&job, threads);
+    return job.decoded;
+}
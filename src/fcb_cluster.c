@@ -0,0 +1,169 @@
+/*  Near-duplicate grouping of dumps
+*   A dump is treated as the set of its presets (each hashed together
+*   with its position) plus one element for the global settings, so two
+*   dumps that differ in d presets have a Jaccard similarity of about
+*   (101 - d) / (101 + d). fcb_minhash() sketches that set as
+*   FCB_MINHASH_SIZE minimums of independent hashes; the share of equal
+*   minimums between two sketches estimates their similarity.
+*
+*   fcb_cluster_minhash() never compares all pairs. The sketch is cut
+*   into FCB_LSH_BANDS bands of rows; dumps whose band hashes match in any
+*   band land in the same bucket of a hash table, and only they are
+*   compared, against the first dump of the bucket. Matches above the
+*   threshold are joined with union-find. Each band is one pass over the
+*   dumps, so the whole run is linear in their number.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "fcb.h"
+
+#define LSH_ROWS (FCB_MINHASH_SIZE / FCB_LSH_BANDS)
+#define SHINGLES (NUM_PRESETS + 1)
+#define SAMPLE_SIZE 32  // Members a representative is measured against
+#define NONE UINT32_MAX
+
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ x >> 31;
+}
+
+static uint64_t hash_bytes(uint64_t seed, const uint8_t *bytes, size_t size) {
+    uint64_t h = seed;
+    for (size_t i = 0; i < size; i++) h = (h ^ bytes[i]) * 0x100000001b3ull;
+    return mix(h);
+}
+
+void fcb_minhash(const FCB1010 *fcb, uint32_t signature[FCB_MINHASH_SIZE]) {
+    uint64_t shingles[SHINGLES];
+
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        shingles[p] = hash_bytes(p, (const uint8_t *)&fcb->preset[p], sizeof(FCB1010Preset));
+    }
+    uint8_t globals[NUM_GLOBAL_FIELDS];
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) globals[f] = fcb_get_global_field(fcb, f);
+    shingles[NUM_PRESETS] = hash_bytes(NUM_PRESETS, globals, sizeof(globals));
+
+    for (int k = 0; k < FCB_MINHASH_SIZE; k++) {
+        uint64_t seed = (k + 1) * 0x9e3779b97f4a7c15ull;
+        uint32_t least = UINT32_MAX;
+        for (int s = 0; s < SHINGLES; s++) {
+            uint32_t h = mix(shingles[s] ^ seed) >> 32;
+            if (h < least) least = h;
+        }
+        signature[k] = least;
+    }
+}
+
+double fcb_minhash_similarity(const uint32_t *a, const uint32_t *b) {
+    int equal = 0;
+    for (int k = 0; k < FCB_MINHASH_SIZE; k++) equal += a[k] == b[k];
+    return (double)equal / FCB_MINHASH_SIZE;
+}
+
+static uint32_t find(uint32_t *parent, uint32_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+typedef struct {
+    uint64_t key;
+    uint32_t first;  // NONE when the slot is empty
+} Bucket;
+
+// The member that is on average most like a spread out sample of the
+// group; members must be listed in group
+static uint32_t pick_representative(const uint32_t *signatures, const uint32_t *group, size_t size) {
+    size_t samples = size < SAMPLE_SIZE ? size : SAMPLE_SIZE;
+    uint32_t best = group[0];
+    double best_score = -1;
+
+    for (size_t m = 0; m < size; m++) {
+        const uint32_t *sig = signatures + (size_t)group[m] * FCB_MINHASH_SIZE;
+        double score = 0;
+        for (size_t s = 0; s < samples; s++) {
+            score += fcb_minhash_similarity(sig, signatures + (size_t)group[s * size / samples] * FCB_MINHASH_SIZE);
+        }
+        if (score > best_score) {
+            best_score = score;
+            best = group[m];
+        }
+    }
+    return best;
+}
+
+FCBStatus fcb_cluster_minhash(const uint32_t *signatures, size_t count, double threshold, uint32_t *cluster,
+                              FCBError *error) {
+    if (count >= NONE / 4) return fcb_set_error(error, FCB_ERR_SIZE, 0, 0, 0, "Too many dumps (%zu)", count);
+
+    size_t capacity = 16;
+    while (capacity < count * 2) capacity <<= 1;
+
+    uint32_t *parent = malloc((count ? count : 1) * sizeof(uint32_t));
+    Bucket *buckets = malloc(capacity * sizeof(Bucket));
+    uint32_t *start = calloc(count + 1, sizeof(uint32_t));
+    uint32_t *members = malloc((count ? count : 1) * sizeof(uint32_t));
+    if (!parent || !buckets || !start || !members) {
+        free(parent);
+        free(buckets);
+        free(start);
+        free(members);
+        return fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory clustering %zu dumps", count);
+    }
+    for (size_t i = 0; i < count; i++) parent[i] = i;
+
+    for (int band = 0; band < FCB_LSH_BANDS; band++) {
+        for (size_t b = 0; b < capacity; b++) buckets[b].first = NONE;
+
+        for (size_t i = 0; i < count; i++) {
+            const uint32_t *sig = signatures + i * FCB_MINHASH_SIZE;
+            const uint8_t *rows = (const uint8_t *)(sig + band * LSH_ROWS);
+            uint64_t key = hash_bytes(band, rows, LSH_ROWS * sizeof(uint32_t));
+
+            size_t b = key & (capacity - 1);
+            while (buckets[b].first != NONE && buckets[b].key != key) b = (b + 1) & (capacity - 1);
+            if (buckets[b].first == NONE) {
+                buckets[b].key = key;
+                buckets[b].first = i;
+                continue;
+            }
+
+            uint32_t first = buckets[b].first;
+            uint32_t x = find(parent, i);
+            uint32_t y = find(parent, first);
+            if (x != y &&
+                fcb_minhash_similarity(sig, signatures + (size_t)first * FCB_MINHASH_SIZE) >= threshold) {
+                parent[x < y ? y : x] = x < y ? x : y;
+            }
+        }
+    }
+
+    // Members grouped by root, in index order within each group
+    for (size_t i = 0; i < count; i++) parent[i] = find(parent, i);
+    for (size_t i = 0; i < count; i++) start[parent[i] + 1]++;
+    for (size_t i = 0; i < count; i++) start[i + 1] += start[i];
+    for (size_t i = 0; i < count; i++) members[start[parent[i]]++] = i;
+    for (size_t i = count; i > 0; i--) start[i] = start[i - 1];
+    start[0] = 0;
+
+    for (size_t root = 0; root < count; root++) {
+        size_t size = start[root + 1] - start[root];
+        if (size == 0) continue;
+
+        const uint32_t *group = members + start[root];
+        uint32_t representative = size > 1 ? pick_representative(signatures, group, size) : group[0];
+        for (size_t m = 0; m < size; m++) cluster[group[m]] = representative;
+    }
+
+    free(parent);
+    free(buckets);
+    free(start);
+    free(members);
+    return FCB_OK;
+}
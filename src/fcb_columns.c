@@ -0,0 +1,365 @@
+/*  Column store for dump collections
+*   fcbconv export decodes a whole library of dumps into one file laid
+*   out by column rather than by dump: each preset field is a run of one
+*   byte values over every preset of every dump, and each global setting
+*   a run over the dumps. A question about one field reads only that
+*   field's bytes, in a loop the compiler can vectorise. Readers map the
+*   file and use the columns in place.
+*
+*   File layout, in host byte order (checked on open):
+*       header     magic, byte order mark, counts, where the names are
+*       directory  one FCBColumn per column
+*       columns    each starting on a 64 byte boundary
+*       names      NUL terminated dump names, indexed by the name column
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fcb.h"
+
+#define COLUMNS_MAGIC "FCBCOLS1"
+#define COLUMNS_BYTE_ORDER 0x01020304u
+#define COLUMN_ALIGN 64
+
+typedef struct {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t dump_count;
+    uint32_t column_count;
+    uint32_t reserved;
+    uint64_t names_offset;
+    uint64_t names_size;
+} ColumnsHeader;
+
+// Column order; preset fields and global settings follow their tables
+// in fcb.c
+enum {
+    COLUMN_DUMP,
+    COLUMN_BANK,
+    COLUMN_PRESET,
+    COLUMN_ENABLED_COUNT,
+    COLUMN_FIELDS,
+    COLUMN_NAME = COLUMN_FIELDS + NUM_PRESET_FIELDS,
+    COLUMN_GLOBALS
+};
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} Buffer;
+
+struct FCBColumnWriter {
+    FCBAllocator allocator;
+    uint32_t dump_count;
+    FCBColumn info[FCB_NUM_COLUMNS];
+    Buffer column[FCB_NUM_COLUMNS];
+    Buffer names;
+};
+
+static void *default_alloc(size_t size, void *user_data) {
+    (void)user_data;
+    return malloc(size);
+}
+
+static void default_free(void *ptr, void *user_data) {
+    (void)user_data;
+    free(ptr);
+}
+
+static bool reserve(FCBColumnWriter *writer, Buffer *buffer, size_t extra) {
+    if (buffer->size + extra <= buffer->capacity) return true;
+
+    size_t capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+    while (capacity < buffer->size + extra) capacity *= 2;
+
+    uint8_t *data = writer->allocator.alloc(capacity, writer->allocator.user_data);
+    if (!data) return false;
+    if (buffer->data) {
+        memcpy(data, buffer->data, buffer->size);
+        writer->allocator.free(buffer->data, writer->allocator.user_data);
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
+static void describe(FCBColumn *column, const char *name, uint32_t width, FCBTable table) {
+    snprintf(column->name, sizeof(column->name), "%s", name);
+    column->width = width;
+    column->table = table;
+}
+
+FCBStatus fcb_columns_create(FCBColumnWriter **writer, const FCBAllocator *allocator, FCBError *error) {
+    FCBAllocator heap = {default_alloc, default_free, NULL};
+    if (!allocator) allocator = &heap;
+
+    FCBColumnWriter *w = allocator->alloc(sizeof(FCBColumnWriter), allocator->user_data);
+    if (!w) return fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory");
+    memset(w, 0, sizeof(FCBColumnWriter));
+    w->allocator = *allocator;
+
+    describe(&w->info[COLUMN_DUMP], "dump", 4, FCB_TABLE_PRESETS);
+    describe(&w->info[COLUMN_BANK], "bank", 1, FCB_TABLE_PRESETS);
+    describe(&w->info[COLUMN_PRESET], "preset", 1, FCB_TABLE_PRESETS);
+    describe(&w->info[COLUMN_ENABLED_COUNT], "enabled_count", 1, FCB_TABLE_PRESETS);
+    for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+        describe(&w->info[COLUMN_FIELDS + f], fcb_preset_fields[f].name, 1, FCB_TABLE_PRESETS);
+    }
+    describe(&w->info[COLUMN_NAME], "name", 4, FCB_TABLE_DUMPS);
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        describe(&w->info[COLUMN_GLOBALS + f], fcb_global_fields[f].name, 1, FCB_TABLE_DUMPS);
+    }
+
+    *writer = w;
+    return FCB_OK;
+}
+
+FCBStatus fcb_columns_append(FCBColumnWriter *writer, const char *name, const FCB1010 *fcb, FCBError *error) {
+    if (writer->dump_count >= UINT32_MAX / NUM_PRESETS) {
+        return fcb_set_error(error, FCB_ERR_SIZE, 0, 0, 0, "Too many dumps");
+    }
+
+    size_t name_size = strlen(name) + 1;
+    for (int c = 0; c < FCB_NUM_COLUMNS; c++) {
+        size_t rows = writer->info[c].table == FCB_TABLE_PRESETS ? NUM_PRESETS : 1;
+        if (!reserve(writer, &writer->column[c], rows * writer->info[c].width)) {
+            return fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory");
+        }
+    }
+    if (!reserve(writer, &writer->names, name_size)) {
+        return fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory");
+    }
+
+    uint32_t dump = writer->dump_count;
+    uint32_t *dumps = (uint32_t *)(writer->column[COLUMN_DUMP].data + writer->column[COLUMN_DUMP].size);
+    uint8_t *banks = writer->column[COLUMN_BANK].data + writer->column[COLUMN_BANK].size;
+    uint8_t *presets = writer->column[COLUMN_PRESET].data + writer->column[COLUMN_PRESET].size;
+    uint8_t *enabled = writer->column[COLUMN_ENABLED_COUNT].data + writer->column[COLUMN_ENABLED_COUNT].size;
+    memset(enabled, 0, NUM_PRESETS);
+
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        dumps[p] = dump;
+        banks[p] = (uint8_t)(p / 10 + 1);
+        presets[p] = (uint8_t)(p % 10 + 1);
+    }
+    for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+        uint8_t *values = writer->column[COLUMN_FIELDS + f].data + writer->column[COLUMN_FIELDS + f].size;
+        for (int p = 0; p < NUM_PRESETS; p++) {
+            values[p] = fcb_get_preset_field(&fcb->preset[p], f);
+            if (fcb_preset_fields[f].is_flag) enabled[p] += values[p];
+        }
+    }
+    for (int c = 0; c < COLUMN_NAME; c++) writer->column[c].size += NUM_PRESETS * writer->info[c].width;
+
+    uint32_t name_offset = (uint32_t)writer->names.size;
+    memcpy(writer->column[COLUMN_NAME].data + writer->column[COLUMN_NAME].size, &name_offset, 4);
+    writer->column[COLUMN_NAME].size += 4;
+    memcpy(writer->names.data + writer->names.size, name, name_size);
+    writer->names.size += name_size;
+
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        Buffer *column = &writer->column[COLUMN_GLOBALS + f];
+        column->data[column->size++] = fcb_get_global_field(fcb, f);
+    }
+
+    writer->dump_count++;
+    return FCB_OK;
+}
+
+static size_t align_up(size_t offset) {
+    return (offset + COLUMN_ALIGN - 1) & ~(size_t)(COLUMN_ALIGN - 1);
+}
+
+static bool write_padded(FILE *file, const void *data, size_t size, size_t padded_size) {
+    static const uint8_t zeros[COLUMN_ALIGN];
+    if (size && fwrite(data, 1, size, file) != size) return false;
+    return padded_size == size || fwrite(zeros, 1, padded_size - size, file) == padded_size - size;
+}
+
+// Streams the file to a temporary next to path and renames it into
+// place, like the dump and CSV writers
+FCBStatus fcb_columns_write(FCBColumnWriter *writer, const char *path, FCBError *error) {
+    ColumnsHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COLUMNS_MAGIC, sizeof(header.magic));
+    header.byte_order = COLUMNS_BYTE_ORDER;
+    header.dump_count = writer->dump_count;
+    header.column_count = FCB_NUM_COLUMNS;
+
+    size_t offset = align_up(sizeof(header) + sizeof(writer->info));
+    for (int c = 0; c < FCB_NUM_COLUMNS; c++) {
+        writer->info[c].offset = offset;
+        offset = align_up(offset + writer->column[c].size);
+    }
+    header.names_offset = offset;
+    header.names_size = writer->names.size;
+
+    char temp_path[1024];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path) >= (int)sizeof(temp_path)) {
+        return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Path too long: %s", path);
+    }
+    int fd = mkstemp(temp_path);
+    if (fd < 0) return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to create a file next to %s", path);
+
+    FILE *file = fdopen(fd, "wb");
+    if (!file) {
+        close(fd);
+        unlink(temp_path);
+        return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to write %s", path);
+    }
+
+    bool ok = fchmod(fd, 0644) == 0 && fwrite(&header, sizeof(header), 1, file) == 1 &&
+              write_padded(file, writer->info, sizeof(writer->info),
+                           align_up(sizeof(header) + sizeof(writer->info)) - sizeof(header));
+    for (int c = 0; ok && c < FCB_NUM_COLUMNS; c++) {
+        ok = write_padded(file, writer->column[c].data, writer->column[c].size, align_up(writer->column[c].size));
+    }
+    if (ok) ok = write_padded(file, writer->names.data, writer->names.size, writer->names.size);
+    if (fclose(file) != 0) ok = false;
+
+    if (!ok || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to write %s", path);
+    }
+    return FCB_OK;
+}
+
+void fcb_columns_free(FCBColumnWriter *writer) {
+    if (!writer) return;
+
+    FCBAllocator allocator = writer->allocator;
+    for (int c = 0; c < FCB_NUM_COLUMNS; c++) {
+        if (writer->column[c].data) allocator.free(writer->column[c].data, allocator.user_data);
+    }
+    if (writer->names.data) allocator.free(writer->names.data, allocator.user_data);
+    allocator.free(writer, allocator.user_data);
+}
+
+size_t fcb_columns_rows(const FCBColumns *columns, const FCBColumn *column) {
+    return column->table == FCB_TABLE_PRESETS ? (size_t)columns->dump_count * NUM_PRESETS : columns->dump_count;
+}
+
+FCBStatus fcb_columns_open(const char *path, FCBColumns *columns, FCBError *error) {
+    memset(columns, 0, sizeof(FCBColumns));
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to read file %s", path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ColumnsHeader)) {
+        close(fd);
+        return fcb_set_error(error, FCB_ERR_HEADER, 0, 0, 0, "%s is not a column file", path);
+    }
+
+    size_t size = st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to map %s", path);
+
+    columns->base = map;
+    columns->size = size;
+
+    const ColumnsHeader *header = map;
+    if (memcmp(header->magic, COLUMNS_MAGIC, sizeof(header->magic)) != 0) {
+        fcb_columns_close(columns);
+        return fcb_set_error(error, FCB_ERR_HEADER, 0, 0, 0, "%s is not a column file", path);
+    }
+    if (header->byte_order != COLUMNS_BYTE_ORDER) {
+        fcb_columns_close(columns);
+        return fcb_set_error(error, FCB_ERR_HEADER, 0, 0, 0, "%s was written on a machine of the other byte order", path);
+    }
+
+    columns->dump_count = header->dump_count;
+    columns->column_count = header->column_count;
+    columns->column = (const FCBColumn *)(columns->base + sizeof(ColumnsHeader));
+    columns->names = (const char *)columns->base + header->names_offset;
+    columns->names_size = header->names_size;
+
+    // Everything the accessors hand out must lie inside the mapping
+    bool ok = header->column_count <= (size - sizeof(ColumnsHeader)) / sizeof(FCBColumn) &&
+              header->names_offset <= size && header->names_size <= size - header->names_offset &&
+              (header->names_size == 0 || columns->names[header->names_size - 1] == '\0');
+    for (uint32_t c = 0; ok && c < columns->column_count; c++) {
+        const FCBColumn *column = &columns->column[c];
+        size_t bytes = fcb_columns_rows(columns, column) * column->width;
+        ok = (column->width == 1 || column->width == 4) && column->table <= FCB_TABLE_DUMPS &&
+             column->offset % COLUMN_ALIGN == 0 && column->offset <= size && bytes <= size - column->offset &&
+             memchr(column->name, '\0', sizeof(column->name)) != NULL;
+    }
+    if (!ok) {
+        fcb_columns_close(columns);
+        return fcb_set_error(error, FCB_ERR_SIZE, 0, 0, 0, "%s is truncated or damaged", path);
+    }
+    return FCB_OK;
+}
+
+void fcb_columns_close(FCBColumns *columns) {
+    if (columns->base) munmap((void *)columns->base, columns->size);
+    memset(columns, 0, sizeof(FCBColumns));
+}
+
+const FCBColumn *fcb_columns_find(const FCBColumns *columns, const char *name) {
+    for (uint32_t c = 0; c < columns->column_count; c++) {
+        if (strcmp(columns->column[c].name, name) == 0) return &columns->column[c];
+    }
+    return NULL;
+}
+
+const char *fcb_columns_dump_name(const FCBColumns *columns, uint32_t dump) {
+    const FCBColumn *column = fcb_columns_find(columns, "name");
+    if (!column || column->width != 4 || dump >= columns->dump_count) return "";
+
+    uint32_t offset;
+    memcpy(&offset, columns->base + column->offset + (size_t)dump * 4, 4);
+    return offset < columns->names_size ? columns->names + offset : "";
+}
+
+void fcb_columns_filter(const uint8_t *values, uint8_t value, uint8_t *mask, size_t rows) {
+    for (size_t i = 0; i < rows; i++) mask[i] &= values[i] == value;
+}
+
+// Four interleaved tables, so runs of equal values do not wait on one
+// counter; values are masked to 7 bits to stay in range on bad input
+void fcb_columns_histogram(const uint8_t *values, const uint8_t *mask, size_t rows,
+                           uint64_t counts[FCB_COLUMN_VALUES]) {
+    uint64_t partial[4][FCB_COLUMN_VALUES];
+    memset(partial, 0, sizeof(partial));
+
+    size_t i = 0;
+    if (mask) {
+        for (; i + 4 <= rows; i += 4) {
+            partial[0][values[i] & 0x7F] += mask[i];
+            partial[1][values[i + 1] & 0x7F] += mask[i + 1];
+            partial[2][values[i + 2] & 0x7F] += mask[i + 2];
+            partial[3][values[i + 3] & 0x7F] += mask[i + 3];
+        }
+        for (; i < rows; i++) partial[0][values[i] & 0x7F] += mask[i];
+    } else {
+        for (; i + 4 <= rows; i += 4) {
+            partial[0][values[i] & 0x7F]++;
+            partial[1][values[i + 1] & 0x7F]++;
+            partial[2][values[i + 2] & 0x7F]++;
+            partial[3][values[i + 3] & 0x7F]++;
+        }
+        for (; i < rows; i++) partial[0][values[i] & 0x7F]++;
+    }
+
+    for (int v = 0; v < FCB_COLUMN_VALUES; v++) {
+        counts[v] += partial[0][v] + partial[1][v] + partial[2][v] + partial[3][v];
+    }
+}
+
+void fcb_columns_group_count(const uint8_t *keys, const uint8_t *values, const uint8_t *mask, size_t rows,
+                             uint64_t counts[FCB_COLUMN_VALUES * FCB_COLUMN_VALUES]) {
+    if (mask) {
+        for (size_t i = 0; i < rows; i++) counts[(keys[i] & 0x7F) * FCB_COLUMN_VALUES + (values[i] & 0x7F)] += mask[i];
+    } else {
+        for (size_t i = 0; i < rows; i++) counts[(keys[i] & 0x7F) * FCB_COLUMN_VALUES + (values[i] & 0x7F)]++;
+    }
+}
@@ -0,0 +1,730 @@
+/*  Bulk file I/O
+*   Dumps are tiny, so converting a directory of them one fopen/fread/
+*   fclose at a time spends nearly all its time entering and leaving the
+*   kernel. fcb_process_files() keeps many files in flight at once instead:
+*   each slot walks a file through open, read, close, convert, and then
+*   open, write, close of its output under a temporary name, renamed over
+*   the output once complete. The I/O goes through io_uring when
+*   the kernel has it, with every slot's next step batched into one
+*   io_uring_enter(); otherwise a pool of threads does plain open/pread/
+*   pwrite. Either way the convert stage runs in the pipeline's own thread
+*   while the other files' I/O carries on, so callers need no locking.
+*   When converting costs more than the I/O, several pipelines (shards)
+*   split the files between them, each with a ring or pool of its own.
+*
+*   io_uring is driven with raw system calls against the kernel header, so
+*   there is no library dependency.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "fcb.h"
+
+#define MAX_DEPTH 4096
+#define MAX_THREADS 64
+#define NONE UINT32_MAX
+
+typedef enum {
+    SLOT_IDLE,
+    SLOT_OPEN_INPUT,
+    SLOT_READ,
+    SLOT_CLOSE_INPUT,
+    SLOT_OPEN_OUTPUT,
+    SLOT_WRITE,
+    SLOT_CLOSE_OUTPUT,
+    SLOT_RENAME_OUTPUT
+} SlotState;
+
+typedef struct {
+    size_t file;
+    SlotState state;
+    int fd;
+    uint8_t *in;          // read_size + 1 bytes, so a longer file shows
+    size_t in_length;
+    uint8_t *out;         // write_size bytes
+    size_t out_length;
+    size_t written;
+    char temp[1024];      // What the output is written as until it is complete
+    unsigned attempts;    // Temporary names tried so far
+    FCBError error;
+    uint32_t next;        // Queue link, for the thread pool
+} Slot;
+
+typedef struct Job Job;
+
+struct Job {
+    const char *const *inputs;
+    const char *const *outputs;
+    size_t count;         // Files in this job, starting at next_file
+    size_t end;
+    const FCBFileJob *options;
+    unsigned depth;
+    Slot *slots;
+    uint8_t *buffers;
+    uint32_t *waiting;    // With ordered, read slots by file % depth
+    size_t next_file;     // Next file to start
+    size_t next_convert;  // With ordered, the file that converts next
+    size_t finished;
+    size_t succeeded;
+    void (*start_output)(Job *job, Slot *slot);
+    void (*release)(Job *job, Slot *slot);
+    void *backend;
+};
+
+static FCBStatus io_error(Slot *slot, const char *what, const char *path, int err) {
+    return fcb_set_error(&slot->error, FCB_ERR_IO, 0, 0, 0, "Failed to %s %s: %s", what, path, strerror(err));
+}
+
+// Callers report it against the input path, so it is not repeated here
+static FCBStatus too_large(Job *job, Slot *slot) {
+    return fcb_set_error(&slot->error, FCB_ERR_SIZE, 0, 0, 0, "Larger than %zu bytes", job->options->read_size);
+}
+
+// The output is written next to itself and then renamed over it, as
+// fcb_write_file() does. The temporary is created with O_EXCL, so it is
+// never a file or symlink someone else put there; on EEXIST the next
+// name is tried.
+#define TEMP_ATTEMPTS 100
+#define TEMP_FLAGS (O_WRONLY | O_CREAT | O_EXCL)
+
+static bool make_temp_name(Job *job, Slot *slot) {
+    const char *path = job->outputs[slot->file];
+    int n = snprintf(slot->temp, sizeof(slot->temp), "%s.%d.%zu.%u.tmp", path, (int)getpid(), slot->file,
+                     slot->attempts++);
+    if (n < (int)sizeof(slot->temp)) return true;
+
+    fcb_set_error(&slot->error, FCB_ERR_IO, 0, 0, 0, "Path too long: %s", path);
+    return false;
+}
+
+static void finish(Job *job, Slot *slot) {
+    if (job->options->finish) job->options->finish(slot->file, &slot->error, job->options->user_data);
+    if (slot->error.status == FCB_OK) job->succeeded++;
+    job->finished++;
+    slot->state = SLOT_IDLE;
+    if (job->release) job->release(job, slot);
+}
+
+static void convert(Job *job, Slot *slot) {
+    const FCBFileJob *o = job->options;
+
+    slot->out_length = 0;
+    if (slot->error.status == FCB_OK && o->convert) {
+        o->convert(slot->file, slot->in, slot->in_length, slot->out, o->write_size, &slot->out_length, &slot->error,
+                   o->user_data);
+    }
+
+    if (slot->error.status == FCB_OK && job->outputs && job->outputs[slot->file] && slot->out_length > 0) {
+        slot->written = 0;
+        slot->attempts = 0;
+        job->start_output(job, slot);
+    } else {
+        finish(job, slot);
+    }
+}
+
+// A slot's input is in. With ordered it waits until every earlier file
+// has been converted, so the stage sees the files in input order; at
+// most depth files are unfinished, so they have a place each in waiting.
+static void input_ready(Job *job, Slot *slot) {
+    if (!job->options->ordered) {
+        convert(job, slot);
+        return;
+    }
+
+    job->waiting[slot->file % job->depth] = slot - job->slots;
+    uint32_t *next;
+    while (*(next = &job->waiting[job->next_convert % job->depth]) != NONE) {
+        Slot *s = &job->slots[*next];
+        *next = NONE;
+        job->next_convert++;
+        convert(job, s);
+    }
+}
+
+// Set a slot up for the next file; false once every file has been started
+static bool start_file(Job *job, Slot *slot) {
+    if (job->next_file == job->end) return false;
+
+    slot->file = job->next_file++;
+    slot->fd = -1;
+    slot->in_length = 0;
+    slot->error.status = FCB_OK;
+    return true;
+}
+
+// io_uring backend
+
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned pending;  // Queued but not yet submitted
+} Ring;
+
+static void ring_close(Ring *ring) {
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0) close(ring->fd);
+}
+
+// The kernel must know every opcode we use; older ones stop at READ
+static bool ring_has_ops(Ring *ring) {
+    static const uint8_t needed[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE,
+                                      IORING_OP_RENAMEAT };
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (!probe) return false;
+
+    bool ok = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (size_t i = 0; ok && i < sizeof(needed); i++) {
+        ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+static bool ring_open(Ring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(ring, 0, sizeof(Ring));
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return false;
+
+    ring->entries = params.sq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) ring->sq_ring = NULL;
+    ring->cq_ring = single ? ring->sq_ring
+                           : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                  ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED) ring->cq_ring = NULL;
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) ring->sqes = NULL;
+
+    if (!ring->sq_ring || !ring->cq_ring || !ring->sqes || !ring_has_ops(ring)) {
+        ring_close(ring);
+        return false;
+    }
+
+    uint8_t *sq = ring->sq_ring;
+    uint8_t *cq = ring->cq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+// Each slot has at most one request in flight and the ring has an entry
+// per slot, so there is always room
+static struct io_uring_sqe *queue_sqe(Ring *ring, Slot *slot, Job *job, uint8_t opcode, int fd) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = slot - job->slots;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+    return sqe;
+}
+
+static void queue_open(Ring *ring, Job *job, Slot *slot, const char *path, int flags) {
+    struct io_uring_sqe *sqe = queue_sqe(ring, slot, job, IORING_OP_OPENAT, AT_FDCWD);
+    sqe->addr = (uintptr_t)path;
+    sqe->len = 0644;
+    sqe->open_flags = flags | O_CLOEXEC;
+}
+
+static void queue_read(Ring *ring, Job *job, Slot *slot) {
+    struct io_uring_sqe *sqe = queue_sqe(ring, slot, job, IORING_OP_READ, slot->fd);
+    sqe->addr = (uintptr_t)(slot->in + slot->in_length);
+    sqe->len = job->options->read_size + 1 - slot->in_length;
+    sqe->off = slot->in_length;
+}
+
+static void queue_write(Ring *ring, Job *job, Slot *slot) {
+    struct io_uring_sqe *sqe = queue_sqe(ring, slot, job, IORING_OP_WRITE, slot->fd);
+    sqe->addr = (uintptr_t)(slot->out + slot->written);
+    sqe->len = slot->out_length - slot->written;
+    sqe->off = slot->written;
+}
+
+static void queue_close(Ring *ring, Job *job, Slot *slot, SlotState state) {
+    queue_sqe(ring, slot, job, IORING_OP_CLOSE, slot->fd);
+    slot->state = state;
+}
+
+static void queue_rename(Ring *ring, Job *job, Slot *slot) {
+    struct io_uring_sqe *sqe = queue_sqe(ring, slot, job, IORING_OP_RENAMEAT, AT_FDCWD);
+    sqe->addr = (uintptr_t)slot->temp;
+    sqe->len = AT_FDCWD;
+    sqe->addr2 = (uintptr_t)job->outputs[slot->file];
+    slot->state = SLOT_RENAME_OUTPUT;
+}
+
+static void ring_start_output(Job *job, Slot *slot) {
+    if (!make_temp_name(job, slot)) {
+        finish(job, slot);
+        return;
+    }
+    slot->state = SLOT_OPEN_OUTPUT;
+    queue_open(job->backend, job, slot, slot->temp, TEMP_FLAGS);
+}
+
+// Move a slot on by one step, given the result of its last request
+static void ring_advance(Ring *ring, Job *job, Slot *slot, int res) {
+    switch (slot->state) {
+        case SLOT_OPEN_INPUT:
+            if (res < 0) {
+                io_error(slot, "open", job->inputs[slot->file], -res);
+                finish(job, slot);
+                break;
+            }
+            slot->fd = res;
+            slot->state = SLOT_READ;
+            queue_read(ring, job, slot);
+            break;
+        case SLOT_READ:
+            if (res < 0) {
+                io_error(slot, "read", job->inputs[slot->file], -res);
+            } else if (res > 0 && (slot->in_length += res) > job->options->read_size) {
+                too_large(job, slot);
+            } else if (res > 0) {
+                queue_read(ring, job, slot);
+                break;
+            }
+            queue_close(ring, job, slot, SLOT_CLOSE_INPUT);
+            break;
+        case SLOT_CLOSE_INPUT:
+            input_ready(job, slot);
+            break;
+        case SLOT_OPEN_OUTPUT:
+            if (res == -EEXIST && slot->attempts < TEMP_ATTEMPTS) {
+                ring_start_output(job, slot);
+                break;
+            }
+            if (res < 0) {
+                io_error(slot, "create", job->outputs[slot->file], -res);
+                finish(job, slot);
+                break;
+            }
+            slot->fd = res;
+            slot->state = SLOT_WRITE;
+            queue_write(ring, job, slot);
+            break;
+        case SLOT_WRITE:
+            if (res <= 0) {
+                io_error(slot, "write", job->outputs[slot->file], res < 0 ? -res : ENOSPC);
+            } else if ((slot->written += res) < slot->out_length) {
+                queue_write(ring, job, slot);
+                break;
+            }
+            queue_close(ring, job, slot, SLOT_CLOSE_OUTPUT);
+            break;
+        case SLOT_CLOSE_OUTPUT:
+            if (res < 0 && slot->error.status == FCB_OK) io_error(slot, "write", job->outputs[slot->file], -res);
+            if (slot->error.status == FCB_OK) {
+                queue_rename(ring, job, slot);
+                break;
+            }
+            unlink(slot->temp);
+            finish(job, slot);
+            break;
+        case SLOT_RENAME_OUTPUT:
+            if (res < 0) {
+                io_error(slot, "replace", job->outputs[slot->file], -res);
+                unlink(slot->temp);
+            }
+            finish(job, slot);
+            break;
+        default:
+            break;
+    }
+}
+
+static bool run_ring(Job *job) {
+    Ring ring;
+    if (!ring_open(&ring, job->depth)) return false;
+
+    job->backend = &ring;
+    job->start_output = ring_start_output;
+
+    while (job->finished < job->count) {
+        for (unsigned i = 0; i < job->depth; i++) {
+            Slot *slot = &job->slots[i];
+            if (slot->state != SLOT_IDLE || !start_file(job, slot)) continue;
+            slot->state = SLOT_OPEN_INPUT;
+            queue_open(&ring, job, slot, job->inputs[slot->file], O_RDONLY);
+        }
+
+        long submitted = syscall(__NR_io_uring_enter, ring.fd, ring.pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            break;  // The ring is unusable; what is left is reported below
+        }
+        ring.pending -= submitted;
+
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            ring_advance(&ring, job, &job->slots[cqe->user_data], cqe->res);
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    // Only reached early if io_uring_enter() itself failed
+    for (unsigned i = 0; i < job->depth; i++) {
+        Slot *slot = &job->slots[i];
+        if (slot->state == SLOT_IDLE) continue;
+        fcb_set_error(&slot->error, FCB_ERR_IO, 0, 0, 0, "io_uring failed: %s", strerror(errno));
+        finish(job, slot);
+    }
+    while (start_file(job, &job->slots[0])) {
+        fcb_set_error(&job->slots[0].error, FCB_ERR_IO, 0, 0, 0, "io_uring failed: %s", strerror(errno));
+        finish(job, &job->slots[0]);
+    }
+
+    ring_close(&ring);
+    return true;
+}
+
+// Thread pool backend. Workers take writes first, then new files while
+// a slot is free; the calling thread converts what they read.
+
+typedef struct {
+    uint32_t head;
+    uint32_t tail;
+} SlotQueue;
+
+typedef struct {
+    Job *job;
+    pthread_mutex_t lock;
+    pthread_cond_t work;     // Workers wait on it
+    pthread_cond_t done;     // The calling thread waits on it
+    SlotQueue free_slots;
+    SlotQueue writes;
+    SlotQueue completed;
+    bool stopping;
+} Pool;
+
+static void push(Job *job, SlotQueue *queue, Slot *slot) {
+    uint32_t index = slot - job->slots;
+    slot->next = NONE;
+    if (queue->tail != NONE) {
+        job->slots[queue->tail].next = index;
+    } else {
+        queue->head = index;
+    }
+    queue->tail = index;
+}
+
+static Slot *pop(Job *job, SlotQueue *queue) {
+    if (queue->head == NONE) return NULL;
+
+    Slot *slot = &job->slots[queue->head];
+    queue->head = slot->next;
+    if (queue->head == NONE) queue->tail = NONE;
+    return slot;
+}
+
+static void read_input(Job *job, Slot *slot) {
+    const char *path = job->inputs[slot->file];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        io_error(slot, "open", path, errno);
+        return;
+    }
+
+    size_t room = job->options->read_size + 1;
+    ssize_t len;
+    while ((len = pread(fd, slot->in + slot->in_length, room - slot->in_length, slot->in_length)) != 0) {
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            io_error(slot, "read", path, errno);
+            break;
+        }
+        if ((slot->in_length += len) > job->options->read_size) {
+            too_large(job, slot);
+            break;
+        }
+    }
+    close(fd);
+}
+
+static void write_output(Job *job, Slot *slot) {
+    const char *path = job->outputs[slot->file];
+    int fd = -1;
+    do {
+        if (!make_temp_name(job, slot)) return;
+        fd = open(slot->temp, TEMP_FLAGS | O_CLOEXEC, 0644);
+    } while (fd < 0 && errno == EEXIST && slot->attempts < TEMP_ATTEMPTS);
+    if (fd < 0) {
+        io_error(slot, "create", path, errno);
+        return;
+    }
+
+    while (slot->written < slot->out_length) {
+        ssize_t len = pwrite(fd, slot->out + slot->written, slot->out_length - slot->written, slot->written);
+        if (len < 0 && errno == EINTR) continue;
+        if (len <= 0) {
+            io_error(slot, "write", path, len < 0 ? errno : ENOSPC);
+            break;
+        }
+        slot->written += len;
+    }
+    if (close(fd) != 0 && slot->error.status == FCB_OK) io_error(slot, "write", path, errno);
+
+    if (slot->error.status == FCB_OK && rename(slot->temp, path) != 0) io_error(slot, "replace", path, errno);
+    if (slot->error.status != FCB_OK) unlink(slot->temp);
+}
+
+// Next thing for a worker to do, with the lock held: a write, or else a
+// new file if a slot is free
+static Slot *take_work(Pool *pool) {
+    Job *job = pool->job;
+    Slot *slot = pop(job, &pool->writes);
+
+    if (!slot && job->next_file < job->end && (slot = pop(job, &pool->free_slots))) {
+        start_file(job, slot);
+        slot->state = SLOT_READ;
+    }
+    return slot;
+}
+
+static void do_work(Job *job, Slot *slot) {
+    if (slot->state == SLOT_READ) {
+        read_input(job, slot);
+    } else {
+        write_output(job, slot);
+    }
+}
+
+static void *pool_worker(void *arg) {
+    Pool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stopping) {
+        Slot *slot = take_work(pool);
+        if (!slot) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+        do_work(pool->job, slot);
+        pthread_mutex_lock(&pool->lock);
+        push(pool->job, &pool->completed, slot);
+        pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static void pool_start_output(Job *job, Slot *slot) {
+    Pool *pool = job->backend;
+
+    pthread_mutex_lock(&pool->lock);
+    slot->state = SLOT_WRITE;
+    push(job, &pool->writes, slot);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void pool_release(Job *job, Slot *slot) {
+    Pool *pool = job->backend;
+
+    pthread_mutex_lock(&pool->lock);
+    push(job, &pool->free_slots, slot);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void run_pool(Job *job, int threads) {
+    Pool pool = { .job = job, .stopping = false };
+    pool.free_slots.head = pool.free_slots.tail = NONE;
+    pool.writes = pool.completed = pool.free_slots;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.work, NULL);
+    pthread_cond_init(&pool.done, NULL);
+    for (unsigned i = 0; i < job->depth; i++) push(job, &pool.free_slots, &job->slots[i]);
+
+    job->backend = &pool;
+    job->start_output = pool_start_output;
+    job->release = pool_release;
+
+    if (threads <= 0) threads = 2 * (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    pthread_t thread[MAX_THREADS];
+    int started = 0;
+    while (started < threads && pthread_create(&thread[started], NULL, pool_worker, &pool) == 0) started++;
+
+    pthread_mutex_lock(&pool.lock);
+    while (job->finished < job->count) {
+        Slot *slot = pop(job, &pool.completed);
+        if (!slot && started == 0 && (slot = take_work(&pool))) {
+            // No thread could be started, so the I/O happens here
+            pthread_mutex_unlock(&pool.lock);
+            do_work(job, slot);
+            pthread_mutex_lock(&pool.lock);
+        }
+        if (!slot) {
+            pthread_cond_wait(&pool.done, &pool.lock);
+            continue;
+        }
+
+        // The convert stage runs unlocked, in this thread only
+        pthread_mutex_unlock(&pool.lock);
+        if (slot->state == SLOT_READ) {
+            input_ready(job, slot);
+        } else {
+            finish(job, slot);
+        }
+        pthread_mutex_lock(&pool.lock);
+    }
+    pool.stopping = true;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (int i = 0; i < started; i++) pthread_join(thread[i], NULL);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.work);
+    pthread_cond_destroy(&pool.done);
+}
+
+typedef struct {
+    const char *const *inputs;
+    const char *const *outputs;
+    size_t first;
+    size_t count;
+    const FCBFileJob *options;
+    FCBFileBackend used;
+    FCBStatus status;
+    FCBError error;
+} Shard;
+
+static void *run_shard(void *arg) {
+    Shard *shard = arg;
+    const FCBFileJob *options = shard->options;
+    Job job;
+    memset(&job, 0, sizeof(job));
+    job.inputs = shard->inputs;
+    job.outputs = shard->outputs;
+    job.count = shard->count;
+    job.next_file = job.next_convert = shard->first;
+    job.end = shard->first + shard->count;
+    job.options = options;
+    job.depth = options->depth ? options->depth : FCB_FILES_DEPTH;
+    if (job.depth > MAX_DEPTH) job.depth = MAX_DEPTH;
+    if (job.depth > job.count) job.depth = job.count ? job.count : 1;
+
+    size_t read_room = options->read_size + 1;
+    size_t write_room = options->write_size;
+    job.slots = calloc(job.depth, sizeof(Slot));
+    job.waiting = malloc(job.depth * sizeof(uint32_t));
+    job.buffers = malloc(job.depth * (read_room + write_room));
+    shard->status = FCB_OK;
+
+    if (!job.slots || !job.waiting || !job.buffers) {
+        shard->status = fcb_set_error(&shard->error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory for %u files in flight",
+                                      job.depth);
+    } else {
+        memset(job.waiting, 0xff, job.depth * sizeof(uint32_t));
+        for (unsigned i = 0; i < job.depth; i++) {
+            job.slots[i].in = job.buffers + i * (read_room + write_room);
+            job.slots[i].out = job.slots[i].in + read_room;
+        }
+
+        shard->used = FCB_FILES_THREADS;
+        if (options->backend != FCB_FILES_THREADS && run_ring(&job)) {
+            shard->used = FCB_FILES_URING;
+        } else if (options->backend == FCB_FILES_URING) {
+            shard->status = fcb_set_error(&shard->error, FCB_ERR_IO, 0, 0, 0, "io_uring is not available");
+        } else {
+            run_pool(&job, options->threads);
+        }
+    }
+
+    free(job.slots);
+    free(job.waiting);
+    free(job.buffers);
+    return NULL;
+}
+
+FCBStatus fcb_process_files(const char *const *inputs, const char *const *outputs, size_t count,
+                            const FCBFileJob *options, FCBFileBackend *used, FCBError *error) {
+    int shards = options->shards > 1 ? options->shards : 1;
+    if (shards > MAX_THREADS) shards = MAX_THREADS;
+    if ((size_t)shards > count) shards = count ? (int)count : 1;
+
+    Shard shard[MAX_THREADS];
+    pthread_t thread[MAX_THREADS];
+    bool started[MAX_THREADS];
+    for (int i = 0; i < shards; i++) {
+        size_t first = count * i / shards;
+        shard[i] = (Shard){ .inputs = inputs, .outputs = outputs, .first = first,
+                            .count = count * (i + 1) / shards - first, .options = options };
+    }
+
+    // The calling thread runs the first share; a shard that cannot get a
+    // thread of its own runs there too, afterwards
+    for (int i = 1; i < shards; i++) started[i] = pthread_create(&thread[i], NULL, run_shard, &shard[i]) == 0;
+    run_shard(&shard[0]);
+    for (int i = 1; i < shards; i++) {
+        if (started[i]) {
+            pthread_join(thread[i], NULL);
+        } else {
+            run_shard(&shard[i]);
+        }
+    }
+
+    if (used) *used = shard[0].used;
+    for (int i = 0; i < shards; i++) {
+        if (shard[i].status != FCB_OK) {
+            if (error) *error = shard[i].error;
+            return shard[i].status;
+        }
+    }
+    return FCB_OK;
+}
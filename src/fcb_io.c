@@ -12,88 +12,67 @@
 #include "ui_ncurses.h"
 #include "fcb_io.h"
 
-void handle_parse_and_inspect() {
-    char sysex_filename[512];
-    snprintf(sysex_filename, sizeof(sysex_filename), "%s/.fcb1010/dump.syx", getenv("HOME"));
+// Read and parse a dump file without touching the screen
+bool load_sysex_file(const char *filename, FCB1010 *fcb) {
+    uint8_t sysex_data[SYSEX_SIZE];
+    if (fcb_read_sysex_file(filename, sysex_data, NULL) != FCB_OK) return false;
 
-    FILE *sysex_file = fopen(sysex_filename, "rb");
-    if (!sysex_file) {
-        printw("Failed to open SysEx file: %s\n", sysex_filename);
-        refresh();
-        getch();
-        return;
-    }
+    return fcb_decode_sysex(sysex_data, SYSEX_SIZE, fcb, NULL) == FCB_OK;
+}
 
-    uint8_t sysex_data[SYSEX_SIZE];
-    size_t read_size = fread(sysex_data, 1, SYSEX_SIZE, sysex_file);
-    fclose(sysex_file);
+// Read and decode a dump, reporting any problem on the status line
+static bool open_sysex_file(const char *filename, uint8_t *data, FCB1010 *fcb) {
+    FCBError error;
 
-    if (read_size != SYSEX_SIZE) {
-        printw("Error: SysEx file size does not match expected size\n");
-        refresh();
-        getch();
-        return;
+    if (fcb_read_sysex_file(filename, data, &error) != FCB_OK ||
+        fcb_decode_sysex(data, SYSEX_SIZE, fcb, &error) != FCB_OK) {
+        ui_message("Failed to read SysEx file: %s", error.message);
+        return false;
     }
+    return true;
+}
 
+// Open a dump in the preset grid for browsing and editing
+void inspect_sysex_file(const char *filename) {
+    uint8_t sysex_data[SYSEX_SIZE];
     FCB1010 fcb;
-    init_fcb1010(&fcb);
+    if (!open_sysex_file(filename, sysex_data, &fcb)) return;
 
-    if (!parse_sysex(&fcb, sysex_data, SYSEX_SIZE)) {
-        printw("Failed to parse SysEx data\n");
-        refresh();
-        getch();
-        return;
-    }
-
-    print_fcb1010(&fcb);  // Function to display the parsed FCB1010 data
+    print_fcb1010(&fcb, sysex_data, filename);  // Browse and edit the parsed FCB1010 data
 }
 
-void handle_create_csv() {
+void handle_parse_and_inspect() {
     char sysex_filename[512];
     snprintf(sysex_filename, sizeof(sysex_filename), "%s/.fcb1010/dump.syx", getenv("HOME"));
 
-    FILE *sysex_file = fopen(sysex_filename, "rb");
-    if (!sysex_file) {
-        printw("Failed to open SysEx file: %s\n", sysex_filename);
-        refresh();
-        getch();
-        return;
-    }
+    inspect_sysex_file(sysex_filename);
+}
 
-    uint8_t sysex_data[SYSEX_SIZE];
-    size_t read_size = fread(sysex_data, 1, SYSEX_SIZE, sysex_file);
-    fclose(sysex_file);
+void handle_browse_backups() {
+    char backup_dir[512];
+    snprintf(backup_dir, sizeof(backup_dir), "%s/.fcb1010/backups", getenv("HOME"));
 
-    if (read_size != SYSEX_SIZE) {
-        printw("Error: SysEx file size does not match expected size\n");
-        refresh();
-        getch();
-        return;
-    }
+    browse_library(backup_dir);
+}
 
-    FCB1010 fcb;
-    init_fcb1010(&fcb);
+void handle_create_csv() {
+    char sysex_filename[512];
+    snprintf(sysex_filename, sizeof(sysex_filename), "%s/.fcb1010/dump.syx", getenv("HOME"));
 
-    if (!parse_sysex(&fcb, sysex_data, SYSEX_SIZE)) {
-        printw("Failed to parse SysEx data\n");
-        refresh();
-        getch();
-        return;
-    }
+    uint8_t sysex_data[SYSEX_SIZE];
+    FCB1010 fcb;
+    if (!open_sysex_file(sysex_filename, sysex_data, &fcb)) return;
 
     char csv_filename[512];
     snprintf(csv_filename, sizeof(csv_filename), "%s/.fcb1010/fcb1010.csv", getenv("HOME"));
 
-    if (!write_csv(&fcb, csv_filename)) {
-        printw("Failed to write CSV file: %s\n", csv_filename);
-        refresh();
-        getch();
+    FCBError error;
+    if (fcb_write_csv_file(csv_filename, &fcb, &error) != FCB_OK) {
+        ui_message("Failed to write CSV file: %s", error.message);
         return;
     }
 
-    printw("CSV file written successfully. Press any key to return to the main menu.\n");
-    refresh();
-    getch();
+    ui_message("CSV file written successfully.");
 }
 
 
@@ -110,14 +89,11 @@ void create_fcb_home_dir() {
 
 void csv_to_sysex() {
     FCB1010 fcb;
-    init_fcb1010(&fcb);
 
     // Get the home directory
     const char *home_dir = getenv("HOME");
     if (!home_dir) {
-        printw("Failed to get home directory.\n");
-        refresh();
-        getch();
+        ui_message("Failed to get home directory.");
         return;
     }
 
@@ -126,10 +102,13 @@ void csv_to_sysex() {
     snprintf(csv_filename, sizeof(csv_filename), "%s/.fcb1010/fcb1010.csv", home_dir);
 
     // Load CSV into FCB1010 structure
-    if (!load_csv(&fcb, csv_filename)) {
-        printw("Failed to load CSV file: %s\n", csv_filename);
-        refresh();
-        getch();
+    FCBError error;
+    if (fcb_read_csv_file(csv_filename, &fcb, NULL, &error) != FCB_OK) {
+        if (error.line > 0) {
+            ui_message("%s:%d: %s", csv_filename, error.line, error.message);
+        } else {
+            ui_message("Failed to load CSV file: %s", error.message);
+        }
         return;
     }
 
@@ -137,27 +116,33 @@ void csv_to_sysex() {
     char sysex_filename[512];
     snprintf(sysex_filename, sizeof(sysex_filename), "%s/.fcb1010/dump.syx", home_dir);
 
-    FILE *sysex_file = fopen(sysex_filename, "wb");
-    if (!sysex_file) {
-        printw("Failed to open SysEx file for writing: %s\n", sysex_filename);
-        refresh();
-        getch();
+    // Patch the CSV onto the current dump when there is a valid one, so
+    // bytes the CSV does not cover survive. Either way nothing is written
+    // until the new dump is complete, so a bad CSV cannot clobber it.
+    uint8_t sysex_data[SYSEX_SIZE];
+    FCBError read_error;
+    if (fcb_read_sysex_file(sysex_filename, sysex_data, &read_error) == FCB_OK &&
+        fcb_check_sysex(sysex_data, sizeof(sysex_data), &read_error) == FCB_OK) {
+        size_t changed;
+        if (fcb_overlay_sysex(&fcb, sysex_data, sizeof(sysex_data), &changed, NULL, &error) != FCB_OK) {
+            ui_message("Failed to generate SysEx data: %s", error.message);
+            return;
+        }
+        if (changed == 0) {
+            ui_message("SysEx data is already up to date.");
+            return;
+        }
+    } else if (fcb_encode_sysex(&fcb, sysex_data, sizeof(sysex_data), &error) != FCB_OK) {
+        ui_message("Failed to generate SysEx data: %s", error.message);
         return;
     }
 
-    uint8_t sysex_data[SYSEX_SIZE];
-    memset(sysex_data, 0, SYSEX_SIZE);  // Clear the SysEx data array
-
-    if (get_raw_sysex(&fcb, sysex_data)) {
-        fwrite(sysex_data, 1, SYSEX_SIZE, sysex_file);
-        printw("SysEx data generated and saved successfully.\n");
-    } else {
-        printw("Failed to generate SysEx data.\n");
+    if (fcb_write_sysex_file(sysex_filename, sysex_data, &error) != FCB_OK) {
+        ui_message("Failed to write SysEx file: %s", error.message);
+        return;
     }
 
-    fclose(sysex_file);
-    refresh();
-    getch();
+    ui_message("SysEx data generated and saved successfully.");
 }
 
 void backup_sysex_file() {
@@ -170,9 +155,7 @@ void backup_sysex_file() {
     // Get the home directory
     const char *home_dir = getenv("HOME");
     if (!home_dir) {
-        printw("Failed to get home directory.\n");
-        refresh();
-        getch();
+        ui_message("Failed to get home directory.");
         return;
     }
 
@@ -185,18 +168,14 @@ void backup_sysex_file() {
 
     FILE *source_file = fopen(source_path, "rb");
     if (!source_file) {
-        printw("Failed to open source SysEx file for reading: %s\n", source_path);
-        refresh();
-        getch();
+        ui_message("Failed to open source SysEx file for reading: %s", source_path);
         return;
     }
 
     FILE *destination_file = fopen(backup_path, "wb");
     if (!destination_file) {
-        printw("Failed to open destination SysEx file for writing: %s\n", backup_path);
+        ui_message("Failed to open destination SysEx file for writing: %s", backup_path);
         fclose(source_file);
-        refresh();
-        getch();
         return;
     }
 
@@ -205,26 +184,22 @@ void backup_sysex_file() {
 
     while ((bytes_read = fread(buffer, 1, sizeof(buffer), source_file)) > 0) {
         if (fwrite(buffer, 1, bytes_read, destination_file) != bytes_read) {
-            printw("Failed to write to destination SysEx file: %s\n", backup_path);
+            ui_message("Failed to write to destination SysEx file: %s", backup_path);
             fclose(source_file);
             fclose(destination_file);
-            refresh();
-            getch();
             return;
         }
     }
 
     if (ferror(source_file)) {
-        printw("Error reading source SysEx file.\n");
+        ui_message("Error reading source SysEx file.");
     } else if (ferror(destination_file)) {
-        printw("Error writing to destination SysEx file.\n");
+        ui_message("Error writing to destination SysEx file.");
     } else {
-        printw("SysEx dump copied successfully to %s.\n", backup_path);
+        ui_message("SysEx dump copied successfully to %s.", backup_path);
     }
 
     fclose(source_file);
     fclose(destination_file);
-    refresh();
-    getch();
 }
 
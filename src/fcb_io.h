@@ -1,10 +1,17 @@
 #ifndef FCB_IO_H
 #define FCB_IO_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include "fcb.h"
+
 void handle_parse_and_inspect();
+void inspect_sysex_file(const char *filename);
+void handle_browse_backups();
 void handle_create_csv();
 void csv_to_sysex();
 void backup_sysex_file();
 void create_fcb_home_dir();
+bool load_sysex_file(const char *filename, FCB1010 *fcb);
 
 #endif
@@ -0,0 +1,734 @@
+/*  NDJSON export and import
+*   A dump becomes one JSON object per line: a "globals" record, then a
+*   "preset" record for each preset, keyed by the names in
+*   fcb_global_fields and fcb_preset_fields. Flags are true or false.
+*
+*   The writer is a small SAX-style emitter: calls append keys and values
+*   straight into the caller's buffer, with no tree and no allocation, so
+*   a whole archive can be streamed through one buffer. The reader is a
+*   pull parser that hands out one token at a time from a buffer, and
+*   fcb_parse_ndjson() drives it one record at a time.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fcb.h"
+
+#define NDJSON_MAX_FILE_SIZE (16 * 1024 * 1024)
+
+// What the reader will accept next
+enum {
+    EXPECT_RECORD,        // A top level value, after any blank lines
+    EXPECT_VALUE,         // After a colon, or a comma in an array
+    EXPECT_VALUE_OR_END,  // Right after [
+    EXPECT_KEY,           // After a comma in an object
+    EXPECT_KEY_OR_END,    // Right after {
+    EXPECT_COMMA_OR_END,  // After a value in an object or array
+    EXPECT_LINE_END       // After a complete top level value
+};
+
+static void put(FCBJsonWriter *w, const char *text, size_t length) {
+    if (w->length + length <= w->size) memcpy(w->out + w->length, text, length);
+    w->length += length;
+}
+
+static void put_char(FCBJsonWriter *w, char c) {
+    if (w->length < w->size) w->out[w->length] = c;
+    w->length++;
+}
+
+// Comma before anything but the first item of an object or array, and
+// nothing between a key and its value
+static void separate(FCBJsonWriter *w) {
+    if (w->after_key) {
+        w->after_key = false;
+    } else if (!w->first) {
+        put_char(w, ',');
+    }
+    w->first = false;
+}
+
+static void put_string(FCBJsonWriter *w, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+
+    put_char(w, '"');
+    while (*s) {
+        // Copy the longest run that needs no escaping in one go
+        const char *run = s;
+        while ((unsigned char)*s >= 0x20 && *s != '"' && *s != '\\') s++;
+        put(w, run, s - run);
+        if (!*s) break;
+
+        unsigned char c = *s++;
+        char escape[6] = { '\\', 0 };
+        switch (c) {
+        case '"': escape[1] = '"'; break;
+        case '\\': escape[1] = '\\'; break;
+        case '\n': escape[1] = 'n'; break;
+        case '\r': escape[1] = 'r'; break;
+        case '\t': escape[1] = 't'; break;
+        case '\b': escape[1] = 'b'; break;
+        case '\f': escape[1] = 'f'; break;
+        default:
+            memcpy(escape + 1, "u00", 3);
+            escape[4] = hex[c >> 4];
+            escape[5] = hex[c & 15];
+            put(w, escape, 6);
+            continue;
+        }
+        put(w, escape, 2);
+    }
+    put_char(w, '"');
+}
+
+void fcb_json_writer_init(FCBJsonWriter *w, char *out, size_t size) {
+    w->out = out;
+    w->size = size;
+    w->length = 0;
+    w->first = true;
+    w->after_key = false;
+}
+
+void fcb_json_begin_object(FCBJsonWriter *w) {
+    separate(w);
+    put_char(w, '{');
+    w->first = true;
+}
+
+void fcb_json_end_object(FCBJsonWriter *w) {
+    put_char(w, '}');
+    w->first = false;
+}
+
+void fcb_json_begin_array(FCBJsonWriter *w) {
+    separate(w);
+    put_char(w, '[');
+    w->first = true;
+}
+
+void fcb_json_end_array(FCBJsonWriter *w) {
+    put_char(w, ']');
+    w->first = false;
+}
+
+void fcb_json_key(FCBJsonWriter *w, const char *key) {
+    separate(w);
+    put_string(w, key);
+    put_char(w, ':');
+    w->after_key = true;
+}
+
+void fcb_json_string(FCBJsonWriter *w, const char *value) {
+    separate(w);
+    put_string(w, value);
+}
+
+void fcb_json_uint(FCBJsonWriter *w, unsigned value) {
+    char digits[10];
+    int n = sizeof(digits);
+
+    separate(w);
+    do {
+        digits[--n] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    put(w, digits + n, sizeof(digits) - n);
+}
+
+void fcb_json_bool(FCBJsonWriter *w, bool value) {
+    separate(w);
+    if (value) {
+        put(w, "true", 4);
+    } else {
+        put(w, "false", 5);
+    }
+}
+
+void fcb_json_end_line(FCBJsonWriter *w) {
+    put_char(w, '\n');
+    w->first = true;
+}
+
+// Format as NDJSON into out (NUL terminated). dump, when not NULL, is
+// added to every record so several dumps can share a stream. *length gets
+// the text length, or the size needed when out is too small.
+FCBStatus fcb_format_ndjson(const FCB1010 *fcb, const char *dump, char *out, size_t size, size_t *length,
+                            FCBError *error) {
+    FCBJsonWriter w;
+    fcb_json_writer_init(&w, out, size);
+
+    fcb_json_begin_object(&w);
+    fcb_json_key(&w, "type");
+    fcb_json_string(&w, "globals");
+    if (dump) {
+        fcb_json_key(&w, "dump");
+        fcb_json_string(&w, dump);
+    }
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        fcb_json_key(&w, fcb_global_fields[f].name);
+        if (fcb_global_fields[f].is_flag) {
+            fcb_json_bool(&w, fcb_get_global_field(fcb, f));
+        } else {
+            fcb_json_uint(&w, fcb_get_global_field(fcb, f));
+        }
+    }
+    fcb_json_end_object(&w);
+    fcb_json_end_line(&w);
+
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        const FCB1010Preset *preset = &fcb->preset[p];
+
+        fcb_json_begin_object(&w);
+        fcb_json_key(&w, "type");
+        fcb_json_string(&w, "preset");
+        if (dump) {
+            fcb_json_key(&w, "dump");
+            fcb_json_string(&w, dump);
+        }
+        fcb_json_key(&w, "bank");
+        fcb_json_uint(&w, p / 10 + 1);
+        fcb_json_key(&w, "preset");
+        fcb_json_uint(&w, p % 10 + 1);
+        for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+            fcb_json_key(&w, fcb_preset_fields[f].name);
+            if (fcb_preset_fields[f].is_flag) {
+                fcb_json_bool(&w, fcb_get_preset_field(preset, f));
+            } else {
+                fcb_json_uint(&w, fcb_get_preset_field(preset, f));
+            }
+        }
+        fcb_json_end_object(&w);
+        fcb_json_end_line(&w);
+    }
+
+    if (length) *length = w.length;
+    if (w.length >= size) {
+        return fcb_set_error(error, FCB_ERR_SIZE, 0, 0, 0, "NDJSON needs %zu bytes, buffer holds %zu", w.length + 1,
+                             size);
+    }
+    out[w.length] = '\0';
+    return FCB_OK;
+}
+
+void fcb_json_reader_init(FCBJsonReader *r, const char *text, size_t length) {
+    memset(r, 0, sizeof(FCBJsonReader));
+    r->pos = text;
+    r->end = text + length;
+    r->line_start = text;
+    r->line = 1;
+    r->expect = EXPECT_RECORD;
+}
+
+static FCBJsonToken reader_error(FCBJsonReader *r, FCBError *error, const char *message) {
+    r->expect = -1;
+    fcb_set_error(error, FCB_ERR_JSON, r->line, (int)(r->pos - r->line_start) + 1, 0, "%s", message);
+    return FCB_JSON_ERROR;
+}
+
+// Spaces within a line; a record may not continue onto the next one
+static void skip_spaces(FCBJsonReader *r) {
+    while (r->pos < r->end && (*r->pos == ' ' || *r->pos == '\t' || *r->pos == '\r')) r->pos++;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool read_hex4(FCBJsonReader *r, unsigned *value) {
+    if (r->end - r->pos < 4) return false;
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hex_digit(r->pos[i]);
+        if (digit < 0) return false;
+        *value = *value << 4 | digit;
+    }
+    r->pos += 4;
+    return true;
+}
+
+static bool append_string(FCBJsonReader *r, const char *text, size_t length) {
+    if (r->string_length + length >= FCB_JSON_STRING_MAX) return false;
+    memcpy(r->string + r->string_length, text, length);
+    r->string_length += length;
+    return true;
+}
+
+static bool append_utf8(FCBJsonReader *r, unsigned code) {
+    char utf8[4];
+    size_t n;
+
+    if (code < 0x80) {
+        utf8[0] = code;
+        n = 1;
+    } else if (code < 0x800) {
+        utf8[0] = 0xc0 | code >> 6;
+        utf8[1] = 0x80 | (code & 0x3f);
+        n = 2;
+    } else if (code < 0x10000) {
+        utf8[0] = 0xe0 | code >> 12;
+        utf8[1] = 0x80 | (code >> 6 & 0x3f);
+        utf8[2] = 0x80 | (code & 0x3f);
+        n = 3;
+    } else {
+        utf8[0] = 0xf0 | code >> 18;
+        utf8[1] = 0x80 | (code >> 12 & 0x3f);
+        utf8[2] = 0x80 | (code >> 6 & 0x3f);
+        utf8[3] = 0x80 | (code & 0x3f);
+        n = 4;
+    }
+    return append_string(r, utf8, n);
+}
+
+// The opening quote has been consumed; unescapes into r->string
+static FCBJsonToken read_string(FCBJsonReader *r, FCBJsonToken token, FCBError *error) {
+    r->string_length = 0;
+
+    for (;;) {
+        const char *run = r->pos;
+        while (r->pos < r->end && *r->pos != '"' && *r->pos != '\\' && (unsigned char)*r->pos >= 0x20) r->pos++;
+        if (!append_string(r, run, r->pos - run)) return reader_error(r, error, "String too long");
+
+        if (r->pos == r->end) return reader_error(r, error, "Unterminated string");
+        char c = *r->pos;
+        if (c == '"') {
+            r->pos++;
+            break;
+        }
+        if (c != '\\') return reader_error(r, error, "Control character in string");
+
+        r->pos++;
+        if (r->pos == r->end) return reader_error(r, error, "Unterminated string");
+        c = *r->pos++;
+
+        const char *plain = NULL;
+        switch (c) {
+        case '"': plain = "\""; break;
+        case '\\': plain = "\\"; break;
+        case '/': plain = "/"; break;
+        case 'b': plain = "\b"; break;
+        case 'f': plain = "\f"; break;
+        case 'n': plain = "\n"; break;
+        case 'r': plain = "\r"; break;
+        case 't': plain = "\t"; break;
+        case 'u': {
+            unsigned code;
+            if (!read_hex4(r, &code)) return reader_error(r, error, "Bad \\u escape");
+            if (code >= 0xdc00 && code <= 0xdfff) return reader_error(r, error, "Unpaired surrogate in \\u escape");
+            if (code >= 0xd800 && code <= 0xdbff) {
+                unsigned low;
+                if (r->end - r->pos < 2 || r->pos[0] != '\\' || r->pos[1] != 'u') {
+                    return reader_error(r, error, "Unpaired surrogate in \\u escape");
+                }
+                r->pos += 2;
+                if (!read_hex4(r, &low) || low < 0xdc00 || low > 0xdfff) {
+                    return reader_error(r, error, "Unpaired surrogate in \\u escape");
+                }
+                code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            }
+            if (code == 0) return reader_error(r, error, "NUL in string");
+            if (!append_utf8(r, code)) return reader_error(r, error, "String too long");
+            continue;
+        }
+        default:
+            return reader_error(r, error, "Bad escape in string");
+        }
+        if (!append_string(r, plain, 1)) return reader_error(r, error, "String too long");
+    }
+
+    r->string[r->string_length] = '\0';
+    return token;
+}
+
+static FCBJsonToken read_number(FCBJsonReader *r, FCBError *error) {
+    const char *start = r->pos;
+    bool negative = false;
+    long long value = 0;
+    int digits = 0;
+
+    if (*r->pos == '-') {
+        negative = true;
+        r->pos++;
+    }
+    if (r->pos == r->end || *r->pos < '0' || *r->pos > '9') return reader_error(r, error, "Bad number");
+    if (*r->pos == '0' && r->pos + 1 < r->end && r->pos[1] >= '0' && r->pos[1] <= '9') {
+        return reader_error(r, error, "Leading zero in number");
+    }
+    while (r->pos < r->end && *r->pos >= '0' && *r->pos <= '9') {
+        if (digits++ < 18) value = value * 10 + (*r->pos - '0');
+        r->pos++;
+    }
+    r->integer = digits <= 18;
+
+    if (r->pos < r->end && *r->pos == '.') {
+        r->pos++;
+        if (r->pos == r->end || *r->pos < '0' || *r->pos > '9') return reader_error(r, error, "Bad number");
+        while (r->pos < r->end && *r->pos >= '0' && *r->pos <= '9') r->pos++;
+        r->integer = false;
+    }
+    if (r->pos < r->end && (*r->pos == 'e' || *r->pos == 'E')) {
+        r->pos++;
+        if (r->pos < r->end && (*r->pos == '+' || *r->pos == '-')) r->pos++;
+        if (r->pos == r->end || *r->pos < '0' || *r->pos > '9') return reader_error(r, error, "Bad number");
+        while (r->pos < r->end && *r->pos >= '0' && *r->pos <= '9') r->pos++;
+        r->integer = false;
+    }
+
+    r->number = negative ? -value : value;
+    r->column = (int)(start - r->line_start) + 1;
+    return FCB_JSON_NUMBER;
+}
+
+static FCBJsonToken read_literal(FCBJsonReader *r, const char *word, FCBJsonToken token, FCBError *error) {
+    size_t length = strlen(word);
+    if ((size_t)(r->end - r->pos) < length || memcmp(r->pos, word, length) != 0) {
+        return reader_error(r, error, "Unexpected character");
+    }
+    r->pos += length;
+    return token;
+}
+
+// A value has ended; what may follow depends on whether it was nested
+static void value_done(FCBJsonReader *r) {
+    r->expect = r->depth ? EXPECT_COMMA_OR_END : EXPECT_LINE_END;
+}
+
+static FCBJsonToken read_value(FCBJsonReader *r, FCBError *error) {
+    if (r->pos == r->end || *r->pos == '\n') return reader_error(r, error, "Record ends in the middle");
+
+    FCBJsonToken token;
+    char c = *r->pos;
+    switch (c) {
+    case '{':
+    case '[':
+        if (r->depth == FCB_JSON_MAX_DEPTH) return reader_error(r, error, "Nested too deeply");
+        r->pos++;
+        if (c == '[') {
+            r->in_array |= 1u << r->depth;
+        } else {
+            r->in_array &= ~(1u << r->depth);
+        }
+        r->depth++;
+        r->expect = c == '{' ? EXPECT_KEY_OR_END : EXPECT_VALUE_OR_END;
+        return c == '{' ? FCB_JSON_BEGIN_OBJECT : FCB_JSON_BEGIN_ARRAY;
+    case '"':
+        r->pos++;
+        token = read_string(r, FCB_JSON_STRING, error);
+        break;
+    case 't':
+        token = read_literal(r, "true", FCB_JSON_TRUE, error);
+        break;
+    case 'f':
+        token = read_literal(r, "false", FCB_JSON_FALSE, error);
+        break;
+    case 'n':
+        token = read_literal(r, "null", FCB_JSON_NULL, error);
+        break;
+    default:
+        if (c == '-' || (c >= '0' && c <= '9')) {
+            token = read_number(r, error);
+        } else {
+            return reader_error(r, error, "Unexpected character");
+        }
+    }
+
+    if (token != FCB_JSON_ERROR) value_done(r);
+    return token;
+}
+
+static FCBJsonToken read_key(FCBJsonReader *r, FCBError *error) {
+    if (r->pos == r->end || *r->pos == '\n') return reader_error(r, error, "Record ends in the middle");
+    if (*r->pos != '"') return reader_error(r, error, "Expected a key");
+    r->pos++;
+    if (read_string(r, FCB_JSON_KEY, error) == FCB_JSON_ERROR) return FCB_JSON_ERROR;
+
+    skip_spaces(r);
+    if (r->pos == r->end || *r->pos != ':') return reader_error(r, error, "Expected : after the key");
+    r->pos++;
+    r->expect = EXPECT_VALUE;
+    return FCB_JSON_KEY;
+}
+
+static FCBJsonToken close_container(FCBJsonReader *r, FCBError *error) {
+    bool array = r->in_array >> (r->depth - 1) & 1;
+    if (*r->pos != (array ? ']' : '}')) return reader_error(r, error, array ? "Expected ]" : "Expected }");
+
+    r->pos++;
+    r->depth--;
+    value_done(r);
+    return array ? FCB_JSON_END_ARRAY : FCB_JSON_END_OBJECT;
+}
+
+// The next token. Once this returns FCB_JSON_ERROR (with error filled in)
+// or FCB_JSON_END it keeps doing so.
+FCBJsonToken fcb_json_next(FCBJsonReader *r, FCBError *error) {
+    if (r->expect < 0) return FCB_JSON_ERROR;
+
+    if (r->expect == EXPECT_RECORD) {
+        // Blank lines between records are allowed
+        while (r->pos < r->end && (*r->pos == ' ' || *r->pos == '\t' || *r->pos == '\r' || *r->pos == '\n')) {
+            if (*r->pos++ == '\n') {
+                r->line++;
+                r->line_start = r->pos;
+            }
+        }
+        if (r->pos == r->end) return FCB_JSON_END;
+    } else {
+        skip_spaces(r);
+    }
+    r->column = (int)(r->pos - r->line_start) + 1;
+
+    switch (r->expect) {
+    case EXPECT_RECORD:
+    case EXPECT_VALUE:
+        return read_value(r, error);
+    case EXPECT_VALUE_OR_END:
+        if (r->pos < r->end && *r->pos == ']') return close_container(r, error);
+        return read_value(r, error);
+    case EXPECT_KEY:
+        return read_key(r, error);
+    case EXPECT_KEY_OR_END:
+        if (r->pos < r->end && *r->pos == '}') return close_container(r, error);
+        return read_key(r, error);
+    case EXPECT_COMMA_OR_END:
+        if (r->pos == r->end || *r->pos == '\n') return reader_error(r, error, "Record ends in the middle");
+        if (*r->pos == ',') {
+            r->pos++;
+            skip_spaces(r);
+            r->column = (int)(r->pos - r->line_start) + 1;
+            if (r->in_array >> (r->depth - 1) & 1) return read_value(r, error);
+            return read_key(r, error);
+        }
+        return close_container(r, error);
+    default:  // EXPECT_LINE_END
+        if (r->pos < r->end) {
+            if (*r->pos != '\n') return reader_error(r, error, "Expected the end of the line");
+            r->pos++;
+            r->line++;
+            r->line_start = r->pos;
+        }
+        r->expect = EXPECT_RECORD;
+        return FCB_JSON_END_LINE;
+    }
+}
+
+// One record as read, before it is applied: keys may come in any order,
+// so "type" is not known until the end
+typedef struct {
+    enum { RECORD_UNKNOWN, RECORD_GLOBALS, RECORD_PRESET } type;
+    int bank;
+    int preset;
+    uint8_t preset_value[NUM_PRESET_FIELDS];
+    uint8_t global_value[NUM_GLOBAL_FIELDS];
+    uint32_t preset_set;  // Bit per field given
+    uint32_t global_set;
+    int next_preset_field;  // Lookup hints, see find_preset_field()
+    int next_global_field;
+} Record;
+
+// Flags take true/false or 0/1, everything else an integer up to max
+static bool value_in_range(const FCBJsonReader *r, FCBJsonToken token, bool is_flag, int max, int *value) {
+    if (is_flag && (token == FCB_JSON_TRUE || token == FCB_JSON_FALSE)) {
+        *value = token == FCB_JSON_TRUE;
+        return true;
+    }
+    if (token != FCB_JSON_NUMBER || !r->integer || r->number < 0 || r->number > max) return false;
+    *value = (int)r->number;
+    return true;
+}
+
+// Keys usually come in table order, as fcb_format_ndjson() writes them,
+// so the field after the last match (*next) is tried before searching
+static int find_preset_field(const char *name, int *next) {
+    int field = *next < NUM_PRESET_FIELDS && strcmp(fcb_preset_fields[*next].name, name) == 0
+                    ? *next
+                    : fcb_find_preset_field(name);
+    if (field >= 0) *next = field + 1;
+    return field;
+}
+
+static int find_global_field(const char *name, int *next) {
+    int field = *next < NUM_GLOBAL_FIELDS && strcmp(fcb_global_fields[*next].name, name) == 0
+                    ? *next
+                    : fcb_find_global_field(name);
+    if (field >= 0) *next = field + 1;
+    return field;
+}
+
+// Read the members of one object up to its closing brace. dump holds the
+// first dump name seen in the text; every record must agree with it.
+static FCBStatus read_record(FCBJsonReader *r, Record *record, char *dump, FCBError *error) {
+    for (;;) {
+        FCBJsonToken token = fcb_json_next(r, error);
+        if (token == FCB_JSON_END_OBJECT) return FCB_OK;
+        if (token == FCB_JSON_ERROR) return FCB_ERR_JSON;
+
+        char key[FCB_JSON_STRING_MAX];
+        int line = r->line;
+        int column = r->column;
+        memcpy(key, r->string, r->string_length + 1);
+
+        token = fcb_json_next(r, error);
+        if (token == FCB_JSON_ERROR) return FCB_ERR_JSON;
+        if (token == FCB_JSON_BEGIN_OBJECT || token == FCB_JSON_BEGIN_ARRAY) {
+            return fcb_set_error(error, FCB_ERR_JSON, line, column, 0, "%s must not be an object or array", key);
+        }
+
+        int value;
+        int field;
+        if (strcmp(key, "type") == 0) {
+            if (token == FCB_JSON_STRING && strcmp(r->string, "globals") == 0) {
+                record->type = RECORD_GLOBALS;
+            } else if (token == FCB_JSON_STRING && strcmp(r->string, "preset") == 0) {
+                record->type = RECORD_PRESET;
+            } else {
+                return fcb_set_error(error, FCB_ERR_JSON, line, column, 0, "type must be \"globals\" or \"preset\"");
+            }
+        } else if (strcmp(key, "dump") == 0) {
+            if (token != FCB_JSON_STRING) {
+                return fcb_set_error(error, FCB_ERR_JSON, line, column, 0, "dump must be a string");
+            }
+            if (dump[0] == '\0') {
+                memcpy(dump, r->string, r->string_length + 1);
+            } else if (strcmp(dump, r->string) != 0) {
+                return fcb_set_error(error, FCB_ERR_JSON, line, column, 0, "Holds more than one dump: %.60s and %.60s",
+                                     dump, r->string);
+            }
+        } else if (strcmp(key, "bank") == 0 || strcmp(key, "preset") == 0) {
+            if (!value_in_range(r, token, false, 10, &value) || value < 1) {
+                return fcb_set_error(error, FCB_ERR_JSON, line, column, 0, "%s must be 1-10", key);
+            }
+            if (strcmp(key, "bank") == 0) {
+                record->bank = value;
+            } else {
+                record->preset = value;
+            }
+        } else if ((field = find_preset_field(key, &record->next_preset_field)) >= 0) {
+            bool is_flag = fcb_preset_fields[field].is_flag;
+            if (!value_in_range(r, token, is_flag, 127, &value)) {
+                return fcb_set_error(error, FCB_ERR_VALUE, line, column, 0, "%s must be %s", key,
+                                     is_flag ? "true or false" : "0-127");
+            }
+            record->preset_value[field] = value;
+            record->preset_set |= 1u << field;
+        } else if ((field = find_global_field(key, &record->next_global_field)) >= 0) {
+            // The globals the CSV carries are the MIDI channels
+            bool is_flag = fcb_global_fields[field].is_flag;
+            int max = fcb_global_fields[field].in_csv ? 15 : 127;
+            if (!value_in_range(r, token, is_flag, max, &value)) {
+                return fcb_set_error(error, FCB_ERR_VALUE, line, column, 0, "%s must be %s", key,
+                                     is_flag ? "true or false" : max == 15 ? "0-15" : "0-127");
+            }
+            record->global_value[field] = value;
+            record->global_set |= 1u << field;
+        } else {
+            return fcb_set_error(error, FCB_ERR_JSON, line, column, 0, "Unknown key %.80s", key);
+        }
+    }
+}
+
+static FCBStatus apply_record(const Record *record, int line, FCB1010 *fcb, FCBError *error) {
+    switch (record->type) {
+    case RECORD_GLOBALS:
+        if (record->preset_set || record->bank || record->preset) {
+            return fcb_set_error(error, FCB_ERR_JSON, line, 0, 0, "Preset fields in a globals record");
+        }
+        for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+            if (record->global_set >> f & 1) fcb_set_global_field(fcb, f, record->global_value[f]);
+        }
+        return FCB_OK;
+    case RECORD_PRESET: {
+        if (record->global_set) {
+            return fcb_set_error(error, FCB_ERR_JSON, line, 0, 0, "Global settings in a preset record");
+        }
+        if (!record->bank || !record->preset) {
+            return fcb_set_error(error, FCB_ERR_JSON, line, 0, 0, "Preset record without bank and preset");
+        }
+        FCB1010Preset *preset = &fcb->preset[(record->bank - 1) * 10 + record->preset - 1];
+        for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+            if (record->preset_set >> f & 1) fcb_set_preset_field(preset, f, record->preset_value[f]);
+        }
+        return FCB_OK;
+    }
+    default:
+        return fcb_set_error(error, FCB_ERR_JSON, line, 0, 0, "Record without a type");
+    }
+}
+
+// Parse NDJSON text of one dump. Like fcb_parse_csv(), fcb starts from
+// init_fcb1010() defaults, so fields and presets the text leaves out get
+// those, and fcb is left untouched on error.
+FCBStatus fcb_parse_ndjson(const char *text, size_t length, FCB1010 *fcb, FCBError *error) {
+    FCB1010 parsed;
+    FCBJsonReader reader;
+    char dump[FCB_JSON_STRING_MAX] = "";
+    int records = 0;
+
+    init_fcb1010(&parsed);
+    fcb_json_reader_init(&reader, text, length);
+
+    for (;;) {
+        FCBJsonToken token = fcb_json_next(&reader, error);
+        if (token == FCB_JSON_END) break;
+        if (token == FCB_JSON_ERROR) return FCB_ERR_JSON;
+        if (token != FCB_JSON_BEGIN_OBJECT) {
+            return fcb_set_error(error, FCB_ERR_JSON, reader.line, reader.column, 0, "Each line must be an object");
+        }
+
+        int line = reader.line;
+        Record record;
+        memset(&record, 0, sizeof(record));
+
+        FCBStatus status = read_record(&reader, &record, dump, error);
+        if (status != FCB_OK) return status;
+        if (fcb_json_next(&reader, error) != FCB_JSON_END_LINE) return FCB_ERR_JSON;
+
+        status = apply_record(&record, line, &parsed, error);
+        if (status != FCB_OK) return status;
+        records++;
+    }
+
+    if (records == 0) return fcb_set_error(error, FCB_ERR_JSON, 0, 0, 0, "No records");
+    *fcb = parsed;
+    return FCB_OK;
+}
+
+// The text is read into the thread's arena, reset once it is parsed
+FCBStatus fcb_read_ndjson_file(const char *path, FCB1010 *fcb, FCBError *error) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to read file %s", path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size > NDJSON_MAX_FILE_SIZE) {
+        close(fd);
+        return fcb_set_error(error, FCB_ERR_SIZE, 0, 0, 0, "%s is not an FCB1010 NDJSON file (too large)", path);
+    }
+
+    size_t size = st.st_size;
+    FCBArena *scratch = fcb_thread_arena();
+    char *text = scratch ? fcb_arena_alloc(scratch, size + 1) : NULL;
+    if (!text) {
+        close(fd);
+        return fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory reading %s", path);
+    }
+
+    size_t read_size = 0;
+    while (read_size < size) {
+        ssize_t n = read(fd, text + read_size, size - read_size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        read_size += n;
+    }
+    close(fd);
+
+    FCBStatus status = fcb_parse_ndjson(text, read_size, fcb, error);
+    fcb_arena_reset(scratch);
+    return status;
+}
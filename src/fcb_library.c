@@ -0,0 +1,331 @@
+/*  Lazily decoded dump libraries
+*   A library is a directory of dumps that is browsed rather than loaded.
+*   Opening it only lists the file names. A preset (or the globals) of a
+*   dump is decoded the first time it is asked for, straight from the
+*   mapped file, and kept in an LRU cache of a fixed number of entries;
+*   only the last few files stay mapped. Memory use is therefore set by
+*   the cache size, not by how many dumps the directory holds, and showing
+*   the first screen reads only the dumps on it.
+*/
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fcb.h"
+
+#define MAPPED_DUMPS 16
+#define GLOBALS_SLOT NUM_PRESETS  // Cache slot of a dump's global settings
+#define NONE UINT32_MAX
+
+typedef struct {
+    uint32_t dump;
+    uint32_t prev;   // LRU list, most recently used first
+    uint32_t next;
+    uint32_t chain;  // Next entry in the same hash bucket
+    uint8_t slot;    // Preset 0-99, or GLOBALS_SLOT
+    union {
+        FCB1010Preset preset;
+        uint8_t global[NUM_GLOBAL_FIELDS];
+    };
+} CacheEntry;
+
+typedef struct {
+    uint32_t dump;        // NONE when unused
+    const uint8_t *data;  // NULL when the file is not a valid dump
+    FCBError error;       // Why, for a file that is not
+    uint64_t last_used;
+} MappedDump;
+
+struct FCBLibrary {
+    char directory[1024];
+    char *names;         // NUL terminated file names, back to back
+    uint32_t *name;      // Offset of each dump's name in names
+    size_t count;
+    CacheEntry *entries;
+    uint32_t capacity;
+    uint32_t used;
+    uint32_t *buckets;   // Hash heads, bucket_mask + 1 of them
+    uint32_t bucket_mask;
+    uint32_t head;       // Most recently used entry
+    uint32_t tail;       // Least recently used, evicted first
+    MappedDump mapped[MAPPED_DUMPS];
+    uint64_t clock;
+    FCBLibraryStats stats;
+};
+
+static int is_dump_name(const struct dirent *entry) {
+    size_t len = strlen(entry->d_name);
+    return entry->d_name[0] != '.' && len > 4 && strcmp(entry->d_name + len - 4, ".syx") == 0;
+}
+
+// Names only, in name order; nothing is read from the files
+static FCBStatus list_dumps(FCBLibrary *library, FCBError *error) {
+    struct dirent **entries;
+    int count = scandir(library->directory, &entries, is_dump_name, alphasort);
+    if (count < 0) return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to read directory %s", library->directory);
+
+    size_t pool = 0;
+    for (int i = 0; i < count; i++) pool += strlen(entries[i]->d_name) + 1;
+
+    library->names = malloc(pool ? pool : 1);
+    library->name = malloc((count ? count : 1) * sizeof(uint32_t));
+    bool ok = library->names && library->name && pool <= UINT32_MAX;
+
+    size_t used = 0;
+    for (int i = 0; i < count; i++) {
+        if (ok) {
+            size_t len = strlen(entries[i]->d_name) + 1;
+            library->name[i] = used;
+            memcpy(library->names + used, entries[i]->d_name, len);
+            used += len;
+        }
+        free(entries[i]);
+    }
+    free(entries);
+
+    if (!ok) return fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory listing %s", library->directory);
+    library->count = count;
+    return FCB_OK;
+}
+
+FCBStatus fcb_library_open(FCBLibrary **out, const char *directory, size_t cache_entries, FCBError *error) {
+    *out = NULL;
+    if (cache_entries == 0 || cache_entries >= NONE / 2) {
+        return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "Cache of %zu entries is not supported", cache_entries);
+    }
+
+    FCBLibrary *library = calloc(1, sizeof(FCBLibrary));
+    if (!library) return fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory");
+    snprintf(library->directory, sizeof(library->directory), "%s", directory);
+
+    uint32_t buckets = 1;
+    while (buckets < cache_entries) buckets <<= 1;
+
+    library->capacity = cache_entries;
+    library->bucket_mask = buckets - 1;
+    library->head = library->tail = NONE;
+    library->entries = malloc(cache_entries * sizeof(CacheEntry));
+    library->buckets = malloc(buckets * sizeof(uint32_t));
+    for (int i = 0; i < MAPPED_DUMPS; i++) library->mapped[i].dump = NONE;
+
+    FCBStatus status = FCB_OK;
+    if (!library->entries || !library->buckets) {
+        status = fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory for a cache of %zu entries",
+                               cache_entries);
+    } else {
+        memset(library->buckets, 0xff, buckets * sizeof(uint32_t));
+        status = list_dumps(library, error);
+    }
+
+    if (status != FCB_OK) {
+        fcb_library_close(library);
+        return status;
+    }
+    *out = library;
+    return FCB_OK;
+}
+
+void fcb_library_close(FCBLibrary *library) {
+    if (!library) return;
+
+    for (int i = 0; i < MAPPED_DUMPS; i++) {
+        if (library->mapped[i].data) munmap((void *)library->mapped[i].data, SYSEX_SIZE);
+    }
+    free(library->names);
+    free(library->name);
+    free(library->entries);
+    free(library->buckets);
+    free(library);
+}
+
+size_t fcb_library_count(const FCBLibrary *library) {
+    return library->count;
+}
+
+const char *fcb_library_name(const FCBLibrary *library, size_t dump) {
+    return library->names + library->name[dump];
+}
+
+bool fcb_library_path(const FCBLibrary *library, size_t dump, char *out, size_t size) {
+    return snprintf(out, size, "%s/%s", library->directory, fcb_library_name(library, dump)) < (int)size;
+}
+
+FCBLibraryStats fcb_library_stats(const FCBLibrary *library) {
+    FCBLibraryStats stats = library->stats;
+    stats.cached = library->used;
+    return stats;
+}
+
+static uint32_t bucket_of(const FCBLibrary *library, uint32_t dump, int slot) {
+    uint32_t hash = (dump * (GLOBALS_SLOT + 1) + slot) * 2654435761u;
+    return (hash ^ hash >> 15) & library->bucket_mask;
+}
+
+static void unlink_entry(FCBLibrary *library, uint32_t index) {
+    CacheEntry *e = &library->entries[index];
+    if (e->prev != NONE) {
+        library->entries[e->prev].next = e->next;
+    } else {
+        library->head = e->next;
+    }
+    if (e->next != NONE) {
+        library->entries[e->next].prev = e->prev;
+    } else {
+        library->tail = e->prev;
+    }
+}
+
+static void push_front(FCBLibrary *library, uint32_t index) {
+    CacheEntry *e = &library->entries[index];
+    e->prev = NONE;
+    e->next = library->head;
+    if (library->head != NONE) library->entries[library->head].prev = index;
+    library->head = index;
+    if (library->tail == NONE) library->tail = index;
+}
+
+static CacheEntry *lookup(FCBLibrary *library, uint32_t dump, int slot) {
+    for (uint32_t i = library->buckets[bucket_of(library, dump, slot)]; i != NONE; i = library->entries[i].chain) {
+        CacheEntry *e = &library->entries[i];
+        if (e->dump != dump || e->slot != slot) continue;
+
+        if (library->head != i) {
+            unlink_entry(library, i);
+            push_front(library, i);
+        }
+        library->stats.hits++;
+        return e;
+    }
+    return NULL;
+}
+
+// A free entry, evicting the least recently used one when full
+static CacheEntry *insert(FCBLibrary *library, uint32_t dump, int slot) {
+    uint32_t index;
+
+    if (library->used < library->capacity) {
+        index = library->used++;
+    } else {
+        index = library->tail;
+        CacheEntry *old = &library->entries[index];
+        unlink_entry(library, index);
+
+        uint32_t *link = &library->buckets[bucket_of(library, old->dump, old->slot)];
+        while (*link != index) link = &library->entries[*link].chain;
+        *link = old->chain;
+        library->stats.evictions++;
+    }
+
+    CacheEntry *e = &library->entries[index];
+    uint32_t *bucket = &library->buckets[bucket_of(library, dump, slot)];
+    e->dump = dump;
+    e->slot = slot;
+    e->chain = *bucket;
+    *bucket = index;
+    push_front(library, index);
+    return e;
+}
+
+static const uint8_t *map_file(const char *path, FCBError *error) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to open %s", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size != SYSEX_SIZE) {
+        close(fd);
+        fcb_set_error(error, FCB_ERR_SIZE, 0, 0, 0, "%s is not %d bytes", path, SYSEX_SIZE);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, SYSEX_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to map %s", path);
+        return NULL;
+    }
+    if (fcb_check_sysex(data, SYSEX_SIZE, error) != FCB_OK) {
+        munmap(data, SYSEX_SIZE);
+        return NULL;
+    }
+    return data;
+}
+
+// The mapped bytes of a dump, mapping it in place of the least recently
+// used one if needed. Failures are remembered the same way, so a bad file
+// is not reopened on every redraw.
+static const uint8_t *dump_data(FCBLibrary *library, uint32_t dump, FCBError *error) {
+    MappedDump *slot = &library->mapped[0];
+
+    library->clock++;
+    for (int i = 0; i < MAPPED_DUMPS; i++) {
+        MappedDump *m = &library->mapped[i];
+        if (m->dump == dump) {
+            slot = m;
+            break;
+        }
+        if (m->last_used < slot->last_used) slot = m;
+    }
+
+    if (slot->dump != dump) {
+        if (slot->data) munmap((void *)slot->data, SYSEX_SIZE);
+        char path[2048];
+        if (!fcb_library_path(library, dump, path, sizeof(path))) {
+            slot->data = NULL;
+            fcb_set_error(&slot->error, FCB_ERR_IO, 0, 0, 0, "Path too long: %s", fcb_library_name(library, dump));
+        } else {
+            slot->data = map_file(path, &slot->error);
+        }
+        slot->dump = dump;
+        library->stats.files_mapped++;
+    }
+
+    slot->last_used = library->clock;
+    if (!slot->data) *error = slot->error;
+    return slot->data;
+}
+
+const FCB1010Preset *fcb_library_preset(FCBLibrary *library, size_t dump, int preset, FCBError *error) {
+    CacheEntry *e = lookup(library, dump, preset);
+    if (e) return &e->preset;
+
+    FCBError failure;
+    library->stats.misses++;
+    const uint8_t *data = dump_data(library, dump, &failure);
+    if (!data) {
+        if (error) *error = failure;
+        return NULL;
+    }
+
+    e = insert(library, dump, preset);
+    fcb_decode_preset(data, SYSEX_SIZE, preset, &e->preset, NULL);
+    return &e->preset;
+}
+
+FCBStatus fcb_library_globals(FCBLibrary *library, size_t dump, FCB1010 *fcb, FCBError *error) {
+    CacheEntry *e = lookup(library, dump, GLOBALS_SLOT);
+    if (!e) {
+        FCBError failure;
+        library->stats.misses++;
+        const uint8_t *data = dump_data(library, dump, &failure);
+        if (!data) {
+            if (error) *error = failure;
+            return failure.status;
+        }
+
+        FCB1010 decoded;
+        fcb_decode_globals(data, SYSEX_SIZE, &decoded, NULL);
+        e = insert(library, dump, GLOBALS_SLOT);
+        for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) e->global[f] = fcb_get_global_field(&decoded, f);
+    }
+
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) fcb_set_global_field(fcb, f, e->global[f]);
+    return FCB_OK;
+}
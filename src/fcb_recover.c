@@ -0,0 +1,378 @@
+/*  Recovery decoder for damaged SysEx captures
+*   A flaky cable drops bytes, repeats them, or mixes in status bytes, so
+*   the dump no longer lines up with its fixed 2352 byte layout. Status
+*   and realtime bytes can never be part of the data and are removed
+*   first. What is left is aligned against a model of every position in
+*   the layout: header and filler bytes are constant, flag and channel
+*   bytes have bits that are always clear, value bytes are usually 0 or
+*   127. The alignment is a hidden Markov model whose state is the shift
+*   between the capture and the layout. A dropped byte moves the shift
+*   down one, an inserted run moves it up. Forward-backward gives, for
+*   every layout position, how likely each capture byte is to belong
+*   there. That posterior picks the repaired byte and becomes the
+*   confidence of the preset it belongs to.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fcb.h"
+
+#define MAX_SHIFT 48
+#define NUM_SHIFTS (2 * MAX_SHIFT + 1)
+#define MAX_INSERT_RUN 4
+
+// Shifts searched beyond those the start and end of the capture imply,
+// for damage that cancels out (a drop and a later insertion)
+#define SHIFT_MARGIN 8
+
+// Chance a preset value repeats the same value of the preset before;
+// dumps tend to use one controller or program layout throughout
+#define P_REPEAT 0.6f
+
+// Probabilities below this are treated as zero, which keeps the float
+// arithmetic out of denormals
+#define P_FLOOR 1e-25f
+
+#define P_DROP 1e-3f
+#define P_INSERT 1e-3f
+
+typedef enum {
+    POS_VALUE,  // Any 7-bit value, mostly 0 or 127
+    POS_CONST,  // Always value
+    POS_MASK    // Bits in zero always clear, bits in one always set
+} PositionKind;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t value;
+    uint8_t zero;
+    uint8_t one;
+    uint16_t previous;  // Same value of the previous preset, 0 if none
+} PositionModel;
+
+// Flag slots 10, 11, 13 and 14 of every preset are never used
+#define UNUSED_FLAG_SLOTS ((1 << 10) | (1 << 11) | (1 << 13) | (1 << 14))
+
+static void build_model(PositionModel *model) {
+    static const uint8_t header[] = { 0xF0, 0, 32, 50, 1, 12, 15 };
+    static const uint8_t constants[] = { 127, 127, 127, 127, 120, 127, 127 };
+
+    for (int i = 0; i < SYSEX_SIZE; i++) {
+        model[i] = (PositionModel){ POS_CONST, 127, 0, 0, 0 };  // Filler
+    }
+    for (int i = 0; i < 7; i++) model[i].value = header[i];
+
+    for (int idx = 0; idx < NUM_PRESETS * 16; idx++) {
+        PositionModel *value = &model[7 + idx + idx / 7];
+        value->kind = POS_VALUE;
+        if (idx >= 16) value->previous = 7 + (idx - 16) + (idx - 16) / 7;
+
+        PositionModel *flags = &model[14 + (idx / 7) * 8];
+        flags->kind = POS_MASK;
+        if (UNUSED_FLAG_SLOTS & (1 << (idx % 16))) flags->zero |= 1 << (idx % 7);
+    }
+    // Bits past the last preset in the final flag byte are filler ones
+    model[1838].one = 0x70;
+
+    for (int i = 2311; i <= 2341; i++) {
+        model[i] = (PositionModel){ POS_MASK, 0, 0x70, 0, 0 };  // MIDI channels
+    }
+    for (int i = 0; i < 7; i++) model[2322 + i] = (PositionModel){ POS_CONST, constants[i], 0, 0, 0 };
+    model[2329] = (PositionModel){ POS_MASK, 0, 0x3F, 0, 0 };  // switch2
+    model[2330] = (PositionModel){ POS_MASK, 0, 0x69, 0, 0 };  // direct select, running status, merge
+    model[2334] = (PositionModel){ POS_MASK, 0, 0x78, 0, 0 };  // switch1
+
+    for (int i = 2342; i <= 2349; i++) model[i] = (PositionModel){ POS_CONST, 0, 0, 0, 0 };
+    for (int i = 2343; i <= 2346; i++) model[i].kind = POS_VALUE;  // Pedal calibration
+    model[2350].value = 10;
+    model[2351].value = 0xF7;
+}
+
+static bool model_matches(const PositionModel *m, uint8_t b) {
+    switch (m->kind) {
+        case POS_CONST: return b == m->value;
+        case POS_MASK: return b < 0x80 && (b & m->zero) == 0 && (b & m->one) == m->one;
+        default: return b < 0x80;
+    }
+}
+
+static int capture_byte(const uint8_t *capture, size_t n, int pos) {
+    return pos >= 0 && (size_t)pos < n ? capture[pos] : -1;
+}
+
+// Likelihood of the capture byte at layout position i + shift belonging
+// at layout position i
+static float emission(const PositionModel *model, const uint8_t *capture, size_t n, int i, int shift) {
+    const PositionModel *m = &model[i];
+    int b = capture_byte(capture, n, i + shift);
+
+    if (b < 0) return 1e-6f;
+    if (!model_matches(m, b)) return 0.02f / 256;
+
+    switch (m->kind) {
+        case POS_CONST:
+            return 0.98f;
+        case POS_MASK:
+            return 0.98f / (1 << (7 - __builtin_popcount(m->zero | m->one)));
+        default: {
+            float p = b == 0 ? 0.35f : b == 127 ? 0.12f : 0.53f / 126;
+            if (!m->previous) return p;
+
+            // Under the same shift, since damage is rare
+            bool repeat = capture_byte(capture, n, m->previous + shift) == b;
+            return (1 - P_REPEAT) * p + (repeat ? P_REPEAT : 0);
+        }
+    }
+}
+
+// Presets own their 16 value bytes and the flag bytes holding their flags
+static void preset_span(int preset, int *first, int *last) {
+    int idx = preset * 16;
+    *first = 7 + idx + idx / 7;
+    *last = 14 + ((idx + 15) / 7) * 8;
+}
+
+// Strip bytes that cannot be data: realtime and status bytes, and
+// anything before the first F0. The last F7 ends the dump.
+static size_t clean_capture(const uint8_t *data, size_t size, uint8_t *out, int *stray) {
+    size_t start = 0;
+    while (start < size && data[start] != 0xF0) start++;
+    if (start == size) start = 0;
+
+    size_t end = size;
+    while (end > start && data[end - 1] != 0xF7) end--;
+    if (end == start) end = size;
+
+    size_t n = 0;
+    for (size_t i = start; i < end; i++) {
+        uint8_t b = data[i];
+        bool keep = b < 0x80 || (i == start && b == 0xF0) || (i == end - 1 && b == 0xF7);
+        if (keep) {
+            out[n++] = b;
+        }
+    }
+
+    *stray = (int)(size - n);
+    return n;
+}
+
+FCBStatus fcb_recover_sysex(const uint8_t *data, size_t size, uint8_t *repaired, FCB1010 *fcb,
+                            FCBRecovery *report, const FCBAllocator *allocator, FCBError *error) {
+    PositionModel model[SYSEX_SIZE];
+    uint8_t local_repaired[SYSEX_SIZE];
+    FCBRecovery local_report;
+
+    if (!repaired) repaired = local_repaired;
+    if (!report) report = &local_report;
+    memset(report, 0, sizeof(*report));
+
+    if (size > 2 * SYSEX_SIZE || size < SYSEX_SIZE - MAX_SHIFT) {
+        return fcb_set_error(error, FCB_ERR_SIZE, 0, 0, 0, "%zu bytes is too far from %d to realign",
+                             size, SYSEX_SIZE);
+    }
+
+    // One scratch block: forward probabilities, their per-position scale
+    // factors, then the cleaned capture
+    size_t alpha_size = (size_t)SYSEX_SIZE * NUM_SHIFTS * sizeof(float);
+    size_t block_size = alpha_size + SYSEX_SIZE * sizeof(float) + size;
+    FCBArena *scratch = allocator ? NULL : fcb_thread_arena();
+    void *block = NULL;
+    if (allocator) {
+        block = allocator->alloc(block_size, allocator->user_data);
+    } else if (scratch) {
+        block = fcb_arena_alloc(scratch, block_size);
+    }
+    if (!block) return fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory");
+
+    float *alpha = block;
+    float *scale = (float *)((uint8_t *)block + alpha_size);
+    uint8_t *capture = (uint8_t *)(scale + SYSEX_SIZE);
+
+    size_t n = clean_capture(data, size, capture, &report->stray_bytes);
+    build_model(model);
+
+    FCBStatus status = FCB_OK;
+    int end_shift = (int)n - SYSEX_SIZE;
+    if (end_shift < -MAX_SHIFT || end_shift > MAX_SHIFT) {
+        status = fcb_set_error(error, FCB_ERR_SIZE, 0, 0, 0, "%zu data bytes is too far from %d to realign",
+                               n, SYSEX_SIZE);
+        goto done;
+    }
+
+    // A capture of the right length that fits every fixed byte is taken as is
+    bool exact = n == SYSEX_SIZE;
+    for (int i = 0; exact && i < SYSEX_SIZE; i++) {
+        if (model[i].kind != POS_VALUE && !model_matches(&model[i], capture[i])) exact = false;
+    }
+    if (exact) {
+        memcpy(repaired, capture, SYSEX_SIZE);
+        memset(report->confidence, 100, sizeof(report->confidence));
+        report->globals_confidence = 100;
+        report->exact = true;
+        status = fcb_decode_sysex(repaired, SYSEX_SIZE, fcb, error);
+        goto done;
+    }
+
+    float p_insert[MAX_INSERT_RUN + 1];
+    float p_stay = 1 - P_DROP;
+    for (int k = 1; k <= MAX_INSERT_RUN; k++) {
+        p_insert[k] = P_INSERT / (1 << (k - 1));
+        p_stay -= p_insert[k];
+    }
+
+    // Shift state s means layout position i is capture byte i + s - MAX_SHIFT.
+    // The capture starts at its F0 and ends at its F7, so the shift runs
+    // from about 0 to about end_shift; only that band is searched.
+    int lo = MAX_SHIFT + (end_shift < 0 ? end_shift : 0) - SHIFT_MARGIN;
+    int hi = MAX_SHIFT + (end_shift > 0 ? end_shift : 0) + SHIFT_MARGIN;
+    if (lo < 0) lo = 0;
+    if (hi > NUM_SHIFTS - 1) hi = NUM_SHIFTS - 1;
+
+    // Forward pass, normalized per position
+    for (int i = 0; i < SYSEX_SIZE; i++) {
+        float *row = &alpha[(size_t)i * NUM_SHIFTS];
+        const float *prev = row - NUM_SHIFTS;
+        float total = 0;
+
+        for (int s = lo; s <= hi; s++) {
+            float p;
+            if (i == 0) {
+                p = 1.0f / (hi - lo + 1);
+            } else {
+                p = prev[s] * p_stay;
+                if (s + 1 <= hi) p += prev[s + 1] * P_DROP;
+                for (int k = 1; k <= MAX_INSERT_RUN && s - k >= lo; k++) p += prev[s - k] * p_insert[k];
+            }
+
+            row[s] = p * emission(model, capture, n, i, s - MAX_SHIFT);
+            total += row[s];
+        }
+
+        if (total <= 0) total = P_FLOOR;
+        scale[i] = total;
+        for (int s = lo; s <= hi; s++) {
+            row[s] /= total;
+            if (row[s] < P_FLOOR) row[s] = 0;
+        }
+    }
+
+    // Backward pass, combined with the forward probabilities as it goes.
+    // lost[] collects the chance that a layout byte was dropped and only
+    // echoes its neighbour.
+    float beta[NUM_SHIFTS];
+    float next_beta[NUM_SHIFTS];
+    float lost[SYSEX_SIZE];
+    float inserted = 0;
+    float dropped = 0;
+    float byte_confidence[SYSEX_SIZE];
+
+    memset(lost, 0, sizeof(lost));
+    for (int s = lo; s <= hi; s++) beta[s] = 1;
+
+    for (int i = SYSEX_SIZE - 1; i >= 0; i--) {
+        const float *row = &alpha[(size_t)i * NUM_SHIFTS];
+
+        // Posterior of each shift here, pooled by the capture byte it reads
+        float mass[NUM_SHIFTS];
+        int values[NUM_SHIFTS];
+        int count = 0;
+        float total = 0;
+
+        for (int s = lo; s <= hi; s++) total += row[s] * beta[s];
+        if (total <= 0) total = P_FLOOR;
+
+        for (int s = lo; s <= hi; s++) {
+            float p = row[s] * beta[s] / total;
+            if (p < 1e-6f) continue;
+
+            int b = capture_byte(capture, n, i + s - MAX_SHIFT);
+            int j = 0;
+            while (j < count && values[j] != b) j++;
+            if (j == count) {
+                values[count] = b;
+                mass[count++] = 0;
+            }
+            mass[j] += p;
+        }
+
+        int best = 0;
+        for (int j = 1; j < count; j++) {
+            if (mass[j] > mass[best]) best = j;
+        }
+        repaired[i] = count && values[best] >= 0 ? values[best] : 0;
+        byte_confidence[i] = count ? mass[best] : 0;
+
+        if (i == 0) break;
+
+        // Transitions into position i, then beta for position i - 1
+        const float *prev = row - NUM_SHIFTS;
+        float e[NUM_SHIFTS];
+        for (int s = lo; s <= hi; s++) {
+            e[s] = emission(model, capture, n, i, s - MAX_SHIFT) * beta[s] / scale[i];
+        }
+
+        for (int s = lo; s <= hi; s++) {
+            if (s + 1 <= hi) {
+                float p = prev[s + 1] * P_DROP * e[s] / total;
+                lost[i] += p;
+                dropped += p;
+            }
+            for (int k = 1; k <= MAX_INSERT_RUN && s - k >= lo; k++) {
+                inserted += k * prev[s - k] * p_insert[k] * e[s] / total;
+            }
+        }
+
+        for (int s = lo; s <= hi; s++) {
+            float b = e[s] * p_stay;
+            if (s - 1 >= lo) b += e[s - 1] * P_DROP;
+            for (int k = 1; k <= MAX_INSERT_RUN && s + k <= hi; k++) b += e[s + k] * p_insert[k];
+            next_beta[s] = b < P_FLOOR ? 0 : b;
+        }
+        memcpy(beta + lo, next_beta + lo, (hi - lo + 1) * sizeof(float));
+    }
+
+    // Fixed bytes are known whatever the capture says
+    for (int i = 0; i < SYSEX_SIZE; i++) {
+        if (model[i].kind == POS_CONST) repaired[i] = model[i].value;
+    }
+
+    // A drop before position i means byte i or byte i - 1 is an echo
+    for (int i = 1; i < SYSEX_SIZE; i++) {
+        byte_confidence[i] -= lost[i];
+        byte_confidence[i - 1] -= lost[i];
+    }
+
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        int first, last;
+        preset_span(p, &first, &last);
+
+        float worst = 1;
+        for (int i = first; i <= last; i++) {
+            if (model[i].kind != POS_CONST && byte_confidence[i] < worst) worst = byte_confidence[i];
+        }
+        report->confidence[p] = worst <= 0 ? 0 : (uint8_t)lrintf(worst * 100);
+    }
+
+    float worst = 1;
+    for (int i = 2311; i <= 2346; i++) {
+        if (model[i].kind != POS_CONST && byte_confidence[i] < worst) worst = byte_confidence[i];
+    }
+    report->globals_confidence = worst <= 0 ? 0 : (uint8_t)lrintf(worst * 100);
+    report->inserted_bytes = (int)lrintf(inserted);
+    report->dropped_bytes = (int)lrintf(dropped);
+
+    // Flag and channel bytes must still fit their masks to decode sanely
+    for (int i = 0; i < SYSEX_SIZE; i++) {
+        if (model[i].kind == POS_MASK) repaired[i] = (repaired[i] & ~model[i].zero & 0x7F) | model[i].one;
+    }
+    status = fcb_decode_sysex(repaired, SYSEX_SIZE, fcb, error);
+
+done:
+    if (allocator) {
+        allocator->free(block, allocator->user_data);
+    } else {
+        fcb_arena_reset(scratch);
+    }
+    return status;
+}
@@ -0,0 +1,411 @@
+/*  Variants of one base dump
+*   A setup is often the same rig with small changes per venue or player:
+*   other MIDI channels, a few CC values, another expression controller.
+*   An override file lists those changes field by field, grouped by
+*   variant name, and fcb_generate_variants() writes one dump (and/or CSV)
+*   per variant.
+*
+*   Nothing is encoded from scratch. Each variant starts as a copy of the
+*   base dump's bytes and only the bytes of the overridden fields are
+*   rewritten, so presets the variant leaves alone keep the base bytes
+*   exactly. The result is decoded again to check that every override
+*   reads back. Variants are shared out over threads through a counter;
+*   the base and the parsed overrides are only ever read.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fcb.h"
+
+#define MAX_THREADS 64
+#define VARIANTS_MAX_FILE_SIZE (64 * 1024 * 1024)
+#define VARIANTS_CHUNK 16  // Variants handed to a thread at a time
+
+static bool grow(void **array, size_t *capacity, size_t needed, size_t item_size) {
+    if (needed <= *capacity) return true;
+
+    size_t capacity_ = *capacity ? *capacity * 2 : 64;
+    while (capacity_ < needed) capacity_ *= 2;
+    void *grown = realloc(*array, capacity_ * item_size);
+    if (!grown) return false;
+    *array = grown;
+    *capacity = capacity_;
+    return true;
+}
+
+// Next space separated word of the line, NUL terminated in place
+static char *next_word(char **cursor, char *end, int *column, const char *line) {
+    char *p = *cursor;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    if (p == end) return NULL;
+
+    char *word = p;
+    while (p < end && *p != ' ' && *p != '\t') p++;
+    if (p < end) *p++ = '\0';
+    *cursor = p;
+    *column = word - line + 1;
+    return word;
+}
+
+static bool valid_name(const char *name) {
+    if (name[0] == '.' || strlen(name) >= FCB_VARIANT_NAME_SIZE) return false;
+    for (const char *c = name; *c; c++) {
+        bool ok = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') ||
+                  *c == '-' || *c == '_' || *c == '.';
+        if (!ok) return false;
+    }
+    return true;
+}
+
+// Same limits the encoder checks: flags 0/1 (or true/false), channels
+// 0-15, everything else 0-127
+static bool parse_value(const char *text, bool is_flag, unsigned max, uint8_t *value) {
+    if (is_flag && (strcmp(text, "true") == 0 || strcmp(text, "false") == 0)) {
+        *value = text[0] == 't';
+        return true;
+    }
+
+    char *end;
+    errno = 0;
+    unsigned long v = strtoul(text, &end, 10);
+    if (text[0] < '0' || text[0] > '9' || *end != '\0' || errno || v > max) return false;
+    *value = v;
+    return true;
+}
+
+typedef struct {
+    FCBVariantSet *set;
+    size_t variant_capacity;
+    size_t override_capacity;
+} Parser;
+
+// One line: "<variant>", or "<variant> <bank>-<preset>|*|global <field> <value>"
+static FCBStatus parse_line(Parser *p, char *line, char *end, int line_number, FCBError *error) {
+    FCBVariantSet *set = p->set;
+    char *cursor = line;
+    int column;
+
+    char *name = next_word(&cursor, end, &column, line);
+    if (!name || name[0] == '#') return FCB_OK;
+    if (!valid_name(name)) {
+        return fcb_set_error(error, FCB_ERR_VALUE, line_number, column, 0,
+                             "Variant name %s must be letters, digits, '-', '_' or '.', at most %d long", name,
+                             FCB_VARIANT_NAME_SIZE - 1);
+    }
+
+    FCBVariant *variant = set->count ? &set->variants[set->count - 1] : NULL;
+    if (!variant || strcmp(variant->name, name) != 0) {
+        if (!grow((void **)&set->variants, &p->variant_capacity, set->count + 1, sizeof(FCBVariant))) {
+            return fcb_set_error(error, FCB_ERR_NOMEM, line_number, 0, 0, "Out of memory");
+        }
+        variant = &set->variants[set->count++];
+        snprintf(variant->name, sizeof(variant->name), "%s", name);
+        variant->line = line_number;
+        variant->first = set->override_count;
+        variant->count = 0;
+    }
+
+    char *target = next_word(&cursor, end, &column, line);
+    if (!target) return FCB_OK;
+    int target_column = column;
+
+    char *field_name = next_word(&cursor, end, &column, line);
+    int field_column = column;
+    char *text = field_name ? next_word(&cursor, end, &column, line) : NULL;
+    if (!text || next_word(&cursor, end, &column, line)) {
+        return fcb_set_error(error, FCB_ERR_VALUE, line_number, 0, 0,
+                             "Expected <variant> <bank>-<preset>|*|global <field> <value>");
+    }
+
+    bool global = strcmp(target, "global") == 0;
+    bool all = strcmp(target, "*") == 0;
+    int preset = global || all ? 0 : fcb_parse_preset(target);
+    if (preset < 0) return fcb_set_error(error, FCB_ERR_VALUE, line_number, target_column, 0, "No preset %s", target);
+
+    int field = global ? fcb_find_global_field(field_name) : fcb_find_preset_field(field_name);
+    if (field < 0) {
+        return fcb_set_error(error, FCB_ERR_VALUE, line_number, field_column, 0, "Unknown %s field %s",
+                             global ? "global" : "preset", field_name);
+    }
+
+    bool is_flag = global ? fcb_global_fields[field].is_flag : fcb_preset_fields[field].is_flag;
+    unsigned max = is_flag ? 1 : global && fcb_global_fields[field].in_csv ? 15 : 127;
+    uint8_t value;
+    if (!parse_value(text, is_flag, max, &value)) {
+        return fcb_set_error(error, FCB_ERR_VALUE, line_number, column, 0, "%s must be %s, not %s", field_name,
+                             is_flag ? "true or false" : max == 15 ? "0-15" : "0-127", text);
+    }
+
+    size_t count = all ? NUM_PRESETS : 1;
+    if (!grow((void **)&set->overrides, &p->override_capacity, set->override_count + count, sizeof(FCBOverride))) {
+        return fcb_set_error(error, FCB_ERR_NOMEM, line_number, 0, 0, "Out of memory");
+    }
+    for (size_t i = 0; i < count; i++) {
+        FCBOverride *o = &set->overrides[set->override_count++];
+        o->preset = global ? FCB_OVERRIDE_GLOBAL : preset + (int)i;
+        o->field = field;
+        o->value = value;
+    }
+    variant->count += count;
+    return FCB_OK;
+}
+
+static int compare_names(const void *a, const void *b) {
+    const FCBVariant *x = *(const FCBVariant *const *)a;
+    const FCBVariant *y = *(const FCBVariant *const *)b;
+    int order = strcmp(x->name, y->name);
+    return order ? order : x->line - y->line;
+}
+
+// Two groups with one name would write the same files
+static FCBStatus check_unique(const FCBVariantSet *set, FCBError *error) {
+    if (set->count < 2) return FCB_OK;
+
+    const FCBVariant **sorted = malloc(set->count * sizeof(FCBVariant *));
+    if (!sorted) return fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory");
+    for (size_t i = 0; i < set->count; i++) sorted[i] = &set->variants[i];
+    qsort(sorted, set->count, sizeof(FCBVariant *), compare_names);
+
+    FCBStatus status = FCB_OK;
+    for (size_t i = 1; i < set->count && status == FCB_OK; i++) {
+        if (strcmp(sorted[i - 1]->name, sorted[i]->name) == 0) {
+            status = fcb_set_error(error, FCB_ERR_VALUE, sorted[i]->line, 1, 0,
+                                   "Variant %s was already listed at line %d; keep its lines together",
+                                   sorted[i]->name, sorted[i - 1]->line);
+        }
+    }
+    free(sorted);
+    return status;
+}
+
+FCBStatus fcb_parse_variants(const char *text, size_t length, FCBVariantSet *set, FCBError *error) {
+    memset(set, 0, sizeof(*set));
+    Parser parser = { .set = set };
+
+    char line[FCB_VARIANT_MAX_LINE];
+    const char *ptr = text;
+    const char *end = text + length;
+    int line_number = 0;
+    FCBStatus status = FCB_OK;
+
+    while (ptr < end && status == FCB_OK) {
+        const char *newline = memchr(ptr, '\n', end - ptr);
+        const char *line_end = newline ? newline : end;
+        size_t len = line_end - ptr;
+        line_number++;
+
+        if (len >= sizeof(line)) {
+            status = fcb_set_error(error, FCB_ERR_VALUE, line_number, 0, 0, "Line longer than %d characters",
+                                   FCB_VARIANT_MAX_LINE - 1);
+            break;
+        }
+        memcpy(line, ptr, len);
+        if (len > 0 && line[len - 1] == '\r') len--;
+        line[len] = '\0';
+        ptr = newline ? newline + 1 : end;
+
+        status = parse_line(&parser, line, line + len, line_number, error);
+    }
+
+    if (status == FCB_OK && set->count == 0) {
+        status = fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "No variants");
+    }
+    if (status == FCB_OK) status = check_unique(set, error);
+    if (status != FCB_OK) fcb_variants_free(set);
+    return status;
+}
+
+// Read until EOF rather than trusting st_size, so pipes and /dev/stdin
+// work; the buffer starts at the file size and doubles as needed
+FCBStatus fcb_read_variants_file(const char *path, FCBVariantSet *set, FCBError *error) {
+    memset(set, 0, sizeof(*set));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to read file %s", path);
+
+    struct stat st;
+    size_t capacity = 64 * 1024;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size < VARIANTS_MAX_FILE_SIZE &&
+        (size_t)st.st_size >= capacity) {
+        capacity = st.st_size + 1;
+    }
+
+    char *text = malloc(capacity);
+    if (!text) {
+        close(fd);
+        return fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory reading %s", path);
+    }
+
+    size_t read_size = 0;
+    FCBStatus status = FCB_OK;
+    for (;;) {
+        if (read_size > VARIANTS_MAX_FILE_SIZE) {
+            status = fcb_set_error(error, FCB_ERR_SIZE, 0, 0, 0, "%s is too large for an override file", path);
+            break;
+        }
+        if (read_size + 1 == capacity) {
+            char *grown = realloc(text, capacity * 2);
+            if (!grown) {
+                status = fcb_set_error(error, FCB_ERR_NOMEM, 0, 0, 0, "Out of memory reading %s", path);
+                break;
+            }
+            text = grown;
+            capacity *= 2;
+        }
+
+        ssize_t n = read(fd, text + read_size, capacity - 1 - read_size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            status = fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Failed to read file %s", path);
+            break;
+        }
+        if (n == 0) break;
+        read_size += n;
+    }
+    close(fd);
+
+    if (status == FCB_OK) status = fcb_parse_variants(text, read_size, set, error);
+    free(text);
+    return status;
+}
+
+void fcb_variants_free(FCBVariantSet *set) {
+    free(set->variants);
+    free(set->overrides);
+    memset(set, 0, sizeof(*set));
+}
+
+void fcb_apply_overrides(const FCBOverride *overrides, size_t count, uint8_t *data, FCBDirtyRange *dirty) {
+    for (size_t i = 0; i < count; i++) {
+        const FCBOverride *o = &overrides[i];
+        if (o->preset == FCB_OVERRIDE_GLOBAL) {
+            fcb_encode_global_field(data, o->field, o->value, dirty);
+        } else {
+            fcb_encode_preset_field(data, o->preset, o->field, o->value, dirty);
+        }
+    }
+}
+
+typedef struct {
+    const uint8_t *base;
+    const FCBVariantSet *set;
+    const char *out_dir;
+    int formats;
+    size_t next;        // Next variant to hand out, atomically
+    size_t written;     // Variants done, atomically
+    pthread_mutex_t lock;
+    size_t failed;      // Lowest variant that failed, or set->count
+    FCBError error;     // Its error
+} VariantJob;
+
+// Later overrides of a field win, so only the last one must read back
+static FCBStatus check_variant(const FCB1010 *fcb, const FCBOverride *overrides, size_t count, FCBError *error) {
+    for (size_t i = 0; i < count; i++) {
+        const FCBOverride *o = &overrides[i];
+        bool last = true;
+        for (size_t j = i + 1; j < count && last; j++) {
+            last = overrides[j].preset != o->preset || overrides[j].field != o->field;
+        }
+        if (!last) continue;
+
+        uint8_t value = o->preset == FCB_OVERRIDE_GLOBAL ? fcb_get_global_field(fcb, o->field)
+                                                         : fcb_get_preset_field(&fcb->preset[o->preset], o->field);
+        if (value != o->value) {
+            const char *name = o->preset == FCB_OVERRIDE_GLOBAL ? fcb_global_fields[o->field].name
+                                                                : fcb_preset_fields[o->field].name;
+            return fcb_set_error(error, FCB_ERR_VALUE, 0, 0, 0, "%s reads back as %u, not %u", name, value,
+                                 o->value);
+        }
+    }
+    return FCB_OK;
+}
+
+static FCBStatus make_variant(VariantJob *job, const FCBVariant *variant, FCBError *error) {
+    uint8_t data[SYSEX_SIZE];
+    FCB1010 fcb;
+    char path[1024];
+
+    memcpy(data, job->base, SYSEX_SIZE);
+    const FCBOverride *overrides = job->set->overrides + variant->first;
+    fcb_apply_overrides(overrides, variant->count, data, NULL);
+
+    FCBStatus status = fcb_decode_sysex(data, SYSEX_SIZE, &fcb, error);
+    if (status == FCB_OK) status = check_variant(&fcb, overrides, variant->count, error);
+
+    if (status == FCB_OK && (job->formats & FCB_VARIANT_SYX)) {
+        if (snprintf(path, sizeof(path), "%s/%s.syx", job->out_dir, variant->name) >= (int)sizeof(path)) {
+            return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Path too long for %s", variant->name);
+        }
+        status = fcb_write_sysex_file(path, data, error);
+    }
+    if (status == FCB_OK && (job->formats & FCB_VARIANT_CSV)) {
+        if (snprintf(path, sizeof(path), "%s/%s.csv", job->out_dir, variant->name) >= (int)sizeof(path)) {
+            return fcb_set_error(error, FCB_ERR_IO, 0, 0, 0, "Path too long for %s", variant->name);
+        }
+        status = fcb_write_csv_file(path, &fcb, error);
+    }
+    return status;
+}
+
+static void *variant_worker(void *arg) {
+    VariantJob *job = arg;
+    size_t count = job->set->count;
+
+    for (;;) {
+        size_t first = __atomic_fetch_add(&job->next, VARIANTS_CHUNK, __ATOMIC_RELAXED);
+        if (first >= count) break;
+        size_t last = first + VARIANTS_CHUNK < count ? first + VARIANTS_CHUNK : count;
+
+        for (size_t v = first; v < last; v++) {
+            FCBError error;
+            if (make_variant(job, &job->set->variants[v], &error) == FCB_OK) {
+                __atomic_add_fetch(&job->written, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+
+            pthread_mutex_lock(&job->lock);
+            if (v < job->failed) {
+                job->failed = v;
+                job->error = error;
+            }
+            pthread_mutex_unlock(&job->lock);
+        }
+    }
+    return NULL;
+}
+
+FCBStatus fcb_generate_variants(const uint8_t *base, const FCBVariantSet *set, const char *out_dir, int formats,
+                                int threads, size_t *written, FCBError *error) {
+    if (written) *written = 0;
+    FCBStatus status = fcb_check_sysex(base, SYSEX_SIZE, error);
+    if (status != FCB_OK) return status;
+
+    VariantJob job = { .base = base, .set = set, .out_dir = out_dir, .formats = formats, .failed = set->count };
+    pthread_mutex_init(&job.lock, NULL);
+
+    if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t chunks = (set->count + VARIANTS_CHUNK - 1) / VARIANTS_CHUNK;
+    if ((size_t)threads > chunks) threads = chunks;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if (threads < 1) threads = 1;
+
+    pthread_t workers[MAX_THREADS];
+    int started = 0;
+    while (started < threads - 1 && pthread_create(&workers[started], NULL, variant_worker, &job) == 0) started++;
+    variant_worker(&job);
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    pthread_mutex_destroy(&job.lock);
+
+    if (written) *written = job.written;
+    if (job.failed < set->count) {
+        const FCBError *e = &job.error;
+        return fcb_set_error(error, e->status, set->variants[job.failed].line, 0, e->offset, "%s: %s",
+                             set->variants[job.failed].name, e->message);
+    }
+    return FCB_OK;
+}
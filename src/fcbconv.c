@@ -0,0 +1,958 @@
+/*  fcbconv: batch conversion and validation on top of libfcb
+*   Same formats as the interactive tool, but with explicit paths and
+*   no ncurses or ALSA, so it can run from scripts and build systems.
+*/
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fcb.h"
+
+// Room for a few dozen dumps of NDJSON between writes
+#define JSON_BUFFER_SIZE (4 * 1024 * 1024)
+
+static void usage() {
+    fprintf(stderr, "Usage: fcbconv syx2csv <in.syx> <out.csv|->\n");
+    fprintf(stderr, "       fcbconv csv2syx <in.csv|in.ndjson> <out.syx> [--overlay]\n");
+    fprintf(stderr, "       fcbconv syx2json <out.ndjson|-> <file.syx|directory>...\n");
+    fprintf(stderr, "       fcbconv convert <out-dir> [--io auto|uring|threads] <file.syx|directory>...\n");
+    fprintf(stderr, "       fcbconv variants <base.syx|base.csv|base.ndjson> <overrides> <out-dir> [--csv] [--syx]\n");
+    fprintf(stderr, "       fcbconv cluster [--threshold <0-1>] <file.syx|directory>...\n");
+    fprintf(stderr, "       fcbconv validate <file.syx|file.csv>...\n");
+    fprintf(stderr, "       fcbconv recover <damaged.syx> <out.syx>\n");
+    fprintf(stderr, "       fcbconv scan <capture.syx>...\n");
+    fprintf(stderr, "       fcbconv export <out.fcol> <file.syx|directory>...\n");
+    fprintf(stderr, "       fcbconv aggregate <file.fcol> [<column> [--by <column>] [--where <column>=<value>]...]\n");
+}
+
+// file:line:col: message, leaving out the parts that do not apply. The
+// library's file readers already name the file, so it is not repeated
+static void report(const char *path, const FCBError *error) {
+    if (error->line == 0 && strstr(error->message, path)) {
+        fprintf(stderr, "%s\n", error->message);
+    } else if (error->line > 0 && error->column > 0) {
+        fprintf(stderr, "%s:%d:%d: %s\n", path, error->line, error->column, error->message);
+    } else if (error->line > 0) {
+        fprintf(stderr, "%s:%d: %s\n", path, error->line, error->message);
+    } else {
+        fprintf(stderr, "%s: %s\n", path, error->message);
+    }
+}
+
+static bool load(const char *path, FCB1010 *fcb, FCBError *error) {
+    if (fcb_has_suffix(path, ".csv")) return fcb_read_csv_file(path, fcb, NULL, error) == FCB_OK;
+    if (fcb_has_suffix(path, ".ndjson")) return fcb_read_ndjson_file(path, fcb, error) == FCB_OK;
+
+    uint8_t data[SYSEX_SIZE];
+    return fcb_read_sysex_file(path, data, error) == FCB_OK &&
+           fcb_decode_sysex(data, SYSEX_SIZE, fcb, error) == FCB_OK;
+}
+
+static int syx2csv(const char *in, const char *out) {
+    FCB1010 fcb;
+    FCBError error;
+
+    if (!load(in, &fcb, &error)) {
+        report(in, &error);
+        return 2;
+    }
+
+    if (strcmp(out, "-") != 0) {
+        if (fcb_write_csv_file(out, &fcb, &error) != FCB_OK) {
+            report(out, &error);
+            return 2;
+        }
+        return 0;
+    }
+
+    char text[FCB_CSV_MAX_SIZE];
+    size_t length;
+    if (fcb_format_csv(&fcb, text, sizeof(text), &length, &error) != FCB_OK) {
+        report(out, &error);
+        return 2;
+    }
+    return fwrite(text, 1, length, stdout) == length ? 0 : 2;
+}
+
+// With overlay, out must already be a valid dump; the CSV is patched
+// onto it and the file is left alone when nothing differs
+static int csv2syx(const char *in, const char *out, bool overlay) {
+    FCB1010 fcb;
+    FCBError error;
+    uint8_t data[SYSEX_SIZE];
+
+    if (!load(in, &fcb, &error)) {
+        report(in, &error);
+        return 2;
+    }
+
+    if (overlay) {
+        size_t changed;
+        if (fcb_read_sysex_file(out, data, &error) != FCB_OK ||
+            fcb_check_sysex(data, sizeof(data), &error) != FCB_OK) {
+            report(out, &error);
+            return 2;
+        }
+        if (fcb_overlay_sysex(&fcb, data, sizeof(data), &changed, NULL, &error) != FCB_OK) {
+            report(in, &error);
+            return 2;
+        }
+        if (changed == 0) return 0;
+    } else if (fcb_encode_sysex(&fcb, data, sizeof(data), &error) != FCB_OK) {
+        report(in, &error);
+        return 2;
+    }
+
+    if (fcb_write_sysex_file(out, data, &error) != FCB_OK) {
+        report(out, &error);
+        return 2;
+    }
+    return 0;
+}
+
+// Check every file, reporting each bad one; CSVs must also encode
+static int validate(int count, char *paths[]) {
+    int status = 0;
+
+    for (int i = 0; i < count; i++) {
+        FCB1010 fcb;
+        FCBError error;
+        uint8_t data[SYSEX_SIZE];
+
+        if (!load(paths[i], &fcb, &error) ||
+            fcb_encode_sysex(&fcb, data, sizeof(data), &error) != FCB_OK) {
+            report(paths[i], &error);
+            status = 2;
+        }
+    }
+    return status;
+}
+
+// Presets below this confidence are listed by recover and scan
+#define RECOVER_REPORT_THRESHOLD 90
+
+static bool read_capture(const char *path, uint8_t *data, size_t size, size_t *length) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "%s: Failed to open\n", path);
+        return false;
+    }
+    *length = fread(data, 1, size, file);
+    fclose(file);
+    return true;
+}
+
+// One line per capture: clean, or how much was repaired and which
+// presets are in doubt
+static bool recover_one(const char *path, uint8_t *repaired, FCB1010 *fcb) {
+    uint8_t data[2 * SYSEX_SIZE + 1];
+    size_t length;
+    FCBRecovery recovery;
+    FCBError error;
+
+    if (!read_capture(path, data, sizeof(data), &length)) return false;
+
+    if (fcb_recover_sysex(data, length, repaired, fcb, &recovery, NULL, &error) != FCB_OK) {
+        report(path, &error);
+        return false;
+    }
+
+    if (recovery.exact) {
+        printf("%s: clean\n", path);
+        return true;
+    }
+
+    int good = 0;
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        if (recovery.confidence[p] >= RECOVER_REPORT_THRESHOLD) good++;
+    }
+    printf("%s: %zu bytes, %d stray, ~%d inserted, ~%d dropped; %d/%d presets >= %d%%, globals %d%%",
+           path, length, recovery.stray_bytes, recovery.inserted_bytes, recovery.dropped_bytes, good, NUM_PRESETS,
+           RECOVER_REPORT_THRESHOLD, recovery.globals_confidence);
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        if (recovery.confidence[p] < RECOVER_REPORT_THRESHOLD) {
+            printf(" %d-%d:%d%%", p / 10 + 1, p % 10 + 1, recovery.confidence[p]);
+        }
+    }
+    printf("\n");
+    return true;
+}
+
+static int recover(const char *in, const char *out) {
+    uint8_t repaired[SYSEX_SIZE];
+    FCB1010 fcb;
+    FCBError error;
+
+    if (!recover_one(in, repaired, &fcb)) return 2;
+
+    if (fcb_write_sysex_file(out, repaired, &error) != FCB_OK) {
+        report(out, &error);
+        return 2;
+    }
+    return 0;
+}
+
+static int scan(int count, char *paths[]) {
+    int status = 0;
+
+    for (int i = 0; i < count; i++) {
+        uint8_t repaired[SYSEX_SIZE];
+        FCB1010 fcb;
+        if (!recover_one(paths[i], repaired, &fcb)) status = 2;
+    }
+    return status;
+}
+
+// Inputs read by the file pipeline may be this long; a dump as CSV or
+// NDJSON is far shorter
+#define FILE_READ_SIZE (256 * 1024)
+
+// Called for every dump file named on the command line or found under a
+// directory, in that order; returns false if the file failed
+typedef bool (*DumpVisitor)(void *context, const char *path, const FCB1010 *fcb);
+
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t capacity;
+} PathList;
+
+static bool add_path(PathList *list, const char *path) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        char **paths = realloc(list->paths, capacity * sizeof(char *));
+        if (!paths) return false;
+        list->paths = paths;
+        list->capacity = capacity;
+    }
+    if (!(list->paths[list->count] = strdup(path))) return false;
+    list->count++;
+    return true;
+}
+
+static void free_paths(PathList *list) {
+    for (size_t i = 0; i < list->count; i++) free(list->paths[i]);
+    free(list->paths);
+}
+
+// Every .syx under a directory, in name order so output is repeatable
+static bool collect_directory(const char *path, PathList *list) {
+    struct dirent **entries;
+    int count = scandir(path, &entries, NULL, alphasort);
+    if (count < 0) {
+        fprintf(stderr, "%s: Failed to read directory\n", path);
+        return false;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < count; i++) {
+        const char *name = entries[i]->d_name;
+        char child[4096];
+        struct stat st;
+
+        if (ok && name[0] != '.' && snprintf(child, sizeof(child), "%s/%s", path, name) < (int)sizeof(child) &&
+            stat(child, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                if (!collect_directory(child, list)) ok = false;
+            } else if (S_ISREG(st.st_mode) && fcb_has_suffix(name, ".syx") && !add_path(list, child)) {
+                fprintf(stderr, "Out of memory\n");
+                ok = false;
+            }
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    return ok;
+}
+
+// Files are taken as given, directories searched for .syx files
+static bool collect_paths(int count, char *paths[], PathList *list) {
+    bool ok = true;
+
+    for (int i = 0; i < count; i++) {
+        struct stat st;
+        if (stat(paths[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            if (!collect_directory(paths[i], list)) ok = false;
+        } else if (!add_path(list, paths[i])) {
+            fprintf(stderr, "Out of memory\n");
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// load() for bytes the file pipeline has already read
+static FCBStatus decode(const char *path, const uint8_t *data, size_t size, FCB1010 *fcb, FCBError *error) {
+    if (fcb_has_suffix(path, ".csv")) return fcb_parse_csv((const char *)data, size, fcb, error);
+    if (fcb_has_suffix(path, ".ndjson")) return fcb_parse_ndjson((const char *)data, size, fcb, error);
+    return fcb_decode_sysex(data, size, fcb, error);
+}
+
+typedef struct {
+    char **paths;
+    DumpVisitor visit;
+    void *context;
+    bool ok;
+} VisitJob;
+
+static void visit_convert(size_t file, const uint8_t *data, size_t size, uint8_t *out, size_t out_size,
+                          size_t *length, FCBError *error, void *user_data) {
+    (void)out;
+    (void)out_size;
+    (void)length;
+
+    VisitJob *v = user_data;
+    FCB1010 fcb;
+    if (decode(v->paths[file], data, size, &fcb, error) == FCB_OK && !v->visit(v->context, v->paths[file], &fcb)) {
+        v->ok = false;
+    }
+}
+
+static void visit_finish(size_t file, const FCBError *error, void *user_data) {
+    VisitJob *v = user_data;
+    if (error->status != FCB_OK) {
+        report(v->paths[file], error);
+        v->ok = false;
+    }
+}
+
+// Read every dump through the file pipeline and visit them in order
+static bool visit_paths(int count, char *paths[], DumpVisitor visit, void *context) {
+    PathList list = { NULL, 0, 0 };
+    bool ok = collect_paths(count, paths, &list);
+
+    VisitJob v = { list.paths, visit, context, true };
+    FCBFileJob job = {
+        .read_size = FILE_READ_SIZE,
+        .ordered = true,
+        .convert = visit_convert,
+        .finish = visit_finish,
+        .user_data = &v,
+    };
+    FCBError error;
+    if (fcb_process_files((const char *const *)list.paths, NULL, list.count, &job, NULL, &error) != FCB_OK) {
+        fprintf(stderr, "%s\n", error.message);
+        ok = false;
+    }
+
+    free_paths(&list);
+    return ok && v.ok;
+}
+
+typedef struct {
+    FCBColumnWriter *writer;
+    int dumps;
+} ExportState;
+
+static bool export_file(void *context, const char *path, const FCB1010 *fcb) {
+    ExportState *state = context;
+    FCBError error;
+
+    if (fcb_columns_append(state->writer, path, fcb, &error) != FCB_OK) {
+        report(path, &error);
+        return false;
+    }
+    state->dumps++;
+    return true;
+}
+
+// Dumps that fail to load are reported and left out; the file is still
+// written with the rest
+static int export_columns(const char *out, int count, char *paths[]) {
+    ExportState state = { NULL, 0 };
+    FCBError error;
+    int status = 0;
+
+    if (fcb_columns_create(&state.writer, NULL, &error) != FCB_OK) {
+        report(out, &error);
+        return 2;
+    }
+
+    if (!visit_paths(count, paths, export_file, &state)) status = 2;
+
+    if (fcb_columns_write(state.writer, out, &error) != FCB_OK) {
+        report(out, &error);
+        status = 2;
+    } else {
+        printf("%s: %d dumps, %d presets\n", out, state.dumps, state.dumps * NUM_PRESETS);
+    }
+    fcb_columns_free(state.writer);
+    return status;
+}
+
+// Output is gathered in one buffer and written whenever the next dump
+// does not fit, so the stream costs one write per few dozen dumps
+typedef struct {
+    FILE *out;
+    char *buffer;
+    size_t used;
+    bool failed;  // Writing the output failed; nothing more is attempted
+} JsonStream;
+
+static bool flush_json(JsonStream *stream) {
+    if (!stream->failed && fwrite(stream->buffer, 1, stream->used, stream->out) != stream->used) {
+        fprintf(stderr, "Failed to write the NDJSON output\n");
+        stream->failed = true;
+    }
+    stream->used = 0;
+    return !stream->failed;
+}
+
+static bool json_file(void *context, const char *path, const FCB1010 *fcb) {
+    JsonStream *stream = context;
+    FCBError error;
+    size_t length;
+
+    if (stream->failed) return false;
+
+    FCBStatus status = fcb_format_ndjson(fcb, path, stream->buffer + stream->used, JSON_BUFFER_SIZE - stream->used,
+                                         &length, &error);
+    if (status == FCB_ERR_SIZE && stream->used > 0) {
+        if (!flush_json(stream)) return false;
+        status = fcb_format_ndjson(fcb, path, stream->buffer, JSON_BUFFER_SIZE, &length, &error);
+    }
+    if (status != FCB_OK) {
+        report(path, &error);
+        return false;
+    }
+    stream->used += length;
+    return true;
+}
+
+// Dumps that fail to load are reported and left out of the stream
+static int export_json(const char *out, int count, char *paths[]) {
+    JsonStream stream = { stdout, malloc(JSON_BUFFER_SIZE), 0, false };
+    if (!stream.buffer) {
+        fprintf(stderr, "Out of memory\n");
+        return 2;
+    }
+    if (strcmp(out, "-") != 0 && !(stream.out = fopen(out, "wb"))) {
+        fprintf(stderr, "%s: Failed to open for writing\n", out);
+        free(stream.buffer);
+        return 2;
+    }
+
+    int status = visit_paths(count, paths, json_file, &stream) ? 0 : 2;
+    if (!flush_json(&stream)) status = 2;
+
+    if (stream.out != stdout && fclose(stream.out) != 0) {
+        fprintf(stderr, "%s: Failed to write\n", out);
+        status = 2;
+    }
+    free(stream.buffer);
+    return status;
+}
+
+typedef struct {
+    char **paths;
+    size_t converted;
+} ConvertState;
+
+static void convert_file(size_t file, const uint8_t *data, size_t size, uint8_t *out, size_t out_size,
+                         size_t *length, FCBError *error, void *user_data) {
+    (void)file;
+    (void)user_data;
+
+    FCB1010 fcb;
+    if (fcb_decode_sysex(data, size, &fcb, error) == FCB_OK) {
+        fcb_format_csv(&fcb, (char *)out, out_size, length, error);
+    }
+}
+
+static void convert_finish(size_t file, const FCBError *error, void *user_data) {
+    ConvertState *state = user_data;
+    if (error->status == FCB_OK) {
+        __atomic_fetch_add(&state->converted, 1, __ATOMIC_RELAXED);
+    } else {
+        report(state->paths[file], error);
+    }
+}
+
+// A CSV per dump in out_dir, named after the dump. Reading, converting
+// and writing overlap across many files at once, with a pipeline per CPU
+// since formatting the CSV costs more than the I/O.
+static int convert_dumps(const char *out_dir, FCBFileBackend backend, int count, char *paths[]) {
+    PathList inputs = { NULL, 0, 0 };
+    PathList outputs = { NULL, 0, 0 };
+    bool ok = collect_paths(count, paths, &inputs);
+
+    for (size_t i = 0; ok && i < inputs.count; i++) {
+        const char *slash = strrchr(inputs.paths[i], '/');
+        const char *name = slash ? slash + 1 : inputs.paths[i];
+        size_t stem = fcb_has_suffix(name, ".syx") ? strlen(name) - 4 : strlen(name);
+        char out[4096];
+
+        if (snprintf(out, sizeof(out), "%s/%.*s.csv", out_dir, (int)stem, name) >= (int)sizeof(out) ||
+            !add_path(&outputs, out)) {
+            fprintf(stderr, "%s: Failed to name the output\n", inputs.paths[i]);
+            ok = false;
+        }
+    }
+
+    ConvertState state = { inputs.paths, 0 };
+    FCBFileJob job = {
+        .backend = backend,
+        .shards = (int)sysconf(_SC_NPROCESSORS_ONLN),
+        .read_size = SYSEX_SIZE,
+        .write_size = FCB_CSV_MAX_SIZE,
+        .convert = convert_file,
+        .finish = convert_finish,
+        .user_data = &state,
+    };
+    FCBFileBackend used;
+    FCBError error;
+    if (ok && fcb_process_files((const char *const *)inputs.paths, (const char *const *)outputs.paths, inputs.count,
+                                &job, &used, &error) != FCB_OK) {
+        fprintf(stderr, "%s\n", error.message);
+        ok = false;
+    }
+    if (ok) {
+        printf("%zu of %zu dumps converted with %s\n", state.converted, inputs.count,
+               used == FCB_FILES_URING ? "io_uring" : "threads");
+    }
+
+    free_paths(&inputs);
+    free_paths(&outputs);
+    return ok && state.converted == inputs.count ? 0 : 2;
+}
+
+#define CLUSTER_THRESHOLD 0.8   // Estimated similarity for two dumps to be joined
+#define CLUSTER_MAX_CHANGES 12  // Changes listed per member, against the representative
+
+typedef struct {
+    char **paths;
+    uint32_t *signatures;
+    bool *sketched;
+} ClusterState;
+
+static void sketch_file(size_t file, const uint8_t *data, size_t size, uint8_t *out, size_t out_size,
+                        size_t *length, FCBError *error, void *user_data) {
+    (void)out;
+    (void)out_size;
+    (void)length;
+    ClusterState *state = user_data;
+
+    FCB1010 fcb;
+    if (fcb_decode_sysex(data, size, &fcb, error) == FCB_OK) {
+        fcb_minhash(&fcb, state->signatures + file * FCB_MINHASH_SIZE);
+    }
+}
+
+static void sketch_finish(size_t file, const FCBError *error, void *user_data) {
+    ClusterState *state = user_data;
+    if (error->status == FCB_OK) {
+        state->sketched[file] = true;
+    } else {
+        report(state->paths[file], error);
+    }
+}
+
+typedef struct {
+    uint32_t representative;
+    uint32_t first;  // Into the members array
+    uint32_t size;
+} Cluster;
+
+static int compare_clusters(const void *a, const void *b) {
+    const Cluster *x = a;
+    const Cluster *y = b;
+    if (x->size != y->size) return x->size < y->size ? 1 : -1;
+    return x->representative < y->representative ? -1 : x->representative > y->representative;
+}
+
+static void print_value(bool is_flag, uint8_t value) {
+    if (is_flag) {
+        printf("%s", value ? "true" : "false");
+    } else {
+        printf("%u", value);
+    }
+}
+
+static void print_change(int *changes, const char *target, const char *field, bool is_flag, uint8_t from,
+                         uint8_t to) {
+    if (from == to) return;
+    if (++*changes > CLUSTER_MAX_CHANGES) return;
+
+    printf("%s%s %s ", *changes > 1 ? ", " : " ", target, field);
+    print_value(is_flag, from);
+    printf("->");
+    print_value(is_flag, to);
+}
+
+// "  path: N changes: 1-2 cc1_value 20->30, ..." against the representative
+static void print_member(const char *path, const FCB1010 *base) {
+    FCB1010 fcb;
+    FCBError error;
+    if (!load(path, &fcb, &error)) {
+        report(path, &error);
+        return;
+    }
+
+    printf("  %s:", path);
+    int changes = 0;
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        print_change(&changes, "global", fcb_global_fields[f].name, fcb_global_fields[f].is_flag,
+                     fcb_get_global_field(base, f), fcb_get_global_field(&fcb, f));
+    }
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        char target[8];
+        snprintf(target, sizeof(target), "%d-%d", p / 10 + 1, p % 10 + 1);
+        for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+            print_change(&changes, target, fcb_preset_fields[f].name, fcb_preset_fields[f].is_flag,
+                         fcb_get_preset_field(&base->preset[p], f), fcb_get_preset_field(&fcb.preset[p], f));
+        }
+    }
+
+    if (changes == 0) {
+        printf(" identical\n");
+    } else if (changes > CLUSTER_MAX_CHANGES) {
+        printf(", ... %d changes in all\n", changes);
+    } else {
+        printf("\n");
+    }
+}
+
+// Groups of near duplicate dumps, largest first: the representative, then
+// each other member with its changes. Sketches are made by the file
+// pipeline on every CPU; grouping is one linear pass per LSH band.
+static int cluster_dumps(double threshold, int count, char *paths[]) {
+    PathList inputs = { NULL, 0, 0 };
+    bool ok = collect_paths(count, paths, &inputs);
+    size_t n = inputs.count;
+
+    ClusterState state = {
+        inputs.paths,
+        malloc((n ? n : 1) * FCB_MINHASH_SIZE * sizeof(uint32_t)),
+        calloc(n ? n : 1, sizeof(bool)),
+    };
+    uint32_t *index = malloc((n ? n : 1) * sizeof(uint32_t));    // Sketched dump -> file
+    uint32_t *cluster = malloc((n ? n : 1) * sizeof(uint32_t));
+    uint32_t *members = malloc((n ? n : 1) * sizeof(uint32_t));
+    Cluster *clusters = malloc((n ? n : 1) * sizeof(Cluster));
+    if (ok && (!state.signatures || !state.sketched || !index || !cluster || !members || !clusters)) {
+        fprintf(stderr, "Out of memory\n");
+        ok = false;
+    }
+
+    FCBFileJob job = {
+        .shards = (int)sysconf(_SC_NPROCESSORS_ONLN),
+        .read_size = SYSEX_SIZE,
+        .convert = sketch_file,
+        .finish = sketch_finish,
+        .user_data = &state,
+    };
+    FCBError error;
+    if (ok && fcb_process_files((const char *const *)inputs.paths, NULL, n, &job, NULL, &error) != FCB_OK) {
+        fprintf(stderr, "%s\n", error.message);
+        ok = false;
+    }
+
+    // Only dumps that decoded take part; their sketches move down in place
+    size_t sketched = 0;
+    for (size_t i = 0; ok && i < n; i++) {
+        if (!state.sketched[i]) continue;
+        memmove(state.signatures + sketched * FCB_MINHASH_SIZE, state.signatures + i * FCB_MINHASH_SIZE,
+                FCB_MINHASH_SIZE * sizeof(uint32_t));
+        index[sketched++] = i;
+    }
+
+    if (ok && fcb_cluster_minhash(state.signatures, sketched, threshold, cluster, &error) != FCB_OK) {
+        fprintf(stderr, "%s\n", error.message);
+        ok = false;
+    }
+
+    // Clusters of two or more by representative, then their members in
+    // dump order, each cluster's slice of members starting at first
+    size_t cluster_count = 0;
+    size_t clustered = 0;
+    uint32_t *slot = ok ? calloc(sketched ? sketched : 1, sizeof(uint32_t)) : NULL;
+    if (ok && !slot) {
+        fprintf(stderr, "Out of memory\n");
+        ok = false;
+    }
+    if (ok) {
+        for (size_t d = 0; d < sketched; d++) slot[cluster[d]]++;
+        for (size_t d = 0; d < sketched; d++) {
+            if (slot[d] > 1) {
+                clusters[cluster_count] = (Cluster){ .representative = d, .first = clustered, .size = 0 };
+                clustered += slot[d];
+                slot[d] = ++cluster_count;
+            } else {
+                slot[d] = 0;
+            }
+        }
+        for (size_t d = 0; d < sketched; d++) {
+            uint32_t c = slot[cluster[d]];
+            if (c > 0) {
+                Cluster *k = &clusters[c - 1];
+                members[k->first + k->size++] = d;
+            }
+        }
+        qsort(clusters, cluster_count, sizeof(Cluster), compare_clusters);
+
+        for (size_t c = 0; c < cluster_count; c++) {
+            const Cluster *k = &clusters[c];
+            const char *path = inputs.paths[index[k->representative]];
+            FCB1010 base;
+            if (!load(path, &base, &error)) {
+                report(path, &error);
+                ok = false;
+                continue;
+            }
+
+            printf("cluster %zu: %u dumps, representative %s\n", c + 1, k->size, path);
+            for (uint32_t m = 0; m < k->size; m++) {
+                uint32_t d = members[k->first + m];
+                if (d != k->representative) print_member(inputs.paths[index[d]], &base);
+            }
+        }
+        printf("%zu dumps, %zu clusters of near duplicates holding %zu, %zu unclustered\n", sketched,
+               cluster_count, clustered, sketched - clustered);
+    }
+
+    free(slot);
+    free(state.signatures);
+    free(state.sketched);
+    free(index);
+    free(cluster);
+    free(members);
+    free(clusters);
+    free_paths(&inputs);
+    return ok && sketched == n ? 0 : 2;
+}
+
+// A one byte column as rows of table; per dump values are repeated for
+// each preset of the dump. *owned is set when the result must be freed.
+static const uint8_t *column_rows(const FCBColumns *columns, const char *name, FCBTable table, uint8_t **owned) {
+    *owned = NULL;
+
+    const FCBColumn *column = fcb_columns_find(columns, name);
+    if (!column || column->width != 1) {
+        fprintf(stderr, "No one byte column named %s\n", name);
+        return NULL;
+    }
+
+    const uint8_t *values = columns->base + column->offset;
+    if (column->table == table) return values;
+    if (column->table == FCB_TABLE_PRESETS) {
+        fprintf(stderr, "%s has a value per preset and cannot group or filter dumps\n", name);
+        return NULL;
+    }
+
+    *owned = malloc((size_t)columns->dump_count * NUM_PRESETS);
+    if (!*owned) {
+        fprintf(stderr, "Out of memory\n");
+        return NULL;
+    }
+    for (uint32_t d = 0; d < columns->dump_count; d++) memset(*owned + (size_t)d * NUM_PRESETS, values[d], NUM_PRESETS);
+    return *owned;
+}
+
+static void list_columns(const FCBColumns *columns) {
+    printf("%u dumps\n", columns->dump_count);
+    for (uint32_t c = 0; c < columns->column_count; c++) {
+        const FCBColumn *column = &columns->column[c];
+        printf("%-24s %s %u byte%s\n", column->name, column->table == FCB_TABLE_PRESETS ? "preset" : "dump",
+               column->width, column->width == 1 ? "" : "s");
+    }
+}
+
+// "value count" per value of column, or "key value count" with --by,
+// over the rows that pass every --where; zero counts are left out
+static int aggregate(int argc, char *argv[]) {
+    FCBColumns columns;
+    FCBError error;
+
+    if (fcb_columns_open(argv[0], &columns, &error) != FCB_OK) {
+        report(argv[0], &error);
+        return 2;
+    }
+    if (argc == 1) {
+        list_columns(&columns);
+        fcb_columns_close(&columns);
+        return 0;
+    }
+
+    int status = 2;
+    uint8_t *owned_values = NULL;
+    uint8_t *owned_keys = NULL;
+    uint8_t *mask = NULL;
+    uint64_t *counts = NULL;
+
+    const FCBColumn *column = fcb_columns_find(&columns, argv[1]);
+    if (!column) {
+        fprintf(stderr, "No column named %s\n", argv[1]);
+        goto done;
+    }
+    FCBTable table = column->table;
+    size_t rows = fcb_columns_rows(&columns, column);
+    const uint8_t *values = column_rows(&columns, argv[1], table, &owned_values);
+    const uint8_t *keys = NULL;
+    if (!values) goto done;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--by") == 0 && i + 1 < argc && !keys) {
+            keys = column_rows(&columns, argv[++i], table, &owned_keys);
+            if (!keys) goto done;
+        } else if (strcmp(argv[i], "--where") == 0 && i + 1 < argc) {
+            char name[FCB_COLUMN_NAME_SIZE];
+            char *equals = strchr(argv[++i], '=');
+            char *end;
+            long value = equals ? strtol(equals + 1, &end, 10) : -1;
+            if (!equals || equals - argv[i] >= (long)sizeof(name) || end == equals + 1 || *end || value < 0 ||
+                value >= FCB_COLUMN_VALUES) {
+                fprintf(stderr, "Expected --where <column>=<0-127>, got %s\n", argv[i]);
+                goto done;
+            }
+            snprintf(name, sizeof(name), "%.*s", (int)(equals - argv[i]), argv[i]);
+
+            uint8_t *owned;
+            const uint8_t *filter = column_rows(&columns, name, table, &owned);
+            if (!filter) goto done;
+            if (!mask) {
+                mask = malloc(rows ? rows : 1);
+                if (!mask) {
+                    free(owned);
+                    fprintf(stderr, "Out of memory\n");
+                    goto done;
+                }
+                memset(mask, 1, rows);
+            }
+            fcb_columns_filter(filter, (uint8_t)value, mask, rows);
+            free(owned);
+        } else {
+            usage();
+            status = 1;
+            goto done;
+        }
+    }
+
+    size_t bins = keys ? FCB_COLUMN_VALUES * FCB_COLUMN_VALUES : FCB_COLUMN_VALUES;
+    counts = calloc(bins, sizeof(uint64_t));
+    if (!counts) {
+        fprintf(stderr, "Out of memory\n");
+        goto done;
+    }
+
+    if (keys) {
+        fcb_columns_group_count(keys, values, mask, rows, counts);
+    } else {
+        fcb_columns_histogram(values, mask, rows, counts);
+    }
+
+    for (size_t b = 0; b < bins; b++) {
+        if (!counts[b]) continue;
+        if (keys) {
+            printf("%zu %zu %llu\n", b / FCB_COLUMN_VALUES, b % FCB_COLUMN_VALUES, (unsigned long long)counts[b]);
+        } else {
+            printf("%zu %llu\n", b, (unsigned long long)counts[b]);
+        }
+    }
+    status = 0;
+
+done:
+    free(counts);
+    free(mask);
+    free(owned_keys);
+    free(owned_values);
+    fcb_columns_close(&columns);
+    return status;
+}
+
+// One dump (and/or CSV) per variant in the override file. A .syx base is
+// patched as is, so what the CSV does not carry (calibration, global
+// switches) passes through; a CSV or NDJSON base is encoded once first.
+static int make_variants(const char *base_path, const char *overrides_path, const char *out_dir, int formats) {
+    uint8_t base[SYSEX_SIZE];
+    FCB1010 fcb;
+    FCBError error;
+
+    if (fcb_has_suffix(base_path, ".syx")) {
+        if (fcb_read_sysex_file(base_path, base, &error) != FCB_OK ||
+            fcb_check_sysex(base, sizeof(base), &error) != FCB_OK) {
+            report(base_path, &error);
+            return 2;
+        }
+    } else if (!load(base_path, &fcb, &error) || fcb_encode_sysex(&fcb, base, sizeof(base), &error) != FCB_OK) {
+        report(base_path, &error);
+        return 2;
+    }
+
+    FCBVariantSet set;
+    if (fcb_read_variants_file(overrides_path, &set, &error) != FCB_OK) {
+        report(overrides_path, &error);
+        return 2;
+    }
+
+    size_t written;
+    FCBStatus status = fcb_generate_variants(base, &set, out_dir, formats, 0, &written, &error);
+    if (status != FCB_OK) report(overrides_path, &error);
+    printf("%zu of %zu variants written to %s\n", written, set.count, out_dir);
+
+    fcb_variants_free(&set);
+    return status == FCB_OK ? 0 : 2;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 4 && strcmp(argv[1], "syx2csv") == 0) return syx2csv(argv[2], argv[3]);
+    if (argc == 4 && strcmp(argv[1], "csv2syx") == 0) return csv2syx(argv[2], argv[3], false);
+    if (argc == 5 && strcmp(argv[1], "csv2syx") == 0 && strcmp(argv[4], "--overlay") == 0) {
+        return csv2syx(argv[2], argv[3], true);
+    }
+    if (argc >= 5 && strcmp(argv[1], "variants") == 0) {
+        int formats = 0;
+        for (int i = 5; i < argc; i++) {
+            if (strcmp(argv[i], "--csv") == 0) {
+                formats |= FCB_VARIANT_CSV;
+            } else if (strcmp(argv[i], "--syx") == 0) {
+                formats |= FCB_VARIANT_SYX;
+            } else {
+                usage();
+                return 1;
+            }
+        }
+        return make_variants(argv[2], argv[3], argv[4], formats ? formats : FCB_VARIANT_SYX);
+    }
+    if (argc >= 3 && strcmp(argv[1], "cluster") == 0) {
+        double threshold = CLUSTER_THRESHOLD;
+        int first = 2;
+        if (strcmp(argv[2], "--threshold") == 0) {
+            char *end = NULL;
+            threshold = argc >= 5 ? strtod(argv[3], &end) : -1;
+            if (!end || *end != '\0' || threshold <= 0 || threshold > 1) {
+                usage();
+                return 1;
+            }
+            first = 4;
+        }
+        return cluster_dumps(threshold, argc - first, argv + first);
+    }
+    if (argc >= 3 && strcmp(argv[1], "validate") == 0) return validate(argc - 2, argv + 2);
+    if (argc == 4 && strcmp(argv[1], "recover") == 0) return recover(argv[2], argv[3]);
+    if (argc >= 3 && strcmp(argv[1], "scan") == 0) return scan(argc - 2, argv + 2);
+    if (argc >= 4 && strcmp(argv[1], "syx2json") == 0) return export_json(argv[2], argc - 3, argv + 3);
+    if (argc >= 4 && strcmp(argv[1], "export") == 0) return export_columns(argv[2], argc - 3, argv + 3);
+    if (argc >= 3 && strcmp(argv[1], "aggregate") == 0) return aggregate(argc - 2, argv + 2);
+    if (argc >= 4 && strcmp(argv[1], "convert") == 0) {
+        FCBFileBackend backend = FCB_FILES_AUTO;
+        int first = 3;
+        if (strcmp(argv[3], "--io") == 0 && argc >= 6) {
+            if (strcmp(argv[4], "uring") == 0) {
+                backend = FCB_FILES_URING;
+            } else if (strcmp(argv[4], "threads") == 0) {
+                backend = FCB_FILES_THREADS;
+            } else if (strcmp(argv[4], "auto") != 0) {
+                usage();
+                return 1;
+            }
+            first = 5;
+        }
+        return convert_dumps(argv[2], backend, argc - first, argv + first);
+    }
+
+    usage();
+    return 1;
+}
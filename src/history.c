@@ -0,0 +1,540 @@
+/*  Copy-on-write editing history
+*   Snapshots are ten bank nodes plus a global settings node, and every
+*   bank node points at ten refcounted preset nodes. A commit compares the
+*   new FCB1010 against the current snapshot and only allocates nodes for
+*   what changed; everything else is shared by reference.
+*
+*   The history can be mirrored to an append-only journal so an editing
+*   session that dies can be replayed. The file is a header followed by
+*   checksummed records: one BASE with every preset, then a COMMIT per
+*   edit carrying just the changed presets, a MOVE per undo, redo or jump
+*   and a SAVED per write of the dump. The header and SAVED records hold a
+*   hash of the raw dump, so a journal is only replayed onto the dump it
+*   was written against. A torn record at the end is dropped on recovery.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "history.h"
+
+#define HISTORY_BANK_SIZE 10
+#define HISTORY_BANKS (NUM_PRESETS / HISTORY_BANK_SIZE)
+
+// Everything in FCB1010 after the preset array
+#define GLOBALS_OFFSET offsetof(FCB1010, pc1_midi_channel)
+#define GLOBALS_SIZE (sizeof(FCB1010) - GLOBALS_OFFSET)
+
+#define JOURNAL_MAGIC "FCBHIST2"
+
+enum {
+    JOURNAL_BASE = 1,
+    JOURNAL_COMMIT = 2,
+    JOURNAL_MOVE = 3,
+    JOURNAL_SAVED = 4
+};
+
+typedef struct {
+    int refs;
+    FCB1010Preset preset;
+} PresetNode;
+
+typedef struct {
+    int refs;
+    PresetNode *presets[HISTORY_BANK_SIZE];
+} BankNode;
+
+typedef struct {
+    int refs;
+    uint8_t data[GLOBALS_SIZE];
+} GlobalsNode;
+
+typedef struct {
+    BankNode *banks[HISTORY_BANKS];
+    GlobalsNode *globals;
+    char label[HISTORY_LABEL_SIZE];
+} Snapshot;
+
+struct History {
+    Snapshot *snapshots;
+    size_t count;
+    size_t capacity;
+    size_t position;
+    FILE *journal;
+    char journal_path[512];
+    uint32_t dump_hash;  // Of the raw dump as last opened or saved
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t preset_size;
+    uint32_t globals_size;
+    uint32_t dump_hash;
+} JournalHeader;
+
+typedef struct {
+    uint8_t type;
+    uint8_t preset_count;  // JournalPreset entries that follow
+    uint8_t has_globals;   // Followed by GLOBALS_SIZE bytes
+    uint8_t reserved;
+    uint32_t position;     // Parent snapshot of a commit, target of a move, dump hash of a save
+    uint32_t checksum;     // Over the record with this field zeroed, and the payload
+    char label[HISTORY_LABEL_SIZE];
+} JournalRecord;
+
+typedef struct {
+    uint8_t index;
+    FCB1010Preset preset;
+} JournalPreset;
+
+static void release_bank(BankNode *bank) {
+    if (--bank->refs > 0) return;
+
+    for (int i = 0; i < HISTORY_BANK_SIZE; i++) {
+        if (--bank->presets[i]->refs == 0) free(bank->presets[i]);
+    }
+    free(bank);
+}
+
+static void release_snapshot(Snapshot *snapshot) {
+    for (int b = 0; b < HISTORY_BANKS; b++) {
+        if (snapshot->banks[b]) release_bank(snapshot->banks[b]);
+    }
+    if (snapshot->globals && --snapshot->globals->refs == 0) free(snapshot->globals);
+    memset(snapshot, 0, sizeof(Snapshot));
+}
+
+// Build a snapshot of fcb that shares every node it can with base (which
+// may be NULL). *changed is cleared when fcb is identical to base.
+static bool build_snapshot(const Snapshot *base, const FCB1010 *fcb, const char *label,
+                           Snapshot *out, bool *changed) {
+    memset(out, 0, sizeof(Snapshot));
+    snprintf(out->label, sizeof(out->label), "%s", label);
+    *changed = base == NULL;
+
+    for (int b = 0; b < HISTORY_BANKS; b++) {
+        BankNode *old = base ? base->banks[b] : NULL;
+        const FCB1010Preset *presets = &fcb->preset[b * HISTORY_BANK_SIZE];
+
+        bool same = old != NULL;
+        for (int i = 0; i < HISTORY_BANK_SIZE && same; i++) {
+            same = memcmp(&old->presets[i]->preset, &presets[i], sizeof(FCB1010Preset)) == 0;
+        }
+
+        if (same) {
+            old->refs++;
+            out->banks[b] = old;
+            continue;
+        }
+
+        BankNode *bank = calloc(1, sizeof(BankNode));
+        if (!bank) goto fail;
+        bank->refs = 1;
+        out->banks[b] = bank;
+        *changed = true;
+
+        for (int i = 0; i < HISTORY_BANK_SIZE; i++) {
+            if (old && memcmp(&old->presets[i]->preset, &presets[i], sizeof(FCB1010Preset)) == 0) {
+                old->presets[i]->refs++;
+                bank->presets[i] = old->presets[i];
+                continue;
+            }
+
+            PresetNode *node = malloc(sizeof(PresetNode));
+            if (!node) goto fail;
+            node->refs = 1;
+            node->preset = presets[i];
+            bank->presets[i] = node;
+        }
+    }
+
+    const uint8_t *globals = (const uint8_t *)fcb + GLOBALS_OFFSET;
+    if (base && memcmp(base->globals->data, globals, GLOBALS_SIZE) == 0) {
+        base->globals->refs++;
+        out->globals = base->globals;
+    } else {
+        out->globals = malloc(sizeof(GlobalsNode));
+        if (!out->globals) goto fail;
+        out->globals->refs = 1;
+        memcpy(out->globals->data, globals, GLOBALS_SIZE);
+        *changed = true;
+    }
+
+    return true;
+
+fail:
+    // Undo a partial build; new banks may still have empty preset slots
+    for (int b = 0; b < HISTORY_BANKS; b++) {
+        BankNode *bank = out->banks[b];
+        if (!bank) continue;
+
+        if (base && bank == base->banks[b]) {
+            bank->refs--;
+            continue;
+        }
+
+        for (int i = 0; i < HISTORY_BANK_SIZE; i++) {
+            if (bank->presets[i] && --bank->presets[i]->refs == 0) free(bank->presets[i]);
+        }
+        free(bank);
+    }
+    return false;
+}
+
+static uint32_t checksum(uint32_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t dump_hash(const uint8_t *sysex) {
+    return checksum(2166136261u, sysex, SYSEX_SIZE);
+}
+
+static void close_journal(History *history) {
+    if (history->journal) fclose(history->journal);
+    history->journal = NULL;
+}
+
+static bool write_record(History *history, uint8_t type, uint32_t position, const char *label,
+                         const JournalPreset *presets, int preset_count, const uint8_t *globals) {
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = type;
+    record.preset_count = preset_count;
+    record.has_globals = globals != NULL;
+    record.position = position;
+    if (label) snprintf(record.label, sizeof(record.label), "%s", label);
+
+    uint32_t hash = checksum(2166136261u, &record, sizeof(record));
+    hash = checksum(hash, presets, preset_count * sizeof(JournalPreset));
+    if (globals) hash = checksum(hash, globals, GLOBALS_SIZE);
+    record.checksum = hash;
+
+    FILE *file = history->journal;
+    bool ok = fwrite(&record, sizeof(record), 1, file) == 1 &&
+              (preset_count == 0 || fwrite(presets, sizeof(JournalPreset), preset_count, file) == (size_t)preset_count) &&
+              (!globals || fwrite(globals, GLOBALS_SIZE, 1, file) == 1) &&
+              fflush(file) == 0;
+
+    // A journal that cannot be written is dropped; editing carries on
+    if (!ok) close_journal(history);
+    return ok;
+}
+
+// Record snapshot index as a commit on top of index - 1 (or as the base)
+static bool write_snapshot(History *history, size_t index) {
+    const Snapshot *snapshot = &history->snapshots[index];
+    const Snapshot *parent = index > 0 ? &history->snapshots[index - 1] : NULL;
+    JournalPreset presets[NUM_PRESETS];
+    int count = 0;
+
+    // Shared nodes are unchanged presets, so pointer equality is the diff
+    for (int b = 0; b < HISTORY_BANKS; b++) {
+        if (parent && snapshot->banks[b] == parent->banks[b]) continue;
+
+        for (int i = 0; i < HISTORY_BANK_SIZE; i++) {
+            const PresetNode *node = snapshot->banks[b]->presets[i];
+            if (parent && node == parent->banks[b]->presets[i]) continue;
+
+            presets[count].index = b * HISTORY_BANK_SIZE + i;
+            presets[count].preset = node->preset;
+            count++;
+        }
+    }
+
+    bool globals_changed = !parent || snapshot->globals != parent->globals;
+
+    return write_record(history, parent ? JOURNAL_COMMIT : JOURNAL_BASE, parent ? index - 1 : 0,
+                        snapshot->label, presets, count, globals_changed ? snapshot->globals->data : NULL);
+}
+
+// Open the journal on first use and write out what happened so far
+static bool ensure_journal(History *history) {
+    if (history->journal) return true;
+    if (history->journal_path[0] == '\0') return false;
+
+    history->journal = fopen(history->journal_path, "wb");
+    if (!history->journal) {
+        history->journal_path[0] = '\0';
+        return false;
+    }
+
+    JournalHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.preset_size = sizeof(FCB1010Preset);
+    header.globals_size = GLOBALS_SIZE;
+    header.dump_hash = history->dump_hash;
+
+    if (fwrite(&header, sizeof(header), 1, history->journal) != 1) {
+        close_journal(history);
+        return false;
+    }
+
+    for (size_t i = 0; i < history->count; i++) {
+        if (!write_snapshot(history, i)) return false;
+    }
+
+    if (history->position != history->count - 1) {
+        return write_record(history, JOURNAL_MOVE, history->position, NULL, NULL, 0, NULL);
+    }
+    return true;
+}
+
+static void journal_move(History *history) {
+    if (history->journal) {
+        write_record(history, JOURNAL_MOVE, history->position, NULL, NULL, 0, NULL);
+    } else {
+        ensure_journal(history);
+    }
+}
+
+History *history_create(const FCB1010 *fcb, const char *label) {
+    History *history = calloc(1, sizeof(History));
+    if (!history) return NULL;
+
+    history->capacity = 64;
+    history->snapshots = malloc(history->capacity * sizeof(Snapshot));
+
+    bool changed;
+    if (!history->snapshots || !build_snapshot(NULL, fcb, label, &history->snapshots[0], &changed)) {
+        free(history->snapshots);
+        free(history);
+        return NULL;
+    }
+
+    history->count = 1;
+    return history;
+}
+
+void history_destroy(History *history) {
+    if (!history) return;
+
+    close_journal(history);
+    for (size_t i = 0; i < history->count; i++) release_snapshot(&history->snapshots[i]);
+    free(history->snapshots);
+    free(history);
+}
+
+static bool commit(History *history, const FCB1010 *fcb, const char *label, bool journal) {
+    Snapshot snapshot;
+    bool changed;
+
+    if (!build_snapshot(&history->snapshots[history->position], fcb, label, &snapshot, &changed)) {
+        return false;
+    }
+
+    if (!changed) {
+        release_snapshot(&snapshot);
+        return true;
+    }
+
+    if (history->count == history->capacity) {
+        Snapshot *snapshots = realloc(history->snapshots, history->capacity * 2 * sizeof(Snapshot));
+        if (!snapshots) {
+            release_snapshot(&snapshot);
+            return false;
+        }
+        history->snapshots = snapshots;
+        history->capacity *= 2;
+    }
+
+    // A commit after undo drops the redo branch
+    while (history->count > history->position + 1) {
+        release_snapshot(&history->snapshots[--history->count]);
+    }
+
+    history->snapshots[history->count] = snapshot;
+    history->position = history->count++;
+
+    if (journal) {
+        if (history->journal) {
+            write_snapshot(history, history->position);
+        } else {
+            ensure_journal(history);
+        }
+    }
+    return true;
+}
+
+// Add fcb as the newest snapshot. Returns false only when out of memory;
+// committing an unchanged FCB1010 does nothing.
+bool history_commit(History *history, const FCB1010 *fcb, const char *label) {
+    return commit(history, fcb, label, true);
+}
+
+bool history_undo(History *history) {
+    if (history->position == 0) return false;
+
+    history->position--;
+    journal_move(history);
+    return true;
+}
+
+bool history_redo(History *history) {
+    if (history->position + 1 >= history->count) return false;
+
+    history->position++;
+    journal_move(history);
+    return true;
+}
+
+bool history_goto(History *history, size_t index) {
+    if (index >= history->count) return false;
+    if (index == history->position) return true;
+
+    history->position = index;
+    journal_move(history);
+    return true;
+}
+
+size_t history_count(const History *history) {
+    return history->count;
+}
+
+size_t history_position(const History *history) {
+    return history->position;
+}
+
+const char *history_label(const History *history, size_t index) {
+    return index < history->count ? history->snapshots[index].label : "";
+}
+
+void history_get(const History *history, size_t index, FCB1010 *fcb) {
+    const Snapshot *snapshot = &history->snapshots[index < history->count ? index : history->position];
+
+    for (int b = 0; b < HISTORY_BANKS; b++) {
+        for (int i = 0; i < HISTORY_BANK_SIZE; i++) {
+            fcb->preset[b * HISTORY_BANK_SIZE + i] = snapshot->banks[b]->presets[i]->preset;
+        }
+    }
+    memcpy((uint8_t *)fcb + GLOBALS_OFFSET, snapshot->globals->data, GLOBALS_SIZE);
+}
+
+// Mirror the history to path from the next change on. Nothing is written
+// until there is something worth recovering.
+bool history_set_journal(History *history, const char *path, const uint8_t *sysex) {
+    close_journal(history);
+    history->dump_hash = dump_hash(sysex);
+
+    if (snprintf(history->journal_path, sizeof(history->journal_path), "%s", path) >=
+        (int)sizeof(history->journal_path)) {
+        history->journal_path[0] = '\0';
+        return false;
+    }
+    return true;
+}
+
+// The dump was written out as sysex; a journal replays onto that from now on
+void history_saved(History *history, const uint8_t *sysex) {
+    history->dump_hash = dump_hash(sysex);
+    if (history->journal) write_record(history, JOURNAL_SAVED, history->dump_hash, NULL, NULL, 0, NULL);
+}
+
+// Stop journaling and delete the file, once the session ended cleanly
+void history_discard_journal(History *history) {
+    close_journal(history);
+    if (history->journal_path[0]) unlink(history->journal_path);
+    history->journal_path[0] = '\0';
+}
+
+static bool read_record(FILE *file, JournalRecord *record, JournalPreset *presets, uint8_t *globals) {
+    if (fread(record, sizeof(JournalRecord), 1, file) != 1) return false;
+    if (record->preset_count > NUM_PRESETS) return false;
+
+    if (record->preset_count > 0 &&
+        fread(presets, sizeof(JournalPreset), record->preset_count, file) != record->preset_count) {
+        return false;
+    }
+    if (record->has_globals && fread(globals, GLOBALS_SIZE, 1, file) != 1) return false;
+
+    uint32_t expected = record->checksum;
+    record->checksum = 0;
+    uint32_t hash = checksum(2166136261u, record, sizeof(JournalRecord));
+    hash = checksum(hash, presets, record->preset_count * sizeof(JournalPreset));
+    if (record->has_globals) hash = checksum(hash, globals, GLOBALS_SIZE);
+    record->label[HISTORY_LABEL_SIZE - 1] = '\0';
+
+    for (int i = 0; i < record->preset_count; i++) {
+        if (presets[i].index >= NUM_PRESETS) return false;
+    }
+
+    return hash == expected;
+}
+
+// Rebuild the history left behind in a journal, at the position it was
+// in when it stopped. Journaling continues into the same file. Returns
+// NULL if there is no usable journal at path; one written against a
+// different dump than sysex is stale and deleted.
+History *history_recover(const char *path, const uint8_t *sysex) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    JournalHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.preset_size != sizeof(FCB1010Preset) || header.globals_size != GLOBALS_SIZE) {
+        fclose(file);
+        return NULL;
+    }
+
+    History *history = NULL;
+    uint32_t hash = header.dump_hash;
+    long valid_end = ftell(file);
+    JournalRecord record;
+    JournalPreset presets[NUM_PRESETS];
+    uint8_t globals[GLOBALS_SIZE];
+    FCB1010 fcb;
+    memset(&fcb, 0, sizeof(fcb));
+
+    while (read_record(file, &record, presets, globals)) {
+        if (record.type == JOURNAL_BASE) {
+            if (history || record.preset_count != NUM_PRESETS || !record.has_globals) break;
+
+            for (int i = 0; i < NUM_PRESETS; i++) fcb.preset[presets[i].index] = presets[i].preset;
+            memcpy((uint8_t *)&fcb + GLOBALS_OFFSET, globals, GLOBALS_SIZE);
+            history = history_create(&fcb, record.label);
+            if (!history) break;
+        } else if (record.type == JOURNAL_COMMIT) {
+            if (!history || record.position >= history->count) break;
+
+            history->position = record.position;
+            history_get(history, record.position, &fcb);
+            for (int i = 0; i < record.preset_count; i++) fcb.preset[presets[i].index] = presets[i].preset;
+            if (record.has_globals) memcpy((uint8_t *)&fcb + GLOBALS_OFFSET, globals, GLOBALS_SIZE);
+            if (!commit(history, &fcb, record.label, false)) break;
+        } else if (record.type == JOURNAL_MOVE) {
+            if (!history || record.position >= history->count) break;
+            history->position = record.position;
+        } else if (record.type == JOURNAL_SAVED) {
+            hash = record.position;
+        } else {
+            break;
+        }
+
+        valid_end = ftell(file);
+    }
+
+    fclose(file);
+    if (history && hash != dump_hash(sysex)) {
+        history_destroy(history);
+        unlink(path);
+        return NULL;
+    }
+    if (!history) return NULL;
+
+    // Cut off anything torn or unreadable and carry on appending. If that
+    // fails, the first edit rewrites the journal from scratch instead.
+    history->dump_hash = hash;
+    snprintf(history->journal_path, sizeof(history->journal_path), "%s", path);
+    if (truncate(path, valid_end) == 0) history->journal = fopen(path, "ab");
+
+    return history;
+}
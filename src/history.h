@@ -0,0 +1,36 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "fcb.h"
+
+#define HISTORY_LABEL_SIZE 32
+
+// Undo history of an editing session. Every snapshot is a complete
+// FCB1010, but unchanged banks, presets and global settings are shared
+// with the snapshot before it, so a one-field edit costs one bank node
+// and one preset node. Moving to any snapshot is O(1).
+typedef struct History History;
+
+History *history_create(const FCB1010 *fcb, const char *label);
+void history_destroy(History *history);
+
+bool history_commit(History *history, const FCB1010 *fcb, const char *label);
+bool history_undo(History *history);
+bool history_redo(History *history);
+bool history_goto(History *history, size_t index);
+
+size_t history_count(const History *history);
+size_t history_position(const History *history);
+const char *history_label(const History *history, size_t index);
+void history_get(const History *history, size_t index, FCB1010 *fcb);
+
+// sysex is the raw dump being edited; a journal is only recovered onto
+// the same bytes, or onto what history_saved() last recorded
+bool history_set_journal(History *history, const char *path, const uint8_t *sysex);
+History *history_recover(const char *path, const uint8_t *sysex);
+void history_saved(History *history, const uint8_t *sysex);
+void history_discard_journal(History *history);
+
+#endif
@@ -0,0 +1,279 @@
+/*  Synthetic MIDI load generator
+*   Builds realistic traffic from a loaded FCB1010: each preset's change
+*   messages followed by expression pedal sweeps over its expA/expB
+*   controller, scaled through the global pedal calibration and the
+*   preset's min/max. The whole cycle is precomputed once so sending is
+*   just paced writes out of a flat buffer.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fcb.h"
+#include "fcb_io.h"
+#include "loadgen.h"
+#include "midi.h"
+#include "playback.h"
+#include "timing.h"
+
+#define LOADGEN_PRESET_BYTES (PLAYBACK_MAX_MESSAGE + 2 * LOADGEN_MAX_SWEEP * 3 + 3)
+#define LOADGEN_TICK_NS (10 * NSEC_PER_MSEC)
+#define LOADGEN_UNPACED_CHUNK 4096
+
+typedef int32_t v4si __attribute__((vector_size(16)));
+
+// Map every raw pedal position between the calibration points onto the
+// preset's [min, max] range, up and back down again. The scale is 16.16
+// fixed point so four positions go through per vector op with no divide.
+// min > max (a reversed pedal) works the same way. Returns the count.
+size_t loadgen_sweep_values(uint8_t *values, uint8_t calibration_min, uint8_t calibration_max,
+                            uint8_t min, uint8_t max) {
+    if (calibration_max > 127 || calibration_max <= calibration_min) {
+        calibration_min = 0;
+        calibration_max = 127;
+    }
+
+    int32_t span = calibration_max - calibration_min;
+    int32_t delta = (int32_t)(max & 0x7F) - (int32_t)(min & 0x7F);
+    int32_t scale = (delta * 65536 + (delta < 0 ? -span : span) / 2) / span;
+    size_t steps = span + 1;
+
+    int32_t wide[LOADGEN_MAX_SWEEP / 2] __attribute__((aligned(16)));
+    v4si position = { 0, 1, 2, 3 };
+    const v4si step = { 4, 4, 4, 4 };
+    const v4si vscale = { scale, scale, scale, scale };
+    const int32_t base = (int32_t)(min & 0x7F) * 65536 + 0x8000;
+    const v4si vbase = { base, base, base, base };
+    const v4si lo = { 0, 0, 0, 0 };
+    const v4si hi = { 127, 127, 127, 127 };
+
+    for (size_t i = 0; i < steps; i += 4) {
+        v4si v = (position * vscale + vbase) >> 16;
+        v4si below = v < lo;
+        v = (v & ~below) | (lo & below);
+        v4si above = v > hi;
+        v = (v & ~above) | (hi & above);
+        memcpy(&wide[i], &v, sizeof(v));
+        position += step;
+    }
+
+    for (size_t i = 0; i < steps; i++) {
+        values[i] = (uint8_t)wide[i];
+    }
+
+    // Back down, without repeating either end point
+    for (size_t i = 1; i + 1 < steps; i++) {
+        values[steps + i - 1] = values[steps - 1 - i];
+    }
+
+    return steps + (steps > 2 ? steps - 2 : 0);
+}
+
+static size_t append_sweep(uint8_t *out, uint8_t channel, uint8_t controller, const uint8_t *values,
+                           size_t count, bool running_status) {
+    uint8_t status = 0xB0 | (channel & 0x0F);
+    size_t len = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (!running_status || i == 0) out[len++] = status;
+        out[len++] = controller & 0x7F;
+        out[len++] = values[i];
+    }
+
+    return len;
+}
+
+bool loadgen_build(const FCB1010 *fcb, bool shuffle, unsigned seed, LoadgenBuffer *buffer) {
+    memset(buffer, 0, sizeof(LoadgenBuffer));
+
+    buffer->data = malloc((size_t)NUM_PRESETS * LOADGEN_PRESET_BYTES);
+    if (!buffer->data) return false;
+
+    int order[NUM_PRESETS];
+    for (int i = 0; i < NUM_PRESETS; i++) order[i] = i;
+    if (shuffle) {
+        for (int i = NUM_PRESETS - 1; i > 0; i--) {
+            int j = rand_r(&seed) % (i + 1);
+            int tmp = order[i];
+            order[i] = order[j];
+            order[j] = tmp;
+        }
+    }
+
+    uint8_t values[LOADGEN_MAX_SWEEP];
+
+    for (int n = 0; n < NUM_PRESETS; n++) {
+        const FCB1010Preset *p = &fcb->preset[order[n]];
+        uint8_t *out = buffer->data + buffer->size;
+
+        size_t len = playback_resolve_preset(fcb, order[n], out);
+        for (size_t i = 0; i < len; i++) {
+            if (out[i] & 0x80) buffer->messages++;
+        }
+
+        if (p->expA_enabled) {
+            size_t count = loadgen_sweep_values(values, fcb->expA_calibration_min, fcb->expA_calibration_max,
+                                                p->expA_min, p->expA_max);
+            len += append_sweep(out + len, fcb->expA_midi_channel, p->expA_controller, values, count,
+                                fcb->running_status);
+            buffer->messages += count;
+        }
+
+        if (p->expB_enabled) {
+            size_t count = loadgen_sweep_values(values, fcb->expB_calibration_min, fcb->expB_calibration_max,
+                                                p->expB_min, p->expB_max);
+            len += append_sweep(out + len, fcb->expB_midi_channel, p->expB_controller, values, count,
+                                fcb->running_status);
+            buffer->messages += count;
+        }
+
+        if (p->note_enabled) {
+            out[len++] = 0x80 | (fcb->note_midi_channel & 0x0F);
+            out[len++] = p->note_value & 0x7F;
+            out[len++] = 0;
+            buffer->messages++;
+        }
+
+        buffer->size += len;
+    }
+
+    return true;
+}
+
+void loadgen_free(LoadgenBuffer *buffer) {
+    free(buffer->data);
+    memset(buffer, 0, sizeof(LoadgenBuffer));
+}
+
+// Send the buffer round and round for duration_ns. rate is in bytes per
+// second; 0 writes as fast as the port accepts. Paced runs release one
+// tick's worth of bytes at each absolute 10 ms deadline.
+bool loadgen_run(MidiPort *port, const LoadgenBuffer *buffer, uint32_t rate,
+                 uint64_t duration_ns, LoadgenStats *stats) {
+    memset(stats, 0, sizeof(LoadgenStats));
+    if (buffer->size == 0) return true;
+
+    uint64_t start_ns = timing_now_ns();
+    uint64_t end_ns = start_ns + duration_ns;
+    size_t position = 0;
+    uint64_t tick = 0;
+
+    while (1) {
+        uint64_t now_ns = timing_now_ns();
+        if (now_ns >= end_ns) break;
+
+        size_t chunk;
+        if (rate == 0) {
+            chunk = LOADGEN_UNPACED_CHUNK;
+        } else {
+            // Bytes due by the end of this tick, minus what is already out
+            tick++;
+            uint64_t due = (uint64_t)rate * tick * LOADGEN_TICK_NS / NSEC_PER_SEC;
+            chunk = due - stats->bytes;
+        }
+
+        while (chunk > 0) {
+            size_t len = buffer->size - position;
+            if (len > chunk) len = chunk;
+
+            if (!midi_port_write(port, buffer->data + position, len)) return false;
+
+            stats->bytes += len;
+            chunk -= len;
+            position += len;
+            if (position == buffer->size) position = 0;
+        }
+
+        if (rate != 0) timing_sleep_until(start_ns + tick * LOADGEN_TICK_NS);
+    }
+
+    stats->duration_ns = timing_now_ns() - start_ns;
+    stats->messages = stats->bytes * buffer->messages / buffer->size;
+    return true;
+}
+
+static void print_usage() {
+    fprintf(stderr, "Usage: fcbtool --loadgen <port> [--dump <file.syx>] [--rate <bytes/s>|wire|max]\n");
+    fprintf(stderr, "                [--duration <seconds>] [--shuffle <seed>]\n");
+}
+
+int loadgen_main(int argc, char *argv[]) {
+    const char *port_name = NULL;
+    const char *dump_filename = NULL;
+    uint32_t rate = MIDI_WIRE_RATE;
+    double duration = 10;
+    bool shuffle = false;
+    unsigned seed = 0;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dump_filename = argv[++i];
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            if (!midi_parse_rate(argv[++i], &rate)) {
+                fprintf(stderr, "Invalid rate: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            duration = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--shuffle") == 0 && i + 1 < argc) {
+            shuffle = true;
+            seed = strtoul(argv[++i], NULL, 10);
+        } else if (!port_name) {
+            port_name = argv[i];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (!port_name || duration <= 0) {
+        print_usage();
+        return 1;
+    }
+
+    char default_dump[512];
+    if (!dump_filename) {
+        snprintf(default_dump, sizeof(default_dump), "%s/.fcb1010/dump.syx", getenv("HOME"));
+        dump_filename = default_dump;
+    }
+
+    FCB1010 fcb;
+    if (!load_sysex_file(dump_filename, &fcb)) {
+        fprintf(stderr, "Failed to load SysEx file: %s\n", dump_filename);
+        return 1;
+    }
+
+    LoadgenBuffer buffer;
+    if (!loadgen_build(&fcb, shuffle, seed, &buffer)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    char error[256];
+    MidiPort *port = midi_port_open_output(port_name, error, sizeof(error));
+    if (!port) {
+        fprintf(stderr, "%s\n", error);
+        loadgen_free(&buffer);
+        return 1;
+    }
+
+    LoadgenStats stats;
+    bool ok = loadgen_run(port, &buffer, rate, (uint64_t)(duration * NSEC_PER_SEC), &stats);
+    midi_port_close(port);
+
+    FILE *report = strcmp(port_name, "-") == 0 ? stderr : stdout;
+    fprintf(report, "Cycle: %zu bytes, %zu messages\n", buffer.size, buffer.messages);
+    loadgen_free(&buffer);
+
+    if (!ok) {
+        fprintf(stderr, "Error writing to %s\n", port_name);
+        return 1;
+    }
+
+    double seconds = stats.duration_ns / 1e9;
+    fprintf(report, "Sent %llu bytes (~%llu messages) in %.3f s: %.0f bytes/s, %.0f messages/s\n",
+            (unsigned long long)stats.bytes, (unsigned long long)stats.messages, seconds,
+            stats.bytes / seconds, stats.messages / seconds);
+
+    return 0;
+}
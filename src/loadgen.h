@@ -0,0 +1,37 @@
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "fcb.h"
+#include "midi.h"
+
+// A pedal sweep covers at most 128 positions up and 128 back down
+#define LOADGEN_MAX_SWEEP 256
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t messages;
+} LoadgenBuffer;
+
+typedef struct {
+    uint64_t bytes;
+    uint64_t messages;
+    uint64_t duration_ns;
+} LoadgenStats;
+
+size_t loadgen_sweep_values(uint8_t *values, uint8_t calibration_min, uint8_t calibration_max,
+                            uint8_t min, uint8_t max);
+
+bool loadgen_build(const FCB1010 *fcb, bool shuffle, unsigned seed, LoadgenBuffer *buffer);
+
+void loadgen_free(LoadgenBuffer *buffer);
+
+bool loadgen_run(MidiPort *port, const LoadgenBuffer *buffer, uint32_t rate,
+                 uint64_t duration_ns, LoadgenStats *stats);
+
+int loadgen_main(int argc, char *argv[]);
+
+#endif
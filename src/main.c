@@ -4,47 +4,120 @@
 #include <ncurses.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include "event_loop.h"
 #include "midi.h"
 #include "fcb.h"
 #include "ui_ncurses.h"
 #include "fcb_io.h"
+#include "playback.h"
+#include "loadgen.h"
+#include "server.h"
+#include "watch.h"
+#include "optimize.h"
+#include "batch.h"
+#include "emulator.h"
+#include "stats.h"
 
-int main() {
-    initialize_ui();
+static EventLoop *loop;
 
-    create_fcb_home_dir();  // Ensure the ~/.fcb1010 directory is created
+static void handle_menu_choice(int user_choice) {
+    switch (user_choice) {
+        case 'q':
+            event_loop_stop(loop);
+            break;
+        case '1':
+            handle_sysex_receive(loop);  // MIDI handling function
+            break;
+        case '2':
+            handle_sysex_send(loop);  // MIDI handling function
+            break;
+        case '3':
+            handle_parse_and_inspect();  // Function to parse and inspect SysEx data
+            break;
+        case '4':
+            handle_create_csv();  // Function to create CSV from SysEx data
+            break;
+        case '5':
+            csv_to_sysex();  // FCB IO function
+            break;
+        case '6':
+            backup_sysex_file();  // FCB IO function
+            break;
+        case '7':
+            handle_browse_backups();  // FCB IO function
+            break;
+        default:
+            break;  // Invalid input, re-prompt
+    }
+}
 
-    while (1) {
-        int user_choice = display_main_menu();  // UI function to display the main menu
-
-        switch (user_choice) {
-            case 'q':
-                endwin();
-                return 0;
-            case '1':
-                handle_sysex_receive();  // MIDI handling function
-                break;
-            case '2':
-                handle_sysex_send();  // MIDI handling function
-                break;
-            case '3':
-                handle_parse_and_inspect();  // Function to parse and inspect SysEx data
-                break;
-            case '4':
-                handle_create_csv();  // Function to create CSV from SysEx data
-                break;
-            case '5':
-                csv_to_sysex();  // FCB IO function
-                break;
-            case '6':
-                backup_sysex_file();  // FCB IO function
-                break;
-            default:
-                break;  // Invalid input, re-prompt
+// Take --stats[=file] out of argv wherever it appears, so it combines
+// with any mode. Returns the new argc.
+static int handle_stats_option(int argc, char *argv[]) {
+    int kept = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            stats_start(NULL);
+        } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+            stats_start(argv[i] + 8);
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+
+    argv[kept] = NULL;
+    return kept;
+}
+
+int main(int argc, char *argv[]) {
+    argc = handle_stats_option(argc, argv);
+
+    // Command line modes run without the ncurses interface
+    if (argc > 1) {
+        if (strcmp(argv[1], "--play") == 0) {
+            return playback_main(argc, argv);
+        }
+        if (strcmp(argv[1], "--loadgen") == 0) {
+            return loadgen_main(argc, argv);
+        }
+        if (strcmp(argv[1], "--serve") == 0) {
+            return server_main(argc, argv);
         }
+        if (strcmp(argv[1], "--watch") == 0) {
+            return watch_main(argc, argv);
+        }
+        if (strcmp(argv[1], "--optimize") == 0) {
+            return optimize_main(argc, argv);
+        }
+        if (strcmp(argv[1], "--batch") == 0) {
+            return batch_main(argc, argv);
+        }
+        if (strcmp(argv[1], "--emulate") == 0) {
+            return emulator_main(argc, argv);
+        }
+
+        fprintf(stderr, "Unknown option: %s\n", argv[1]);
+        fprintf(stderr, "Usage: fcbtool [--stats[=file]] [--play <script> <port> | --loadgen <port> | --serve <socket> | --watch | --optimize <setlist> <out> | --batch | --emulate <link>] [options]\n");
+        return 1;
+    }
+
+    loop = event_loop_create();
+    if (!loop) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
     }
 
+    initialize_ui();
+
+    create_fcb_home_dir();  // Ensure the ~/.fcb1010 directory is created
+
+    // Everything from here on is driven by stdin, MIDI and timer events
+    ui_start(loop, handle_menu_choice);
+    event_loop_run(loop);
+
+    ui_shutdown();
     endwin();
+    event_loop_destroy(loop);
     return 0;
 }
-
@@ -1,63 +1,154 @@
 #include <alsa/asoundlib.h>
 #include <ncurses.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "fcb.h"
 #include "fcb_io.h"
 #include "midi.h"
+#include "stats.h"
+#include "timing.h"
 #include "ui_ncurses.h"
 
-void handle_sysex_receive() {
-    char devices[MAX_DEVICES][128];
-    int device_count;
+#define SEND_TICK_NS (10 * NSEC_PER_MSEC)
+
+// Longest message either direction handles: two dumps' worth
+#define SYSEX_MAX_SIZE (SYSEX_SIZE * 2)
+
+struct MidiPort {
+    snd_rawmidi_t *input;
+    snd_rawmidi_t *output;
+    int fd;
+    short events;  // What fd is polled for: POLLIN, or POLLOUT for an output only port
+};
+
+typedef struct {
+    Task task;
+    EventLoop *loop;
+    MidiPort *port;
+    struct pollfd pfds[MIDI_PORT_MAX_POLL_FDS];
+    int nfds;
+    uint8_t data[SYSEX_MAX_SIZE];
+    size_t size;
+    bool in_sysex;
+    char filename[512];
+} ReceiveTask;
+
+typedef struct {
+    Task task;
+    EventLoop *loop;
+    MidiPort *port;
+    int timer_id;
+    uint8_t data[SYSEX_MAX_SIZE];
+    uint32_t rate;
+    uint64_t start_ns;
+    char filename[512];
+} SendTask;
+
+static char pending_send_device[128];
+
+// The last task of each kind and the last port released are kept for the
+// next one, so sending or receiving dump after dump (--watch, --batch)
+// does not allocate once the first has been through. The event loop
+// thread is the only user.
+static void *spare_receive;
+static void *spare_send;
+static void *spare_port;
+
+static void *reuse(void **spare, size_t size) {
+    void *object = *spare;
+    *spare = NULL;
+    if (!object) return calloc(1, size);
+    memset(object, 0, size);
+    return object;
+}
 
-    list_midi_devices(devices, &device_count);
+static void retire(void **spare, void *object) {
+    if (*spare) {
+        free(object);
+    } else {
+        *spare = object;
+    }
+}
 
-    if (device_count == 0) {
-        printw("No MIDI devices found.\n");
-        getch();
+static void start_receive(const char *device_name, void *user_data) {
+    EventLoop *loop = user_data;
+    char sysex_filename[512];
+    char error[256];
+
+    snprintf(sysex_filename, sizeof(sysex_filename), "%s/.fcb1010/dump.syx", getenv("HOME"));
+
+    Task *task = receive_sysex_dump(loop, device_name, sysex_filename, error, sizeof(error));
+    if (!task) {
+        ui_message("%s", error);
         return;
     }
 
-    int selected_device = select_midi_device(devices, device_count);
-    if (selected_device == -1) return;
+    ui_message("Please activate the SysEx dump on your MIDI device...");
+    ui_run_task(task);
+}
 
+static void start_send(void *user_data) {
+    EventLoop *loop = user_data;
     char sysex_filename[512];
+    char error[256];
+
     snprintf(sysex_filename, sizeof(sysex_filename), "%s/.fcb1010/dump.syx", getenv("HOME"));
 
-    printw("Attempting to receive SysEx...\n");
-    refresh();
-    receive_sysex_dump(devices[selected_device], sysex_filename);
+    Task *task = send_sysex_dump(loop, pending_send_device, sysex_filename, MIDI_WIRE_RATE,
+                                 error, sizeof(error));
+    if (!task) {
+        ui_message("%s", error);
+        return;
+    }
+
+    ui_run_task(task);
+}
 
-    printw("Operation completed. Press any key to return to the main menu.\n");
-    refresh();
-    getch();
+static void confirm_send(const char *device_name, void *user_data) {
+    snprintf(pending_send_device, sizeof(pending_send_device), "%s", device_name);
+    ui_confirm("Set your device in receive mode then hit enter.", start_send, user_data);
 }
 
-void handle_sysex_send() {
+void handle_sysex_receive(EventLoop *loop) {
     char devices[MAX_DEVICES][128];
     int device_count;
 
+    if (ui_task_busy()) {
+        ui_message("A transfer is already running.");
+        return;
+    }
+
     list_midi_devices(devices, &device_count);
 
     if (device_count == 0) {
-        printw("No MIDI devices found.\n");
-        getch();
+        ui_message("No MIDI devices found.");
         return;
     }
 
-    int selected_device = select_midi_device(devices, device_count);
-    if (selected_device == -1) return;
+    select_midi_device(devices, device_count, start_receive, loop);
+}
 
-    char sysex_filename[512];
-    snprintf(sysex_filename, sizeof(sysex_filename), "%s/.fcb1010/dump.syx", getenv("HOME"));
+void handle_sysex_send(EventLoop *loop) {
+    char devices[MAX_DEVICES][128];
+    int device_count;
+
+    if (ui_task_busy()) {
+        ui_message("A transfer is already running.");
+        return;
+    }
 
-    printw("Attempting to send SysEx...\n");
-    refresh();
-    send_sysex_dump(devices[selected_device], sysex_filename);
+    list_midi_devices(devices, &device_count);
 
-    printw("Operation completed. Press any key to return to the main menu.\n");
-    refresh();
-    getch();
+    if (device_count == 0) {
+        ui_message("No MIDI devices found.");
+        return;
+    }
+
+    select_midi_device(devices, device_count, confirm_send, loop);
 }
 
 void list_midi_devices(char devices[MAX_DEVICES][128], int *count) {
@@ -75,10 +166,13 @@ void list_midi_devices(char devices[MAX_DEVICES][128], int *count) {
         char name[32];
 
         sprintf(name, "hw:%d", card);
-        if (snd_ctl_open(&ctl, name, 0) < 0) continue;
+        if (snd_ctl_open(&ctl, name, 0) < 0) {
+            snd_card_next(&card);
+            continue;
+        }
 
         dev = -1;
-        while (snd_ctl_rawmidi_next_device(ctl, &dev) >= 0 && dev >= 0) {
+        while (*count < MAX_DEVICES && snd_ctl_rawmidi_next_device(ctl, &dev) >= 0 && dev >= 0) {
             snd_rawmidi_info_set_device(info, dev);
             snd_rawmidi_info_set_subdevice(info, 0);
             snd_rawmidi_info_set_stream(info, SND_RAWMIDI_STREAM_INPUT);
@@ -94,133 +188,442 @@ void list_midi_devices(char devices[MAX_DEVICES][128], int *count) {
     }
 }
 
-void receive_sysex_dump(const char *device_name, const char *filename) {
-    snd_rawmidi_t *input = NULL;
-    FILE *output_file;
-    unsigned char buffer[BUFFER_SIZE];
-    int err;
-    int in_sysex = 0;  // Flag to indicate if we are inside a SysEx message
-    size_t total_bytes = 0;
-    char actual_device_name[16];
+static void receive_close(ReceiveTask *rt) {
+    for (int i = 0; i < rt->nfds; i++) {
+        event_loop_remove_fd(rt->loop, rt->pfds[i].fd);
+    }
+    rt->nfds = 0;
 
-    // Extract the actual device identifier ("hw:2,0") from the full device_name
-    sscanf(device_name, "%15s", actual_device_name);
+    midi_port_close(rt->port);
+    rt->port = NULL;
+}
 
-    printw("Attempting to open MIDI input on device %s...\n", actual_device_name);
-    refresh();
-    if ((err = snd_rawmidi_open(&input, NULL, actual_device_name, 0)) < 0) {
-        printw("Error opening MIDI input: %s\n", snd_strerror(err));
-        refresh();
-        getch();  // Wait for user to press a key
-        return;
-    }
+// Saved through a temporary file, so a failed write leaves the old dump
+static void receive_complete(ReceiveTask *rt) {
+    receive_close(rt);
 
-    output_file = fopen(filename, "wb");
-    if (!output_file) {
-        printw("Error opening file: %s\n", filename);
-        refresh();
-        snd_rawmidi_close(input);
-        getch();  // Wait for user to press a key
+    FCBError error;
+    if (fcb_write_file(rt->filename, rt->data, rt->size, &error) != FCB_OK) {
+        task_finish(&rt->task, TASK_FAILED, "%s", error.message);
         return;
     }
 
-    printw("Ready to receive SysEx dump.\n");
-    printw("Please activate the SysEx dump on your MIDI device...\n");
-    refresh();
+    task_finish(&rt->task, TASK_DONE, "SysEx dump received (%zu bytes) and saved to %s",
+                rt->size, rt->filename);
+}
 
-    printw("Receiving SysEx dump...\n");
-    refresh();
+static void receive_readable(EventLoop *loop, int fd, short revents, void *user_data) {
+    (void)loop;
+    (void)fd;
+    (void)revents;
 
-    while (1) {
-        err = snd_rawmidi_read(input, buffer, BUFFER_SIZE);
-        if (err < 0) {
-            printw("Error reading MIDI input: %s\n", snd_strerror(err));
-            refresh();
-            getch();  // Wait for user to press a key
-            break;
-        }
+    ReceiveTask *rt = user_data;
+    uint8_t buffer[BUFFER_SIZE];
+    ssize_t len;
 
-        for (int i = 0; i < err; i++) {
+    if (rt->task.state != TASK_RUNNING) return;
+
+    while ((len = midi_port_read(rt->port, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t i = 0; i < len; i++) {
             if (buffer[i] == 0xF0) {
-                in_sysex = 1;  // Start of SysEx message
-                total_bytes = 0;
+                rt->in_sysex = true;  // Start of SysEx message
+                rt->size = 0;
+            }
+
+            if (!rt->in_sysex) continue;
+
+            if (rt->size == sizeof(rt->data)) {
+                receive_close(rt);
+                task_finish(&rt->task, TASK_FAILED, "SysEx message longer than %zu bytes", sizeof(rt->data));
+                return;
             }
 
-            if (in_sysex) {
-                fwrite(&buffer[i], 1, 1, output_file);
-                total_bytes++;
-
-                if (buffer[i] == 0xF7) {
-                    in_sysex = 0;  // End of SysEx message
-                    printw("SysEx dump received (%zu bytes) and saved to %s\n", total_bytes, filename);
-                    refresh();
-                    fclose(output_file);
-                    snd_rawmidi_close(input);
-                    return;
-                }
+            rt->data[rt->size++] = buffer[i];
+            rt->task.done = rt->size;
+
+            if (buffer[i] == 0xF7) {
+                rt->in_sysex = false;  // End of SysEx message
+                receive_complete(rt);
+                return;
             }
         }
     }
 
-    fclose(output_file);
-    snd_rawmidi_close(input);
-    printw("SysEx dump reception was incomplete or failed.\n");
-    refresh();
+    if (len < 0) {
+        receive_close(rt);
+        task_finish(&rt->task, TASK_FAILED, "Error reading MIDI input");
+    }
 }
 
-void send_sysex_dump(const char *device_name, const char *filename) {
-    snd_rawmidi_t *output = NULL;
-    FILE *input_file;
-    unsigned char buffer[BUFFER_SIZE];
-    int err;
-    size_t bytes_read;
-    char actual_device_name[16];
+static void receive_cancel(Task *task) {
+    receive_close((ReceiveTask *)task);
+}
 
-    // Extract the actual device identifier ("hw:2,0") from the full device_name
-    sscanf(device_name, "%15s", actual_device_name);
+static void receive_destroy(Task *task) {
+    retire(&spare_receive, task);
+}
 
-    printw("Attempting to open MIDI output on device %s...\n", actual_device_name);
-    printw("Set your device in receive mode then hit enter.\n");
-    refresh();
-    getch();  // Wait for user to press a key
-    if ((err = snd_rawmidi_open(NULL, &output, actual_device_name, 0)) < 0) {
-        printw("Error opening MIDI output: %s\n", snd_strerror(err));
-        refresh();
-        getch();  // Wait for user to press a key
-        return;
+// Start capturing one SysEx message from device_name into filename. The
+// file is only written once the closing F7 has arrived.
+Task *receive_sysex_dump(EventLoop *loop, const char *device_name, const char *filename,
+                         char *error, size_t error_size) {
+    ReceiveTask *rt = reuse(&spare_receive, sizeof(ReceiveTask));
+    if (!rt) {
+        snprintf(error, error_size, "Out of memory");
+        return NULL;
     }
 
-    input_file = fopen(filename, "rb");
-    if (!input_file) {
-        printw("Error opening file: %s\n", filename);
-        refresh();
-        snd_rawmidi_close(output);
-        getch();  // Wait for user to press a key
-        return;
+    task_init(&rt->task, "Receiving SysEx", SYSEX_SIZE);
+    rt->task.cancel = receive_cancel;
+    rt->task.destroy = receive_destroy;
+    rt->loop = loop;
+    snprintf(rt->filename, sizeof(rt->filename), "%s", filename);
+
+    rt->port = midi_port_open(device_name, MIDI_PORT_INPUT | MIDI_PORT_NONBLOCK, error, error_size);
+    if (!rt->port) {
+        receive_destroy(&rt->task);
+        return NULL;
+    }
+
+    int nfds = midi_port_poll_descriptors(rt->port, rt->pfds, MIDI_PORT_MAX_POLL_FDS);
+    for (int i = 0; i < nfds; i++) {
+        if (!event_loop_add_fd(loop, rt->pfds[i].fd, POLLIN, receive_readable, rt)) {
+            receive_close(rt);
+            receive_destroy(&rt->task);
+            snprintf(error, error_size, "Too many open descriptors");
+            return NULL;
+        }
+        rt->nfds = i + 1;
+    }
+
+    return &rt->task;
+}
+
+static void send_close(SendTask *st) {
+    event_loop_remove_timer(st->loop, st->timer_id);
+    st->timer_id = 0;
+
+    midi_port_close(st->port);
+    st->port = NULL;
+}
+
+// Release the bytes due by now at the configured rate. Writing ahead of
+// the wire would only fill the driver buffer and make progress lie.
+static void send_tick(EventLoop *loop, int timer_id, void *user_data) {
+    (void)loop;
+    (void)timer_id;
+
+    SendTask *st = user_data;
+    if (st->task.state != TASK_RUNNING) return;
+
+    size_t due = st->task.total;
+    if (st->rate > 0) {
+        uint64_t elapsed_ns = timing_now_ns() - st->start_ns + SEND_TICK_NS;
+        uint64_t allowed = (uint64_t)st->rate * elapsed_ns / NSEC_PER_SEC;
+        if (allowed < due) due = allowed;
+    }
+
+    if (due > st->task.done) {
+        ssize_t written = midi_port_write_some(st->port, st->data + st->task.done, due - st->task.done);
+        if (written < 0) {
+            send_close(st);
+            task_finish(&st->task, TASK_FAILED, "Error writing to MIDI output");
+            return;
+        }
+        st->task.done += written;
+    }
+
+    if (st->task.done == st->task.total) {
+        send_close(st);
+        task_finish(&st->task, TASK_DONE, "SysEx dump sent from %s", st->filename);
+    }
+}
+
+static void send_cancel(Task *task) {
+    send_close((SendTask *)task);
+}
+
+static void send_destroy(Task *task) {
+    retire(&spare_send, task);
+}
+
+// Start sending filename to device_name at rate bytes per second
+// (0 for as fast as the port accepts)
+Task *send_sysex_dump(EventLoop *loop, const char *device_name, const char *filename, uint32_t rate,
+                      char *error, size_t error_size) {
+    SendTask *st = reuse(&spare_send, sizeof(SendTask));
+    if (!st) {
+        snprintf(error, error_size, "Out of memory");
+        return NULL;
     }
 
-    printw("Sending SysEx dump...\n");
-    refresh();
-    while ((bytes_read = fread(buffer, 1, BUFFER_SIZE, input_file)) > 0) {
-        if ((err = snd_rawmidi_write(output, buffer, bytes_read)) < 0) {
-            printw("Error writing to MIDI output: %s\n", snd_strerror(err));
-            refresh();
-            getch();  // Wait for user to press a key
-            break;
+    STATS_BEGIN(start);
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        snprintf(error, error_size, "Error opening file: %s", filename);
+        send_destroy(&st->task);
+        return NULL;
+    }
+
+    size_t size = 0;
+    ssize_t bytes_read;
+    uint8_t extra;
+    do {
+        bytes_read = read(fd, st->data + size, sizeof(st->data) - size);
+        if (bytes_read > 0) size += bytes_read;
+    } while ((bytes_read > 0 && size < sizeof(st->data)) || (bytes_read < 0 && errno == EINTR));
+
+    // A full buffer is only fine if that was the end of the file
+    bool too_large = bytes_read > 0 && read(fd, &extra, 1) > 0;
+    close(fd);
+    STATS_END(STATS_FILE_READ, start);
+    STATS_ADD(STATS_FILE_BYTES_READ, size);
+
+    if (bytes_read < 0 || too_large) {
+        if (too_large) {
+            snprintf(error, error_size, "%s is larger than %zu bytes", filename, sizeof(st->data));
+        } else {
+            snprintf(error, error_size, "Error reading file: %s", filename);
         }
+        send_destroy(&st->task);
+        return NULL;
+    }
+
+    task_init(&st->task, "Sending SysEx", size);
+    st->task.cancel = send_cancel;
+    st->task.destroy = send_destroy;
+    st->loop = loop;
+    st->rate = rate;
+    snprintf(st->filename, sizeof(st->filename), "%s", filename);
+
+    st->port = midi_port_open(device_name, MIDI_PORT_OUTPUT | MIDI_PORT_NONBLOCK, error, error_size);
+    if (!st->port) {
+        send_destroy(&st->task);
+        return NULL;
     }
 
-    fclose(input_file);
-    snd_rawmidi_drain(output);
-    snd_rawmidi_close(output);
+    st->start_ns = timing_now_ns();
+    st->timer_id = event_loop_add_timer(loop, SEND_TICK_NS, true, send_tick, st);
+    if (st->timer_id == 0) {
+        send_close(st);
+        send_destroy(&st->task);
+        snprintf(error, error_size, "Too many timers");
+        return NULL;
+    }
+
+    return &st->task;
+}
 
-    if (err < 0) {
-        printw("Error during SysEx dump send: %s\n", snd_strerror(err));
+bool midi_parse_rate(const char *text, uint32_t *rate) {
+    if (strcmp(text, "wire") == 0) {
+        *rate = MIDI_WIRE_RATE;
+        return true;
+    }
+    if (strcmp(text, "max") == 0) {
+        *rate = 0;
+        return true;
+    }
+
+    char *end;
+    errno = 0;
+    unsigned long value = strtoul(text, &end, 10);
+    if (text[0] < '0' || text[0] > '9' || *end != '\0' || errno != 0 || value > UINT32_MAX) return false;
+    *rate = value;
+    return true;
+}
+
+MidiPort *midi_port_open(const char *name, int flags, char *error, size_t error_size) {
+    MidiPort *port = reuse(&spare_port, sizeof(MidiPort));
+    if (!port) {
+        snprintf(error, error_size, "Out of memory");
+        return NULL;
+    }
+    port->fd = -1;
+    port->events = (flags & MIDI_PORT_INPUT) ? POLLIN : POLLOUT;
+
+    if (strncmp(name, "hw:", 3) == 0 || strcmp(name, "virtual") == 0) {
+        char actual_device_name[16];
+        int mode = (flags & MIDI_PORT_NONBLOCK) ? SND_RAWMIDI_NONBLOCK : 0;
+        int err;
+
+        // Accept entries straight from list_midi_devices ("hw:2,0 - Name")
+        sscanf(name, "%15s", actual_device_name);
+        if ((err = snd_rawmidi_open((flags & MIDI_PORT_INPUT) ? &port->input : NULL,
+                                    (flags & MIDI_PORT_OUTPUT) ? &port->output : NULL,
+                                    actual_device_name, mode)) < 0) {
+            snprintf(error, error_size, "Error opening MIDI device %s: %s", actual_device_name, snd_strerror(err));
+            retire(&spare_port, port);
+            return NULL;
+        }
+    } else if (strcmp(name, "-") == 0) {
+        port->fd = (flags & MIDI_PORT_INPUT) ? STDIN_FILENO : STDOUT_FILENO;
     } else {
-        printw("SysEx dump sent from %s\n", filename);
+        int mode = O_NOCTTY | O_CLOEXEC;
+        if ((flags & MIDI_PORT_INPUT) && (flags & MIDI_PORT_OUTPUT)) {
+            mode |= O_RDWR;
+        } else if (flags & MIDI_PORT_INPUT) {
+            mode |= O_RDONLY;
+        } else {
+            // A plain file gets just this stream; FIFOs and ttys ignore O_TRUNC
+            mode |= O_WRONLY | O_CREAT | O_TRUNC;
+        }
+        if (flags & MIDI_PORT_NONBLOCK) mode |= O_NONBLOCK;
+
+        port->fd = open(name, mode, 0644);
+        if (port->fd < 0) {
+            snprintf(error, error_size, "Error opening %s: %s", name, strerror(errno));
+            retire(&spare_port, port);
+            return NULL;
+        }
+    }
+
+    return port;
+}
+
+// A port over a descriptor opened elsewhere, such as a pty master.
+// Closing the port closes the descriptor.
+MidiPort *midi_port_adopt_fd(int fd, char *error, size_t error_size) {
+    MidiPort *port = reuse(&spare_port, sizeof(MidiPort));
+    if (!port) {
+        snprintf(error, error_size, "Out of memory");
+        return NULL;
+    }
+
+    port->fd = fd;
+    port->events = POLLIN;
+    return port;
+}
+
+MidiPort *midi_port_open_output(const char *name, char *error, size_t error_size) {
+    return midi_port_open(name, MIDI_PORT_OUTPUT, error, error_size);
+}
+
+int midi_port_poll_descriptors(MidiPort *port, struct pollfd *pfds, int space) {
+    if (port->input) {
+        return snd_rawmidi_poll_descriptors(port->input, pfds, space);
     }
-    refresh();
-    getch();  // Wait for user to press a key
+    if (port->output) {
+        return snd_rawmidi_poll_descriptors(port->output, pfds, space);
+    }
+    if (space < 1) return 0;
+
+    pfds[0].fd = port->fd;
+    pfds[0].events = port->events;
+    pfds[0].revents = 0;
+    return 1;
 }
 
+// Returns the bytes read, 0 if a non-blocking port has nothing pending,
+// -1 on error or once a path reaches end of file
+static ssize_t port_read(MidiPort *port, uint8_t *data, size_t size) {
+    ssize_t len;
+
+    if (port->input) {
+        len = snd_rawmidi_read(port->input, data, size);
+        if (len == -EAGAIN) return 0;
+        return len < 0 ? -1 : len;
+    }
 
+    do {
+        len = read(port->fd, data, size);
+    } while (len < 0 && errno == EINTR);
+
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    return len == 0 ? -1 : len;
+}
+
+ssize_t midi_port_read(MidiPort *port, uint8_t *data, size_t size) {
+    STATS_BEGIN(start);
+    ssize_t len = port_read(port, data, size);
+    STATS_END(STATS_MIDI_READ, start);
+
+    if (len > 0) STATS_ADD(STATS_MIDI_BYTES_IN, len);
+    if (len == 0) STATS_ADD(STATS_MIDI_WOULD_BLOCK, 1);
+    return len;
+}
+
+// Write what the port accepts right now; returns the count or -1
+static ssize_t port_write_some(MidiPort *port, const uint8_t *data, size_t size) {
+    ssize_t written;
+
+    if (port->output) {
+        written = snd_rawmidi_write(port->output, data, size);
+        if (written == -EAGAIN) return 0;
+        return written < 0 ? -1 : written;
+    }
+
+    do {
+        written = write(port->fd, data, size);
+    } while (written < 0 && errno == EINTR);
+
+    if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    return written;
+}
+
+ssize_t midi_port_write_some(MidiPort *port, const uint8_t *data, size_t size) {
+    STATS_BEGIN(start);
+    ssize_t written = port_write_some(port, data, size);
+    STATS_END(STATS_MIDI_WRITE, start);
+
+    if (written > 0) STATS_ADD(STATS_MIDI_BYTES_OUT, written);
+    if (written == 0) STATS_ADD(STATS_MIDI_WOULD_BLOCK, 1);
+    return written;
+}
+
+// Block until a non-blocking port can take more
+static bool wait_writable(MidiPort *port) {
+    struct pollfd pfds[MIDI_PORT_MAX_POLL_FDS];
+    int nfds = 1;
+
+    if (port->output) {
+        nfds = snd_rawmidi_poll_descriptors(port->output, pfds, MIDI_PORT_MAX_POLL_FDS);
+    } else {
+        pfds[0].fd = port->fd;
+        pfds[0].events = POLLOUT;
+    }
+
+    int ready;
+    do {
+        ready = poll(pfds, nfds, -1);
+    } while (ready < 0 && errno == EINTR);
+    return ready > 0;
+}
+
+static bool port_write(MidiPort *port, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = port_write_some(port, data, size);
+        if (written < 0) return false;
+        if (written == 0 && !wait_writable(port)) return false;
+
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+bool midi_port_write(MidiPort *port, const uint8_t *data, size_t size) {
+    STATS_BEGIN(start);
+    bool ok = port_write(port, data, size);
+    STATS_END(STATS_MIDI_WRITE, start);
+
+    if (ok) STATS_ADD(STATS_MIDI_BYTES_OUT, size);
+    return ok;
+}
+
+void midi_port_close(MidiPort *port) {
+    if (!port) return;
+
+    if (port->output) {
+        snd_rawmidi_drain(port->output);
+        snd_rawmidi_close(port->output);
+    }
+    if (port->input) {
+        snd_rawmidi_close(port->input);
+    }
+    if (port->fd > STDERR_FILENO) {
+        close(port->fd);
+    }
+
+    retire(&spare_port, port);
+}
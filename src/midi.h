@@ -1,14 +1,49 @@
 #ifndef MIDI_H
 #define MIDI_H
 
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "event_loop.h"
+#include "task.h"
+
 #define MAX_DEVICES 10
 #define BUFFER_SIZE 1024
 
-void handle_sysex_receive();
-void handle_sysex_send();
+// 31250 baud, 10 bits per byte on the wire
+#define MIDI_WIRE_RATE 3125
+
+#define MIDI_PORT_INPUT 1
+#define MIDI_PORT_OUTPUT 2
+#define MIDI_PORT_NONBLOCK 4
+#define MIDI_PORT_MAX_POLL_FDS 4
+
+// A MIDI endpoint: an ALSA rawmidi device ("hw:1,0", or "virtual" for a
+// new ALSA sequencer port) or any path that can be opened (FIFO, pty,
+// plain file, "-" for stdin/stdout)
+typedef struct MidiPort MidiPort;
+
+void handle_sysex_receive(EventLoop *loop);
+void handle_sysex_send(EventLoop *loop);
 void list_midi_devices(char devices[MAX_DEVICES][128], int *count);
-void receive_sysex_dump(const char *device_name, const char *filename);
-void send_sysex_dump(const char *device_name, const char *filename);
+Task *receive_sysex_dump(EventLoop *loop, const char *device_name, const char *filename,
+                         char *error, size_t error_size);
+Task *send_sysex_dump(EventLoop *loop, const char *device_name, const char *filename, uint32_t rate,
+                      char *error, size_t error_size);
 
-#endif
+MidiPort *midi_port_open(const char *name, int flags, char *error, size_t error_size);
+MidiPort *midi_port_adopt_fd(int fd, char *error, size_t error_size);
+MidiPort *midi_port_open_output(const char *name, char *error, size_t error_size);
+int midi_port_poll_descriptors(MidiPort *port, struct pollfd *pfds, int space);
+ssize_t midi_port_read(MidiPort *port, uint8_t *data, size_t size);
+ssize_t midi_port_write_some(MidiPort *port, const uint8_t *data, size_t size);
+bool midi_port_write(MidiPort *port, const uint8_t *data, size_t size);
+void midi_port_close(MidiPort *port);
+
+// A --rate argument: "wire" for MIDI_WIRE_RATE, "max" for 0 (no limit)
+// or bytes per second; false for anything else
+bool midi_parse_rate(const char *text, uint32_t *rate);
 
+#endif
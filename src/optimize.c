@@ -0,0 +1,636 @@
+/*  Setlist bank optimizer
+*   fcbtool --optimize lays out a show's presets on the 10x10 grid so that
+*   playing the setlist in order needs as few bank changes as possible.
+*   Steps with the same requirements share one preset. The number of bank
+*   switches only depends on which presets share a bank, so each thread
+*   anneals a partition of the presets into banks of ten, restarting from
+*   a shaken up copy of the best partition found so far, until the time
+*   budget runs out. The banks are then numbered to minimise up/down
+*   pedal presses, and presets in a bank follow the order they are first
+*   played in.
+*
+*   Setlist format, one step per line ('#' starts a comment):
+*       [<label>: ]<requirement> ...
+*   where a requirement is pc1-pc5=<program>, cc1/cc2=<controller>:<value>,
+*   expA/expB=<controller>[:<min>[:<max>]], note=<value>, switch1, switch2,
+*   or any CSV column as <name>=<value>.
+*/
+
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fcb.h"
+#include "optimize.h"
+#include "timing.h"
+
+#define NUM_BANKS 10
+#define BANK_SIZE 10
+#define LABEL_SIZE 48
+
+// Annealing schedule of one run, in bank switches
+#define ANNEAL_START_TEMPERATURE 2.0
+#define ANNEAL_END_TEMPERATURE 0.05
+#define ANNEAL_MOVES_PER_PRESET 20000
+
+// Random restarts when numbering the banks of a partition
+#define NUMBERING_RESTARTS 64
+
+typedef struct {
+    FCB1010Preset preset[NUM_PRESETS];  // Distinct requirements in first use order
+    char label[NUM_PRESETS][LABEL_SIZE];
+    int count;
+    int *steps;  // Index into preset[] of each step
+    size_t step_count;
+    size_t step_capacity;
+    // Transitions between consecutive steps for each pair of presets
+    int weight[NUM_PRESETS][NUM_PRESETS];
+    int neighbor[NUM_PRESETS][NUM_PRESETS];
+    int neighbor_count[NUM_PRESETS];
+} Setlist;
+
+typedef struct {
+    uint8_t bank[NUM_PRESETS];  // 0-9 for each distinct preset
+    long switches;
+    long presses;
+} Layout;
+
+typedef struct {
+    const Setlist *setlist;
+    uint64_t deadline_ns;
+    long switch_bound;  // No layout can need fewer switches
+    pthread_mutex_t lock;
+    Layout best;
+    bool have_best;
+    bool done;
+    long runs;
+} Search;
+
+typedef struct {
+    Search *search;
+    uint64_t seed;
+} Worker;
+
+typedef struct {
+    const char *name;
+    int max_values;
+    const char *fields[3];  // Set in order from the values; <name>_enabled is turned on
+} Shorthand;
+
+static const Shorthand shorthands[] = {
+    {"pc1", 1, {"program"}},
+    {"pc2", 1, {"program"}},
+    {"pc3", 1, {"program"}},
+    {"pc4", 1, {"program"}},
+    {"pc5", 1, {"program"}},
+    {"cc1", 2, {"controller", "value"}},
+    {"cc2", 2, {"controller", "value"}},
+    {"expA", 3, {"controller", "min", "max"}},
+    {"expB", 3, {"controller", "min", "max"}},
+    {"note", 1, {"value"}},
+};
+
+#define NUM_SHORTHANDS (sizeof(shorthands) / sizeof(shorthands[0]))
+
+static uint64_t next_random(uint64_t *state) {
+    // xorshift64*
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double random_unit(uint64_t *state) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void set_field(FCB1010Preset *preset, const char *prefix, const char *suffix, int value) {
+    char name[32];
+    snprintf(name, sizeof(name), "%s_%s", prefix, suffix);
+    fcb_set_preset_field(preset, fcb_find_preset_field(name), (uint8_t)value);
+}
+
+// Parses "<n>[:<n>...]" with every number 0-127; returns how many, or -1
+static int parse_numbers(const char *text, int *values, int max_count) {
+    int count = 0;
+    for (;;) {
+        char *end;
+        if (!isdigit((unsigned char)*text) || count == max_count) return -1;
+        long value = strtol(text, &end, 10);
+        if (value > 127) return -1;
+        values[count++] = (int)value;
+        if (*end == '\0') return count;
+        if (*end != ':') return -1;
+        text = end + 1;
+    }
+}
+
+static bool apply_requirement(FCB1010Preset *preset, char *token) {
+    if (strcmp(token, "switch1") == 0 || strcmp(token, "switch2") == 0) {
+        set_field(preset, token, "enabled", 1);
+        return true;
+    }
+
+    char *equals = strchr(token, '=');
+    if (!equals) return false;
+    *equals = '\0';
+
+    int values[3];
+    int count = parse_numbers(equals + 1, values, 3);
+    if (count < 0) return false;
+
+    for (size_t i = 0; i < NUM_SHORTHANDS; i++) {
+        const Shorthand *shorthand = &shorthands[i];
+        if (strcmp(token, shorthand->name) != 0) continue;
+        if (count > shorthand->max_values) return false;
+
+        set_field(preset, token, "enabled", 1);
+        for (int v = 0; v < count; v++) set_field(preset, token, shorthand->fields[v], values[v]);
+        return true;
+    }
+
+    int field = fcb_find_preset_field(token);
+    if (field < 0 || count != 1) return false;
+    if (fcb_preset_fields[field].is_flag && values[0] > 1) return false;
+    fcb_set_preset_field(preset, field, (uint8_t)values[0]);
+    return true;
+}
+
+static bool same_preset(const FCB1010Preset *a, const FCB1010Preset *b) {
+    for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+        if (fcb_get_preset_field(a, f) != fcb_get_preset_field(b, f)) return false;
+    }
+    return true;
+}
+
+static bool append_step(Setlist *setlist, int preset) {
+    if (setlist->step_count == setlist->step_capacity) {
+        size_t capacity = setlist->step_capacity ? setlist->step_capacity * 2 : 64;
+        int *steps = realloc(setlist->steps, capacity * sizeof(int));
+        if (!steps) return false;
+        setlist->steps = steps;
+        setlist->step_capacity = capacity;
+    }
+    setlist->steps[setlist->step_count++] = preset;
+    return true;
+}
+
+static bool load_setlist(const char *filename, Setlist *setlist, char *error, size_t error_size) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        snprintf(error, error_size, "Failed to read file %s", filename);
+        return false;
+    }
+
+    FCB1010 defaults;
+    init_fcb1010(&defaults);
+
+    char line[1024];
+    int line_number = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+
+        if (!strchr(line, '\n') && !feof(file)) {
+            snprintf(error, error_size, "Line %d: too long", line_number);
+            goto fail;
+        }
+
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        // A label ends at the first colon followed by a space, which no
+        // requirement contains
+        char label[LABEL_SIZE];
+        snprintf(label, sizeof(label), "line %d", line_number);
+        char *ptr = line;
+        for (char *colon = strchr(line, ':'); colon; colon = strchr(colon + 1, ':')) {
+            if (colon[1] != '\0' && !isspace((unsigned char)colon[1])) continue;
+
+            char *start = line;
+            char *end = colon;
+            while (isspace((unsigned char)*start)) start++;
+            while (end > start && isspace((unsigned char)end[-1])) end--;
+            if (end > start) snprintf(label, sizeof(label), "%.*s", (int)(end - start), start);
+            ptr = colon + 1;
+            break;
+        }
+
+        FCB1010Preset preset = defaults.preset[0];
+        int requirements = 0;
+        char *saveptr;
+        for (char *token = strtok_r(ptr, " \t\r\n", &saveptr); token; token = strtok_r(NULL, " \t\r\n", &saveptr)) {
+            char text[64];
+            snprintf(text, sizeof(text), "%s", token);
+            if (!apply_requirement(&preset, token)) {
+                snprintf(error, error_size, "Line %d: bad requirement '%s'", line_number, text);
+                goto fail;
+            }
+            requirements++;
+        }
+        // A labelled line without requirements is a step with everything off
+        if (requirements == 0 && ptr == line) continue;
+
+        int index = 0;
+        while (index < setlist->count && !same_preset(&setlist->preset[index], &preset)) index++;
+        if (index == setlist->count) {
+            if (setlist->count == NUM_PRESETS) {
+                snprintf(error, error_size, "Line %d: more than %d different presets", line_number, NUM_PRESETS);
+                goto fail;
+            }
+            setlist->preset[index] = preset;
+            snprintf(setlist->label[index], LABEL_SIZE, "%s", label);
+            setlist->count++;
+        }
+
+        if (setlist->step_count == OPTIMIZE_MAX_STEPS) {
+            snprintf(error, error_size, "Line %d: more than %d steps", line_number, OPTIMIZE_MAX_STEPS);
+            goto fail;
+        }
+        if (!append_step(setlist, index)) {
+            snprintf(error, error_size, "Out of memory");
+            goto fail;
+        }
+    }
+    fclose(file);
+
+    if (setlist->step_count == 0) {
+        snprintf(error, error_size, "No steps");
+        return false;
+    }
+
+    for (size_t i = 1; i < setlist->step_count; i++) {
+        int a = setlist->steps[i - 1];
+        int b = setlist->steps[i];
+        if (a == b) continue;
+        setlist->weight[a][b]++;
+        setlist->weight[b][a]++;
+    }
+    for (int a = 0; a < setlist->count; a++) {
+        for (int b = 0; b < setlist->count; b++) {
+            if (setlist->weight[a][b]) setlist->neighbor[a][setlist->neighbor_count[a]++] = b;
+        }
+    }
+    return true;
+
+fail:
+    fclose(file);
+    return false;
+}
+
+// Bank up/down presses between two banks; the pedals wrap around
+static int bank_distance(int a, int b) {
+    int distance = abs(a - b);
+    return distance < NUM_BANKS - distance ? distance : NUM_BANKS - distance;
+}
+
+static void score_layout(const Setlist *setlist, Layout *layout) {
+    layout->switches = 0;
+    layout->presses = 0;
+    for (size_t i = 1; i < setlist->step_count; i++) {
+        int a = layout->bank[setlist->steps[i - 1]];
+        int b = layout->bank[setlist->steps[i]];
+        if (a == b) continue;
+        layout->switches++;
+        layout->presses += bank_distance(a, b);
+    }
+}
+
+static bool better_layout(const Layout *a, const Layout *b) {
+    return a->switches < b->switches || (a->switches == b->switches && a->presses < b->presses);
+}
+
+// Switches on transitions of a if it sat in bank, leaving out those to skip
+static int switch_cost(const Setlist *setlist, const uint8_t *bank_of, int a, int bank, int skip) {
+    int cost = 0;
+    for (int n = 0; n < setlist->neighbor_count[a]; n++) {
+        int c = setlist->neighbor[a][n];
+        if (c != skip && bank_of[c] != bank) cost += setlist->weight[a][c];
+    }
+    return cost;
+}
+
+static long numbering_cost(long transitions[NUM_BANKS][NUM_BANKS], const int *number) {
+    long presses = 0;
+    for (int a = 0; a < NUM_BANKS; a++) {
+        for (int b = a + 1; b < NUM_BANKS; b++) {
+            if (transitions[a][b]) presses += transitions[a][b] * bank_distance(number[a], number[b]);
+        }
+    }
+    return presses;
+}
+
+// Renumbers the banks of a layout to need the fewest up/down presses:
+// pairwise swaps of bank numbers until none helps, from several starts
+static void number_banks(const Setlist *setlist, Layout *layout, uint64_t *rng) {
+    long transitions[NUM_BANKS][NUM_BANKS] = {{0}};
+    for (size_t i = 1; i < setlist->step_count; i++) {
+        int a = layout->bank[setlist->steps[i - 1]];
+        int b = layout->bank[setlist->steps[i]];
+        if (a == b) continue;
+        transitions[a][b]++;
+        transitions[b][a]++;
+    }
+
+    int best[NUM_BANKS];
+    long best_presses = -1;
+    for (int restart = 0; restart < NUMBERING_RESTARTS; restart++) {
+        int number[NUM_BANKS];
+        for (int b = 0; b < NUM_BANKS; b++) number[b] = b;
+        for (int b = NUM_BANKS - 1; restart > 0 && b > 0; b--) {
+            int other = (int)(next_random(rng) % (uint64_t)(b + 1));
+            int swap = number[b];
+            number[b] = number[other];
+            number[other] = swap;
+        }
+
+        long presses = numbering_cost(transitions, number);
+        bool improved = true;
+        while (improved) {
+            improved = false;
+            for (int a = 0; a < NUM_BANKS; a++) {
+                for (int b = a + 1; b < NUM_BANKS; b++) {
+                    int swap = number[a];
+                    number[a] = number[b];
+                    number[b] = swap;
+                    long cost = numbering_cost(transitions, number);
+                    if (cost < presses) {
+                        presses = cost;
+                        improved = true;
+                    } else {
+                        number[b] = number[a];
+                        number[a] = swap;
+                    }
+                }
+            }
+        }
+
+        if (best_presses < 0 || presses < best_presses) {
+            best_presses = presses;
+            memcpy(best, number, sizeof(best));
+        }
+    }
+
+    // Distances wrap around, so rotating the numbers to open the show in
+    // bank 1 costs nothing
+    int first = best[layout->bank[setlist->steps[0]]];
+    for (int p = 0; p < setlist->count; p++) {
+        layout->bank[p] = (uint8_t)((best[layout->bank[p]] - first + NUM_BANKS) % NUM_BANKS);
+    }
+    score_layout(setlist, layout);
+}
+
+static bool search_stopped(Search *search) {
+    return __atomic_load_n(&search->done, __ATOMIC_RELAXED) || timing_now_ns() >= search->deadline_ns;
+}
+
+static void *worker_main(void *arg) {
+    Worker *worker = arg;
+    Search *search = worker->search;
+    const Setlist *setlist = search->setlist;
+    int count = setlist->count;
+    uint64_t rng = worker->seed;
+
+    Layout layout;
+    int members[NUM_BANKS][BANK_SIZE];
+    int size[NUM_BANKS];
+    int position[NUM_PRESETS];
+
+    do {
+        // Mostly refine the best partition so far, sometimes start afresh
+        pthread_mutex_lock(&search->lock);
+        bool from_best = search->have_best && next_random(&rng) % 4 != 0;
+        if (from_best) layout = search->best;
+        pthread_mutex_unlock(&search->lock);
+
+        if (from_best) {
+            for (int shake = 1 + count / 8; shake > 0; shake--) {
+                int a = (int)(next_random(&rng) % (uint64_t)count);
+                int b = (int)(next_random(&rng) % (uint64_t)count);
+                uint8_t swap = layout.bank[a];
+                layout.bank[a] = layout.bank[b];
+                layout.bank[b] = swap;
+            }
+        } else {
+            uint8_t slots[NUM_PRESETS];
+            for (int s = 0; s < NUM_PRESETS; s++) slots[s] = (uint8_t)s;
+            for (int p = 0; p < count; p++) {
+                int other = p + (int)(next_random(&rng) % (uint64_t)(NUM_PRESETS - p));
+                uint8_t swap = slots[p];
+                slots[p] = slots[other];
+                slots[other] = swap;
+                layout.bank[p] = slots[p] / BANK_SIZE;
+            }
+        }
+
+        memset(size, 0, sizeof(size));
+        for (int p = 0; p < count; p++) {
+            int bank = layout.bank[p];
+            position[p] = size[bank];
+            members[bank][size[bank]++] = p;
+        }
+
+        // Move a preset to a random slot in another bank, swapping with
+        // the preset there if the slot is taken
+        long moves = (long)ANNEAL_MOVES_PER_PRESET * count;
+        double temperature = ANNEAL_START_TEMPERATURE;
+        double cooling = pow(ANNEAL_END_TEMPERATURE / ANNEAL_START_TEMPERATURE, 1.0 / (double)moves);
+        for (long m = 0; m < moves; m++, temperature *= cooling) {
+            if ((m & 4095) == 0 && search_stopped(search)) break;
+
+            int a = (int)(next_random(&rng) % (uint64_t)count);
+            int from = layout.bank[a];
+            int to = (int)(next_random(&rng) % (NUM_BANKS - 1));
+            if (to >= from) to++;
+            int slot = (int)(next_random(&rng) % BANK_SIZE);
+            int b = slot < size[to] ? members[to][slot] : -1;
+
+            int delta = switch_cost(setlist, layout.bank, a, to, b) - switch_cost(setlist, layout.bank, a, from, b);
+            if (b >= 0) delta += switch_cost(setlist, layout.bank, b, from, a) - switch_cost(setlist, layout.bank, b, to, a);
+            if (delta > 0 && random_unit(&rng) >= exp(-delta / temperature)) continue;
+
+            if (b >= 0) {
+                members[from][position[a]] = b;
+                members[to][position[b]] = a;
+                int swap = position[a];
+                position[a] = position[b];
+                position[b] = swap;
+                layout.bank[b] = (uint8_t)from;
+            } else {
+                int last = members[from][--size[from]];
+                members[from][position[a]] = last;
+                position[last] = position[a];
+                position[a] = size[to];
+                members[to][size[to]++] = a;
+            }
+            layout.bank[a] = (uint8_t)to;
+        }
+
+        score_layout(setlist, &layout);
+
+        pthread_mutex_lock(&search->lock);
+        bool contender = !search->have_best || layout.switches <= search->best.switches;
+        pthread_mutex_unlock(&search->lock);
+        if (contender) number_banks(setlist, &layout, &rng);
+
+        pthread_mutex_lock(&search->lock);
+        search->runs++;
+        if (!search->have_best || better_layout(&layout, &search->best)) {
+            search->best = layout;
+            search->have_best = true;
+            // Every switch is at least one press
+            if (layout.switches == search->switch_bound && layout.presses == layout.switches) {
+                __atomic_store_n(&search->done, true, __ATOMIC_RELAXED);
+            }
+        }
+        pthread_mutex_unlock(&search->lock);
+    } while (!search_stopped(search));
+
+    return NULL;
+}
+
+static void print_usage() {
+    fprintf(stderr, "Usage: fcbtool --optimize <setlist> <out.csv|out.syx> [--base <dump.syx>] [--time <seconds>] [--threads <count>]\n");
+}
+
+int optimize_main(int argc, char *argv[]) {
+    const char *setlist_filename = NULL;
+    const char *out_filename = NULL;
+    const char *base_filename = NULL;
+    double seconds = OPTIMIZE_DEFAULT_SECONDS;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--base") == 0 && i + 1 < argc) {
+            base_filename = argv[++i];
+        } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+            seconds = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = strtol(argv[++i], NULL, 10);
+        } else if (!setlist_filename) {
+            setlist_filename = argv[i];
+        } else if (!out_filename) {
+            out_filename = argv[i];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (!setlist_filename || !out_filename || !(seconds > 0)) {
+        print_usage();
+        return 1;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > OPTIMIZE_MAX_THREADS) threads = OPTIMIZE_MAX_THREADS;
+
+    FCB1010 fcb;
+    FCBError error;
+    uint8_t data[SYSEX_SIZE];
+    if (base_filename) {
+        if (fcb_read_sysex_file(base_filename, data, &error) != FCB_OK ||
+            fcb_decode_sysex(data, SYSEX_SIZE, &fcb, &error) != FCB_OK) {
+            fprintf(stderr, "%s: %s\n", base_filename, error.message);
+            return 2;
+        }
+    } else {
+        init_fcb1010(&fcb);
+    }
+
+    Setlist *setlist = calloc(1, sizeof(Setlist));
+    if (!setlist) {
+        fprintf(stderr, "Out of memory\n");
+        return 2;
+    }
+
+    char message[256];
+    if (!load_setlist(setlist_filename, setlist, message, sizeof(message))) {
+        fprintf(stderr, "%s: %s\n", setlist_filename, message);
+        free(setlist->steps);
+        free(setlist);
+        return 2;
+    }
+
+    // Laid out by hand: presets in the order they are first played
+    Layout first_use;
+    for (int p = 0; p < setlist->count; p++) first_use.bank[p] = (uint8_t)(p / BANK_SIZE);
+    score_layout(setlist, &first_use);
+
+    static Search search;
+    search.setlist = setlist;
+    search.switch_bound = (setlist->count + BANK_SIZE - 1) / BANK_SIZE - 1;
+    uint64_t start_ns = timing_now_ns();
+    search.deadline_ns = start_ns + (uint64_t)(seconds * NSEC_PER_SEC);
+    pthread_mutex_init(&search.lock, NULL);
+
+    pthread_t thread[OPTIMIZE_MAX_THREADS];
+    Worker workers[OPTIMIZE_MAX_THREADS];
+    int started = 0;
+    for (; started < threads; started++) {
+        workers[started].search = &search;
+        workers[started].seed = (start_ns ^ 0x9E3779B97F4A7C15ULL * (uint64_t)(started + 1)) | 1;
+        if (pthread_create(&thread[started], NULL, worker_main, &workers[started]) != 0) break;
+    }
+    if (started == 0) {
+        fprintf(stderr, "Failed to start worker threads\n");
+        free(setlist->steps);
+        free(setlist);
+        return 2;
+    }
+    for (int i = 0; i < started; i++) pthread_join(thread[i], NULL);
+    double elapsed = (double)(timing_now_ns() - start_ns) / NSEC_PER_SEC;
+
+    // Unused slots are left blank; globals come from the base dump
+    FCB1010 blank;
+    init_fcb1010(&blank);
+    memcpy(fcb.preset, blank.preset, sizeof(fcb.preset));
+
+    int slot_of[NUM_PRESETS];
+    int fill[NUM_BANKS] = {0};
+    for (int p = 0; p < setlist->count; p++) {
+        int bank = search.best.bank[p];
+        slot_of[p] = bank * BANK_SIZE + fill[bank]++;
+        fcb.preset[slot_of[p]] = setlist->preset[p];
+    }
+
+    // A dump is the base with only the presets rewritten, so everything
+    // else in it stays byte for byte
+    FCBStatus status;
+    if (fcb_has_suffix(out_filename, ".csv")) {
+        status = fcb_write_csv_file(out_filename, &fcb, &error);
+    } else {
+        if (base_filename) {
+            status = fcb_overlay_sysex(&fcb, data, SYSEX_SIZE, NULL, NULL, &error);
+        } else {
+            status = fcb_encode_sysex(&fcb, data, SYSEX_SIZE, &error);
+        }
+        if (status == FCB_OK) status = fcb_write_sysex_file(out_filename, data, &error);
+    }
+    if (status != FCB_OK) {
+        fprintf(stderr, "%s: %s\n", out_filename, error.message);
+        free(setlist->steps);
+        free(setlist);
+        return 2;
+    }
+
+    for (int slot = 0; slot < NUM_PRESETS; slot++) {
+        for (int p = 0; p < setlist->count; p++) {
+            if (slot_of[p] == slot) printf("%2d-%-2d %s\n", slot / BANK_SIZE + 1, slot % BANK_SIZE + 1, setlist->label[p]);
+        }
+    }
+
+    int banks_used = 0;
+    for (int b = 0; b < NUM_BANKS; b++) banks_used += fill[b] > 0;
+    printf("%zu steps, %d presets in %d bank%s\n", setlist->step_count, setlist->count, banks_used,
+           banks_used == 1 ? "" : "s");
+    printf("Bank switches: %ld (%ld in first use order), up/down presses: %ld\n", search.best.switches,
+           first_use.switches, search.best.presses);
+    printf("%ld runs on %d thread%s in %.2f s\n", search.runs, started, started == 1 ? "" : "s", elapsed);
+
+    free(setlist->steps);
+    free(setlist);
+    return 0;
+}
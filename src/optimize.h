@@ -0,0 +1,12 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+// Longest setlist accepted; keeps the switch count and pedal press count
+// of a layout apart in one 64 bit score
+#define OPTIMIZE_MAX_STEPS 100000
+#define OPTIMIZE_MAX_THREADS 64
+#define OPTIMIZE_DEFAULT_SECONDS 2.0
+
+int optimize_main(int argc, char *argv[]);
+
+#endif
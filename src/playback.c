@@ -0,0 +1,327 @@
+/*  Scripted preset playback
+*   Replays a timed list of preset activations against a loaded FCB1010,
+*   sending the same PC/CC/note messages the pedal would send. Every
+*   message is resolved before the clock starts so the timed loop only
+*   sleeps to an absolute deadline and writes.
+*
+*   Script format, one event per line ('#' starts a comment):
+*       <time_ms> <bank> <preset>     time from the start of the run
+*       +<time_ms> <bank> <preset>    time after the previous event
+*/
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fcb.h"
+#include "fcb_io.h"
+#include "midi.h"
+#include "playback.h"
+#include "timing.h"
+
+#define PLAYBACK_LEAD_NS (5 * NSEC_PER_MSEC)
+#define PLAYBACK_LATE_NS NSEC_PER_MSEC
+#define PLAYBACK_RT_PRIORITY 70
+
+typedef struct {
+    uint8_t *out;
+    size_t len;
+    uint8_t last_status;
+    bool running_status;
+} Emitter;
+
+static void emit(Emitter *e, uint8_t status, uint8_t data1, int data2) {
+    if (!e->running_status || status != e->last_status) {
+        e->out[e->len++] = status;
+        e->last_status = status;
+    }
+    e->out[e->len++] = data1 & 0x7F;
+    if (data2 >= 0) {
+        e->out[e->len++] = data2 & 0x7F;
+    }
+}
+
+static void emit_preset(Emitter *e, const FCB1010 *fcb, int preset) {
+    const FCB1010Preset *p = &fcb->preset[preset];
+
+    if (p->pc1_enabled) emit(e, 0xC0 | (fcb->pc1_midi_channel & 0x0F), p->pc1_program, -1);
+    if (p->pc2_enabled) emit(e, 0xC0 | (fcb->pc2_midi_channel & 0x0F), p->pc2_program, -1);
+    if (p->pc3_enabled) emit(e, 0xC0 | (fcb->pc3_midi_channel & 0x0F), p->pc3_program, -1);
+    if (p->pc4_enabled) emit(e, 0xC0 | (fcb->pc4_midi_channel & 0x0F), p->pc4_program, -1);
+    if (p->pc5_enabled) emit(e, 0xC0 | (fcb->pc5_midi_channel & 0x0F), p->pc5_program, -1);
+    if (p->cc1_enabled) emit(e, 0xB0 | (fcb->cc1_midi_channel & 0x0F), p->cc1_controller, p->cc1_value);
+    if (p->cc2_enabled) emit(e, 0xB0 | (fcb->cc2_midi_channel & 0x0F), p->cc2_controller, p->cc2_value);
+    if (p->note_enabled) emit(e, 0x90 | (fcb->note_midi_channel & 0x0F), p->note_value, 127);
+}
+
+// Resolve a preset (0-99) into the raw MIDI bytes it sends when pressed.
+// out must hold PLAYBACK_MAX_MESSAGE bytes. Returns the byte count.
+size_t playback_resolve_preset(const FCB1010 *fcb, int preset, uint8_t *out) {
+    Emitter e = { .out = out, .len = 0, .last_status = 0, .running_status = false };
+
+    emit_preset(&e, fcb, preset);
+    return e.len;
+}
+
+static bool append_event(PlaybackScript *script, uint64_t time_ns, int preset) {
+    if (script->count == script->capacity) {
+        size_t capacity = script->capacity ? script->capacity * 2 : 64;
+        PlaybackEvent *events = realloc(script->events, capacity * sizeof(PlaybackEvent));
+        if (!events) return false;
+        script->events = events;
+        script->capacity = capacity;
+    }
+
+    script->events[script->count].time_ns = time_ns;
+    script->events[script->count].preset = preset;
+    script->count++;
+    return true;
+}
+
+bool playback_load_script(const char *filename, PlaybackScript *script, char *error, size_t error_size) {
+    memset(script, 0, sizeof(PlaybackScript));
+
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        snprintf(error, error_size, "Failed to read file %s", filename);
+        return false;
+    }
+
+    char line[256];
+    int line_number = 0;
+    uint64_t previous_ns = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char *ptr = line;
+        while (isspace((unsigned char)*ptr)) ptr++;
+        if (*ptr == '\0') continue;
+
+        bool relative = (*ptr == '+');
+        if (relative) ptr++;
+
+        char *end;
+        double time_ms = strtod(ptr, &end);
+        int bank, preset_num;
+        if (end == ptr || time_ms < 0 || sscanf(end, "%d %d", &bank, &preset_num) != 2) {
+            snprintf(error, error_size, "Line %d: expected '<time_ms> <bank> <preset>'", line_number);
+            goto fail;
+        }
+
+        if (bank < 1 || bank > 10 || preset_num < 1 || preset_num > 10) {
+            snprintf(error, error_size, "Line %d: bank and preset must be 1-10", line_number);
+            goto fail;
+        }
+
+        uint64_t time_ns = (uint64_t)llround(time_ms * NSEC_PER_MSEC);
+        if (relative) time_ns += previous_ns;
+
+        if (time_ns < previous_ns) {
+            snprintf(error, error_size, "Line %d: events must be in time order", line_number);
+            goto fail;
+        }
+
+        if (!append_event(script, time_ns, (bank - 1) * 10 + (preset_num - 1))) {
+            snprintf(error, error_size, "Out of memory");
+            goto fail;
+        }
+        previous_ns = time_ns;
+    }
+
+    fclose(file);
+    return true;
+
+fail:
+    fclose(file);
+    playback_free_script(script);
+    return false;
+}
+
+void playback_free_script(PlaybackScript *script) {
+    free(script->events);
+    memset(script, 0, sizeof(PlaybackScript));
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void compute_stats(int64_t *errors, size_t count, PlaybackStats *stats) {
+    double sum = 0;
+    double sum_sq = 0;
+
+    stats->late_events = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += errors[i];
+        sum_sq += (double)errors[i] * errors[i];
+        if (errors[i] > (int64_t)PLAYBACK_LATE_NS) stats->late_events++;
+    }
+
+    qsort(errors, count, sizeof(int64_t), compare_int64);
+
+    stats->events = count;
+    stats->min_ns = errors[0];
+    stats->max_ns = errors[count - 1];
+    stats->p50_ns = errors[count / 2];
+    stats->p99_ns = errors[(count * 99) / 100];
+    stats->mean_ns = sum / count;
+    stats->stddev_ns = sqrt(fmax(0, sum_sq / count - stats->mean_ns * stats->mean_ns));
+}
+
+bool playback_run(const FCB1010 *fcb, const PlaybackScript *script, MidiPort *port, PlaybackStats *stats) {
+    memset(stats, 0, sizeof(PlaybackStats));
+    if (script->count == 0) return true;
+
+    // One extra slot carries the trailing note off
+    uint8_t *stream = malloc((script->count + 1) * PLAYBACK_MAX_MESSAGE);
+    size_t *offsets = malloc((script->count + 2) * sizeof(size_t));
+    int64_t *errors = malloc(script->count * sizeof(int64_t));
+    if (!stream || !offsets || !errors) {
+        free(stream);
+        free(offsets);
+        free(errors);
+        return false;
+    }
+
+    Emitter e = { .out = stream, .len = 0, .last_status = 0, .running_status = fcb->running_status };
+    int pending_note = -1;
+
+    for (size_t i = 0; i < script->count; i++) {
+        offsets[i] = e.len;
+
+        if (pending_note >= 0) {
+            emit(&e, 0x80 | (fcb->note_midi_channel & 0x0F), pending_note, 0);
+            pending_note = -1;
+        }
+
+        const FCB1010Preset *p = &fcb->preset[script->events[i].preset];
+        emit_preset(&e, fcb, script->events[i].preset);
+        if (p->note_enabled) pending_note = p->note_value;
+    }
+
+    offsets[script->count] = e.len;
+    if (pending_note >= 0) {
+        emit(&e, 0x80 | (fcb->note_midi_channel & 0x0F), pending_note, 0);
+    }
+    offsets[script->count + 1] = e.len;
+
+    bool ok = true;
+    uint64_t start_ns = timing_now_ns() + PLAYBACK_LEAD_NS;
+
+    for (size_t i = 0; i < script->count; i++) {
+        uint64_t deadline_ns = start_ns + script->events[i].time_ns;
+
+        timing_sleep_until(deadline_ns);
+        errors[i] = (int64_t)(timing_now_ns() - deadline_ns);
+
+        size_t len = offsets[i + 1] - offsets[i];
+        if (len > 0 && !midi_port_write(port, stream + offsets[i], len)) {
+            ok = false;
+            break;
+        }
+    }
+
+    if (ok) {
+        size_t len = offsets[script->count + 1] - offsets[script->count];
+        if (len > 0) ok = midi_port_write(port, stream + offsets[script->count], len);
+
+        stats->duration_ns = timing_now_ns() - start_ns;
+        compute_stats(errors, script->count, stats);
+    }
+
+    free(stream);
+    free(offsets);
+    free(errors);
+    return ok;
+}
+
+static void print_usage() {
+    fprintf(stderr, "Usage: fcbtool --play <script> <port> [--dump <file.syx>] [--rt]\n");
+    fprintf(stderr, "  port is an ALSA device (hw:1,0) or a path to write to ('-' for stdout)\n");
+}
+
+int playback_main(int argc, char *argv[]) {
+    const char *script_filename = NULL;
+    const char *port_name = NULL;
+    const char *dump_filename = NULL;
+    bool realtime = false;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--rt") == 0) {
+            realtime = true;
+        } else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dump_filename = argv[++i];
+        } else if (!script_filename) {
+            script_filename = argv[i];
+        } else if (!port_name) {
+            port_name = argv[i];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (!script_filename || !port_name) {
+        print_usage();
+        return 1;
+    }
+
+    char default_dump[512];
+    if (!dump_filename) {
+        snprintf(default_dump, sizeof(default_dump), "%s/.fcb1010/dump.syx", getenv("HOME"));
+        dump_filename = default_dump;
+    }
+
+    FCB1010 fcb;
+    if (!load_sysex_file(dump_filename, &fcb)) {
+        fprintf(stderr, "Failed to load SysEx file: %s\n", dump_filename);
+        return 1;
+    }
+
+    char error[256];
+    PlaybackScript script;
+    if (!playback_load_script(script_filename, &script, error, sizeof(error))) {
+        fprintf(stderr, "%s: %s\n", script_filename, error);
+        return 1;
+    }
+
+    MidiPort *port = midi_port_open_output(port_name, error, sizeof(error));
+    if (!port) {
+        fprintf(stderr, "%s\n", error);
+        playback_free_script(&script);
+        return 1;
+    }
+
+    if (realtime && !timing_enable_realtime(PLAYBACK_RT_PRIORITY)) {
+        fprintf(stderr, "Warning: could not enable SCHED_FIFO/mlockall, running with normal priority\n");
+    }
+
+    PlaybackStats stats;
+    bool ok = playback_run(&fcb, &script, port, &stats);
+    midi_port_close(port);
+    playback_free_script(&script);
+
+    if (!ok) {
+        fprintf(stderr, "Error writing to %s\n", port_name);
+        return 1;
+    }
+
+    // Keep the report off stdout when the MIDI stream itself goes there
+    FILE *report = strcmp(port_name, "-") == 0 ? stderr : stdout;
+    fprintf(report, "Played %zu events in %.3f s\n", stats.events, stats.duration_ns / 1e9);
+    if (stats.events > 0) {
+        fprintf(report, "Timing error (us): min %.1f  mean %.1f  p50 %.1f  p99 %.1f  max %.1f  stddev %.1f\n",
+                stats.min_ns / 1e3, stats.mean_ns / 1e3, stats.p50_ns / 1e3,
+                stats.p99_ns / 1e3, stats.max_ns / 1e3, stats.stddev_ns / 1e3);
+        fprintf(report, "Events later than 1 ms: %zu\n", stats.late_events);
+    }
+
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "fcb.h"
+#include "midi.h"
+
+// Worst case for one activation: a pending note off, five program
+// changes, two control changes and a note on
+#define PLAYBACK_MAX_MESSAGE 32
+
+typedef struct {
+    uint64_t time_ns;  // Offset from the start of the run
+    uint8_t preset;    // 0-99, bank * 10 + preset
+} PlaybackEvent;
+
+typedef struct {
+    PlaybackEvent *events;
+    size_t count;
+    size_t capacity;
+} PlaybackScript;
+
+typedef struct {
+    size_t events;
+    size_t late_events;  // Woke more than 1 ms after the deadline
+    uint64_t duration_ns;
+    int64_t min_ns;
+    int64_t max_ns;
+    int64_t p50_ns;
+    int64_t p99_ns;
+    double mean_ns;
+    double stddev_ns;
+} PlaybackStats;
+
+bool playback_load_script(const char *filename, PlaybackScript *script, char *error, size_t error_size);
+
+void playback_free_script(PlaybackScript *script);
+
+size_t playback_resolve_preset(const FCB1010 *fcb, int preset, uint8_t *out);
+
+bool playback_run(const FCB1010 *fcb, const PlaybackScript *script, MidiPort *port, PlaybackStats *stats);
+
+int playback_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,547 @@
+/*  Conversion server
+*   fcbtool --serve <socket> answers framed requests (see server.h) on a
+*   Unix domain socket with the libfcb codec, so callers skip a process
+*   spawn per conversion. One epoll thread does all socket I/O; complete
+*   requests go to a fixed pool of worker threads and come back through
+*   an eventfd. Each connection has one request in flight at a time, so
+*   pipelined requests are answered in order. Connection slots keep their
+*   buffers when a client leaves, so steady state does no allocation.
+*/
+
+#define _GNU_SOURCE  // accept4()
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "fcb.h"
+#include "server.h"
+#include "stats.h"
+#include "timing.h"
+
+#define FRAME_HEADER 4
+
+// epoll data for the fds that are not connections
+#define EVENT_LISTEN SERVER_MAX_CONNECTIONS
+#define EVENT_WAKE (SERVER_MAX_CONNECTIONS + 1)
+#define EVENT_SIGNAL (SERVER_MAX_CONNECTIONS + 2)
+
+typedef enum {
+    CONN_FREE,
+    CONN_READING,
+    CONN_QUEUED,   // Owned by the worker pool, not watched by epoll
+    CONN_WRITING
+} ConnState;
+
+typedef struct Connection {
+    int fd;
+    int slot;
+    ConnState state;
+    bool close_after_write;
+    size_t in_len;
+    size_t out_len;
+    size_t out_sent;
+    uint64_t received_ns;
+    struct Connection *next;  // Job or done queue link
+    uint8_t in[FRAME_HEADER + 1 + SERVER_MAX_REQUEST];
+    uint8_t out[FRAME_HEADER + 1 + SERVER_MAX_RESPONSE];
+} Connection;
+
+typedef struct {
+    Connection *head;
+    Connection *tail;
+} ConnQueue;
+
+typedef struct {
+    int epoll_fd;
+    int listen_fd;
+    int wake_fd;
+    int signal_fd;
+    uint64_t start_ns;
+    int open_connections;
+    Connection *slots[SERVER_MAX_CONNECTIONS];
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    ConnQueue jobs;
+    ConnQueue done;
+    bool stopping;
+    int worker_count;
+    pthread_t workers[SERVER_MAX_WORKERS];
+} Server;
+
+// Only the STATS op reads this, to report uptime and load
+static Server *server;
+
+static uint32_t get_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void put_be32(uint8_t *p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static void queue_push(ConnQueue *queue, Connection *conn) {
+    conn->next = NULL;
+    if (queue->tail) {
+        queue->tail->next = conn;
+    } else {
+        queue->head = conn;
+    }
+    queue->tail = conn;
+}
+
+static Connection *queue_pop(ConnQueue *queue) {
+    Connection *conn = queue->head;
+    if (conn) {
+        queue->head = conn->next;
+        if (!queue->head) queue->tail = NULL;
+    }
+    return conn;
+}
+
+// "bank-preset field old new" per changed preset field, "global field
+// old new" per changed global. Fits SERVER_MAX_RESPONSE even when every
+// field differs.
+static size_t diff_dumps(const FCB1010 *a, const FCB1010 *b, char *out, size_t size) {
+    size_t len = 0;
+
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+            uint8_t old_value = fcb_get_preset_field(&a->preset[p], f);
+            uint8_t new_value = fcb_get_preset_field(&b->preset[p], f);
+            if (old_value == new_value) continue;
+
+            len += snprintf(out + len, size - len, "%d-%d %s %u %u\n", p / 10 + 1, p % 10 + 1,
+                            fcb_preset_fields[f].name, old_value, new_value);
+        }
+    }
+
+    for (int f = 0; f < NUM_GLOBAL_FIELDS; f++) {
+        uint8_t old_value = fcb_get_global_field(a, f);
+        uint8_t new_value = fcb_get_global_field(b, f);
+        if (old_value == new_value) continue;
+
+        len += snprintf(out + len, size - len, "global %s %u %u\n", fcb_global_fields[f].name, old_value, new_value);
+    }
+
+    return len;
+}
+
+static size_t format_stats(char *out, size_t size) {
+    int open_connections = __atomic_load_n(&server->open_connections, __ATOMIC_RELAXED);
+    int len = snprintf(out, size, "{\"uptime_ns\": %llu, \"workers\": %d, \"connections\": %d, \"stats\": ",
+                       (unsigned long long)(timing_now_ns() - server->start_ns), server->worker_count,
+                       open_connections);
+
+    FILE *file = fmemopen(out + len, size - len - 2, "w");
+    if (!file) return 0;
+    stats_write_json(file);
+    len += ftell(file);
+    fclose(file);
+
+    out[len++] = '}';
+    out[len++] = '\n';
+    return len;
+}
+
+// Run one request. out gets the status byte and the response payload,
+// and must hold 1 + SERVER_MAX_RESPONSE bytes. Returns the length.
+size_t server_handle_request(uint8_t op, const uint8_t *payload, size_t size, uint8_t *out) {
+    uint8_t *body = out + 1;
+    size_t len = 0;
+    FCBError error = { .status = FCB_OK };
+    FCB1010 fcb;
+    FCB1010 other;
+
+    switch (op) {
+        case SERVER_OP_SYX2CSV:
+            if (fcb_decode_sysex(payload, size, &fcb, &error) == FCB_OK) {
+                fcb_format_csv(&fcb, (char *)body, SERVER_MAX_RESPONSE, &len, &error);
+            }
+            break;
+        case SERVER_OP_CSV2SYX:
+            if (fcb_parse_csv((const char *)payload, size, &fcb, &error) == FCB_OK &&
+                fcb_encode_sysex(&fcb, body, SERVER_MAX_RESPONSE, &error) == FCB_OK) {
+                len = SYSEX_SIZE;
+            }
+            break;
+        case SERVER_OP_VALIDATE:
+            if (size > 0 && payload[0] == 0xF0) {
+                fcb_decode_sysex(payload, size, &fcb, &error);
+            } else if (fcb_parse_csv((const char *)payload, size, &fcb, &error) == FCB_OK) {
+                fcb_encode_sysex(&fcb, body, SERVER_MAX_RESPONSE, &error);
+            }
+            break;
+        case SERVER_OP_DIFF:
+            if (size != 2 * SYSEX_SIZE) {
+                snprintf(error.message, sizeof(error.message), "DIFF takes two %d byte dumps", SYSEX_SIZE);
+                error.status = FCB_ERR_SIZE;
+            } else if (fcb_decode_sysex(payload, SYSEX_SIZE, &fcb, &error) == FCB_OK &&
+                       fcb_decode_sysex(payload + SYSEX_SIZE, SYSEX_SIZE, &other, &error) == FCB_OK) {
+                len = diff_dumps(&fcb, &other, (char *)body, SERVER_MAX_RESPONSE);
+            }
+            break;
+        case SERVER_OP_STATS:
+            len = format_stats((char *)body, SERVER_MAX_RESPONSE);
+            break;
+        default:
+            out[0] = SERVER_STATUS_BAD_REQUEST;
+            return 1 + snprintf((char *)body, SERVER_MAX_RESPONSE, "Unknown op %u", op);
+    }
+
+    out[0] = error.status;
+    if (error.status == FCB_OK) return 1 + len;
+
+    put_be32(body, error.line);
+    put_be32(body + 4, error.column);
+    put_be32(body + 8, error.offset);
+    len = strlen(error.message);
+    memcpy(body + 12, error.message, len);
+    return 1 + 12 + len;
+}
+
+static void *worker_main(void *arg) {
+    Server *s = arg;
+
+    pthread_mutex_lock(&s->lock);
+    while (true) {
+        Connection *conn = NULL;
+        while (!s->stopping && !(conn = queue_pop(&s->jobs))) {
+            pthread_cond_wait(&s->work, &s->lock);
+        }
+        if (s->stopping) break;
+        pthread_mutex_unlock(&s->lock);
+
+        uint32_t frame_len = get_be32(conn->in);
+        size_t len = server_handle_request(conn->in[FRAME_HEADER], conn->in + FRAME_HEADER + 1, frame_len - 1,
+                                           conn->out + FRAME_HEADER);
+        put_be32(conn->out, len);
+        conn->out_len = FRAME_HEADER + len;
+        conn->out_sent = 0;
+
+        STATS_END(STATS_SERVE_REQUEST, conn->received_ns);
+        if (conn->out[FRAME_HEADER] != FCB_OK) STATS_ADD(STATS_SERVE_ERRORS, 1);
+
+        pthread_mutex_lock(&s->lock);
+        queue_push(&s->done, conn);
+
+        uint64_t one = 1;
+        if (write(s->wake_fd, &one, sizeof(one)) < 0) {
+            // The counter cannot overflow at these rates; the loop drains it
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static void close_connection(Server *s, Connection *conn) {
+    epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+    conn->state = CONN_FREE;
+    __atomic_fetch_sub(&s->open_connections, 1, __ATOMIC_RELAXED);
+}
+
+static bool watch(Server *s, Connection *conn, uint32_t events, int op) {
+    struct epoll_event event = { .events = events, .data.u64 = conn->slot };
+    return epoll_ctl(s->epoll_fd, op, conn->fd, &event) == 0;
+}
+
+// Queue the first complete frame in the input buffer, if there is one
+static void dispatch(Server *s, Connection *conn) {
+    if (conn->in_len < FRAME_HEADER) return;
+
+    uint32_t frame_len = get_be32(conn->in);
+    if (frame_len == 0 || frame_len > 1 + SERVER_MAX_REQUEST) {
+        // The stream cannot be resynchronized; answer and hang up
+        conn->out[FRAME_HEADER] = SERVER_STATUS_BAD_REQUEST;
+        size_t len = 1 + snprintf((char *)conn->out + FRAME_HEADER + 1, SERVER_MAX_RESPONSE,
+                                  "Frame length %u out of range 1-%d", frame_len, 1 + SERVER_MAX_REQUEST);
+        put_be32(conn->out, len);
+        conn->out_len = FRAME_HEADER + len;
+        conn->out_sent = 0;
+        conn->close_after_write = true;
+        conn->state = CONN_WRITING;
+        watch(s, conn, EPOLLOUT, EPOLL_CTL_MOD);
+        return;
+    }
+
+    if (conn->in_len < FRAME_HEADER + frame_len) return;
+
+    conn->received_ns = timing_now_ns();
+    conn->state = CONN_QUEUED;
+    epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    STATS_ADD(STATS_SERVE_BYTES_IN, FRAME_HEADER + frame_len);
+
+    pthread_mutex_lock(&s->lock);
+    queue_push(&s->jobs, conn);
+    pthread_cond_signal(&s->work);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void handle_readable(Server *s, Connection *conn) {
+    ssize_t n = read(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        close_connection(s, conn);
+        return;
+    }
+    if (n > 0) conn->in_len += n;
+
+    dispatch(s, conn);
+}
+
+static void handle_writable(Server *s, Connection *conn) {
+    while (conn->out_sent < conn->out_len) {
+        ssize_t n = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return;
+        if (n <= 0) {
+            close_connection(s, conn);
+            return;
+        }
+        conn->out_sent += n;
+    }
+
+    STATS_ADD(STATS_SERVE_BYTES_OUT, conn->out_len);
+    if (conn->close_after_write) {
+        close_connection(s, conn);
+        return;
+    }
+
+    conn->state = CONN_READING;
+    watch(s, conn, EPOLLIN, EPOLL_CTL_MOD);
+    dispatch(s, conn);  // A pipelined request may already be buffered
+}
+
+// Pick up answered requests: drop the consumed frame, then send
+static void handle_done(Server *s) {
+    uint64_t count;
+    if (read(s->wake_fd, &count, sizeof(count)) < 0) return;
+
+    pthread_mutex_lock(&s->lock);
+    Connection *conn = s->done.head;
+    s->done.head = s->done.tail = NULL;
+    pthread_mutex_unlock(&s->lock);
+
+    while (conn) {
+        Connection *next = conn->next;
+        size_t consumed = FRAME_HEADER + get_be32(conn->in);
+
+        memmove(conn->in, conn->in + consumed, conn->in_len - consumed);
+        conn->in_len -= consumed;
+        conn->state = CONN_WRITING;
+
+        if (!watch(s, conn, EPOLLOUT, EPOLL_CTL_ADD)) {
+            close_connection(s, conn);
+        } else {
+            handle_writable(s, conn);
+        }
+        conn = next;
+    }
+}
+
+static void handle_accept(Server *s) {
+    int fd;
+    while ((fd = accept4(s->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        int slot = 0;
+        while (slot < SERVER_MAX_CONNECTIONS && s->slots[slot] && s->slots[slot]->state != CONN_FREE) slot++;
+
+        if (slot == SERVER_MAX_CONNECTIONS) {
+            close(fd);
+            continue;
+        }
+
+        if (!s->slots[slot]) {
+            s->slots[slot] = malloc(sizeof(Connection));
+            if (!s->slots[slot]) {
+                close(fd);
+                continue;
+            }
+        }
+
+        Connection *conn = s->slots[slot];
+        conn->fd = fd;
+        conn->slot = slot;
+        conn->state = CONN_READING;
+        conn->close_after_write = false;
+        conn->in_len = 0;
+
+        if (!watch(s, conn, EPOLLIN, EPOLL_CTL_ADD)) {
+            close(fd);
+            conn->state = CONN_FREE;
+            continue;
+        }
+        __atomic_fetch_add(&s->open_connections, 1, __ATOMIC_RELAXED);
+        STATS_ADD(STATS_SERVE_CONNECTIONS, 1);
+    }
+}
+
+// Bind path, replacing a socket file left behind by a server that died
+static int listen_on(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 && errno == EADDRINUSE) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool in_use = probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (probe >= 0) close(probe);
+
+        if (in_use) {
+            fprintf(stderr, "Another server is listening on %s\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void run(Server *s) {
+    struct epoll_event events[64];
+
+    while (true) {
+        int ready = epoll_wait(s->epoll_fd, events, 64, -1);
+        if (ready < 0 && errno != EINTR) return;
+
+        for (int i = 0; i < ready; i++) {
+            uint64_t id = events[i].data.u64;
+
+            if (id == EVENT_SIGNAL) return;
+            if (id == EVENT_LISTEN) {
+                handle_accept(s);
+            } else if (id == EVENT_WAKE) {
+                handle_done(s);
+            } else {
+                Connection *conn = s->slots[id];
+                if (conn->state == CONN_READING) {
+                    handle_readable(s, conn);
+                } else if (conn->state == CONN_WRITING) {
+                    handle_writable(s, conn);
+                }
+            }
+        }
+    }
+}
+
+static bool add_fd(Server *s, int fd, uint64_t id) {
+    struct epoll_event event = { .events = EPOLLIN, .data.u64 = id };
+    return epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+static void print_usage() {
+    fprintf(stderr, "Usage: fcbtool --serve <socket> [--workers <count>]\n");
+}
+
+int server_main(int argc, char *argv[]) {
+    const char *path = NULL;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = strtol(argv[++i], NULL, 10);
+        } else if (!path) {
+            path = argv[i];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (!path) {
+        print_usage();
+        return 1;
+    }
+    if (workers < 1) workers = 1;
+    if (workers > SERVER_MAX_WORKERS) workers = SERVER_MAX_WORKERS;
+
+    static Server s;
+    server = &s;
+    s.start_ns = timing_now_ns();
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.work, NULL);
+    stats_enable();
+
+    // SIGINT/SIGTERM arrive through the epoll loop for a clean shutdown
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    s.listen_fd = listen_on(path);
+    if (s.listen_fd < 0) {
+        fprintf(stderr, "Failed to listen on %s\n", path);
+        return 1;
+    }
+
+    s.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    s.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    s.signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (s.epoll_fd < 0 || s.wake_fd < 0 || s.signal_fd < 0 ||
+        !add_fd(&s, s.listen_fd, EVENT_LISTEN) || !add_fd(&s, s.wake_fd, EVENT_WAKE) ||
+        !add_fd(&s, s.signal_fd, EVENT_SIGNAL)) {
+        fprintf(stderr, "Failed to set up the event loop\n");
+        unlink(path);
+        return 1;
+    }
+
+    // Workers inherit the blocked signal mask
+    for (s.worker_count = 0; s.worker_count < workers; s.worker_count++) {
+        if (pthread_create(&s.workers[s.worker_count], NULL, worker_main, &s) != 0) break;
+    }
+    if (s.worker_count == 0) {
+        fprintf(stderr, "Failed to start worker threads\n");
+        unlink(path);
+        return 1;
+    }
+
+    fprintf(stderr, "Listening on %s with %d worker%s\n", path, s.worker_count, s.worker_count == 1 ? "" : "s");
+    run(&s);
+
+    pthread_mutex_lock(&s.lock);
+    s.stopping = true;
+    pthread_cond_broadcast(&s.work);
+    pthread_mutex_unlock(&s.lock);
+    for (int i = 0; i < s.worker_count; i++) pthread_join(s.workers[i], NULL);
+
+    for (int i = 0; i < SERVER_MAX_CONNECTIONS; i++) {
+        if (s.slots[i] && s.slots[i]->state != CONN_FREE) close(s.slots[i]->fd);
+        free(s.slots[i]);
+    }
+    close(s.listen_fd);
+    close(s.signal_fd);
+    close(s.wake_fd);
+    close(s.epoll_fd);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Frames in both directions: a 4 byte big endian length of what follows,
+// then one byte (the op in a request, the FCBStatus in a response) and
+// the payload. An error response carries line, column and byte offset
+// (4 bytes big endian each) followed by the message text.
+#define SERVER_MAX_REQUEST (64 * 1024)
+#define SERVER_MAX_RESPONSE (128 * 1024)
+#define SERVER_MAX_CONNECTIONS 256
+#define SERVER_MAX_WORKERS 64
+
+typedef enum {
+    SERVER_OP_SYX2CSV = 1,  // Dump -> CSV text
+    SERVER_OP_CSV2SYX,      // CSV text -> dump
+    SERVER_OP_VALIDATE,     // Dump or CSV -> empty payload
+    SERVER_OP_DIFF,         // Two dumps back to back -> one line per difference
+    SERVER_OP_STATS         // -> JSON counters
+} ServerOp;
+
+// Response status for frames the server cannot make sense of
+#define SERVER_STATUS_BAD_REQUEST 255
+
+size_t server_handle_request(uint8_t op, const uint8_t *payload, size_t size, uint8_t *out);
+
+int server_main(int argc, char *argv[]);
+
+#endif
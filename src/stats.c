@@ -0,0 +1,176 @@
+/*  Stage timing and counters
+*   Each stage keeps a count, a total and a log-linear histogram of span
+*   lengths: 8 buckets per power of two, so percentiles come out within
+*   12.5% without storing samples. Updates are relaxed atomics and safe
+*   from any thread. --stats writes everything as JSON at exit.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+
+#ifdef FCB_STATS
+
+#define STATS_SUB_BITS 3
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[STATS_BUCKETS];
+} StageStats;
+
+static const char *stats_stage_names[STATS_NUM_STAGES] = {
+    "file_read",
+    "file_write",
+    "parse_sysex",
+    "get_raw_sysex",
+    "write_csv",
+    "load_csv",
+    "midi_read",
+    "midi_write",
+    "serve_request",
+};
+
+static const char *stats_counter_names[STATS_NUM_COUNTERS] = {
+    "file_bytes_read",
+    "file_bytes_written",
+    "midi_bytes_in",
+    "midi_bytes_out",
+    "midi_would_block",
+    "serve_connections",
+    "serve_bytes_in",
+    "serve_bytes_out",
+    "serve_errors",
+};
+
+bool stats_enabled;
+
+static StageStats stages[STATS_NUM_STAGES];
+static uint64_t counters[STATS_NUM_COUNTERS];
+static char output_filename[512];
+
+// Values below 8 get a bucket each; above that, the top 3 bits after the
+// leading one pick one of 8 buckets within the power of two
+static int bucket_index(uint64_t ns) {
+    if (ns < STATS_SUB_BUCKETS) return (int)ns;
+
+    int msb = 63 - __builtin_clzll(ns);
+    int sub = (ns >> (msb - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1);
+    return (msb - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS + sub;
+}
+
+// Midpoint of the range of values that land in bucket
+static uint64_t bucket_value(int bucket) {
+    if (bucket < STATS_SUB_BUCKETS) return bucket;
+
+    int msb = bucket / STATS_SUB_BUCKETS + STATS_SUB_BITS - 1;
+    int sub = bucket % STATS_SUB_BUCKETS;
+    uint64_t width = 1ULL << (msb - STATS_SUB_BITS);
+    return (1ULL << msb) + sub * width + width / 2;
+}
+
+void stats_record(StatsStage stage, uint64_t ns) {
+    StageStats *s = &stages[stage];
+
+    __atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->buckets[bucket_index(ns)], 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&s->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&s->max_ns, &max, ns, true,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void stats_add(StatsCounter counter, uint64_t count) {
+    __atomic_fetch_add(&counters[counter], count, __ATOMIC_RELAXED);
+}
+
+static uint64_t percentile(const StageStats *s, uint64_t count, int pct) {
+    uint64_t rank = (count * pct + 99) / 100;
+    uint64_t seen = 0;
+
+    if (rank == 0) rank = 1;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += __atomic_load_n(&s->buckets[i], __ATOMIC_RELAXED);
+        if (seen >= rank) {
+            uint64_t value = bucket_value(i);
+            uint64_t max = __atomic_load_n(&s->max_ns, __ATOMIC_RELAXED);
+            return value < max ? value : max;
+        }
+    }
+    return 0;
+}
+
+void stats_write_json(FILE *out) {
+    fprintf(out, "{\n  \"stages\": {");
+    for (int i = 0; i < STATS_NUM_STAGES; i++) {
+        const StageStats *s = &stages[i];
+        uint64_t count = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+
+        fprintf(out, "%s\n    \"%s\": {\"count\": %llu, \"total_ns\": %llu, \"p50_ns\": %llu, "
+                "\"p99_ns\": %llu, \"max_ns\": %llu}",
+                i ? "," : "", stats_stage_names[i], (unsigned long long)count,
+                (unsigned long long)__atomic_load_n(&s->total_ns, __ATOMIC_RELAXED),
+                (unsigned long long)(count ? percentile(s, count, 50) : 0),
+                (unsigned long long)(count ? percentile(s, count, 99) : 0),
+                (unsigned long long)__atomic_load_n(&s->max_ns, __ATOMIC_RELAXED));
+    }
+
+    fprintf(out, "\n  },\n  \"counters\": {");
+    for (int i = 0; i < STATS_NUM_COUNTERS; i++) {
+        fprintf(out, "%s\n    \"%s\": %llu", i ? "," : "", stats_counter_names[i],
+                (unsigned long long)__atomic_load_n(&counters[i], __ATOMIC_RELAXED));
+    }
+    fprintf(out, "\n  }\n}\n");
+}
+
+static void write_at_exit() {
+    if (output_filename[0] == '\0') {
+        stats_write_json(stderr);
+        return;
+    }
+
+    FILE *out = fopen(output_filename, "w");
+    if (!out) {
+        fprintf(stderr, "Failed to write stats to %s\n", output_filename);
+        return;
+    }
+    stats_write_json(out);
+    fclose(out);
+}
+
+// Start collecting; the JSON goes to filename (stderr when NULL) at exit
+bool stats_start(const char *filename) {
+    snprintf(output_filename, sizeof(output_filename), "%s", filename ? filename : "");
+    if (!stats_enabled && atexit(write_at_exit) != 0) return false;
+
+    stats_enabled = true;
+    return true;
+}
+
+// Collect without writing anything at exit, for modes that report the
+// numbers themselves
+void stats_enable() {
+    stats_enabled = true;
+}
+
+#else
+
+bool stats_start(const char *filename) {
+    (void)filename;
+    fprintf(stderr, "Warning: built without FCB_STATS, --stats has no effect\n");
+    return false;
+}
+
+void stats_enable() {
+}
+
+void stats_write_json(FILE *out) {
+    fprintf(out, "{}\n");
+}
+
+#endif
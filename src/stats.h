@@ -0,0 +1,64 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Stages timed with STATS_BEGIN/STATS_END. Keep stats_stage_names in sync.
+typedef enum {
+    STATS_FILE_READ,
+    STATS_FILE_WRITE,
+    STATS_PARSE_SYSEX,
+    STATS_GET_RAW_SYSEX,
+    STATS_WRITE_CSV,
+    STATS_LOAD_CSV,
+    STATS_MIDI_READ,
+    STATS_MIDI_WRITE,
+    STATS_SERVE_REQUEST,
+    STATS_NUM_STAGES
+} StatsStage;
+
+typedef enum {
+    STATS_FILE_BYTES_READ,
+    STATS_FILE_BYTES_WRITTEN,
+    STATS_MIDI_BYTES_IN,
+    STATS_MIDI_BYTES_OUT,
+    STATS_MIDI_WOULD_BLOCK,
+    STATS_SERVE_CONNECTIONS,
+    STATS_SERVE_BYTES_IN,
+    STATS_SERVE_BYTES_OUT,
+    STATS_SERVE_ERRORS,
+    STATS_NUM_COUNTERS
+} StatsCounter;
+
+// With FCB_STATS undefined the macros compile to nothing. With it
+// defined, a span costs one flag test until --stats switches it on.
+#ifdef FCB_STATS
+
+#include "timing.h"
+
+extern bool stats_enabled;
+
+void stats_record(StatsStage stage, uint64_t ns);
+void stats_add(StatsCounter counter, uint64_t count);
+
+#define STATS_BEGIN(var) uint64_t var = stats_enabled ? timing_now_ns() : 0
+#define STATS_END(stage, var) \
+    do { if (stats_enabled) stats_record(stage, timing_now_ns() - (var)); } while (0)
+#define STATS_ADD(counter, count) \
+    do { if (stats_enabled) stats_add(counter, count); } while (0)
+
+#else
+
+#define STATS_BEGIN(var) do {} while (0)
+#define STATS_END(stage, var) do {} while (0)
+#define STATS_ADD(counter, count) do {} while (0)
+
+#endif
+
+bool stats_start(const char *filename);
+void stats_enable();
+void stats_write_json(FILE *out);
+
+#endif
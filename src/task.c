@@ -0,0 +1,35 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "task.h"
+
+void task_init(Task *task, const char *name, size_t total) {
+    memset(task, 0, sizeof(Task));
+    snprintf(task->name, sizeof(task->name), "%s", name);
+    task->state = TASK_RUNNING;
+    task->total = total;
+}
+
+void task_finish(Task *task, TaskState state, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(task->status, sizeof(task->status), format, args);
+    va_end(args);
+
+    task->state = state;
+}
+
+void task_cancel(Task *task) {
+    if (task->state != TASK_RUNNING) return;
+
+    if (task->cancel) task->cancel(task);
+    if (task->state == TASK_RUNNING) {
+        task_finish(task, TASK_CANCELLED, "%s cancelled", task->name);
+    }
+}
+
+void task_destroy(Task *task) {
+    if (!task) return;
+    task_cancel(task);
+    if (task->destroy) task->destroy(task);
+}
@@ -0,0 +1,34 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    TASK_RUNNING,
+    TASK_DONE,
+    TASK_FAILED,
+    TASK_CANCELLED
+} TaskState;
+
+// A long running operation driven by event loop callbacks. The owner
+// polls state/done/total for progress; cancel() stops it at once and
+// destroy() releases it once it has left TASK_RUNNING.
+typedef struct Task Task;
+struct Task {
+    char name[64];
+    TaskState state;
+    size_t done;
+    size_t total;
+    char status[256];
+    void (*cancel)(Task *task);
+    void (*destroy)(Task *task);
+};
+
+void task_init(Task *task, const char *name, size_t total);
+void task_finish(Task *task, TaskState state, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+void task_cancel(Task *task);
+void task_destroy(Task *task);
+
+#endif
@@ -0,0 +1,53 @@
+/*  Monotonic clock helpers shared by the real-time senders.
+*   Deadlines are absolute CLOCK_MONOTONIC nanoseconds so a late event
+*   never pushes the rest of a sequence back.
+*/
+
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "timing.h"
+
+uint64_t timing_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+// Sleep until an absolute monotonic deadline, resuming after signals
+void timing_sleep_until(uint64_t deadline_ns) {
+    struct timespec ts;
+    ts.tv_sec = deadline_ns / NSEC_PER_SEC;
+    ts.tv_nsec = deadline_ns % NSEC_PER_SEC;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+// Switch the calling process to SCHED_FIFO and lock its memory so page
+// faults cannot land between a deadline and the write that follows it.
+// Needs CAP_SYS_NICE / an rtprio limit; returns false if refused, with
+// the previous scheduling policy back in place.
+bool timing_enable_realtime(int priority) {
+    struct sched_param param = { .sched_priority = priority };
+    struct sched_param old_param;
+    int old_policy = sched_getscheduler(0);
+
+    if (old_policy < 0 || sched_getparam(0, &old_param) != 0) {
+        return false;
+    }
+
+    if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+        return false;
+    }
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        sched_setscheduler(0, old_policy, &old_param);
+        return false;
+    }
+
+    return true;
+}
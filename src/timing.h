@@ -0,0 +1,16 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_SEC 1000000000ULL
+
+uint64_t timing_now_ns();
+
+void timing_sleep_until(uint64_t deadline_ns);
+
+bool timing_enable_realtime(int priority);
+
+#endif
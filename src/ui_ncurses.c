@@ -1,10 +1,130 @@
+#include <stdarg.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <ncurses.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "event_loop.h"
 #include "fcb.h"
+#include "fcb_io.h"
+#include "history.h"
 #include "midi.h"
+#include "task.h"
+#include "timing.h"
 #include "ui_ncurses.h"
 
+#define UI_FRAME_NS (NSEC_PER_SEC / 60)
+#define UI_PROGRESS_WIDTH 30
+
+#define GRID_BANKS 10
+#define GRID_PRESETS 10
+#define GRID_MIN_BANKS 3
+#define GRID_LABEL_WIDTH 8
+#define GRID_CELL_WIDTH 6
+#define GRID_MIN_CELL_WIDTH 4
+#define GRID_DETAIL_LINES 15
+#define GRID_LINE_WIDTH 96
+#define EDIT_ROWS 14
+#define EDIT_COLUMN_WIDTH 30
+#define HISTORY_CTRL_R 18
+#define LIBRARY_CACHE_ENTRIES 4096
+#define LIBRARY_NAME_WIDTH 24
+
+typedef struct {
+    UiView view;
+    WINDOW *win;
+} MenuView;
+
+typedef struct {
+    UiView view;
+    char devices[MAX_DEVICES][128];
+    int device_count;
+    int selected_device;
+    UiSelectCallback on_select;
+    void *user_data;
+} DeviceView;
+
+typedef struct {
+    UiView view;
+    WINDOW *win;
+    char prompt[128];
+    UiConfirmCallback on_confirm;
+    void *user_data;
+} ConfirmView;
+
+typedef struct {
+    char text[GRID_CELL_WIDTH + 1];
+    attr_t attr;
+} GridCell;
+
+// Bank x preset browser. cells/labels/detail mirror what is on screen
+// right now, so a redraw only touches the cells and lines that differ.
+typedef struct {
+    UiView view;
+    FCB1010 fcb;
+    uint8_t sysex[SYSEX_SIZE];  // Live dump, edited in place
+    char filename[512];         // Empty when browsing read-only
+    FCBDirtyRange dirty;
+    History *history;           // NULL when read-only
+    bool confirm_quit;
+    int shown_modified;
+    int cursor;         // Preset index 0-99
+    int scroll;         // First visible bank
+    int top;
+    int left;
+    int visible_banks;
+    int cell_width;
+    int detail_width;
+    GridCell cells[GRID_BANKS][GRID_PRESETS];  // By screen row, not bank
+    int labels[GRID_BANKS];
+    char detail[GRID_DETAIL_LINES][GRID_LINE_WIDTH];
+} GridView;
+
+typedef struct {
+    UiView view;
+    WINDOW *win;
+    GridView *grid;
+    int field;
+    char entry[4];  // Digits typed so far
+} EditView;
+
+typedef struct {
+    UiView view;
+    GridView *grid;
+    int selected;
+    int scroll;
+} HistoryView;
+
+// A directory of dumps, one per row, showing one bank of each. Only the
+// rows on screen are decoded, through the library's cache.
+typedef struct {
+    UiView view;
+    FCBLibrary *library;
+    char title[256];
+    size_t cursor;  // Selected dump
+    size_t scroll;  // First dump on screen
+    int visible;    // Dump rows on screen
+    int preset;     // Selected preset 0-99; the rows show its bank
+} LibraryView;
+
+static EventLoop *ui_loop;
+static UiMenuCallback menu_callback;
+static UiView *views[UI_MAX_VIEWS];
+static int view_count;
+static MenuView menu_view;
+static WINDOW *status_win;
+static int frame_timer;
+static bool needs_redraw;
+static bool needs_clear;
+static char message[256];
+static Task *active_task;
+static size_t shown_progress;
+static char file_info[2][128];
+
 void initialize_ui() {
     initscr();
     start_color();
@@ -13,6 +133,7 @@ void initialize_ui() {
     curs_set(0);
     noecho();
     keypad(stdscr, TRUE);
+    nodelay(stdscr, TRUE);  // Keys are read when poll() says stdin is ready
 
     // Define color pairs
     init_pair(1, COLOR_WHITE, COLOR_RED);
@@ -24,159 +145,1188 @@ void initialize_ui() {
     bkgd(COLOR_PAIR(5) | A_BOLD);
 }
 
-int display_main_menu() {
+// Create win, or move an existing one, so it is centered on the screen
+static WINDOW *center_window(WINDOW *win, int height, int width) {
     int rows, cols;
-    clear();
     getmaxyx(stdscr, rows, cols);  // Get the screen size
 
+    int y = rows > height ? (rows - height) / 2 : 0;
+    int x = cols > width ? (cols - width) / 2 : 0;
+
+    if (!win) return newwin(height, width, y, x);
+
+    int cur_y, cur_x;
+    getbegyx(win, cur_y, cur_x);
+    if (cur_y != y || cur_x != x) mvwin(win, y, x);
+    return win;
+}
+
+static void remove_view(UiView *view) {
+    for (int i = 0; i < view_count; i++) {
+        if (views[i] == view) {
+            memmove(&views[i], &views[i + 1], (view_count - i - 1) * sizeof(UiView *));
+            view_count--;
+            if (view->destroy) view->destroy(view);
+            needs_clear = true;
+            needs_redraw = true;
+            return;
+        }
+    }
+}
+
+void ui_push_view(UiView *view) {
+    if (view_count == UI_MAX_VIEWS) {
+        if (view->destroy) view->destroy(view);
+        return;
+    }
+
+    views[view_count++] = view;
+    needs_clear = true;
+    needs_redraw = true;
+}
+
+void ui_request_redraw() {
+    needs_redraw = true;
+}
+
+void ui_message(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    needs_redraw = true;
+}
+
+bool ui_task_busy() {
+    return active_task != NULL;
+}
+
+// Hand a started task to the UI, which shows its progress, reports its
+// final status and destroys it. Refuses (and destroys) it if busy.
+bool ui_run_task(Task *task) {
+    if (active_task) {
+        task_destroy(task);
+        ui_message("A transfer is already running.");
+        return false;
+    }
+
+    active_task = task;
+    shown_progress = (size_t)-1;
+    needs_redraw = true;
+    return true;
+}
+
+static void draw_status() {
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+
+    if (!status_win) {
+        status_win = newwin(2, cols, rows - 2, 0);
+        wbkgd(status_win, COLOR_PAIR(5) | A_BOLD);
+    } else {
+        wresize(status_win, 2, cols);
+        mvwin(status_win, rows - 2, 0);
+    }
+
+    werase(status_win);
+
+    const char *text = message;
+    if (text[0] == '\0' && view_count == 1) text = "Make a selection.";
+    mvwprintw(status_win, 0, (cols - (int)strlen(text)) / 2 > 0 ? (cols - (int)strlen(text)) / 2 : 0,
+              "%.*s", cols, text);
+
+    if (active_task) {
+        size_t done = active_task->done;
+        size_t total = active_task->total ? active_task->total : 1;
+        int filled = done >= total ? UI_PROGRESS_WIDTH : (int)(done * UI_PROGRESS_WIDTH / total);
+        char bar[UI_PROGRESS_WIDTH + 1];
+
+        memset(bar, '#', filled);
+        memset(bar + filled, '.', UI_PROGRESS_WIDTH - filled);
+        bar[UI_PROGRESS_WIDTH] = '\0';
+
+        mvwprintw(status_win, 1, 1, "%s [%s] %zu/%zu bytes%s", active_task->name, bar,
+                  done, active_task->total, view_count == 1 ? "  c: cancel" : "");
+    }
+
+    touchwin(status_win);
+    wnoutrefresh(status_win);
+}
+
+static void render() {
+    bool full = needs_clear;
+
+    if (needs_clear) {
+        erase();
+        needs_clear = false;
+    }
+
+    UiView *top = views[view_count - 1];
+    top->draw(top, full);
+    draw_status();
+    doupdate();
+
+    needs_redraw = false;
+}
+
+static void read_keys() {
+    int ch;
+
+    while ((ch = getch()) != ERR) {
+        if (ch == KEY_RESIZE) {
+            needs_clear = true;
+            needs_redraw = true;
+            continue;
+        }
+
+        UiView *top = views[view_count - 1];
+        if (!top->handle_key(top, ch)) {
+            remove_view(top);
+        }
+        needs_redraw = true;
+
+        if (view_count == 0) return;
+    }
+}
+
+static void stdin_ready(EventLoop *loop, int fd, short revents, void *user_data) {
+    (void)loop;
+    (void)fd;
+    (void)revents;
+    (void)user_data;
+
+    read_keys();
+}
+
+static void frame_tick(EventLoop *loop, int timer_id, void *user_data) {
+    (void)loop;
+    (void)timer_id;
+    (void)user_data;
+
+    // Also catches KEY_RESIZE, which arrives by signal rather than on stdin
+    read_keys();
+
+    if (active_task) {
+        if (active_task->state != TASK_RUNNING) {
+            ui_message("%s", active_task->status);
+            task_destroy(active_task);
+            active_task = NULL;
+        } else if (active_task->done != shown_progress) {
+            shown_progress = active_task->done;
+            needs_redraw = true;
+        }
+    }
+
+    if (needs_redraw && view_count > 0) render();
+}
+
+static void describe_file(char *out, size_t size, const char *home_dir, const char *name) {
+    char path[512];
+    struct stat st;
+
+    snprintf(path, sizeof(path), "%s/.fcb1010/%s", home_dir, name);
+    if (stat(path, &st) != 0) {
+        snprintf(out, size, "%s: not found", name);
+        return;
+    }
+
+    char timestamp[32];
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", localtime(&st.st_mtime));
+    snprintf(out, size, "%s: %lld bytes, %s", name, (long long)st.st_size, timestamp);
+}
+
+static void refresh_file_info() {
+    const char *home_dir = getenv("HOME");
+    if (!home_dir) return;
+
+    describe_file(file_info[0], sizeof(file_info[0]), home_dir, "dump.syx");
+    describe_file(file_info[1], sizeof(file_info[1]), home_dir, "fcb1010.csv");
+    needs_redraw = true;
+}
+
+static void fcb_dir_changed(EventLoop *loop, const char *name, uint32_t mask, void *user_data) {
+    (void)loop;
+    (void)mask;
+    (void)user_data;
+
+    if (strcmp(name, "dump.syx") == 0 || strcmp(name, "fcb1010.csv") == 0) {
+        refresh_file_info();
+    }
+}
+
+void display_main_menu() {
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);  // Get the screen size
+    (void)rows;
+
     const int WIN_WIDTH = 35;
-    const int WIN_HEIGHT = 11;
+    const int WIN_HEIGHT = 12;
 
     // Create a new window for the settings box
-    WINDOW *menu_win = newwin(WIN_HEIGHT, WIN_WIDTH, (rows - WIN_HEIGHT) / 2, (cols - WIN_WIDTH) / 2);
-    wbkgd(menu_win, COLOR_PAIR(3));  
-    box(menu_win, 0, 0);  // Draw a box around the window
+    menu_view.win = center_window(menu_view.win, WIN_HEIGHT, WIN_WIDTH);
+    wbkgd(menu_view.win, COLOR_PAIR(3));
+    werase(menu_view.win);
+    box(menu_view.win, 0, 0);  // Draw a box around the window
 
-    // Display the title and instructions in the main window
+    // Display the title and file state in the main window
     mvprintw(1, (cols - strlen("FCB1010 Edit Tool:")) / 2, "FCB1010 Edit Tool:");
-    mvprintw(rows - 2, (cols - strlen("Make a selection.")) / 2, "Make a selection.");
+    move(2, 0);
+    clrtoeol();
+    mvprintw(2, 2, "%s", file_info[0]);
+    move(3, 0);
+    clrtoeol();
+    mvprintw(3, 2, "%s", file_info[1]);
 
     // Display menu options inside the settings window
-    mvwprintw(menu_win, 1, 2, "Select an option:");
-    mvwprintw(menu_win, 3, 2, "1: Receive Midi SysEx & Save");
-    mvwprintw(menu_win, 4, 2, "2: Send SysEx file over Midi");
-    mvwprintw(menu_win, 5, 2, "3: Parse and Inspect dump.syx");
-    mvwprintw(menu_win, 6, 2, "4: Create CSV from dump.syx");
-    mvwprintw(menu_win, 7, 2, "5: Create Sysex from CSV");
-    mvwprintw(menu_win, 8, 2, "6: Backup SysEx Dump");
-    mvwprintw(menu_win, 9, 2, "q: Quit");
-
-    // Refresh the settings window and the main screen
-    refresh();  
-    wrefresh(menu_win);  
-
-    // Delete the settings window
-//    delwin(menu_win);  
-    return getch();
-}
-
-int select_midi_device(char devices[MAX_DEVICES][128], int device_count) {
-    int selected_device = 0;
-
-    while (1) {
-        clear();
-        printw("Select a MIDI device:\n");
-        for (int i = 0; i < device_count; i++) {
-            if (i == selected_device) {
-                attron(A_REVERSE);
+    mvwprintw(menu_view.win, 1, 2, "Select an option:");
+    mvwprintw(menu_view.win, 3, 2, "1: Receive Midi SysEx & Save");
+    mvwprintw(menu_view.win, 4, 2, "2: Send SysEx file over Midi");
+    mvwprintw(menu_view.win, 5, 2, "3: Parse and Inspect dump.syx");
+    mvwprintw(menu_view.win, 6, 2, "4: Create CSV from dump.syx");
+    mvwprintw(menu_view.win, 7, 2, "5: Create Sysex from CSV");
+    mvwprintw(menu_view.win, 8, 2, "6: Backup SysEx Dump");
+    mvwprintw(menu_view.win, 9, 2, "7: Browse Backups");
+    mvwprintw(menu_view.win, 10, 2, "q: Quit");
+
+    wnoutrefresh(stdscr);
+    touchwin(menu_view.win);
+    wnoutrefresh(menu_view.win);
+}
+
+static void menu_draw(UiView *view, bool full) {
+    (void)view;
+    (void)full;
+    display_main_menu();
+}
+
+static bool menu_handle_key(UiView *view, int ch) {
+    (void)view;
+
+    if (ch == 'c' && active_task) {
+        task_cancel(active_task);
+        return true;
+    }
+
+    message[0] = '\0';
+    menu_callback(ch);
+    return true;
+}
+
+void ui_start(EventLoop *loop, UiMenuCallback on_choice) {
+    ui_loop = loop;
+    menu_callback = on_choice;
+
+    menu_view.view.draw = menu_draw;
+    menu_view.view.handle_key = menu_handle_key;
+    menu_view.view.destroy = NULL;
+    ui_push_view(&menu_view.view);
+
+    refresh_file_info();
+
+    const char *home_dir = getenv("HOME");
+    if (home_dir) {
+        char dir_path[512];
+        snprintf(dir_path, sizeof(dir_path), "%s/.fcb1010", home_dir);
+        event_loop_add_watch(loop, dir_path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE,
+                             fcb_dir_changed, NULL);
+    }
+
+    event_loop_add_fd(loop, STDIN_FILENO, POLLIN, stdin_ready, NULL);
+    frame_timer = event_loop_add_timer(loop, UI_FRAME_NS, true, frame_tick, NULL);
+}
+
+void ui_shutdown() {
+    if (active_task) {
+        task_destroy(active_task);
+        active_task = NULL;
+    }
+
+    while (view_count > 0) {
+        remove_view(views[view_count - 1]);
+    }
+
+    if (menu_view.win) delwin(menu_view.win);
+    if (status_win) delwin(status_win);
+    menu_view.win = NULL;
+    status_win = NULL;
+
+    if (ui_loop) {
+        event_loop_remove_timer(ui_loop, frame_timer);
+        event_loop_remove_fd(ui_loop, STDIN_FILENO);
+    }
+}
+
+static void confirm_draw(UiView *view, bool full) {
+    ConfirmView *cv = (ConfirmView *)view;
+    (void)full;
+
+    int width = (int)strlen(cv->prompt) + 4;
+    if (width < 40) width = 40;
+
+    cv->win = center_window(cv->win, 5, width);
+    wbkgd(cv->win, COLOR_PAIR(3));
+    werase(cv->win);
+    box(cv->win, 0, 0);
+    mvwprintw(cv->win, 1, 2, "%s", cv->prompt);
+    mvwprintw(cv->win, 3, 2, "Enter: continue  q: cancel");
+
+    wnoutrefresh(stdscr);
+    touchwin(cv->win);
+    wnoutrefresh(cv->win);
+}
+
+static bool confirm_handle_key(UiView *view, int ch) {
+    ConfirmView *cv = (ConfirmView *)view;
+
+    if (ch == '\n') {
+        cv->on_confirm(cv->user_data);
+        return false;
+    }
+
+    return ch != 'q' && ch != 27;
+}
+
+static void confirm_destroy(UiView *view) {
+    ConfirmView *cv = (ConfirmView *)view;
+    if (cv->win) delwin(cv->win);
+    free(cv);
+}
+
+void ui_confirm(const char *prompt, UiConfirmCallback on_confirm, void *user_data) {
+    ConfirmView *cv = calloc(1, sizeof(ConfirmView));
+    if (!cv) return;
+
+    cv->view.draw = confirm_draw;
+    cv->view.handle_key = confirm_handle_key;
+    cv->view.destroy = confirm_destroy;
+    snprintf(cv->prompt, sizeof(cv->prompt), "%s", prompt);
+    cv->on_confirm = on_confirm;
+    cv->user_data = user_data;
+
+    ui_push_view(&cv->view);
+}
+
+static void device_draw(UiView *view, bool full) {
+    DeviceView *dv = (DeviceView *)view;
+    (void)full;
+
+    erase();
+    printw("Select a MIDI device:\n");
+    for (int i = 0; i < dv->device_count; i++) {
+        if (i == dv->selected_device) {
+            attron(A_REVERSE);
+        }
+        printw("%d: %s\n", i, dv->devices[i]);
+        if (i == dv->selected_device) {
+            attroff(A_REVERSE);
+        }
+    }
+
+    wnoutrefresh(stdscr);
+}
+
+static bool device_handle_key(UiView *view, int ch) {
+    DeviceView *dv = (DeviceView *)view;
+
+    switch (ch) {
+        case 'q':
+            return false;  // Close without selecting
+        case KEY_UP:
+            if (dv->selected_device > 0) dv->selected_device--;
+            break;
+        case KEY_DOWN:
+            if (dv->selected_device < dv->device_count - 1) dv->selected_device++;
+            break;
+        case '\n':
+            dv->on_select(dv->devices[dv->selected_device], dv->user_data);
+            return false;
+        default:
+            break;
+    }
+
+    return true;
+}
+
+static void device_destroy(UiView *view) {
+    free(view);
+}
+
+void select_midi_device(char devices[MAX_DEVICES][128], int device_count,
+                        UiSelectCallback on_select, void *user_data) {
+    DeviceView *dv = calloc(1, sizeof(DeviceView));
+    if (!dv) return;
+
+    dv->view.draw = device_draw;
+    dv->view.handle_key = device_handle_key;
+    dv->view.destroy = device_destroy;
+    memcpy(dv->devices, devices, sizeof(dv->devices));
+    dv->device_count = device_count;
+    dv->on_select = on_select;
+    dv->user_data = user_data;
+
+    ui_push_view(&dv->view);
+}
+
+// Short summary of what a preset sends: its first program change,
+// else its first control change, else its note
+static void format_cell(const FCB1010Preset *p, char *out, size_t size) {
+    if (p->pc1_enabled) snprintf(out, size, "P%03d", p->pc1_program);
+    else if (p->pc2_enabled) snprintf(out, size, "P%03d", p->pc2_program);
+    else if (p->pc3_enabled) snprintf(out, size, "P%03d", p->pc3_program);
+    else if (p->pc4_enabled) snprintf(out, size, "P%03d", p->pc4_program);
+    else if (p->pc5_enabled) snprintf(out, size, "P%03d", p->pc5_program);
+    else if (p->cc1_enabled) snprintf(out, size, "C%03d", p->cc1_controller);
+    else if (p->cc2_enabled) snprintf(out, size, "C%03d", p->cc2_controller);
+    else if (p->note_enabled) snprintf(out, size, "N%03d", p->note_value);
+    else snprintf(out, size, " -- ");
+}
+
+static void format_detail(const FCB1010 *fcb, int preset, char lines[GRID_DETAIL_LINES][GRID_LINE_WIDTH]) {
+    const FCB1010Preset *p = &fcb->preset[preset];
+
+    snprintf(lines[0], GRID_LINE_WIDTH, "Bank %d  Preset %d  (#%d)", preset / 10 + 1, preset % 10 + 1, preset + 1);
+    snprintf(lines[1], GRID_LINE_WIDTH, "  PC1: %s %d  PC2: %s %d",
+             p->pc1_enabled ? "On" : "Off", p->pc1_program,
+             p->pc2_enabled ? "On" : "Off", p->pc2_program);
+    snprintf(lines[2], GRID_LINE_WIDTH, "  PC3: %s %d  PC4: %s %d",
+             p->pc3_enabled ? "On" : "Off", p->pc3_program,
+             p->pc4_enabled ? "On" : "Off", p->pc4_program);
+    snprintf(lines[3], GRID_LINE_WIDTH, "  PC5: %s %d",
+             p->pc5_enabled ? "On" : "Off", p->pc5_program);
+    snprintf(lines[4], GRID_LINE_WIDTH, "  CC1: %s %d %d CC2: %s %d %d",
+             p->cc1_enabled ? "On" : "Off", p->cc1_controller, p->cc1_value,
+             p->cc2_enabled ? "On" : "Off", p->cc2_controller, p->cc2_value);
+    snprintf(lines[5], GRID_LINE_WIDTH, "  EXP A: %s %d [%d, %d]",
+             p->expA_enabled ? "On" : "Off", p->expA_controller, p->expA_min, p->expA_max);
+    snprintf(lines[6], GRID_LINE_WIDTH, "  EXP B: %s %d [%d, %d]",
+             p->expB_enabled ? "On" : "Off", p->expB_controller, p->expB_min, p->expB_max);
+    snprintf(lines[7], GRID_LINE_WIDTH, "  NOTE: %s %d",
+             p->note_enabled ? "On" : "Off", p->note_value);
+    snprintf(lines[8], GRID_LINE_WIDTH, "  Switch 1: %s  Switch 2: %s",
+             p->switch1_enabled ? "On" : "Off", p->switch2_enabled ? "On" : "Off");
+
+    snprintf(lines[9], GRID_LINE_WIDTH, "Global Settings:");
+    snprintf(lines[10], GRID_LINE_WIDTH, "  MIDI Channels: PC1: %d  PC2: %d  PC3: %d  PC4: %d  PC5: %d",
+             fcb->pc1_midi_channel, fcb->pc2_midi_channel, fcb->pc3_midi_channel,
+             fcb->pc4_midi_channel, fcb->pc5_midi_channel);
+    snprintf(lines[11], GRID_LINE_WIDTH, "                 CC1: %d  CC2: %d  EXP A: %d  EXP B: %d  NOTE: %d",
+             fcb->cc1_midi_channel, fcb->cc2_midi_channel,
+             fcb->expA_midi_channel, fcb->expB_midi_channel, fcb->note_midi_channel);
+    snprintf(lines[12], GRID_LINE_WIDTH, "  Direct Select: %s  Running Status: %s  Merge: %s  Switch 1: %s  Switch 2: %s",
+             fcb->direct_select ? "Yes" : "No", fcb->running_status ? "Yes" : "No",
+             fcb->merge ? "Yes" : "No", fcb->switch1 ? "Yes" : "No", fcb->switch2 ? "Yes" : "No");
+    snprintf(lines[13], GRID_LINE_WIDTH, "  EXP A Calibration: [%d, %d]  EXP B Calibration: [%d, %d]",
+             fcb->expA_calibration_min, fcb->expA_calibration_max,
+             fcb->expB_calibration_min, fcb->expB_calibration_max);
+    snprintf(lines[14], GRID_LINE_WIDTH, "hjkl: move  0-9: bank  n/p: step  e: edit  u/r: undo/redo  H: history  w: save  q: quit");
+}
+
+// Work out where everything goes for the current terminal size. Returns
+// true if the layout moved, in which case everything must be repainted.
+static bool grid_layout(GridView *gv) {
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+
+    // Title, column header and a gap above the detail pane, status below.
+    // Short terminals scroll the banks and cut the detail pane short.
+    int visible_banks = rows - 2 - 3 - GRID_DETAIL_LINES;
+    if (visible_banks > GRID_BANKS) visible_banks = GRID_BANKS;
+    if (visible_banks < GRID_MIN_BANKS) visible_banks = GRID_MIN_BANKS;
+    if (visible_banks > rows - 5) visible_banks = rows - 5;
+    if (visible_banks < 1) visible_banks = 1;
+
+    int cell_width = (cols - GRID_LABEL_WIDTH) / GRID_PRESETS;
+    if (cell_width > GRID_CELL_WIDTH) cell_width = GRID_CELL_WIDTH;
+    if (cell_width < GRID_MIN_CELL_WIDTH) cell_width = GRID_MIN_CELL_WIDTH;
+
+    int width = GRID_LABEL_WIDTH + cell_width * GRID_PRESETS;
+    int left = cols > width ? (cols - width) / 2 : 0;
+    int detail_width = cols - left;
+    if (detail_width >= GRID_LINE_WIDTH) detail_width = GRID_LINE_WIDTH - 1;
+    if (detail_width < 0) detail_width = 0;
+
+    bool moved = gv->visible_banks != visible_banks || gv->cell_width != cell_width ||
+                 gv->left != left || gv->detail_width != detail_width;
+
+    gv->top = 1;
+    gv->visible_banks = visible_banks;
+    gv->cell_width = cell_width;
+    gv->left = left;
+    gv->detail_width = detail_width;
+
+    // Keep the cursor's bank inside the visible rows
+    int bank = gv->cursor / GRID_PRESETS;
+    if (bank < gv->scroll) gv->scroll = bank;
+    if (bank >= gv->scroll + visible_banks) gv->scroll = bank - visible_banks + 1;
+
+    return moved;
+}
+
+static void grid_draw(UiView *view, bool full) {
+    GridView *gv = (GridView *)view;
+
+    if (grid_layout(gv) && !full) {
+        erase();
+        full = true;
+    }
+
+    if (full) {
+        // Forget what was on screen; every cell and line differs now
+        memset(gv->cells, 0, sizeof(gv->cells));
+        memset(gv->detail, 0, sizeof(gv->detail));
+        for (int row = 0; row < GRID_BANKS; row++) gv->labels[row] = -1;
+
+        gv->shown_modified = -1;
+        for (int col = 0; col < GRID_PRESETS; col++) {
+            mvprintw(gv->top, gv->left + GRID_LABEL_WIDTH + col * gv->cell_width, "%*d",
+                     gv->cell_width - 1, col + 1);
+        }
+    }
+
+    int modified = gv->dirty.start != gv->dirty.end;
+    if (gv->shown_modified != modified) {
+        move(0, gv->left);
+        clrtoeol();
+        printw("FCB1010 Presets%s", modified ? "  [modified]" : "");
+        gv->shown_modified = modified;
+    }
+
+    for (int row = 0; row < gv->visible_banks; row++) {
+        int bank = gv->scroll + row;
+
+        if (gv->labels[row] != bank) {
+            mvprintw(gv->top + 1 + row, gv->left, "Bank %-2d ", bank + 1);
+            gv->labels[row] = bank;
+        }
+
+        for (int col = 0; col < GRID_PRESETS; col++) {
+            int preset = bank * GRID_PRESETS + col;
+            GridCell cell;
+
+            memset(&cell, 0, sizeof(cell));
+            format_cell(&gv->fcb.preset[preset], cell.text, gv->cell_width);
+            cell.attr = preset == gv->cursor ? A_REVERSE : A_NORMAL;
+
+            GridCell *shown = &gv->cells[row][col];
+            if (strcmp(shown->text, cell.text) == 0 && shown->attr == cell.attr) continue;
+
+            attrset(COLOR_PAIR(5) | A_BOLD | cell.attr);
+            mvprintw(gv->top + 1 + row, gv->left + GRID_LABEL_WIDTH + col * gv->cell_width,
+                     "%-*s", gv->cell_width - 1, cell.text);
+            attrset(COLOR_PAIR(5) | A_BOLD);
+            *shown = cell;
+        }
+    }
+
+    char lines[GRID_DETAIL_LINES][GRID_LINE_WIDTH];
+    format_detail(&gv->fcb, gv->cursor, lines);
+
+    int rows = getmaxy(stdscr);
+    int detail_top = gv->top + 2 + gv->visible_banks;
+
+    for (int i = 0; i < GRID_DETAIL_LINES && detail_top + i < rows - 2; i++) {
+        lines[i][gv->detail_width] = '\0';
+        if (strcmp(gv->detail[i], lines[i]) == 0) continue;
+
+        move(detail_top + i, gv->left);
+        clrtoeol();
+        addstr(lines[i]);
+        memcpy(gv->detail[i], lines[i], GRID_LINE_WIDTH);
+    }
+
+    wnoutrefresh(stdscr);
+}
+
+// Write the patched dump back in one piece, through a temporary file, so
+// a crash mid-write leaves the old dump; the message counts the bytes
+// edited since the last commit
+static void grid_commit(GridView *gv) {
+    if (gv->dirty.start == gv->dirty.end) {
+        ui_message("No changes to save.");
+        return;
+    }
+
+    size_t start = gv->dirty.start;
+    size_t count = gv->dirty.end - gv->dirty.start;
+    FCBError error;
+    if (fcb_write_sysex_file(gv->filename, gv->sysex, &error) != FCB_OK) {
+        ui_message("%s", error.message);
+        return;
+    }
+
+    gv->dirty.start = gv->dirty.end = 0;
+    if (gv->history) history_saved(gv->history, gv->sysex);
+    ui_message("Saved %s, %zu changed byte%s at offset %zu", gv->filename, count, count == 1 ? "" : "s", start);
+}
+
+// Bring the grid and the raw dump in line with the current snapshot.
+// Only presets that differ are re-encoded, and the cursor follows them.
+static void grid_show_snapshot(GridView *gv) {
+    FCB1010 target;
+    int first = -1;
+
+    history_get(gv->history, history_position(gv->history), &target);
+
+    for (int i = 0; i < NUM_PRESETS; i++) {
+        if (memcmp(&gv->fcb.preset[i], &target.preset[i], sizeof(FCB1010Preset)) == 0) continue;
+
+        if (first < 0) first = i;
+        for (int f = 0; f < NUM_PRESET_FIELDS; f++) {
+            fcb_encode_preset_field(gv->sysex, i, f, fcb_get_preset_field(&target.preset[i], f), &gv->dirty);
+        }
+    }
+
+    gv->fcb = target;
+    if (first >= 0) gv->cursor = first;
+}
+
+static void grid_undo(GridView *gv, bool redo) {
+    if (!gv->history) return;
+
+    size_t undone = history_position(gv->history);
+    if (!(redo ? history_redo(gv->history) : history_undo(gv->history))) {
+        ui_message(redo ? "Nothing to redo." : "Nothing to undo.");
+        return;
+    }
+
+    size_t shown = redo ? history_position(gv->history) : undone;
+    ui_message("%s: %s", redo ? "Redo" : "Undo", history_label(gv->history, shown));
+    grid_show_snapshot(gv);
+}
+
+static void edit_apply(EditView *ev, int value) {
+    GridView *gv = ev->grid;
+    int max = fcb_preset_fields[ev->field].is_flag ? 1 : 127;
+
+    if (value < 0) value = 0;
+    if (value > max) value = max;
+
+    fcb_set_preset_field(&gv->fcb.preset[gv->cursor], ev->field, value);
+    fcb_encode_preset_field(gv->sysex, gv->cursor, ev->field, value, &gv->dirty);
+
+    char label[HISTORY_LABEL_SIZE];
+    snprintf(label, sizeof(label), "%d-%d %s=%d", gv->cursor / 10 + 1, gv->cursor % 10 + 1,
+             fcb_preset_fields[ev->field].name, value);
+    if (gv->history && !history_commit(gv->history, &gv->fcb, label)) {
+        ui_message("Out of memory: this edit cannot be undone.");
+    }
+}
+
+static void edit_draw(UiView *view, bool full) {
+    EditView *ev = (EditView *)view;
+    const FCB1010Preset *p = &ev->grid->fcb.preset[ev->grid->cursor];
+    (void)full;
+
+    ev->win = center_window(ev->win, EDIT_ROWS + 5, EDIT_COLUMN_WIDTH * 2 + 4);
+    wbkgd(ev->win, COLOR_PAIR(3));
+    werase(ev->win);
+    box(ev->win, 0, 0);
+    mvwprintw(ev->win, 0, 2, "Edit Bank %d Preset %d", ev->grid->cursor / 10 + 1, ev->grid->cursor % 10 + 1);
+
+    for (int i = 0; i < NUM_PRESET_FIELDS; i++) {
+        int value = fcb_get_preset_field(p, i);
+
+        if (i == ev->field) wattron(ev->win, A_REVERSE);
+        if (fcb_preset_fields[i].is_flag) {
+            mvwprintw(ev->win, 2 + i % EDIT_ROWS, 2 + (i / EDIT_ROWS) * EDIT_COLUMN_WIDTH, "%-18s %5s",
+                      fcb_preset_fields[i].name, value ? "On" : "Off");
+        } else if (i == ev->field && ev->entry[0]) {
+            mvwprintw(ev->win, 2 + i % EDIT_ROWS, 2 + (i / EDIT_ROWS) * EDIT_COLUMN_WIDTH, "%-18s %4s_",
+                      fcb_preset_fields[i].name, ev->entry);
+        } else {
+            mvwprintw(ev->win, 2 + i % EDIT_ROWS, 2 + (i / EDIT_ROWS) * EDIT_COLUMN_WIDTH, "%-18s %5d",
+                      fcb_preset_fields[i].name, value);
+        }
+        if (i == ev->field) wattroff(ev->win, A_REVERSE);
+    }
+
+    mvwprintw(ev->win, EDIT_ROWS + 3, 2, "Up/Down: field  -/+: adjust  Space: toggle  0-9 Enter: set  u/r: undo/redo  w: save  q: back");
+
+    wnoutrefresh(stdscr);
+    touchwin(ev->win);
+    wnoutrefresh(ev->win);
+}
+
+static bool edit_handle_key(UiView *view, int ch) {
+    EditView *ev = (EditView *)view;
+    const FCB1010Preset *p = &ev->grid->fcb.preset[ev->grid->cursor];
+    int value = fcb_get_preset_field(p, ev->field);
+    size_t len = strlen(ev->entry);
+
+    if (ch >= '0' && ch <= '9' && !fcb_preset_fields[ev->field].is_flag) {
+        if (len < sizeof(ev->entry) - 1) {
+            ev->entry[len] = ch;
+            ev->entry[len + 1] = '\0';
+        }
+        return true;
+    }
+
+    if (ch == '\n' && len > 0) {
+        edit_apply(ev, atoi(ev->entry));
+        ev->entry[0] = '\0';
+        return true;
+    }
+
+    ev->entry[0] = '\0';
+
+    switch (ch) {
+        case 'q':
+        case 27:
+            return false;
+        case KEY_UP:
+        case 'k':
+            if (ev->field > 0) ev->field--;
+            break;
+        case KEY_DOWN:
+        case 'j':
+            if (ev->field < NUM_PRESET_FIELDS - 1) ev->field++;
+            break;
+        case KEY_LEFT:
+        case 'h':
+            ev->field = ev->field >= EDIT_ROWS ? ev->field - EDIT_ROWS : ev->field;
+            break;
+        case KEY_RIGHT:
+        case 'l':
+            ev->field = ev->field + EDIT_ROWS < NUM_PRESET_FIELDS ? ev->field + EDIT_ROWS : ev->field;
+            break;
+        case '-':
+            edit_apply(ev, value - 1);
+            break;
+        case '+':
+        case '=':
+            edit_apply(ev, value + 1);
+            break;
+        case KEY_NPAGE:
+            edit_apply(ev, value - 10);
+            break;
+        case KEY_PPAGE:
+            edit_apply(ev, value + 10);
+            break;
+        case ' ':
+            if (fcb_preset_fields[ev->field].is_flag) edit_apply(ev, !value);
+            break;
+        case 'u':
+            grid_undo(ev->grid, false);
+            break;
+        case 'r':
+        case HISTORY_CTRL_R:
+            grid_undo(ev->grid, true);
+            break;
+        case 'w':
+            grid_commit(ev->grid);
+            break;
+        default:
+            break;
+    }
+
+    return true;
+}
+
+static void edit_destroy(UiView *view) {
+    EditView *ev = (EditView *)view;
+    if (ev->win) delwin(ev->win);
+    free(ev);
+}
+
+static void edit_preset(GridView *gv) {
+    EditView *ev = calloc(1, sizeof(EditView));
+    if (!ev) return;
+
+    ev->view.draw = edit_draw;
+    ev->view.handle_key = edit_handle_key;
+    ev->view.destroy = edit_destroy;
+    ev->grid = gv;
+
+    ui_push_view(&ev->view);
+}
+
+static void history_draw(UiView *view, bool full) {
+    HistoryView *hv = (HistoryView *)view;
+    History *history = hv->grid->history;
+    size_t position = history_position(history);
+    int rows = getmaxy(stdscr);
+    int visible = rows - 4 > 1 ? rows - 4 : 1;
+    (void)full;
+
+    if (hv->selected < hv->scroll) hv->scroll = hv->selected;
+    if (hv->selected >= hv->scroll + visible) hv->scroll = hv->selected - visible + 1;
+
+    erase();
+    printw("Edit history (Enter: go to step, q: back)\n");
+    for (int i = hv->scroll; i < (int)history_count(history) && i < hv->scroll + visible; i++) {
+        if (i == hv->selected) attron(A_REVERSE);
+        printw("%c %4d  %s\n", (size_t)i == position ? '*' : ' ', i, history_label(history, i));
+        if (i == hv->selected) attroff(A_REVERSE);
+    }
+
+    wnoutrefresh(stdscr);
+}
+
+static bool history_handle_key(UiView *view, int ch) {
+    HistoryView *hv = (HistoryView *)view;
+    int last = (int)history_count(hv->grid->history) - 1;
+
+    switch (ch) {
+        case 'q':
+            return false;
+        case KEY_UP:
+        case 'k':
+            if (hv->selected > 0) hv->selected--;
+            break;
+        case KEY_DOWN:
+        case 'j':
+            if (hv->selected < last) hv->selected++;
+            break;
+        case KEY_PPAGE:
+            hv->selected = hv->selected > 10 ? hv->selected - 10 : 0;
+            break;
+        case KEY_NPAGE:
+            hv->selected = hv->selected + 10 < last ? hv->selected + 10 : last;
+            break;
+        case KEY_HOME:
+            hv->selected = 0;
+            break;
+        case KEY_END:
+            hv->selected = last;
+            break;
+        case '\n':
+            history_goto(hv->grid->history, hv->selected);
+            grid_show_snapshot(hv->grid);
+            ui_message("At step %d: %s", hv->selected, history_label(hv->grid->history, hv->selected));
+            return false;
+        default:
+            break;
+    }
+
+    return true;
+}
+
+static void history_view_destroy(UiView *view) {
+    free(view);
+}
+
+static void show_history(GridView *gv) {
+    HistoryView *hv = calloc(1, sizeof(HistoryView));
+    if (!hv) return;
+
+    hv->view.draw = history_draw;
+    hv->view.handle_key = history_handle_key;
+    hv->view.destroy = history_view_destroy;
+    hv->grid = gv;
+    hv->selected = history_position(gv->history);
+
+    ui_push_view(&hv->view);
+}
+
+static bool grid_handle_key(UiView *view, int ch) {
+    GridView *gv = (GridView *)view;
+    int bank = gv->cursor / GRID_PRESETS;
+    int col = gv->cursor % GRID_PRESETS;
+
+    if (ch != 'q') gv->confirm_quit = false;
+
+    switch (ch) {
+        case 'q':
+            if (gv->dirty.start != gv->dirty.end && !gv->confirm_quit) {
+                ui_message("Unsaved changes: 'w' to save, 'q' again to discard.");
+                gv->confirm_quit = true;
+                return true;
             }
-            printw("%d: %s\n", i, devices[i]);
-            if (i == selected_device) {
-                attroff(A_REVERSE);
+            return false;
+        case 'e':
+        case '\n':
+            if (gv->filename[0] == '\0') {
+                ui_message("Read-only view.");
+            } else {
+                edit_preset(gv);
             }
-        }
+            break;
+        case 'w':
+            grid_commit(gv);
+            break;
+        case 'u':
+            grid_undo(gv, false);
+            break;
+        case 'r':
+        case HISTORY_CTRL_R:
+            grid_undo(gv, true);
+            break;
+        case 'H':
+            if (gv->history) show_history(gv);
+            break;
+        case 'n':
+            gv->cursor = (gv->cursor + 1) % NUM_PRESETS;
+            break;
+        case 'p':
+            gv->cursor = (gv->cursor - 1 + NUM_PRESETS) % NUM_PRESETS;
+            break;
+        case KEY_LEFT:
+        case 'h':
+            if (col > 0) gv->cursor--;
+            break;
+        case KEY_RIGHT:
+        case 'l':
+            if (col < GRID_PRESETS - 1) gv->cursor++;
+            break;
+        case KEY_UP:
+        case 'k':
+            if (bank > 0) gv->cursor -= GRID_PRESETS;
+            break;
+        case KEY_DOWN:
+        case 'j':
+            if (bank < GRID_BANKS - 1) gv->cursor += GRID_PRESETS;
+            break;
+        case KEY_PPAGE:
+            gv->cursor = (bank >= gv->visible_banks ? bank - gv->visible_banks : 0) * GRID_PRESETS + col;
+            break;
+        case KEY_NPAGE:
+            bank += gv->visible_banks;
+            if (bank > GRID_BANKS - 1) bank = GRID_BANKS - 1;
+            gv->cursor = bank * GRID_PRESETS + col;
+            break;
+        case KEY_HOME:
+            gv->cursor = 0;
+            break;
+        case KEY_END:
+            gv->cursor = NUM_PRESETS - 1;
+            break;
+        default:
+            // Jump to a bank: 1-9 for banks 1-9, 0 for bank 10
+            if (ch >= '0' && ch <= '9') {
+                bank = ch == '0' ? GRID_BANKS - 1 : ch - '1';
+                gv->cursor = bank * GRID_PRESETS + col;
+            }
+            break;
+    }
 
-        int ch = getch();
-        switch (ch) {
-            case 'q':
-                return -1;  // Return -1 to indicate quitting
-            case KEY_UP:
-                if (selected_device > 0) selected_device--;
-                break;
-            case KEY_DOWN:
-                if (selected_device < device_count - 1) selected_device++;
-                break;
-            case '\n':
-                return selected_device;  // Return the selected device index
-            default:
+    return true;
+}
+
+static void grid_destroy(UiView *view) {
+    GridView *gv = (GridView *)view;
+
+    // Leaving the grid is a clean end of the session, saved or not
+    if (gv->history) {
+        history_discard_journal(gv->history);
+        history_destroy(gv->history);
+    }
+    free(gv);
+}
+
+static void library_draw(UiView *view, bool full) {
+    LibraryView *lv = (LibraryView *)view;
+    size_t count = fcb_library_count(lv->library);
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+    (void)full;
+
+    // Same proportions as the grid: rows above a detail pane
+    int visible = rows - 2 - 3 - GRID_DETAIL_LINES;
+    if (visible < GRID_MIN_BANKS) visible = GRID_MIN_BANKS;
+    if (visible > rows - 5) visible = rows - 5;
+    if (visible < 1) visible = 1;
+    lv->visible = visible;
+    if (lv->cursor < lv->scroll) lv->scroll = lv->cursor;
+    if (lv->cursor >= lv->scroll + visible) lv->scroll = lv->cursor - visible + 1;
+
+    // Everything is repainted; the cache makes the decoding behind it cheap
+    FCBLibraryStats stats = fcb_library_stats(lv->library);
+    uint64_t lookups = stats.hits + stats.misses;
+    move(0, 0);
+    clrtoeol();
+    mvprintw(0, 1, "%s: %zu dumps  (%u cached, %.0f%% hits)", lv->title, count, stats.cached,
+             lookups ? 100.0 * stats.hits / lookups : 0.0);
+
+    int bank = lv->preset / GRID_PRESETS;
+    move(1, 0);
+    clrtoeol();
+    mvprintw(1, 1, "%-*s", LIBRARY_NAME_WIDTH, "");
+    printw("Bank %-2d", bank + 1);
+    for (int col = 0; col < GRID_PRESETS; col++) {
+        mvprintw(1, 1 + LIBRARY_NAME_WIDTH + col * GRID_CELL_WIDTH, "%*d", GRID_CELL_WIDTH - 1, col + 1);
+    }
+
+    for (int row = 0; row < visible; row++) {
+        size_t dump = lv->scroll + row;
+        move(2 + row, 0);
+        clrtoeol();
+        if (dump >= count) continue;
+
+        attrset(COLOR_PAIR(5) | A_BOLD | (dump == lv->cursor ? A_REVERSE : A_NORMAL));
+        mvprintw(2 + row, 1, "%-*.*s", LIBRARY_NAME_WIDTH - 1, LIBRARY_NAME_WIDTH - 1,
+                 fcb_library_name(lv->library, dump));
+        attrset(COLOR_PAIR(5) | A_BOLD);
+
+        for (int col = 0; col < GRID_PRESETS; col++) {
+            int preset = bank * GRID_PRESETS + col;
+            FCBError error;
+            const FCB1010Preset *p = fcb_library_preset(lv->library, dump, preset, &error);
+            if (!p) {
+                mvprintw(2 + row, 1 + LIBRARY_NAME_WIDTH, "%.*s", cols > LIBRARY_NAME_WIDTH + 2 ?
+                         cols - LIBRARY_NAME_WIDTH - 2 : 0, error.message);
                 break;
+            }
+
+            char text[GRID_CELL_WIDTH + 1];
+            format_cell(p, text, sizeof(text));
+            if (dump == lv->cursor && preset == lv->preset) attron(A_REVERSE);
+            mvprintw(2 + row, 1 + LIBRARY_NAME_WIDTH + col * GRID_CELL_WIDTH, "%-*s", GRID_CELL_WIDTH - 1, text);
+            attroff(A_REVERSE);
         }
     }
+
+    // The detail pane needs only the selected preset and the globals
+    char lines[GRID_DETAIL_LINES][GRID_LINE_WIDTH];
+    int detail_top = 3 + visible;
+    FCB1010 shown;
+    const FCB1010Preset *p = fcb_library_preset(lv->library, lv->cursor, lv->preset, NULL);
+
+    memset(lines, 0, sizeof(lines));
+    if (p && fcb_library_globals(lv->library, lv->cursor, &shown, NULL) == FCB_OK) {
+        shown.preset[lv->preset] = *p;
+        format_detail(&shown, lv->preset, lines);
+    }
+    snprintf(lines[GRID_DETAIL_LINES - 1], GRID_LINE_WIDTH,
+             "jk: dump  hl: preset  0-9: bank  n/p: step  PgUp/PgDn  Enter: open  q: back");
+
+    for (int i = 0; i < GRID_DETAIL_LINES && detail_top + i < rows - 2; i++) {
+        if (cols < GRID_LINE_WIDTH) lines[i][cols > 1 ? cols - 1 : 0] = '\0';
+        move(detail_top + i, 0);
+        clrtoeol();
+        mvaddstr(detail_top + i, 1, lines[i]);
+    }
+
+    wnoutrefresh(stdscr);
 }
 
-void print_fcb1010(const FCB1010 *fcb) {
-    int ch;
-    int preset = 0;
-    int rows, cols;
-    getmaxyx(stdscr, rows, cols);  // Get the screen size
+static bool library_handle_key(UiView *view, int ch) {
+    LibraryView *lv = (LibraryView *)view;
+    size_t count = fcb_library_count(lv->library);
+    int col = lv->preset % GRID_PRESETS;
+    char path[1024];
 
-    const int WIN_WIDTH = 70;
-    const int WIN_HEIGHT = 20;
+    switch (ch) {
+        case 'q':
+            return false;
+        case 'e':
+        case '\n':
+            if (fcb_library_path(lv->library, lv->cursor, path, sizeof(path))) inspect_sysex_file(path);
+            break;
+        case KEY_UP:
+        case 'k':
+            if (lv->cursor > 0) lv->cursor--;
+            break;
+        case KEY_DOWN:
+        case 'j':
+            if (lv->cursor + 1 < count) lv->cursor++;
+            break;
+        case KEY_PPAGE:
+            lv->cursor = lv->cursor > (size_t)lv->visible ? lv->cursor - lv->visible : 0;
+            break;
+        case KEY_NPAGE:
+            lv->cursor = lv->cursor + lv->visible < count ? lv->cursor + lv->visible : count - 1;
+            break;
+        case KEY_HOME:
+            lv->cursor = 0;
+            break;
+        case KEY_END:
+            lv->cursor = count - 1;
+            break;
+        case KEY_LEFT:
+        case 'h':
+            if (col > 0) lv->preset--;
+            break;
+        case KEY_RIGHT:
+        case 'l':
+            if (col < GRID_PRESETS - 1) lv->preset++;
+            break;
+        case 'n':
+            lv->preset = (lv->preset + 1) % NUM_PRESETS;
+            break;
+        case 'p':
+            lv->preset = (lv->preset - 1 + NUM_PRESETS) % NUM_PRESETS;
+            break;
+        default:
+            // Jump to a bank: 1-9 for banks 1-9, 0 for bank 10
+            if (ch >= '0' && ch <= '9') {
+                int bank = ch == '0' ? GRID_BANKS - 1 : ch - '1';
+                lv->preset = bank * GRID_PRESETS + col;
+            }
+            break;
+    }
 
-    // Create a new window for the settings box
-    WINDOW *settings_win = newwin(WIN_HEIGHT, WIN_WIDTH, (rows - WIN_HEIGHT) / 2, (cols - WIN_WIDTH) / 2);
-    if (settings_win == NULL) {
-        endwin();
-        fprintf(stderr, "Error creating window.\n");
+    return true;
+}
+
+static void library_destroy(UiView *view) {
+    LibraryView *lv = (LibraryView *)view;
+
+    fcb_library_close(lv->library);
+    free(lv);
+}
+
+// Browse every dump in a directory. Nothing is read up front, so the
+// first screen comes up as fast for ten thousand dumps as for ten.
+void browse_library(const char *directory) {
+    FCBLibrary *library;
+    FCBError error;
+
+    if (fcb_library_open(&library, directory, LIBRARY_CACHE_ENTRIES, &error) != FCB_OK) {
+        ui_message("%s", error.message);
+        return;
+    }
+    if (fcb_library_count(library) == 0) {
+        ui_message("No dumps in %s", directory);
+        fcb_library_close(library);
         return;
     }
 
-    wbkgd(settings_win, COLOR_PAIR(3));
-    box(settings_win, 0, 0);  // Draw a box around the window
-
-    while (1) {
-        // Clear the content of the window
-        werase(settings_win);
-
-        // Draw a box around the window
-        box(settings_win, 0, 0);
-
-        mvwprintw(settings_win, 0, 2, "Preset %d", preset + 1);
-
-        const FCB1010Preset *p = &fcb->preset[preset];
-        mvwprintw(settings_win, 2, 2, "  PC1: %s %d  PC2: %s %d",
-                 p->pc1_enabled ? "On" : "Off", p->pc1_program,
-                 p->pc2_enabled ? "On" : "Off", p->pc2_program);
-        mvwprintw(settings_win, 3, 2, "  PC3: %s %d  PC4: %s %d",
-                 p->pc3_enabled ? "On" : "Off", p->pc3_program,
-                 p->pc4_enabled ? "On" : "Off", p->pc4_program);
-        mvwprintw(settings_win, 4, 2, "  PC5: %s %d",
-                 p->pc5_enabled ? "On" : "Off", p->pc5_program);
-        mvwprintw(settings_win, 5, 2, "  CC1: %s %d %d CC2: %s %d %d",
-                 p->cc1_enabled ? "On" : "Off", p->cc1_controller, p->cc1_value,
-                 p->cc2_enabled ? "On" : "Off", p->cc2_controller, p->cc2_value);
-        mvwprintw(settings_win, 6, 2, "  EXP A: %s %d [%d, %d]",
-                 p->expA_enabled ? "On" : "Off", p->expA_controller, p->expA_min, p->expA_max);
-        mvwprintw(settings_win, 7, 2, "  EXP B: %s %d [%d, %d]",
-                 p->expB_enabled ? "On" : "Off", p->expB_controller, p->expB_min, p->expB_max);
-        mvwprintw(settings_win, 8, 2, "  NOTE: %s %d",
-                 p->note_enabled ? "On" : "Off", p->note_value);
-        mvwprintw(settings_win, 9, 2, "  Switch 1: %s  Switch 2: %s",
-          p->switch1_enabled ? "On" : "Off", p->switch2_enabled ? "On" : "Off");
-
-        mvwprintw(settings_win, 11, 2, "Global Settings:");
-        mvwprintw(settings_win, 12, 2, "  MIDI Channels: PC1: %d  PC2: %d  PC3: %d  PC4: %d  PC5: %d",
-                 fcb->pc1_midi_channel, fcb->pc2_midi_channel, fcb->pc3_midi_channel,
-                 fcb->pc4_midi_channel, fcb->pc5_midi_channel);
-        mvwprintw(settings_win, 13, 2, "                 CC1: %d  CC2: %d  EXP A: %d  EXP B: %d  NOTE: %d",
-                 fcb->cc1_midi_channel, fcb->cc2_midi_channel,
-                 fcb->expA_midi_channel, fcb->expB_midi_channel, fcb->note_midi_channel);
-        mvwprintw(settings_win, 14, 2, "  Direct Select: %s  Running Status: %s  Merge: %s",
-                 fcb->direct_select ? "Yes" : "No", fcb->running_status ? "Yes" : "No",
-                 fcb->merge ? "Yes" : "No");
-        mvwprintw(settings_win, 15, 2, "  Switch 1: %s  Switch 2: %s",
-                 fcb->switch1 ? "Yes" : "No", fcb->switch2 ? "Yes" : "No");
-        mvwprintw(settings_win, 16, 2, "  EXP A Calibration: [%d, %d]  EXP B Calibration: [%d, %d]",
-                 fcb->expA_calibration_min, fcb->expA_calibration_max,
-                 fcb->expB_calibration_min, fcb->expB_calibration_max);
-
-        mvwprintw(settings_win, 18, 2, "Press 'n' for next preset, 'p' for previous preset, 'q' to exit.");
-
-        // Refresh the window to show changes
-        wrefresh(settings_win);
-
-        // Get user input
-        ch = getch();
-        if (ch == 'q') {
-            break;
-        } else if (ch == 'n') {
-            preset = (preset + 1) % NUM_PRESETS;
-        } else if (ch == 'p') {
-            preset = (preset - 1 + NUM_PRESETS) % NUM_PRESETS;
-        }
+    LibraryView *lv = calloc(1, sizeof(LibraryView));
+    if (!lv) {
+        fcb_library_close(library);
+        return;
     }
 
-    // Delete the window to free resources
-    delwin(settings_win);
+    lv->view.draw = library_draw;
+    lv->view.handle_key = library_handle_key;
+    lv->view.destroy = library_destroy;
+    lv->library = library;
+    snprintf(lv->title, sizeof(lv->title), "%s", directory);
+
+    ui_push_view(&lv->view);
 }
 
+// Browse a parsed dump. With sysex and filename the presets can also be
+// edited; edits go straight into a copy of the raw dump, so 'w' changes
+// no byte of the file but the edited ones. Edits are journaled next to the file,
+// and a journal left by a session that never closed is replayed here.
+void print_fcb1010(const FCB1010 *fcb, const uint8_t *sysex, const char *filename) {
+    GridView *gv = calloc(1, sizeof(GridView));
+    if (!gv) return;
+
+    gv->view.draw = grid_draw;
+    gv->view.handle_key = grid_handle_key;
+    gv->view.destroy = grid_destroy;
+    gv->fcb = *fcb;
+    if (sysex && filename) {
+        memcpy(gv->sysex, sysex, SYSEX_SIZE);
+        snprintf(gv->filename, sizeof(gv->filename), "%s", filename);
+
+        char journal[sizeof(gv->filename) + 8];
+        snprintf(journal, sizeof(journal), "%s.journal", filename);
+
+        gv->history = history_recover(journal, sysex);
+        if (gv->history) {
+            grid_show_snapshot(gv);
+            if (gv->dirty.start != gv->dirty.end) {
+                ui_message("Recovered unsaved edits from an interrupted session ('u' to undo, 'H' for history).");
+            }
+        } else {
+            gv->history = history_create(fcb, "Opened");
+            if (gv->history) history_set_journal(gv->history, journal, sysex);
+        }
+    }
+
+    ui_push_view(&gv->view);
+}
@@ -1,9 +1,43 @@
 #ifndef UI_NCURSES_H
 #define UI_NCURSES_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include "event_loop.h"
+#include "fcb.h"
+#include "midi.h"
+#include "task.h"
+
+#define UI_MAX_VIEWS 8
+
+// A screen on the view stack. Only the top view draws and gets keys;
+// handle_key returns false to close the view. draw() must wnoutrefresh()
+// whatever it touched, stdscr before its own windows; full is set when
+// the screen was cleared and everything has to be repainted.
+typedef struct UiView UiView;
+struct UiView {
+    void (*draw)(UiView *view, bool full);
+    bool (*handle_key)(UiView *view, int ch);
+    void (*destroy)(UiView *view);
+};
+
+typedef void (*UiMenuCallback)(int choice);
+typedef void (*UiSelectCallback)(const char *device_name, void *user_data);
+typedef void (*UiConfirmCallback)(void *user_data);
+
 void initialize_ui();
-int display_main_menu();
-int select_midi_device(char devices[MAX_DEVICES][128], int device_count);
-void print_fcb1010(const FCB1010 *fcb);
+void ui_start(EventLoop *loop, UiMenuCallback on_choice);
+void ui_shutdown();
+void ui_push_view(UiView *view);
+void ui_request_redraw();
+void ui_message(const char *format, ...) __attribute__((format(printf, 1, 2)));
+bool ui_run_task(Task *task);
+bool ui_task_busy();
+void ui_confirm(const char *prompt, UiConfirmCallback on_confirm, void *user_data);
+void display_main_menu();
+void select_midi_device(char devices[MAX_DEVICES][128], int device_count,
+                        UiSelectCallback on_select, void *user_data);
+void print_fcb1010(const FCB1010 *fcb, const uint8_t *sysex, const char *filename);
+void browse_library(const char *directory);
 
 #endif
@@ -0,0 +1,230 @@
+/*  CSV watch mode
+*   fcbtool --watch rebuilds dump.syx whenever fcb1010.csv is saved, and
+*   can send the result straight to a MIDI port. The CSV's directory is
+*   watched rather than the file itself, because editors often save by
+*   renaming a new file over the old one. A burst of events restarts a
+*   short debounce timer; when it fires the CSV is parsed, validated and
+*   encoded. The dump is only replaced, and only sent, when its bytes
+*   differ from the last build.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include "event_loop.h"
+#include "fcb.h"
+#include "midi.h"
+#include "timing.h"
+#include "watch.h"
+
+#define WATCH_TASK_POLL_NS (20 * NSEC_PER_MSEC)
+
+typedef struct {
+    EventLoop *loop;
+    const char *csv_filename;
+    const char *csv_name;  // Part after the last '/'
+    const char *dump_filename;
+    const char *port_name;
+    uint32_t rate;
+    uint64_t debounce_ns;
+    int debounce_timer;
+    uint64_t first_event_ns;
+    uint8_t last[SYSEX_SIZE];
+    bool have_last;
+    Task *send_task;
+    int task_timer;
+} WatchState;
+
+static void report_error(const char *filename, const FCBError *error) {
+    if (error->line > 0 && error->column > 0) {
+        fprintf(stderr, "%s:%d:%d: %s\n", filename, error->line, error->column, error->message);
+    } else if (error->line > 0) {
+        fprintf(stderr, "%s:%d: %s\n", filename, error->line, error->message);
+    } else {
+        fprintf(stderr, "%s: %s\n", filename, error->message);
+    }
+}
+
+static void task_poll(EventLoop *loop, int timer_id, void *user_data) {
+    (void)timer_id;
+
+    WatchState *ws = user_data;
+    if (!ws->send_task || ws->send_task->state == TASK_RUNNING) return;
+
+    fprintf(stderr, "%s\n", ws->send_task->status);
+    task_destroy(ws->send_task);
+    ws->send_task = NULL;
+    event_loop_remove_timer(loop, ws->task_timer);
+    ws->task_timer = 0;
+}
+
+static void start_send(WatchState *ws) {
+    // A newer dump supersedes one still on its way out
+    if (ws->send_task) {
+        task_destroy(ws->send_task);
+        ws->send_task = NULL;
+    }
+
+    char error[256];
+    ws->send_task = send_sysex_dump(ws->loop, ws->port_name, ws->dump_filename, ws->rate, error, sizeof(error));
+    if (!ws->send_task) {
+        fprintf(stderr, "%s\n", error);
+        return;
+    }
+
+    if (ws->task_timer == 0) {
+        ws->task_timer = event_loop_add_timer(ws->loop, WATCH_TASK_POLL_NS, true, task_poll, ws);
+    }
+}
+
+static void rebuild(WatchState *ws) {
+    uint64_t start_ns = timing_now_ns();
+    FCB1010 fcb;
+    FCBError error;
+    uint8_t data[SYSEX_SIZE];
+
+    if (fcb_read_csv_file(ws->csv_filename, &fcb, NULL, &error) != FCB_OK) {
+        report_error(ws->csv_filename, &error);
+        fprintf(stderr, "Kept the previous %s\n", ws->dump_filename);
+        return;
+    }
+
+    // Patch the last dump when there is a valid one, so only the edited
+    // bytes change and bytes the CSV does not cover survive
+    FCBStatus status = FCB_ERR_HEADER;
+    if (ws->have_last) {
+        memcpy(data, ws->last, SYSEX_SIZE);
+        status = fcb_check_sysex(data, sizeof(data), NULL);
+        if (status == FCB_OK) status = fcb_overlay_sysex(&fcb, data, sizeof(data), NULL, NULL, &error);
+    }
+    if (status != FCB_OK && fcb_encode_sysex(&fcb, data, sizeof(data), &error) != FCB_OK) {
+        report_error(ws->csv_filename, &error);
+        fprintf(stderr, "Kept the previous %s\n", ws->dump_filename);
+        return;
+    }
+
+    if (ws->have_last && memcmp(data, ws->last, SYSEX_SIZE) == 0) {
+        fprintf(stderr, "%s unchanged, nothing to do\n", ws->dump_filename);
+        return;
+    }
+
+    if (fcb_write_sysex_file(ws->dump_filename, data, &error) != FCB_OK) {
+        report_error(ws->dump_filename, &error);
+        return;
+    }
+
+    memcpy(ws->last, data, SYSEX_SIZE);
+    ws->have_last = true;
+
+    uint64_t now_ns = timing_now_ns();
+    fprintf(stderr, "Rebuilt %s in %.1f ms (%.1f ms after the first save event)\n", ws->dump_filename,
+            (now_ns - start_ns) / 1e6, ws->first_event_ns ? (now_ns - ws->first_event_ns) / 1e6 : 0.0);
+
+    if (ws->port_name) start_send(ws);
+}
+
+static void debounce_expired(EventLoop *loop, int timer_id, void *user_data) {
+    (void)loop;
+    (void)timer_id;
+
+    WatchState *ws = user_data;
+    ws->debounce_timer = 0;
+    rebuild(ws);
+    ws->first_event_ns = 0;
+}
+
+static void csv_dir_changed(EventLoop *loop, const char *name, uint32_t mask, void *user_data) {
+    (void)mask;
+
+    WatchState *ws = user_data;
+    if (strcmp(name, ws->csv_name) != 0) return;
+
+    if (ws->first_event_ns == 0) ws->first_event_ns = timing_now_ns();
+    event_loop_remove_timer(loop, ws->debounce_timer);
+    ws->debounce_timer = event_loop_add_timer(loop, ws->debounce_ns, false, debounce_expired, ws);
+}
+
+static void print_usage() {
+    fprintf(stderr, "Usage: fcbtool --watch [--csv <file.csv>] [--dump <file.syx>] [--send <port>]\n");
+    fprintf(stderr, "                [--rate <bytes/s>|wire|max] [--debounce <ms>]\n");
+}
+
+int watch_main(int argc, char *argv[]) {
+    static WatchState ws;
+    char default_csv[512];
+    char default_dump[512];
+    long debounce_ms = WATCH_DEBOUNCE_MS;
+
+    ws.rate = MIDI_WIRE_RATE;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            ws.csv_filename = argv[++i];
+        } else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            ws.dump_filename = argv[++i];
+        } else if (strcmp(argv[i], "--send") == 0 && i + 1 < argc) {
+            ws.port_name = argv[++i];
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            if (!midi_parse_rate(argv[++i], &ws.rate)) {
+                fprintf(stderr, "Invalid rate: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--debounce") == 0 && i + 1 < argc) {
+            debounce_ms = strtol(argv[++i], NULL, 10);
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    const char *home_dir = getenv("HOME");
+    if (!ws.csv_filename || !ws.dump_filename) {
+        if (!home_dir) {
+            fprintf(stderr, "HOME is not set; pass --csv and --dump\n");
+            return 1;
+        }
+        snprintf(default_csv, sizeof(default_csv), "%s/.fcb1010/fcb1010.csv", home_dir);
+        snprintf(default_dump, sizeof(default_dump), "%s/.fcb1010/dump.syx", home_dir);
+        if (!ws.csv_filename) ws.csv_filename = default_csv;
+        if (!ws.dump_filename) ws.dump_filename = default_dump;
+    }
+    if (debounce_ms < 0) debounce_ms = 0;
+    ws.debounce_ns = (uint64_t)debounce_ms * NSEC_PER_MSEC;
+
+    char csv_dir[512];
+    const char *slash = strrchr(ws.csv_filename, '/');
+    if (slash) {
+        snprintf(csv_dir, sizeof(csv_dir), "%.*s", (int)(slash - ws.csv_filename), ws.csv_filename);
+        if (csv_dir[0] == '\0') strcpy(csv_dir, "/");
+        ws.csv_name = slash + 1;
+    } else {
+        strcpy(csv_dir, ".");
+        ws.csv_name = ws.csv_filename;
+    }
+
+    // Builds identical to the dump already on disk are skipped too
+    ws.have_last = fcb_read_sysex_file(ws.dump_filename, ws.last, NULL) == FCB_OK;
+
+    ws.loop = event_loop_create();
+    if (!ws.loop) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    if (event_loop_add_watch(ws.loop, csv_dir, IN_CLOSE_WRITE | IN_MOVED_TO, csv_dir_changed, &ws) < 0) {
+        fprintf(stderr, "Failed to watch %s\n", csv_dir);
+        event_loop_destroy(ws.loop);
+        return 1;
+    }
+
+    fprintf(stderr, "Watching %s; writing %s%s%s\n", ws.csv_filename, ws.dump_filename,
+            ws.port_name ? " and sending to " : "", ws.port_name ? ws.port_name : "");
+
+    rebuild(&ws);  // Catch up with edits made while nothing was watching
+    event_loop_run(ws.loop);
+
+    task_destroy(ws.send_task);
+    event_loop_destroy(ws.loop);
+    return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+// Quiet time after the last save before the CSV is rebuilt; spreadsheets
+// often write a file in several steps
+#define WATCH_DEBOUNCE_MS 100
+
+int watch_main(int argc, char *argv[]);
+
+#endif